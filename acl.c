@@ -0,0 +1,301 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * acl.c - dropping blocked IPv4 traffic before it is translated
+ */
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "acl.h"
+#include "clatd.h"
+
+/* function: acl_add_rule
+ * appends a rule. acl_compile must be called before the next lookup.
+ *   acl  - the access control list
+ *   rule - the rule
+ * returns: 1 on success, 0 if the list is full
+ */
+int acl_add_rule(struct acl *acl, const struct acl_rule *rule) {
+  if (acl->num_rules == ACL_MAX_RULES) {
+    return 0;
+  }
+  acl->rules[acl->num_rules++] = *rule;
+  return 1;
+}
+
+/* function: compare_u64
+ * qsort comparator for interval boundaries
+ */
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+/* function: build_intervals
+ * splits a field's value space into the intervals delimited by the rules' ranges, and records
+ * which rules match each interval
+ *   first     - first value of each rule's range
+ *   last      - last value of each rule's range
+ *   num_rules - number of rules
+ *   intervals - filled in, at most 2 * num_rules + 1 entries
+ * returns: the number of intervals
+ */
+static int build_intervals(const uint32_t *first, const uint32_t *last, int num_rules,
+                           struct acl_interval *intervals) {
+  uint64_t bounds[2 * ACL_MAX_RULES + 1];
+  int num_bounds = 0, num_intervals = 0, i, j;
+
+  bounds[num_bounds++] = 0;
+  for (i = 0; i < num_rules; i++) {
+    bounds[num_bounds++] = first[i];
+    bounds[num_bounds++] = (uint64_t)last[i] + 1;
+  }
+  qsort(bounds, num_bounds, sizeof(bounds[0]), compare_u64);
+
+  for (i = 0; i < num_bounds; i++) {
+    // The end of a range that extends to the top of the value space starts no interval.
+    if (bounds[i] > UINT32_MAX || (i > 0 && bounds[i] == bounds[i - 1])) {
+      continue;
+    }
+    uint32_t rules = 0;
+    for (j = 0; j < num_rules; j++) {
+      if (first[j] <= bounds[i] && bounds[i] <= last[j]) {
+        rules |= 1U << j;
+      }
+    }
+    intervals[num_intervals].start   = bounds[i];
+    intervals[num_intervals++].rules = rules;
+  }
+  return num_intervals;
+}
+
+/* function: acl_compile
+ * builds the lookup tables from the rules
+ *   acl - the access control list
+ */
+void acl_compile(struct acl *acl) {
+  uint32_t first[ACL_MAX_RULES], last[ACL_MAX_RULES];
+  int i, p;
+
+  memset(acl->direction_rules, 0, sizeof(acl->direction_rules));
+  memset(acl->protocol_rules, 0, sizeof(acl->protocol_rules));
+  acl->portless_rules = 0;
+
+  for (i = 0; i < acl->num_rules; i++) {
+    const struct acl_rule *rule = &acl->rules[i];
+    uint32_t bit                = 1U << i;
+
+    if (rule->directions & ACL_OUT) {
+      acl->direction_rules[1] |= bit;
+    }
+    if (rule->directions & ACL_IN) {
+      acl->direction_rules[0] |= bit;
+    }
+    for (p = 0; p < 256; p++) {
+      if (!rule->protocol || rule->protocol == p) {
+        acl->protocol_rules[p] |= bit;
+      }
+    }
+    if (rule->port_min == 0 && rule->port_max == 65535) {
+      acl->portless_rules |= bit;
+    }
+  }
+
+  for (i = 0; i < acl->num_rules; i++) {
+    first[i] = ntohl(acl->rules[i].addr);
+    last[i]  = first[i] | ~ntohl(acl->rules[i].mask);
+  }
+  acl->num_addrs = build_intervals(first, last, acl->num_rules, acl->addrs);
+
+  for (i = 0; i < acl->num_rules; i++) {
+    first[i] = acl->rules[i].port_min;
+    last[i]  = acl->rules[i].port_max;
+  }
+  acl->num_ports = build_intervals(first, last, acl->num_rules, acl->ports);
+}
+
+/* function: interval_rules
+ * returns the rules that match a value, by binary search over a field's intervals. The search
+ * has no data-dependent branches, which random addresses and ports would mispredict half the time.
+ *   intervals     - the field's intervals, the first of which starts at 0
+ *   num_intervals - number of intervals
+ *   value         - the value, host byte order
+ */
+static uint32_t interval_rules(const struct acl_interval *intervals, int num_intervals,
+                               uint32_t value) {
+  while (num_intervals > 1) {
+    int half = num_intervals / 2;
+    intervals = intervals[half].start <= value ? intervals + half : intervals;
+    num_intervals -= half;
+  }
+  return intervals->rules;
+}
+
+/* function: acl_blocks
+ * checks whether a packet is blocked, and counts it against the first rule that matches
+ *   acl       - the access control list
+ *   outgoing  - 1 if the packet is going to the network, 0 if it is coming from it
+ *   remote4   - IPv4 address of the remote end, network byte order
+ *   protocol  - IPv4 protocol number
+ *   transport - transport header, or NULL if the packet is a non-first fragment
+ *   len       - length of the transport header and payload
+ * returns: 1 if the packet must be dropped, 0 otherwise
+ */
+int acl_blocks(struct acl *acl, int outgoing, uint32_t remote4, uint8_t protocol,
+               const uint8_t *transport, size_t len) {
+  uint32_t rules = acl->direction_rules[outgoing] & acl->protocol_rules[protocol];
+  if (!rules) {
+    return 0;
+  }
+
+  rules &= interval_rules(acl->addrs, acl->num_addrs, ntohl(remote4));
+  if (!rules) {
+    return 0;
+  }
+
+  if (transport && (protocol == IPPROTO_TCP || protocol == IPPROTO_UDP) && len >= 4) {
+    // The source port comes first in both TCP and UDP.
+    uint16_t port;
+    memcpy(&port, transport + (outgoing ? 2 : 0), sizeof(port));
+    rules &= interval_rules(acl->ports, acl->num_ports, ntohs(port));
+  } else {
+    rules &= acl->portless_rules;
+  }
+  if (!rules) {
+    return 0;
+  }
+
+  acl->hits[__builtin_ctz(rules)]++;
+  return 1;
+}
+
+/* function: parse_acl_prefix
+ * parses a remote IPv4 prefix, e.g., "198.51.100.0/24", "203.0.113.7" or "0.0.0.0/0"
+ *   str  - the string to parse, which gets clobbered
+ *   rule - the rule to write the prefix to
+ *   returns: 1 on success, 0 on failure
+ */
+static int parse_acl_prefix(char *str, struct acl_rule *rule) {
+  char *slash        = strchr(str, '/');
+  unsigned prefixlen = 32;
+  struct in_addr addr;
+
+  if (slash) {
+    *slash = '\0';
+    if (!parse_unsigned(slash + 1, &prefixlen) || prefixlen > 32) {
+      return 0;
+    }
+  }
+  if (inet_pton(AF_INET, str, &addr) != 1) {
+    return 0;
+  }
+  rule->mask = prefixlen ? htonl(0xffffffffU << (32 - prefixlen)) : 0;
+  rule->addr = addr.s_addr & rule->mask;
+  return 1;
+}
+
+/* function: parse_acl_rule
+ * parses a blocking rule: "direction:protocol:prefix[:ports]", where direction is "in", "out" or
+ * "both", protocol is "tcp", "udp", "icmp", "any" or a protocol number, prefix is the remote IPv4
+ * prefix, and ports is a remote port or range, e.g., "out:tcp:198.51.100.0/24:25" or
+ * "both:udp:0.0.0.0/0:137-139"
+ *   str  - the string to parse, which gets clobbered
+ *   rule - the rule to write to
+ *   returns: 1 on success, 0 on failure
+ */
+static int parse_acl_rule(char *str, struct acl_rule *rule) {
+  char *saveptr;
+  char *direction = strtok_r(str, ":", &saveptr);
+  char *protocol  = strtok_r(NULL, ":", &saveptr);
+  char *prefix    = strtok_r(NULL, ":", &saveptr);
+  char *ports     = strtok_r(NULL, ":", &saveptr);
+  unsigned num;
+
+  if (!prefix || strtok_r(NULL, ":", &saveptr)) {
+    return 0;
+  }
+
+  memset(rule, 0, sizeof(*rule));
+  if (!strcmp(direction, "in")) {
+    rule->directions = ACL_IN;
+  } else if (!strcmp(direction, "out")) {
+    rule->directions = ACL_OUT;
+  } else if (!strcmp(direction, "both")) {
+    rule->directions = ACL_IN | ACL_OUT;
+  } else {
+    return 0;
+  }
+
+  if (!strcmp(protocol, "tcp")) {
+    rule->protocol = IPPROTO_TCP;
+  } else if (!strcmp(protocol, "udp")) {
+    rule->protocol = IPPROTO_UDP;
+  } else if (!strcmp(protocol, "icmp")) {
+    rule->protocol = IPPROTO_ICMP;
+  } else if (parse_unsigned(protocol, &num) && num >= 1 && num <= 255) {
+    rule->protocol = num;
+  } else if (strcmp(protocol, "any")) {
+    return 0;
+  }
+
+  if (!parse_acl_prefix(prefix, rule)) {
+    return 0;
+  }
+
+  rule->port_max = 65535;
+  if (ports) {
+    char *dash = strchr(ports, '-');
+    unsigned port_min, port_max;
+    if (dash) {
+      *dash = '\0';
+    }
+    if (!parse_unsigned(ports, &port_min) || !parse_unsigned(dash ? dash + 1 : ports, &port_max) ||
+        port_min > port_max || port_max > 65535 ||
+        (rule->protocol != IPPROTO_TCP && rule->protocol != IPPROTO_UDP)) {
+      return 0;
+    }
+    rule->port_min = port_min;
+    rule->port_max = port_max;
+  }
+  return 1;
+}
+
+/* function: parse_acl
+ * parses a comma-separated list of blocking rules (see parse_acl_rule) and compiles them. The
+ * first rule that matches a packet counts it.
+ *   str - the string to parse
+ *   acl - the access control list to write to
+ *   returns: 1 on success, 0 on failure
+ */
+int parse_acl(const char *str, struct acl *acl) {
+  char buf[1024], *saveptr, *item;
+  struct acl_rule rule;
+
+  memset(acl, 0, sizeof(*acl));
+  if (strlen(str) >= sizeof(buf)) {
+    return 0;
+  }
+  strcpy(buf, str);
+
+  for (item = strtok_r(buf, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+    if (!parse_acl_rule(item, &rule) || !acl_add_rule(acl, &rule)) {
+      return 0;
+    }
+  }
+  acl_compile(acl);
+  return acl->num_rules > 0;
+}
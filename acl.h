@@ -0,0 +1,69 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * acl.h - dropping blocked IPv4 traffic before it is translated
+ *
+ * Each rule blocks traffic in one or both directions by the remote IPv4 address, the protocol and,
+ * for TCP and UDP, a range of remote ports. acl_compile turns the rules into a bit vector per
+ * field value: one bit per rule, set if the rule matches that value. Addresses and ports are
+ * split into the intervals that the rules' ranges delimit, so a lookup is two table reads, two
+ * binary searches over at most 2 * ACL_MAX_RULES + 1 intervals, and an AND of the bit vectors.
+ * The lowest set bit is the first rule that matches.
+ */
+#ifndef __ACL_H__
+#define __ACL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Maximum number of rules. Rules are bits in a uint32_t.
+#define ACL_MAX_RULES 32
+
+#define ACL_OUT 0x01  // from the tun to the network
+#define ACL_IN 0x02   // from the network to the tun
+
+struct acl_rule {
+  uint8_t directions;           // ACL_OUT and/or ACL_IN
+  uint8_t protocol;             // IPv4 protocol number, or 0 for any
+  uint32_t addr, mask;          // remote IPv4 prefix, network byte order
+  uint16_t port_min, port_max;  // remote ports. 0-65535 also matches packets without ports.
+};
+
+struct acl_interval {
+  uint32_t start;  // host byte order
+  uint32_t rules;  // rules that match from start to the start of the next interval
+};
+
+struct acl {
+  int num_rules;
+  struct acl_rule rules[ACL_MAX_RULES];
+  uint64_t hits[ACL_MAX_RULES];  // packets dropped by each rule
+
+  // Compiled by acl_compile.
+  uint32_t direction_rules[2];  // indexed by outgoing
+  uint32_t protocol_rules[256];
+  uint32_t portless_rules;  // rules that match packets without ports, e.g., non-first fragments
+  int num_addrs, num_ports;
+  struct acl_interval addrs[2 * ACL_MAX_RULES + 1];
+  struct acl_interval ports[2 * ACL_MAX_RULES + 1];
+};
+
+int parse_acl(const char *str, struct acl *acl);
+int acl_add_rule(struct acl *acl, const struct acl_rule *rule);
+void acl_compile(struct acl *acl);
+int acl_blocks(struct acl *acl, int outgoing, uint32_t remote4, uint8_t protocol,
+               const uint8_t *transport, size_t len);
+
+#endif /* __ACL_H__ */
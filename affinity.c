@@ -0,0 +1,339 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * affinity.c - placing clatd on the CPUs that receive the uplink's traffic
+ */
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "affinity.h"
+#include "logging.h"
+
+/* function: read_file
+ * reads a small sysfs or procfs file into a NUL-terminated buffer
+ *   path - file to read
+ *   buf  - buffer to read into
+ *   len  - size of buf
+ * returns: 1 on success, 0 on failure
+ */
+static int read_file(const char *path, char *buf, size_t len) {
+  FILE *f = fopen(path, "re");
+  if (!f) {
+    return 0;
+  }
+  size_t n = fread(buf, 1, len - 1, f);
+  fclose(f);
+  buf[n] = '\0';
+  return n > 0;
+}
+
+/* function: parse_cpu_list
+ * adds the CPUs in a list such as "0-3,8" to a set, as found in *_list files in sysfs and procfs
+ *   str  - the list, optionally followed by a newline
+ *   cpus - the set to add to
+ * returns: 1 on success, 0 on failure
+ */
+int parse_cpu_list(const char *str, cpu_set_t *cpus) {
+  while (*str && *str != '\n') {
+    char *end;
+    unsigned long first = strtoul(str, &end, 10), last = first;
+    if (end == str) {
+      return 0;
+    }
+    if (*end == '-') {
+      str  = end + 1;
+      last = strtoul(str, &end, 10);
+      if (end == str || last < first) {
+        return 0;
+      }
+    }
+    if (last >= CPU_SETSIZE) {
+      return 0;
+    }
+    for (unsigned long cpu = first; cpu <= last; cpu++) {
+      CPU_SET(cpu, cpus);
+    }
+    if (*end == ',') {
+      end++;
+    } else if (*end && *end != '\n') {
+      return 0;
+    }
+    str = end;
+  }
+  return 1;
+}
+
+/* function: parse_cpu_mask
+ * adds the CPUs in a hex mask such as "00000000,0000000f" to a set, as found in rps_cpus
+ *   str  - the mask, most significant 32-bit group first, optionally followed by a newline
+ *   cpus - the set to add to
+ * returns: 1 on success, 0 on failure
+ */
+int parse_cpu_mask(const char *str, cpu_set_t *cpus) {
+  size_t len = strcspn(str, "\n");
+  int bit    = 0;
+  if (len == 0) {
+    return 0;
+  }
+  for (size_t i = len; i-- > 0;) {
+    if (str[i] == ',') {
+      continue;
+    }
+    if (!isxdigit((unsigned char)str[i])) {
+      return 0;
+    }
+    int nibble = isdigit((unsigned char)str[i]) ? str[i] - '0' : tolower(str[i]) - 'a' + 10;
+    for (int j = 0; j < 4; j++, bit++) {
+      if ((nibble & (1 << j)) && bit < CPU_SETSIZE) {
+        CPU_SET(bit, cpus);
+      }
+    }
+  }
+  return 1;
+}
+
+/* function: format_cpu_list
+ * formats a set of CPUs as a list such as "0-3,8", for logging
+ *   cpus - the set
+ *   buf  - buffer to write to
+ *   len  - size of buf
+ */
+void format_cpu_list(const cpu_set_t *cpus, char *buf, size_t len) {
+  size_t pos = 0;
+  buf[0]     = '\0';
+  for (int cpu = 0; cpu < CPU_SETSIZE && pos < len; cpu++) {
+    if (!CPU_ISSET(cpu, cpus)) {
+      continue;
+    }
+    int last = cpu;
+    while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, cpus)) {
+      last++;
+    }
+    const char *sep = pos ? "," : "";
+    if (last == cpu) {
+      pos += snprintf(buf + pos, len - pos, "%s%d", sep, cpu);
+    } else {
+      pos += snprintf(buf + pos, len - pos, "%s%d-%d", sep, cpu, last);
+    }
+    cpu = last;
+  }
+}
+
+/* function: add_rps_cpus
+ * adds the CPUs that RPS steers the interface's received packets to
+ *   interface - network interface
+ *   cpus      - the set to add to
+ */
+static void add_rps_cpus(const char *interface, cpu_set_t *cpus) {
+  char path[PATH_MAX], buf[256];
+  snprintf(path, sizeof(path), "/sys/class/net/%s/queues", interface);
+  DIR *dir = opendir(path);
+  if (!dir) {
+    return;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (strncmp(entry->d_name, "rx-", 3)) {
+      continue;
+    }
+    snprintf(path, sizeof(path), "/sys/class/net/%s/queues/%s/rps_cpus", interface, entry->d_name);
+    if (read_file(path, buf, sizeof(buf))) {
+      parse_cpu_mask(buf, cpus);
+    }
+  }
+  closedir(dir);
+}
+
+/* function: irq_is_for_interface
+ * checks whether a line of /proc/interrupts names an interrupt of the interface. Drivers name
+ * their interrupts e.g. "eth0", "eth0-rx-0" or "eth0-TxRx-3".
+ *   line      - the line
+ *   interface - network interface
+ */
+static int irq_is_for_interface(const char *line, const char *interface) {
+  size_t len = strlen(interface);
+  for (const char *p = strstr(line, interface); p; p = strstr(p + 1, interface)) {
+    char after = p[len];
+    if ((p == line || isspace((unsigned char)p[-1])) &&
+        (after == '\0' || after == '\n' || after == '-' || after == '@' || after == ':')) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* function: add_irq_cpus
+ * adds the CPUs that service the interface's interrupts
+ *   interface - network interface
+ *   cpus      - the set to add to
+ */
+static void add_irq_cpus(const char *interface, cpu_set_t *cpus) {
+  FILE *f = fopen("/proc/interrupts", "re");
+  if (!f) {
+    return;
+  }
+  char line[4096], path[PATH_MAX], buf[256];
+  while (fgets(line, sizeof(line), f)) {
+    int irq;
+    if (sscanf(line, " %d:", &irq) != 1 || !irq_is_for_interface(line, interface)) {
+      continue;
+    }
+    // effective_affinity_list is where the interrupt is actually delivered, but needs a kernel
+    // with CONFIG_GENERIC_IRQ_EFFECTIVE_AFF_MASK.
+    snprintf(path, sizeof(path), "/proc/irq/%d/effective_affinity_list", irq);
+    if (!read_file(path, buf, sizeof(buf))) {
+      snprintf(path, sizeof(path), "/proc/irq/%d/smp_affinity_list", irq);
+      if (!read_file(path, buf, sizeof(buf))) {
+        continue;
+      }
+    }
+    parse_cpu_list(buf, cpus);
+  }
+  fclose(f);
+}
+
+/* function: add_smt_siblings
+ * adds the hyperthreads that share a core, and therefore L1 and L2 caches, with the CPUs in a set
+ *   cpus - the set to add to
+ */
+static void add_smt_siblings(cpu_set_t *cpus) {
+  cpu_set_t siblings;
+  char path[PATH_MAX], buf[256];
+  CPU_ZERO(&siblings);
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, cpus)) {
+      continue;
+    }
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list",
+             cpu);
+    if (read_file(path, buf, sizeof(buf))) {
+      parse_cpu_list(buf, &siblings);
+    }
+  }
+  CPU_OR(cpus, cpus, &siblings);
+}
+
+/* function: placement_rx_cpus
+ * finds the CPUs that receive the interface's traffic. Prefers SO_INCOMING_CPU, which is the CPU
+ * that received the last packet, but not all kernels maintain it for packet sockets. Otherwise
+ * uses the RPS settings, and if RPS is off, the affinity of the interface's interrupts.
+ *   interface - uplink interface
+ *   sock      - packet socket the traffic is read from
+ *   cpus      - set to fill in
+ * returns: a description of where the CPUs came from, or NULL if they could not be determined
+ */
+const char *placement_rx_cpus(const char *interface, int sock, cpu_set_t *cpus) {
+  int cpu       = -1;
+  socklen_t len = sizeof(cpu);
+  CPU_ZERO(cpus);
+
+  if (!getsockopt(sock, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) && cpu >= 0 &&
+      cpu < CPU_SETSIZE) {
+    CPU_SET(cpu, cpus);
+    return "SO_INCOMING_CPU";
+  }
+
+  add_rps_cpus(interface, cpus);
+  if (CPU_COUNT(cpus)) {
+    return "RPS";
+  }
+
+  add_irq_cpus(interface, cpus);
+  if (CPU_COUNT(cpus)) {
+    return "IRQ affinity";
+  }
+
+  return NULL;
+}
+
+/* function: placement_init
+ * initializes CPU placement
+ *   placement - CPU placement state
+ *   interface - uplink interface
+ *   enabled   - whether to measure and change the CPUs clatd runs on
+ */
+void placement_init(struct cpu_placement *placement, const char *interface, int enabled) {
+  memset(placement, 0, sizeof(*placement));
+  placement->enabled = enabled;
+  strncpy(placement->interface, interface, sizeof(placement->interface) - 1);
+}
+
+/* function: placement_evaluate
+ * logs how many packets were translated away from the CPUs that received them, and moves clatd
+ * to those CPUs. The first evaluation only finds the CPUs, so that the first report shows the
+ * cross-CPU rate before clatd moved.
+ *   placement - CPU placement state
+ *   sock      - packet socket the downlink traffic is read from
+ *   now       - current time
+ */
+void placement_evaluate(struct cpu_placement *placement, int sock, time_t now) {
+  char list[256];
+  int first = placement->last_eval == 0;
+
+  if (first && sched_getaffinity(0, sizeof(placement->allowed), &placement->allowed)) {
+    logmsg(ANDROID_LOG_WARN, "sched_getaffinity failed: %s", strerror(errno));
+    placement->enabled = 0;
+    return;
+  }
+
+  if (placement->packets && CPU_COUNT(&placement->near_cpus)) {
+    logmsg(ANDROID_LOG_INFO, "Cross-CPU delivery: %.1f%% of %llu packets in %lds (%s)",
+           100.0 * placement->cross_cpu / placement->packets,
+           (unsigned long long)placement->packets, (long)(now - placement->last_eval),
+           placement->pinned ? "pinned" : "not pinned");
+  }
+  placement->packets = placement->cross_cpu = 0;
+  placement->last_eval                      = now;
+
+  cpu_set_t near_cpus;
+  const char *source = placement_rx_cpus(placement->interface, sock, &near_cpus);
+  add_smt_siblings(&near_cpus);
+  // Stay within the CPUs we were allowed to run on, e.g., by a cpuset.
+  CPU_AND(&near_cpus, &near_cpus, &placement->allowed);
+
+  if (!source || !CPU_COUNT(&near_cpus)) {
+    if (first) {
+      logmsg(ANDROID_LOG_WARN, "Can't tell which CPUs receive traffic on %s yet",
+             placement->interface);
+    }
+    if (placement->pinned && !sched_setaffinity(0, sizeof(placement->allowed),
+                                                &placement->allowed)) {
+      placement->pinned = 0;
+    }
+    CPU_ZERO(&placement->near_cpus);
+    return;
+  }
+
+  int changed          = !CPU_EQUAL(&near_cpus, &placement->near_cpus);
+  placement->near_cpus = near_cpus;
+  if (first || (placement->pinned && !changed)) {
+    return;
+  }
+
+  format_cpu_list(&near_cpus, list, sizeof(list));
+  if (sched_setaffinity(0, sizeof(near_cpus), &near_cpus)) {
+    logmsg(ANDROID_LOG_WARN, "Pinning to CPUs %s failed: %s", list, strerror(errno));
+    return;
+  }
+  placement->pinned = 1;
+  logmsg(ANDROID_LOG_INFO, "Pinned to CPUs %s, which receive traffic on %s (from %s)", list,
+         placement->interface, source);
+}
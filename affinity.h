@@ -0,0 +1,72 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * affinity.h - placing clatd on the CPUs that receive the uplink's traffic
+ *
+ * Downlink packets are received, and run through the packet socket's filter, on the CPU that
+ * services the uplink's RX interrupt or that RPS steers them to. If clatd translates them on
+ * another CPU, every packet crosses caches. With -a, clatd measures how often that happens, and
+ * every AFFINITY_EVAL_FREQUENCY seconds restricts itself to the receiving CPUs and their SMT
+ * siblings.
+ */
+#ifndef __AFFINITY_H__
+#define __AFFINITY_H__
+
+#include <linux/if.h>
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
+
+// how frequently (in seconds) to re-evaluate the CPUs clatd runs on
+#define AFFINITY_EVAL_FREQUENCY 60
+
+struct cpu_placement {
+  int enabled;
+  char interface[IFNAMSIZ];
+  cpu_set_t allowed;    // our affinity before placement changed it
+  cpu_set_t near_cpus;  // CPUs that receive the traffic, and their SMT siblings
+  int pinned;           // whether our affinity is currently near_cpus
+  time_t last_eval;     // 0 before the first evaluation
+
+  // Downlink packets translated since the last evaluation, and how many of them were translated
+  // on a CPU not in near_cpus.
+  uint64_t packets, cross_cpu;
+};
+
+void placement_init(struct cpu_placement *placement, const char *interface, int enabled);
+const char *placement_rx_cpus(const char *interface, int sock, cpu_set_t *cpus);
+void placement_evaluate(struct cpu_placement *placement, int sock, time_t now);
+
+int parse_cpu_list(const char *str, cpu_set_t *cpus);
+int parse_cpu_mask(const char *str, cpu_set_t *cpus);
+void format_cpu_list(const cpu_set_t *cpus, char *buf, size_t len);
+
+/* function: placement_account
+ * counts packets that were just translated
+ *   placement - CPU placement state
+ *   packets   - number of packets
+ */
+static inline void placement_account(struct cpu_placement *placement, int packets) {
+  if (!placement->enabled || packets <= 0) {
+    return;
+  }
+  placement->packets += packets;
+  int cpu = sched_getcpu();
+  if (cpu >= 0 && !CPU_ISSET(cpu, &placement->near_cpus)) {
+    placement->cross_cpu += packets;
+  }
+}
+
+#endif /* __AFFINITY_H__ */
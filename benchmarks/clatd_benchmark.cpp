@@ -0,0 +1,613 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * clatd_benchmark.cpp - per-packet cost of normal and pathological inputs
+ *
+ * Each input class is translated in a loop and its cost is reported against a baseline: a
+ * 1400-byte TCP segment for the classes that only translate, and the same packet read from a
+ * socket for the classes that go through read_packet. The ratio is the amplification factor: how
+ * many baseline packets an attacker's packet of that class is worth.
+ *
+ * As of this writing, on an x86 workstation, the worst case is 64KB UDP with a zero checksum at
+ * about 200x a TCP segment (4x per byte), because the checksum must be computed over the whole
+ * payload. 1400-byte zero-checksum UDP and third-party ICMPv6 errors cost about 5x, and ICMP errors
+ * about 3x. Unexpected tun headers are logged on every packet, which costs more than reading the
+ * packet did.
+ *
+ * BM_TranslateMix translates synthetic traffic from packet_generator.h in IMIX, bulk and
+ * small-packet size mixes, for what clatd costs on average rather than per class.
+ *
+ * With --perf_counters, each benchmark also counts cycles, instructions, L1d and LLC read misses,
+ * dTLB read misses and branch misses with perf_event_open, and reports them per packet. That tells
+ * whether a class is bound by checksum arithmetic (high IPC, few misses), by memory (L1d/LLC/dTLB
+ * misses) or by header parsing (branch misses). Counters the CPU or kernel doesn't support, e.g.
+ * in most VMs, are left out.
+ *
+ * With --energy, each benchmark also reads the RAPL package energy counters from powercap sysfs
+ * and reports nanojoules per packet, in total and above the idle power measured at startup, and
+ * joules per gigabyte above idle. What an optimization saves above idle is what it saves on a
+ * phone's battery. RAPL covers the whole package, so other work on the host shows up as noise, and
+ * DRAM is left out. Reading the counters needs root on recent kernels.
+ */
+
+#include <iterator>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/if_ether.h>
+#include <linux/if_tun.h>
+#include <linux/perf_event.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+
+extern "C" {
+#include "acl.h"
+#include "clatd.h"
+#include "config.h"
+#include "libclat.h"
+#include "tcp_monitor.h"
+#include "translate.h"
+}
+
+#include "packet_generator.h"
+
+// Translated packets are not sent anywhere.
+extern "C" void send_rawv6(int, clat_packet, int) {}
+
+using clat_test::icmp6_error;
+using clat_test::icmp_error;
+using clat_test::ipv4;
+using clat_test::ipv6;
+using clat_test::Packet;
+using clat_test::PacketGenerator;
+using clat_test::SizeMix;
+using clat_test::tcp;
+using clat_test::TrafficMix;
+using clat_test::udp;
+using clat_test::with_checksum;
+
+namespace {
+
+const char kIPv4Local[]  = "192.0.0.4";
+const char kIPv4Remote[] = "8.8.8.8";
+const char kIPv6Local[]  = "2001:db8:0:b11::464";
+const char kIPv6Remote[] = "64:ff9b::808:808";
+const char kIPv6Router[] = "2001:db8:ffff::1";
+const char kPlatPrefix[] = "64:ff9b::";
+
+struct InputClass {
+  const char *name;
+  const char *baseline;
+  int to_ipv6;
+  Packet packet;
+};
+
+std::vector<InputClass> make_classes() {
+  const size_t v4hdr = sizeof(struct iphdr), v6hdr = sizeof(struct ip6_hdr);
+  std::vector<InputClass> classes;
+
+  auto v4 = [&](uint8_t proto, const Packet &l4, size_t optlen = 0, uint16_t frag = 0) {
+    return with_checksum(ipv4(proto, l4, kIPv4Local, kIPv4Remote, optlen, frag), v4hdr + optlen,
+                         proto);
+  };
+
+  classes.push_back({ "tcp", "tcp", 1, v4(IPPROTO_TCP, tcp(1400)) });
+  classes.push_back({ "udp", "tcp", 1, v4(IPPROTO_UDP, udp(1400)) });
+  // A zero UDP checksum must be replaced by a real one in IPv6, computed over the whole payload.
+  classes.push_back(
+    { "udp_zero_csum", "tcp", 1, ipv4(IPPROTO_UDP, udp(1400), kIPv4Local, kIPv4Remote) });
+  classes.push_back({ "udp_zero_csum_64k", "tcp", 1,
+                      ipv4(IPPROTO_UDP, udp(IP_MAXPACKET - v4hdr - sizeof(struct udphdr)),
+                           kIPv4Local, kIPv4Remote) });
+  classes.push_back({ "ipv4_options", "tcp", 1, v4(IPPROTO_TCP, tcp(1400), 40) });
+  classes.push_back({ "ipv4_fragment", "tcp", 1, v4(IPPROTO_UDP, udp(1400), 0, IP_MF) });
+
+  // An ICMP error about a packet that was sent to us: both headers are translated, and the
+  // ICMPv6 checksum is computed from scratch over the whole message.
+  Packet inner4 = with_checksum(ipv4(IPPROTO_UDP, udp(520), kIPv4Remote, kIPv4Local), v4hdr,
+                                IPPROTO_UDP);
+  classes.push_back({ "icmp_error", "tcp", 1, v4(IPPROTO_ICMP, icmp_error(inner4)) });
+
+  // ICMPv6 errors are accepted from any source, so anyone on the path can send them.
+  Packet inner6 = with_checksum(ipv6(IPPROTO_UDP, udp(1184), kIPv6Local, kIPv6Remote), v6hdr,
+                                IPPROTO_UDP);
+  classes.push_back({ "icmpv6_error_third_party", "tcp", 0,
+                      with_checksum(ipv6(IPPROTO_ICMPV6, icmp6_error(inner6), kIPv6Router,
+                                         kIPv6Local),
+                                    v6hdr, IPPROTO_ICMPV6) });
+
+  classes.push_back({ "ipv4_unknown_protocol", "tcp", 1, v4(IPPROTO_SCTP, udp(1400)) });
+  // Only logged in debug builds.
+  classes.push_back({ "ipv6_unknown_next_header", "tcp", 0,
+                      ipv6(IPPROTO_SCTP, udp(1400), kIPv6Remote, kIPv6Local) });
+  return classes;
+}
+
+const std::vector<InputClass> &classes() {
+  static const std::vector<InputClass> kClasses = make_classes();
+  return kClasses;
+}
+
+// Set by --perf_counters.
+bool perf_counters_enabled = false;
+
+struct PerfEvent {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+};
+
+constexpr uint64_t cache_read_miss(uint64_t cache) {
+  return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+const PerfEvent kPerfEvents[] = {
+  { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { "L1d_misses", PERF_TYPE_HW_CACHE, cache_read_miss(PERF_COUNT_HW_CACHE_L1D) },
+  { "LLC_misses", PERF_TYPE_HW_CACHE, cache_read_miss(PERF_COUNT_HW_CACHE_LL) },
+  { "dTLB_misses", PERF_TYPE_HW_CACHE, cache_read_miss(PERF_COUNT_HW_CACHE_DTLB) },
+  { "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+// Counts kPerfEvents in the calling thread between Start and Stop. The events are opened
+// separately rather than as a group, so that there can be more of them than the PMU has counters:
+// the kernel multiplexes them and the counts are scaled by the time each one actually ran.
+class PerfCounters {
+ public:
+  PerfCounters() {
+    for (size_t i = 0; i < std::size(kPerfEvents); i++) {
+      fds_[i] = perf_counters_enabled ? open_event(kPerfEvents[i]) : -1;
+    }
+  }
+
+  ~PerfCounters() {
+    for (int fd : fds_) {
+      if (fd >= 0) close(fd);
+    }
+  }
+
+  void Start() {
+    for (int fd : fds_) {
+      if (fd < 0) continue;
+      ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+
+  // Stops counting and reports the counts per iteration, i.e., per packet.
+  void Stop(benchmark::State &state) {
+    for (size_t i = 0; i < std::size(kPerfEvents); i++) {
+      if (fds_[i] < 0) continue;
+      ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+      uint64_t values[3];  // value, time enabled, time running
+      if (read(fds_[i], values, sizeof(values)) != sizeof(values) || values[2] == 0) continue;
+      double count = (double)values[0] * values[1] / values[2];
+      state.counters[kPerfEvents[i].name] =
+        benchmark::Counter(count, benchmark::Counter::kAvgIterations);
+    }
+  }
+
+ private:
+  static int open_event(const PerfEvent &event) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size        = sizeof(attr);
+    attr.type        = event.type;
+    attr.config      = event.config;
+    attr.disabled    = 1;
+    attr.exclude_hv  = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // read_packet's cost is mostly in the kernel, so count it there too if we are allowed to.
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+      attr.exclude_kernel = 1;
+      fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    }
+    if (fd < 0) {
+      static std::set<std::string> warned;
+      if (warned.insert(event.name).second) {
+        fprintf(stderr, "perf counter %s unavailable: %s\n", event.name, strerror(errno));
+      }
+    }
+    return fd;
+  }
+
+  int fds_[std::size(kPerfEvents)];
+};
+
+// Set by --energy.
+bool energy_enabled = false;
+
+// The RAPL package energy counters, summed over all packages. The psys zone, where there is one,
+// includes the packages, and the core, uncore and DRAM subzones are parts of a package or outside
+// it, so only the top-level zones named package-N are read.
+class Rapl {
+ public:
+  // Opens the counters and measures the idle power. Returns false, having said why, if there are
+  // none.
+  bool Open() {
+    for (int i = 0;; i++) {
+      std::string zone = "/sys/class/powercap/intel-rapl:" + std::to_string(i);
+      uint64_t max = 0;
+      int fd       = open((zone + "/name").c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0) break;
+      char name[32] = {};
+      ssize_t len   = pread(fd, name, sizeof(name) - 1, 0);
+      close(fd);
+      if (len <= 0 || strncmp(name, "package-", strlen("package-"))) continue;
+
+      fd      = open((zone + "/max_energy_range_uj").c_str(), O_RDONLY | O_CLOEXEC);
+      bool ok = fd >= 0 && read_uj(fd, &max);
+      if (fd >= 0) close(fd);
+      fd = open((zone + "/energy_uj").c_str(), O_RDONLY | O_CLOEXEC);
+      if (!ok || fd < 0) {
+        fprintf(stderr, "RAPL zone %s unreadable: %s\n", zone.c_str(), strerror(errno));
+        if (fd >= 0) close(fd);
+        continue;
+      }
+      zones_.push_back({ fd, max, 0 });
+    }
+    if (zones_.empty()) {
+      fprintf(stderr, "no readable RAPL package zones, energy not measured\n");
+      return false;
+    }
+
+    double start = Microjoules(), start_time = Now();
+    sleep(1);
+    idle_watts_ = (Microjoules() - start) / 1e6 / (Now() - start_time);
+    fprintf(stderr, "RAPL: %zu package(s), %.2f W at idle\n", zones_.size(), idle_watts_);
+    return true;
+  }
+
+  // Energy used since an arbitrary point in time. The counters wrap at max_energy_range_uj, which
+  // is minutes or more at full power, so reading them at least once per benchmark is enough.
+  double Microjoules() {
+    for (Zone &zone : zones_) {
+      uint64_t uj;
+      if (!read_uj(zone.fd, &uj)) continue;
+      zone.total += uj >= zone.last ? uj - zone.last : zone.max - zone.last + uj;
+      zone.last = uj;
+    }
+    double total = 0;
+    for (const Zone &zone : zones_) total += zone.total;
+    return total;
+  }
+
+  static double Now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+  }
+
+  double idle_watts() const { return idle_watts_; }
+
+ private:
+  struct Zone {
+    int fd;
+    uint64_t max, last;
+    double total;
+  };
+
+  static bool read_uj(int fd, uint64_t *uj) {
+    char buf[32] = {};
+    if (pread(fd, buf, sizeof(buf) - 1, 0) <= 0) return false;
+    *uj = strtoull(buf, NULL, 10);
+    return true;
+  }
+
+  std::vector<Zone> zones_;
+  double idle_watts_ = 0;
+};
+
+// Set by main if --energy was given and the counters could be opened.
+Rapl *rapl = nullptr;
+
+// Measures the package energy used between Start and Stop.
+class EnergyCounters {
+ public:
+  void Start() {
+    if (!rapl) return;
+    start_uj_   = rapl->Microjoules();
+    start_time_ = Rapl::Now();
+  }
+
+  // Reports nanojoules per iteration, i.e., per packet, in total and above idle, and joules per
+  // gigabyte above idle. bytes is the number of bytes translated, or 0 if that means nothing.
+  void Stop(benchmark::State &state, uint64_t bytes) {
+    if (!rapl) return;
+    double nj    = (rapl->Microjoules() - start_uj_) * 1e3;
+    double above = nj - rapl->idle_watts() * (Rapl::Now() - start_time_) * 1e9;
+    state.counters["nJ"] = benchmark::Counter(nj, benchmark::Counter::kAvgIterations);
+    state.counters["nJ_above_idle"] =
+      benchmark::Counter(above, benchmark::Counter::kAvgIterations);
+    // nJ/byte is J/GB.
+    if (bytes) state.counters["J_per_GB"] = benchmark::Counter(above / bytes);
+  }
+
+ private:
+  double start_uj_   = 0;
+  double start_time_ = 0;
+};
+
+struct clat_config make_config() {
+  struct clat_config config;
+  clat_config_init(&config, kIPv4Local, kIPv6Local, kPlatPrefix);
+  return config;
+}
+
+void BM_Translate(benchmark::State &state, const InputClass &input) {
+  const struct clat_config config = make_config();
+  static uint8_t out[MAXMRU + 256];
+  PerfCounters perf;
+  EnergyCounters energy;
+
+  energy.Start();
+  perf.Start();
+  for (auto _ : state) {
+    struct iovec iov = { out, sizeof(out) };
+    benchmark::DoNotOptimize(
+      clat_translate(&config, input.to_ipv6, input.packet.data(), input.packet.size(), &iov));
+    benchmark::ClobberMemory();
+  }
+  perf.Stop(state);
+  energy.Stop(state, state.iterations() * input.packet.size());
+  state.SetBytesProcessed(state.iterations() * input.packet.size());
+}
+
+// Translates a stream of generated packets of both directions, to see what a realistic mix costs
+// rather than a single class. Optionally with the TCP monitor. Every generated packet is a flow of
+// its own, so that is the monitor's worst case: a new flow and a new RTT sample per segment.
+// Optionally with a full blocking rule list whose addresses and protocols match every generated
+// TCP and UDP packet but whose ports don't, so that every lookup goes all the way.
+void BM_TranslateMix(benchmark::State &state, SizeMix sizes, bool with_tcp_monitor,
+                     bool with_acl) {
+  struct clat_config config = make_config();
+  static uint8_t out[MAXMRU + 256];
+  static struct tcp_monitor monitor;
+  static struct acl acl;
+  if (with_tcp_monitor) {
+    tcp_monitor_init(&monitor);
+    config.tcp_monitor = &monitor;
+  }
+  if (with_acl) {
+    std::string rules;
+    for (int i = 0; i < ACL_MAX_RULES; i++) {
+      rules += (i ? "," : "") + std::string("both:") + (i % 2 ? "udp" : "tcp") + ":198." +
+               std::to_string(18 + i % 2) + ".0.0/16:" + std::to_string(20000 + i);
+    }
+    if (!parse_acl(rules.c_str(), &acl)) {
+      state.SkipWithError("parse_acl failed");
+      return;
+    }
+    config.acl = &acl;
+  }
+  TrafficMix mix;
+  mix.sizes = sizes;
+  // Enough packets and flows not to fit in the L1 cache, as on a busy device.
+  const std::vector<clat_test::GeneratedPacket> packets = PacketGenerator(mix, 1).Generate(4096);
+  size_t i = 0, bytes = 0;
+  PerfCounters perf;
+  EnergyCounters energy;
+
+  energy.Start();
+  perf.Start();
+  for (auto _ : state) {
+    const clat_test::GeneratedPacket &p = packets[i++ % packets.size()];
+    struct iovec iov                    = { out, sizeof(out) };
+    benchmark::DoNotOptimize(
+      clat_translate(&config, p.to_ipv6, p.packet.data(), p.packet.size(), &iov));
+    benchmark::ClobberMemory();
+    bytes += p.packet.size();
+  }
+  perf.Stop(state);
+  energy.Stop(state, bytes);
+  state.SetBytesProcessed(bytes);
+}
+
+// Goes through read_packet, which validates the tun header before translating. Includes the cost
+// of a write and a read on a socketpair.
+void BM_ReadPacket(benchmark::State &state, uint16_t flags, uint16_t proto) {
+  Global_Clatd_Config = make_config();
+  const InputClass &tcp = classes()[0];
+
+  Packet p(sizeof(struct tun_pi) + tcp.packet.size());
+  struct tun_pi *pi = (struct tun_pi *)p.data();
+  pi->flags         = htons(flags);
+  pi->proto         = htons(proto);
+  memcpy(&p[sizeof(*pi)], tcp.packet.data(), tcp.packet.size());
+
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds)) {
+    state.SkipWithError("socketpair failed");
+    return;
+  }
+  PerfCounters perf;
+  EnergyCounters energy;
+  energy.Start();
+  perf.Start();
+  for (auto _ : state) {
+    if (write(fds[0], p.data(), p.size()) != (ssize_t)p.size()) {
+      state.SkipWithError("write failed");
+      break;
+    }
+    read_packet(fds[1], -1, 1);
+  }
+  perf.Stop(state);
+  energy.Stop(state, state.iterations() * p.size());
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// Collects the results, then prints each class's cost relative to its baseline.
+class AmplificationReporter : public benchmark::ConsoleReporter {
+ public:
+  void ReportRuns(const std::vector<Run> &runs) override {
+    for (const Run &run : runs) {
+      if (run.run_type == Run::RT_Iteration && run.iterations > 0) {
+        ns_per_packet_[run.benchmark_name()] = run.GetAdjustedRealTime();
+        counters_[run.benchmark_name()]      = run.counters;
+      }
+    }
+    ConsoleReporter::ReportRuns(runs);
+  }
+
+  void Finalize() override {
+    ConsoleReporter::Finalize();
+    printf("\n%-40s %12s %14s\n", "input class", "ns/packet", "amplification");
+    for (const auto &[name, baseline] : baselines_) {
+      auto it = ns_per_packet_.find(name), base = ns_per_packet_.find(baseline);
+      if (it == ns_per_packet_.end() || base == ns_per_packet_.end()) continue;
+      printf("%-40s %12.1f %13.1fx\n", name.c_str(), it->second, it->second / base->second);
+    }
+    if (perf_counters_enabled) PrintPerfCounters();
+    if (rapl) PrintEnergy();
+  }
+
+  void AddBaseline(const std::string &name, const std::string &baseline) {
+    baselines_.push_back({ name, baseline });
+  }
+
+ private:
+  // Prints the hardware counters per packet, and instructions per cycle, of every class.
+  void PrintPerfCounters() {
+    printf("\n%-40s %6s", "per packet", "IPC");
+    for (const PerfEvent &event : kPerfEvents) printf(" %13s", event.name);
+    printf("\n");
+    for (const auto &[name, unused] : baselines_) {
+      auto it = counters_.find(name);
+      if (it == counters_.end()) continue;
+      const benchmark::UserCounters &c = it->second;
+      auto get = [&](const char *counter) {
+        auto v = c.find(counter);
+        return v == c.end() ? -1.0 : v->second.value;
+      };
+      double cycles = get("cycles"), instructions = get("instructions");
+      if (cycles > 0 && instructions >= 0) {
+        printf("%-40s %6.2f", name.c_str(), instructions / cycles);
+      } else {
+        printf("%-40s %6s", name.c_str(), "-");
+      }
+      for (const PerfEvent &event : kPerfEvents) {
+        double v = get(event.name);
+        if (v >= 0) {
+          printf(" %13.1f", v);
+        } else {
+          printf(" %13s", "-");
+        }
+      }
+      printf("\n");
+    }
+  }
+
+  // Prints the energy per packet and per byte of every class, and its cost relative to its
+  // baseline above idle.
+  void PrintEnergy() {
+    printf("\n%-40s %12s %12s %12s %14s\n", "energy", "nJ/packet", "above idle", "J/GB",
+           "amplification");
+    for (const auto &[name, baseline] : baselines_) {
+      auto it = counters_.find(name), base = counters_.find(baseline);
+      if (it == counters_.end() || !it->second.count("nJ")) continue;
+      const benchmark::UserCounters &c = it->second;
+      double above                     = c.at("nJ_above_idle").value;
+      printf("%-40s %12.1f %12.1f", name.c_str(), c.at("nJ").value, above);
+      if (c.count("J_per_GB")) {
+        printf(" %12.2f", c.at("J_per_GB").value);
+      } else {
+        printf(" %12s", "-");
+      }
+      if (base != counters_.end() && base->second.count("nJ_above_idle") &&
+          base->second.at("nJ_above_idle").value > 0) {
+        printf(" %13.1fx\n", above / base->second.at("nJ_above_idle").value);
+      } else {
+        printf(" %14s\n", "-");
+      }
+    }
+  }
+
+  std::map<std::string, double> ns_per_packet_;
+  std::map<std::string, benchmark::UserCounters> counters_;
+  std::vector<std::pair<std::string, std::string>> baselines_;
+};
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  AmplificationReporter reporter;
+
+  // Our own flags. Remove them before the benchmark library sees them.
+  int n = 1;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--perf_counters")) {
+      perf_counters_enabled = true;
+    } else if (!strcmp(argv[i], "--energy")) {
+      energy_enabled = true;
+    } else {
+      argv[n++] = argv[i];
+    }
+  }
+  argc = n;
+
+  static Rapl package_energy;
+  if (energy_enabled && package_energy.Open()) rapl = &package_energy;
+
+  for (const InputClass &input : classes()) {
+    std::string name = std::string("BM_Translate/") + input.name;
+    benchmark::RegisterBenchmark(name.c_str(), BM_Translate, input);
+    reporter.AddBaseline(name, std::string("BM_Translate/") + input.baseline);
+  }
+
+  const std::pair<const char *, SizeMix> mixes[] = {
+    { "imix", SizeMix::kImix }, { "bulk", SizeMix::kBulk }, { "small", SizeMix::kSmall }
+  };
+  for (const auto &[name, sizes] : mixes) {
+    std::string bm = std::string("BM_TranslateMix/") + name;
+    benchmark::RegisterBenchmark(bm.c_str(), BM_TranslateMix, sizes, false, false);
+    reporter.AddBaseline(bm, "BM_Translate/tcp");
+  }
+  benchmark::RegisterBenchmark("BM_TranslateMix/imix_tcp_monitor", BM_TranslateMix, SizeMix::kImix,
+                               true, false);
+  reporter.AddBaseline("BM_TranslateMix/imix_tcp_monitor", "BM_TranslateMix/imix");
+  benchmark::RegisterBenchmark("BM_TranslateMix/imix_acl", BM_TranslateMix, SizeMix::kImix, false,
+                               true);
+  reporter.AddBaseline("BM_TranslateMix/imix_acl", "BM_TranslateMix/imix");
+
+  benchmark::RegisterBenchmark("BM_ReadPacket/tun_baseline", BM_ReadPacket, 0, ETH_P_IP);
+  benchmark::RegisterBenchmark("BM_ReadPacket/tun_unexpected_flags", BM_ReadPacket, TUN_PKT_STRIP,
+                               ETH_P_IP);
+  benchmark::RegisterBenchmark("BM_ReadPacket/tun_unknown_protocol", BM_ReadPacket, 0, ETH_P_ARP);
+  for (const char *name : { "tun_baseline", "tun_unexpected_flags", "tun_unknown_protocol" }) {
+    reporter.AddBaseline(std::string("BM_ReadPacket/") + name, "BM_ReadPacket/tun_baseline");
+  }
+
+  benchmark::Initialize(&argc, argv);
+  benchmark::RunSpecifiedBenchmarks(&reporter);
+  benchmark::Shutdown();
+  return 0;
+}
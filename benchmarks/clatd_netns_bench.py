@@ -0,0 +1,1027 @@
+#!/usr/bin/env python3
+#
+# Copyright 2026 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""End-to-end clatd benchmarks in network namespaces.
+
+Runs a real clatd binary the way netd does: in its own network namespace, on a veth "uplink"
+that leads to a peer namespace acting as the NAT64, with the tun fd passed on the command line.
+IPv4 load is generated in the clat namespace and echoed back by the peer, so both directions
+of the translator are exercised.
+
+Needs root, iproute2 and /dev/net/tun. For example:
+
+  sudo benchmarks/clatd_netns_bench.py --clatd out/host/linux-x86/bin/clatd footprint
+  sudo benchmarks/clatd_netns_bench.py --clatd out/host/linux-x86/bin/clatd scale --instances 1,4,16
+  sudo benchmarks/clatd_netns_bench.py --clatd out/host/linux-x86/bin/clatd soak --hours 8
+  sudo benchmarks/clatd_netns_bench.py --clatd out/host/linux-x86/bin/clatd gateway --workers 1,2,4
+
+gateway runs clatd as a SIIT gateway instead: -4 is a prefix whose hosts sit in a LAN namespace
+behind clatd's, and -w spreads the flows of the different hosts over worker processes.
+
+The load generators are Python, so they can run out of steam before clatd does. Use --rate to
+offer a fixed load when comparing CPU cost rather than peak throughput.
+
+scale --energy also reads the RAPL package energy counters, and reports energy per packet and
+per gigabyte above the idle power measured while the instances settle. The load generators' share
+is included, so compare configurations at the same --rate rather than reading absolute values.
+"""
+
+import argparse
+import collections
+import ctypes
+import fcntl
+import json
+import os
+import re
+import select
+import signal
+import socket
+import struct
+import subprocess
+import sys
+import threading
+import time
+
+PLAT_PREFIX = "64:ff9b::"
+IPV4_LOCAL = "192.0.0.4"
+# The IPv4 address that load is sent to. Reached through the NAT64 prefix.
+IPV4_REMOTE = "192.0.2.2"
+IPV6_REMOTE = "64:ff9b::c000:202"
+ECHO_PORT = 7
+DISCARD_PORT = 9
+CHARGEN_PORT = 19
+# Nothing listens here, so packets to it come back as ICMPv6 errors that clatd translates.
+CLOSED_PORT = 33434
+
+PEER_NS = "clatbench-peer"
+
+# SIIT gateway mode: the gateway's address and its LAN prefix, which is mapped onto
+# <uplink /64>::c633:6400/120.
+GATEWAY_IPV4 = "198.51.100.1"
+GATEWAY_PREFIXLEN = 24
+GATEWAY_HOSTS = "198.51.100.%d"
+GATEWAY_FIRST_HOST = 10
+
+TUNSETIFF = 0x400454CA
+IFF_TUN = 0x0001
+IFF_MULTI_QUEUE = 0x0100
+IFF_VNET_HDR = 0x4000
+SIOCETHTOOL = 0x8946
+ETHTOOL_STXCSUM = 0x17
+
+
+def run(*cmd, ns=None, check=True):
+  if ns:
+    cmd = ("ip", "netns", "exec", ns) + cmd
+  return subprocess.run(cmd, check=check, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                        text=True).stdout
+
+
+def add_ns(ns):
+  run("ip", "netns", "add", ns)
+  # Skip DAD, so the links are usable as soon as they are up.
+  run("sysctl", "-qw", "net.ipv6.conf.default.accept_dad=0", ns=ns)
+  run("sysctl", "-qw", "net.ipv6.conf.all.accept_dad=0", ns=ns)
+  run("ip", "link", "set", "lo", "up", ns=ns)
+
+
+def self_cmd(ns, *args):
+  """Command line that runs one of this script's internal subcommands in a namespace."""
+  return ["ip", "netns", "exec", ns, sys.executable, os.path.abspath(__file__)] + list(args)
+
+
+class Instance(object):
+  """One clatd process, with its own namespace and uplink to the peer namespace."""
+
+  def __init__(self, index, clatd, extra_args=(), vnet_hdr=False, gateway_hosts=0):
+    self.index = index
+    self.ns = "clatbench-%d" % index
+    self.uplink = "uplink%d" % index
+    self.peer_if = "peer%d" % index
+    self.ipv6_prefix = "2001:db8:%x:" % (index + 1)
+    self.ipv6_local = self.ipv6_prefix + ":464"
+    # In SIIT gateway mode, the IPv4 hosts are in their own namespace, on a LAN behind clatd's.
+    self.gateway_hosts = [GATEWAY_HOSTS % (GATEWAY_FIRST_HOST + i) for i in range(gateway_hosts)]
+    self.lan_ns = "clatbench-%d-lan" % index
+    self.lan = "lan%d" % index
+    if self.gateway_hosts:
+      self.ipv4_local = "%s/%d" % (GATEWAY_IPV4, GATEWAY_PREFIXLEN)
+      self.ipv6_local = self.ipv6_prefix + ":c633:6400"
+    else:
+      self.ipv4_local = IPV4_LOCAL
+    self.clatd = clatd
+    self.extra_args = list(extra_args)
+    self.tun_flags = IFF_TUN | IFF_MULTI_QUEUE | (IFF_VNET_HDR if vnet_hdr else 0)
+    self.proc = None
+    # The most recent lines clatd logged. Drained continuously, so that clatd never blocks on a
+    # full pipe however long it runs.
+    self.log = collections.deque(maxlen=1000)
+    self.ring_stats = None
+    self.ring_stats_logged = threading.Event()
+
+  def setup(self):
+    add_ns(self.ns)
+    run("ip", "link", "add", self.uplink, "netns", self.ns, "type", "veth", "peer", "name",
+        self.peer_if, "netns", PEER_NS)
+    run("ip", "link", "set", self.uplink, "up", ns=self.ns)
+    run("ip", "-6", "addr", "add", self.ipv6_prefix + ":1/64", "dev", self.uplink, "nodad",
+        ns=self.ns)
+    run("ip", "-6", "route", "add", "default", "via", self.ipv6_prefix + ":2", "dev", self.uplink,
+        ns=self.ns)
+    run(*self_cmd(PEER_NS, "_no_tx_csum", self.peer_if))
+    run("ip", "link", "set", self.peer_if, "up", ns=PEER_NS)
+    run("ip", "-6", "addr", "add", self.ipv6_prefix + ":2/64", "dev", self.peer_if, "nodad",
+        ns=PEER_NS)
+    if self.gateway_hosts:
+      add_ns(self.lan_ns)
+      run("ip", "link", "add", self.lan, "netns", self.ns, "type", "veth", "peer", "name", "host",
+          "netns", self.lan_ns)
+      run("sysctl", "-qw", "net.ipv4.ip_forward=1", ns=self.ns)
+      run("ip", "addr", "add", "%s/%d" % (GATEWAY_IPV4, GATEWAY_PREFIXLEN), "dev", self.lan,
+          ns=self.ns)
+      run("ip", "link", "set", self.lan, "up", ns=self.ns)
+      for host in self.gateway_hosts:
+        run("ip", "addr", "add", "%s/%d" % (host, GATEWAY_PREFIXLEN), "dev", "host", ns=self.lan_ns)
+      run("ip", "link", "set", "host", "up", ns=self.lan_ns)
+      run("ip", "route", "add", "default", "via", GATEWAY_IPV4, ns=self.lan_ns)
+
+  def start(self):
+    cmd = self_cmd(self.ns, "_exec_clatd", self.clatd, self.uplink, str(self.tun_flags), "-i",
+                   self.uplink, "-p", PLAT_PREFIX, "-4", self.ipv4_local, "-6", self.ipv6_local,
+                   *self.extra_args)
+    # ip netns exec and _exec_clatd both exec, so this is clatd's pid.
+    self.proc = subprocess.Popen(cmd, stderr=subprocess.PIPE, text=True)
+    tun = "v4-" + self.uplink
+    deadline = time.time() + 10
+    while time.time() < deadline:
+      if self.proc.poll() is not None:
+        raise RuntimeError("clatd exited: %s" % self.proc.stderr.read())
+      if "UP" in run("ip", "link", "show", tun, ns=self.ns, check=False):
+        # As a CLAT, netd routes IPv4 into the tun. A SIIT gateway does that itself.
+        if not self.gateway_hosts:
+          run("ip", "route", "add", "default", "dev", tun, ns=self.ns)
+        threading.Thread(target=self._drain_log, daemon=True).start()
+        return
+      time.sleep(0.05)
+    raise RuntimeError("clatd did not bring up %s" % tun)
+
+  def _drain_log(self):
+    for line in self.proc.stderr:
+      self.log.append(line.rstrip())
+      m = re.search(r"Ring statistics: (\d+) packets, (\d+) drops", line)
+      if m:
+        self.ring_stats = {"packets": int(m.group(1)), "drops": int(m.group(2))}
+        self.ring_stats_logged.set()
+
+  def read_ring_stats(self, timeout=2):
+    """Asks clatd to log its packet ring statistics and returns them."""
+    self.ring_stats_logged.clear()
+    os.kill(self.pid, signal.SIGUSR1)
+    # clatd only notices the signal when poll returns, which it does as soon as it is interrupted.
+    if not self.ring_stats_logged.wait(timeout):
+      raise RuntimeError("clatd did not log ring statistics")
+    return self.ring_stats
+
+  @property
+  def pid(self):
+    return self.proc.pid
+
+  @property
+  def pids(self):
+    """clatd's pid and those of its worker processes."""
+    children = []
+    for entry in os.listdir("/proc"):
+      if entry.isdigit():
+        try:
+          with open("/proc/%s/stat" % entry) as f:
+            if int(f.read().rsplit(")", 1)[1].split()[1]) == self.pid:
+              children.append(int(entry))
+        except OSError:
+          pass
+    return [self.pid] + sorted(children)
+
+  def stop(self):
+    if self.proc and self.proc.poll() is None:
+      self.proc.terminate()
+      try:
+        self.proc.wait(5)
+      except subprocess.TimeoutExpired:
+        self.proc.kill()
+        self.proc.wait()
+
+  def teardown(self):
+    self.stop()
+    run("ip", "netns", "del", self.ns, check=False)
+    if self.gateway_hosts:
+      run("ip", "netns", "del", self.lan_ns, check=False)
+
+
+class Testbed(object):
+  """The peer namespace, echo servers in it, and a number of clatd instances."""
+
+  def __init__(self, clatd, count=1, extra_args=(), vnet_hdr=False, gateway_hosts=0):
+    self.instances = [Instance(i, clatd, extra_args, vnet_hdr, gateway_hosts)
+                      for i in range(count)]
+    self.echoes = []
+
+  def __enter__(self):
+    try:
+      add_ns(PEER_NS)
+      run("ip", "-6", "addr", "add", IPV6_REMOTE + "/128", "dev", "lo", ns=PEER_NS)
+      for instance in self.instances:
+        instance.setup()
+      # One echo server per instance or gateway host, so that the peer does not limit aggregate
+      # throughput.
+      self.echoes = [subprocess.Popen(self_cmd(PEER_NS, "_udp_echo")) for instance in self.instances
+                     for _ in range(max(1, len(instance.gateway_hosts)))]
+      self.echoes.append(subprocess.Popen(self_cmd(PEER_NS, "_bulk_server")))
+      for instance in self.instances:
+        instance.start()
+    except BaseException:
+      self.__exit__()
+      raise
+    return self
+
+  def __exit__(self, *unused):
+    for instance in self.instances:
+      instance.teardown()
+    for echo in self.echoes:
+      echo.kill()
+      echo.wait()
+    run("ip", "netns", "del", PEER_NS, check=False)
+
+  def load(self, seconds, size=1200, rate=0, port=ECHO_PORT):
+    """Starts one UDP echo load generator per instance. Returns the generator processes."""
+    return [subprocess.Popen(self_cmd(instance.ns, "_udp_load", str(seconds), str(size),
+                                      str(rate), str(port)), stdout=subprocess.PIPE, text=True)
+            for instance in self.instances]
+
+  def gateway_load(self, seconds, size=1200, rate=0):
+    """Starts one UDP echo load generator per gateway host, each a flow of its own."""
+    return [subprocess.Popen(self_cmd(instance.lan_ns, "_udp_load", str(seconds), str(size),
+                                      str(rate), str(ECHO_PORT), host),
+                             stdout=subprocess.PIPE, text=True)
+            for instance in self.instances for host in instance.gateway_hosts]
+
+  def bulk(self, kind, seconds):
+    """Starts one saturating flow of the given kind through each instance."""
+    return [subprocess.Popen(self_cmd(instance.ns, "_bulk", kind, str(seconds)),
+                             stdout=subprocess.PIPE, text=True) for instance in self.instances]
+
+  def probe(self, dst, seconds, interval):
+    """Starts an RTT prober in the first instance's namespace."""
+    return subprocess.Popen(self_cmd(self.instances[0].ns, "_rtt_probe", dst, str(seconds),
+                                     str(interval)), stdout=subprocess.PIPE, text=True)
+
+  @staticmethod
+  def load_results(procs):
+    return [json.loads(p.communicate()[0]) for p in procs]
+
+
+#
+# Process measurements.
+#
+
+def read_status(pid):
+  """Returns the memory fields of /proc/<pid>/status, in KiB."""
+  status = {}
+  with open("/proc/%d/status" % pid) as f:
+    for line in f:
+      key, value = line.split(":", 1)
+      if key.startswith("Vm") or key in ("RssAnon", "RssFile", "RssShmem"):
+        status[key] = int(value.split()[0])
+  return status
+
+
+def classify_mapping(name, exe):
+  if name.startswith("socket:") or name == "[packet]" or "PACKET" in name:
+    return "packet ring"
+  if name.startswith("/memfd:clatd-shm"):
+    return "shm region"
+  if name == "[stack]":
+    return "stack"
+  if name == "[heap]":
+    return "heap"
+  if name == exe:
+    return "binary"
+  if name.startswith("/"):
+    return "libraries"
+  return "other anon"
+
+
+def read_smaps(pid):
+  """Returns Rss and Locked per component, in KiB."""
+  exe = os.readlink("/proc/%d/exe" % pid)
+  components = {}
+  current = None
+  with open("/proc/%d/smaps" % pid) as f:
+    for line in f:
+      fields = line.split()
+      if "-" in fields[0] and not fields[0].endswith(":"):
+        name = " ".join(fields[5:]) if len(fields) > 5 else ""
+        current = components.setdefault(classify_mapping(name, exe), {"Rss": 0, "Locked": 0})
+      elif fields[0] in ("Rss:", "Locked:"):
+        current[fields[0][:-1]] += int(fields[1])
+  return components
+
+
+def read_fds(pid):
+  """Returns the number of open file descriptors by type."""
+  fds = {}
+  fddir = "/proc/%d/fd" % pid
+  for fd in os.listdir(fddir):
+    try:
+      target = os.readlink(os.path.join(fddir, fd))
+    except OSError:
+      continue
+    kind = target.split(":")[0] if ":" in target else target
+    if kind == "anon_inode":
+      kind = target
+    fds[kind] = fds.get(kind, 0) + 1
+  return fds
+
+
+def read_cpu(pid):
+  """Returns the CPU time used by a process, in seconds."""
+  with open("/proc/%d/stat" % pid) as f:
+    # The command name can contain spaces, so split after it.
+    fields = f.read().rsplit(")", 1)[1].split()
+  return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+
+
+def read_ctxt_switches(pid):
+  """Returns the number of voluntary and involuntary context switches of a process."""
+  switches = 0
+  with open("/proc/%d/status" % pid) as f:
+    for line in f:
+      if line.startswith(("voluntary_ctxt_switches", "nonvoluntary_ctxt_switches")):
+        switches += int(line.split()[1])
+  return switches
+
+
+class PackageEnergy:
+  """The RAPL package energy counters from powercap sysfs, summed over all packages.
+
+  Only the top-level zones named package-N are read: psys includes them, and the subzones are
+  parts of them or outside them. Reading the counters needs root on recent kernels.
+  """
+
+  def __init__(self):
+    self.zones = []
+    i = 0
+    while os.path.exists("/sys/class/powercap/intel-rapl:%d" % i):
+      zone = "/sys/class/powercap/intel-rapl:%d" % i
+      i += 1
+      with open(zone + "/name") as f:
+        if not f.read().startswith("package-"):
+          continue
+      with open(zone + "/max_energy_range_uj") as f:
+        max_uj = int(f.read())
+      self.zones.append({"path": zone + "/energy_uj", "max": max_uj, "last": None, "total": 0})
+    if not self.zones:
+      raise OSError("no RAPL package zones in /sys/class/powercap")
+    self.joules()
+
+  def joules(self):
+    """Returns the energy used since the first call. Must be called at least once per wrap."""
+    for zone in self.zones:
+      with open(zone["path"]) as f:
+        uj = int(f.read())
+      if zone["last"] is not None:
+        wrapped = uj < zone["last"]
+        zone["total"] += uj - zone["last"] + (zone["max"] if wrapped else 0)
+      zone["last"] = uj
+    return sum(zone["total"] for zone in self.zones) / 1e6
+
+
+def sample(pid):
+  return {"status": read_status(pid), "smaps": read_smaps(pid), "fds": read_fds(pid)}
+
+
+def print_sample(title, s):
+  print("%s:" % title)
+  st = s["status"]
+  print("  RSS %d KiB (peak %d), locked %d KiB, page tables %d KiB" %
+        (st["VmRSS"], st["VmHWM"], st["VmLck"], st["VmPTE"]))
+  print("  %-12s %10s %10s" % ("component", "rss KiB", "locked KiB"))
+  for name, c in sorted(s["smaps"].items(), key=lambda kv: -kv[1]["Rss"]):
+    print("  %-12s %10d %10d" % (name, c["Rss"], c["Locked"]))
+  print("  fds: %d (%s)" % (sum(s["fds"].values()),
+                           ", ".join("%s %d" % kv for kv in sorted(s["fds"].items()))))
+
+
+#
+# Subcommands.
+#
+
+def footprint(args):
+  """Measures what one clatd costs at idle and under load."""
+  with Testbed(args.clatd) as bed:
+    pid = bed.instances[0].pid
+    time.sleep(args.settle)
+    idle = sample(pid)
+
+    # Keep the sample with the highest RSS seen while the load runs.
+    gens = bed.load(args.seconds, args.size)
+    loaded = sample(pid)
+    while any(g.poll() is None for g in gens):
+      time.sleep(0.2)
+      s = sample(pid)
+      if s["status"]["VmRSS"] >= loaded["status"]["VmRSS"]:
+        loaded = s
+    traffic = Testbed.load_results(gens)[0]
+
+  print_sample("idle", idle)
+  print_sample("under load (%d pps echoed)" % (traffic["received"] / args.seconds), loaded)
+  # Packet ring pages are pinned kernel memory, but mlock does not apply to them, so they do not
+  # show up as locked.
+  # The stack's Rss never shrinks, so it is the high-water mark.
+  print("stack high-water mark: %d KiB" % loaded["smaps"].get("stack", {"Rss": 0})["Rss"])
+  return {"idle": idle, "loaded": loaded, "traffic": traffic}
+
+
+def scale(args):
+  """Runs N clatd instances on N uplinks at once and reports how aggregate costs grow with N."""
+  rows = []
+  energy = None
+  if args.energy:
+    try:
+      energy = PackageEnergy()
+    except OSError as e:
+      print("energy not measured: %s" % e, file=sys.stderr)
+  for count in args.instances:
+    with Testbed(args.clatd, count, vnet_hdr=args.vnet_hdr) as bed:
+      pids = [instance.pid for instance in bed.instances]
+      if energy:
+        joules, start = energy.joules(), time.time()
+      time.sleep(args.settle)
+      if energy:
+        idle_watts = (energy.joules() - joules) / (time.time() - start)
+        joules = energy.joules()
+      cpu = [read_cpu(pid) for pid in pids]
+      switches = [read_ctxt_switches(pid) for pid in pids]
+      start = time.time()
+      traffic = Testbed.load_results(bed.load(args.seconds, args.size, args.rate))
+      elapsed = time.time() - start
+      if energy:
+        joules = energy.joules() - joules - idle_watts * elapsed
+      cpu = sum(read_cpu(pid) - c for pid, c in zip(pids, cpu))
+      switches = sum(read_ctxt_switches(pid) - c for pid, c in zip(pids, switches))
+      ring = sum(read_smaps(pid).get("packet ring", {"Rss": 0})["Rss"] for pid in pids)
+      rss = sum(read_status(pid)["VmRSS"] for pid in pids)
+
+    # Every echoed packet was translated twice. Lost packets may never have reached clatd.
+    packets = 2 * sum(t["received"] for t in traffic)
+    gbits = packets * args.size * 8 / 1e9
+    rows.append({
+        "instances": count,
+        "gbps": gbits / elapsed,
+        "kpps": packets / elapsed / 1000,
+        "loss": 1 - sum(t["received"] for t in traffic) / max(1, sum(t["sent"] for t in traffic)),
+        "cpu_seconds": cpu,
+        "cpu_seconds_per_gbit": cpu / gbits if gbits else 0,
+        "ctxt_switches_per_second": switches / elapsed,
+        "ring_kib": ring,
+        "rss_kib": rss,
+    })
+    if energy:
+      rows[-1].update({
+          "idle_watts": idle_watts,
+          "joules_above_idle": joules,
+          "uj_per_packet": joules * 1e6 / packets if packets else 0,
+          "joules_per_gb": joules / (packets * args.size / 1e9) if packets else 0,
+      })
+
+  print("%9s %8s %8s %6s %10s %12s %10s %10s" % ("instances", "Gbit/s", "kpps", "loss", "cpu s/Gbit",
+                                               "ctxsw/s", "ring MiB", "RSS MiB"))
+  for r in rows:
+    print("%9d %8.3f %8.1f %5.1f%% %10.3f %12.0f %10.1f %10.1f" %
+          (r["instances"], r["gbps"], r["kpps"], r["loss"] * 100, r["cpu_seconds_per_gbit"],
+           r["ctxt_switches_per_second"], r["ring_kib"] / 1024, r["rss_kib"] / 1024))
+  if energy:
+    print("\n%9s %8s %10s %10s" % ("instances", "idle W", "uJ/packet", "J/GB"))
+    for r in rows:
+      print("%9d %8.2f %10.2f %10.2f" %
+            (r["instances"], r["idle_watts"], r["uj_per_packet"], r["joules_per_gb"]))
+  return rows
+
+
+def percentiles(values, points=(50, 90, 99, 99.9)):
+  values = sorted(values)
+  if not values:
+    return {p: float("nan") for p in points}
+  return {p: values[min(len(values) - 1, int(len(values) * p / 100))] for p in points}
+
+
+def tx_dropped(ns, dev):
+  return json.loads(run("ip", "-j", "-s", "link", "show", "dev", dev, ns=ns))[0]["stats64"]["tx"][
+      "dropped"]
+
+
+def sample_queues(ns, tun, stop, samples):
+  """Samples the tun device's queue and the raw socket's send queue until stop is set."""
+  while not stop.is_set():
+    qdisc = run("tc", "-s", "qdisc", "show", "dev", tun, ns=ns, check=False).split()
+    raw6 = run("cat", "/proc/net/raw6", ns=ns, check=False).splitlines()[1:]
+    tun_backlog = int(qdisc[qdisc.index("backlog") + 2].rstrip("p")) if "backlog" in qdisc else 0
+    # tx_queue:rx_queue, in bytes. clatd's raw socket is the only one with protocol 255.
+    raw_queue = sum(int(line.split()[4].split(":")[0], 16) for line in raw6
+                    if line.split()[1].endswith(":00FF"))
+    samples.append({"tun_backlog_packets": tun_backlog, "raw_tx_queue_bytes": raw_queue})
+    stop.wait(0.1)
+
+
+def latency(args):
+  """Measures RTT inflation through clatd while bulk flows saturate it."""
+  results = {}
+  with Testbed(args.clatd) as bed:
+    instance = bed.instances[0]
+    time.sleep(args.settle)
+
+    # Idle RTT through clatd, then RTT through clatd and directly over IPv6 under load. The
+    # direct probe shares the uplink but not clatd's ring, tun queue or raw socket, so the
+    # difference between the two loaded measurements is what clatd's queues add.
+    idle = json.loads(bed.probe(IPV4_REMOTE, args.seconds / 2, args.interval).communicate()[0])
+    tun = "v4-" + instance.uplink
+    for kind in args.bulk:
+      stop = threading.Event()
+      queues = []
+      sampler = threading.Thread(target=sample_queues, args=(instance.ns, tun, stop, queues))
+      dropped = tx_dropped(instance.ns, tun)
+      flows = bed.bulk(kind, args.seconds + 1)
+      time.sleep(0.5)
+      sampler.start()
+      via_clat = bed.probe(IPV4_REMOTE, args.seconds, args.interval)
+      direct = bed.probe(IPV6_REMOTE, args.seconds, args.interval)
+      via_clat, direct = [json.loads(p.communicate()[0]) for p in (via_clat, direct)]
+      stop.set()
+      sampler.join()
+      goodput = Testbed.load_results(flows)[0]
+      # A full tun queue drops rather than backing up into the qdisc.
+      dropped = tx_dropped(instance.ns, tun) - dropped
+      results[kind] = {"via_clat": via_clat, "direct": direct, "queues": queues,
+                       "tun_tx_dropped": dropped,
+                       "goodput_mbps": goodput["bytes"] * 8 / goodput["seconds"] / 1e6}
+
+  idle_p = percentiles(idle["rtts_us"])
+  print("idle RTT through clatd (us): %s, lost %d/%d" %
+        (", ".join("p%g %d" % kv for kv in idle_p.items()), idle["lost"], idle["sent"]))
+  for kind, r in results.items():
+    clat_p = percentiles(r["via_clat"]["rtts_us"])
+    direct_p = percentiles(r["direct"]["rtts_us"])
+    print("%s, %.0f Mbit/s:" % (kind, r["goodput_mbps"]))
+    print("  %-8s %10s %10s %10s %10s" % ("", "via clat", "direct", "added", "vs idle"))
+    for p in clat_p:
+      print("  p%-7g %10d %10d %10d %10d" % (p, clat_p[p], direct_p[p], clat_p[p] - direct_p[p],
+                                            clat_p[p] - idle_p[p]))
+    print("  lost probes: %d/%d via clat, %d/%d direct" %
+          (r["via_clat"]["lost"], r["via_clat"]["sent"], r["direct"]["lost"], r["direct"]["sent"]))
+    if r["queues"]:
+      print("  tun qdisc: max %d packets queued, %d dropped; raw socket: max %d bytes queued" %
+            (max(q["tun_backlog_packets"] for q in r["queues"]), r["tun_tx_dropped"],
+             max(q["raw_tx_queue_bytes"] for q in r["queues"])))
+  return {"idle": idle, "loaded": results}
+
+
+def link_packets(ns, dev):
+  stats = json.loads(run("ip", "-j", "-s", "link", "show", "dev", dev, ns=ns))[0]["stats64"]
+  return stats["rx"]["packets"] + stats["tx"]["packets"]
+
+
+def churn_addresses(instance, stop, interval):
+  """Adds and removes addresses on the uplink until stop is set.
+
+  The addresses are in clatd's /64, so clatd keeps running, but every address check it makes
+  walks a different set of addresses.
+  """
+  n = 0
+  while not stop.wait(interval):
+    address = "%s:%x:%x/64" % (instance.ipv6_prefix, 0x1000 + n % 16, n)
+    run("ip", "-6", "addr", "add", address, "dev", instance.uplink, "nodad", ns=instance.ns)
+    if n >= 16:
+      old = "%s:%x:%x/64" % (instance.ipv6_prefix, 0x1000 + n % 16, n - 16)
+      run("ip", "-6", "addr", "del", old, "dev", instance.uplink, ns=instance.ns, check=False)
+    n += 1
+
+
+def quarter_medians(values):
+  quarter = len(values) // 4
+  return [sorted(q)[len(q) // 2] for q in
+          (values[i * quarter:(i + 1) * quarter] for i in range(4))]
+
+
+def drift(values, tolerance, direction):
+  """Returns how far values moved in the given direction (+1 or -1) if they did so
+  monotonically by more than tolerance, or None.
+
+  Compares the medians of the four quarters of the series, so that a single outlier or a
+  transient spike from the bursty part of the traffic mix is not reported as drift.
+  """
+  if len(values) < 8:
+    return None
+  medians = [direction * m for m in quarter_medians(values)]
+  if all(b >= a for a, b in zip(medians, medians[1:])) and medians[-1] - medians[0] > tolerance:
+    return direction * (medians[-1] - medians[0])
+  return None
+
+
+def soak(args):
+  """Runs clatd for hours under mixed traffic and address churn, and fails on resource drift."""
+  seconds = args.hours * 3600 + args.minutes * 60
+  if seconds <= 0:
+    sys.exit("soak needs --hours or --minutes")
+  samples = []
+  with Testbed(args.clatd) as bed:
+    instance = bed.instances[0]
+    tun = "v4-" + instance.uplink
+    pid = instance.pid
+    stop = threading.Event()
+    churner = threading.Thread(target=churn_addresses, args=(instance, stop, args.churn))
+    churner.start()
+    try:
+      # Steady echo traffic at a fixed rate, so throughput should not change over the run, plus
+      # bursts of TCP in both directions and of ICMP errors, which take rarely used paths.
+      # The load outlives the loop by an interval, so the last sample is not cut short.
+      load = bed.load(seconds + args.interval, args.size, args.rate)
+      kinds = ("tcp-up", "tcp-down", "icmp")
+      start = time.time()
+      while time.time() < start + seconds:
+        # Each interval is a burst followed by a quiet half in which only the steady load runs.
+        # Throughput and drops are measured in the quiet half, so the bursts don't hide drift.
+        kind = kinds[len(samples) % len(kinds)]
+        burst = (bed.load(args.interval / 2, 100, 1000, CLOSED_PORT) if kind == "icmp" else
+                 bed.bulk(kind, args.interval / 2))
+        for p in burst:
+          p.communicate()
+        quiet = time.time()
+        packets = link_packets(instance.ns, tun)
+        ring = instance.read_ring_stats()
+        time.sleep(args.interval / 2)
+        if instance.proc.poll() is not None:
+          raise RuntimeError("clatd exited: %s" % "\n".join(instance.log))
+
+        now = time.time()
+        status = read_status(pid)
+        s = {
+            "seconds": now - start,
+            "rss_kib": status["VmRSS"],
+            "heap_kib": read_smaps(pid).get("heap", {"Rss": 0})["Rss"],
+            "fds": sum(read_fds(pid).values()),
+            "pps": (link_packets(instance.ns, tun) - packets) / (now - quiet),
+            "ring_drops": instance.read_ring_stats()["drops"] - ring["drops"],
+        }
+        samples.append(s)
+        print("%7.0fs  RSS %6d KiB  heap %5d KiB  fds %3d  %8.0f pps  %5d ring drops" %
+              (s["seconds"], s["rss_kib"], s["heap_kib"], s["fds"], s["pps"], s["ring_drops"]),
+              flush=True)
+      traffic = Testbed.load_results(load)[0]
+    finally:
+      stop.set()
+      churner.join()
+
+  # Memory and fds grow while the first flows and address checks warm up. Only judge the rest.
+  steady = samples[int(len(samples) * args.warmup):]
+  checks = {
+      "rss_kib": drift([s["rss_kib"] for s in steady], args.rss_tolerance, 1),
+      "heap_kib": drift([s["heap_kib"] for s in steady], args.rss_tolerance, 1),
+      "fds": drift([s["fds"] for s in steady], 0, 1),
+      # Every echo crosses the tun twice.
+      "pps": drift([s["pps"] for s in steady], 2 * args.rate * args.pps_tolerance, -1),
+      "ring_drops": drift([s["ring_drops"] for s in steady],
+                          args.rate * args.interval / 2 * args.pps_tolerance, 1),
+  }
+  print("echo load: %d sent, %d received" % (traffic["sent"], traffic["received"]))
+  failed = {k: v for k, v in checks.items() if v is not None}
+  for k, v in failed.items():
+    print("DRIFT: %s moved by %+g over the run" % (k, v))
+  if len(steady) < 8:
+    print("too few samples to judge drift, run longer or sample more often")
+  elif not failed:
+    print("no drift in %d samples" % len(steady))
+  if failed:
+    # Write the results out before failing, they are what shows where the drift started.
+    if args.json:
+      with open(args.json, "w") as f:
+        json.dump({"samples": samples, "drift": failed}, f, indent=2)
+    sys.exit(1)
+  return {"samples": samples, "traffic": traffic}
+
+
+def gateway(args):
+  """Runs clatd as a SIIT gateway for a LAN of IPv4 hosts, with different numbers of workers."""
+  rows = []
+  for workers in args.workers:
+    with Testbed(args.clatd, 1, ["-w", str(workers)], vnet_hdr=args.vnet_hdr,
+                 gateway_hosts=args.hosts) as bed:
+      instance = bed.instances[0]
+      time.sleep(args.settle)
+      pids = instance.pids
+      if len(pids) != workers:
+        raise RuntimeError("expected %d clatd processes, found %d" % (workers, len(pids)))
+      cpu = [read_cpu(pid) for pid in pids]
+      start = time.time()
+      traffic = Testbed.load_results(bed.gateway_load(args.seconds, args.size, args.rate))
+      elapsed = time.time() - start
+      cpu = [read_cpu(pid) - c for pid, c in zip(pids, cpu)]
+
+    # Every echo crossed the gateway in both directions, so a host whose echoes came back was
+    # translated both ways.
+    packets = 2 * sum(t["received"] for t in traffic)
+    rows.append({
+        "workers": workers,
+        "gbps": packets * args.size * 8 / 1e9 / elapsed,
+        "kpps": packets / elapsed / 1000,
+        "loss": 1 - sum(t["received"] for t in traffic) / max(1, sum(t["sent"] for t in traffic)),
+        "hosts_answered": sum(1 for t in traffic if t["received"]),
+        "cpu_seconds": cpu,
+    })
+
+  print("%7s %8s %8s %6s %8s  %s" %
+        ("workers", "Gbit/s", "kpps", "loss", "hosts", "cpu s per process"))
+  for r in rows:
+    print("%7d %8.3f %8.1f %5.1f%% %4d/%-3d  %s" %
+          (r["workers"], r["gbps"], r["kpps"], r["loss"] * 100, r["hosts_answered"], args.hosts,
+           " ".join("%.2f" % c for c in r["cpu_seconds"])))
+  failed = [r["workers"] for r in rows if r["hosts_answered"] < args.hosts]
+  if failed:
+    print("FAILED: not every host got its echoes back with -w %s" % ",".join(map(str, failed)))
+    sys.exit(1)
+  return rows
+
+
+#
+# Internal subcommands, run inside the namespaces.
+#
+
+def exec_clatd(clatd, uplink, flags, clatd_args):
+  """Creates the tun device and execs clatd with it, as netd does."""
+  fd = os.open("/dev/net/tun", os.O_RDWR | os.O_NONBLOCK)
+  ifr = struct.pack("16sH22x", ("v4-" + uplink).encode(), flags)
+  fcntl.ioctl(fd, TUNSETIFF, ifr)
+  os.set_inheritable(fd, True)
+  os.execv(clatd, [clatd] + clatd_args + ["-t", str(fd)])
+
+
+def no_tx_csum(ifname):
+  """Turns off checksum offload on a veth, as ethtool -K <ifname> tx off does.
+
+  Otherwise the peer hands clatd packets with partial checksums. On a real uplink they would
+  have been completed by the NIC, and tun drivers without Android's checksum flag support drop
+  them after translation.
+  """
+  value = ctypes.create_string_buffer(struct.pack("II", ETHTOOL_STXCSUM, 0))
+  ifr = struct.pack("16sP8x", ifname.encode(), ctypes.addressof(value))
+  with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as s:
+    fcntl.ioctl(s, SIOCETHTOOL, ifr)
+
+
+def udp_echo():
+  s = socket.socket(socket.AF_INET6, socket.SOCK_DGRAM)
+  s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEPORT, 1)
+  # Bind to the NAT64 address, so the replies come from it and not from the peer's link address.
+  s.bind((IPV6_REMOTE, ECHO_PORT))
+  while True:
+    data, addr = s.recvfrom(65536)
+    s.sendto(data, addr)
+
+
+def bulk_server():
+  """Serves TCP discard and chargen, and UDP chargen, on the NAT64 address."""
+
+  def tcp_discard(conn):
+    while conn.recv(65536):
+      pass
+
+  def tcp_chargen(conn):
+    data = b"x" * 65536
+    try:
+      while True:
+        conn.sendall(data)
+    except OSError:
+      pass
+
+  def tcp_server(port, handler):
+    s = socket.socket(socket.AF_INET6, socket.SOCK_STREAM)
+    s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    s.bind((IPV6_REMOTE, port))
+    s.listen(16)
+    while True:
+      conn, _ = s.accept()
+      threading.Thread(target=handler, args=(conn,), daemon=True).start()
+
+  def udp_chargen(s, addr, seconds):
+    data = b"x" * 1200
+    end = time.time() + seconds
+    while time.time() < end:
+      try:
+        s.sendto(data, addr)
+      except OSError:
+        pass
+
+  threading.Thread(target=tcp_server, args=(DISCARD_PORT, tcp_discard), daemon=True).start()
+  threading.Thread(target=tcp_server, args=(CHARGEN_PORT, tcp_chargen), daemon=True).start()
+  s = socket.socket(socket.AF_INET6, socket.SOCK_DGRAM)
+  s.bind((IPV6_REMOTE, CHARGEN_PORT))
+  while True:
+    # The request contains the number of seconds to send for.
+    data, addr = s.recvfrom(64)
+    threading.Thread(target=udp_chargen, args=(s, addr, float(data)), daemon=True).start()
+
+
+def bulk(kind, seconds):
+  """Runs one saturating flow through clatd and reports the bytes moved."""
+  family = socket.SOCK_STREAM if kind.startswith("tcp") else socket.SOCK_DGRAM
+  port = DISCARD_PORT if kind.endswith("up") else CHARGEN_PORT
+  s = socket.socket(socket.AF_INET, family)
+  s.connect((IPV4_REMOTE, port))
+  s.settimeout(0.5)
+  data = b"x" * (65536 if family == socket.SOCK_STREAM else 1200)
+  moved = 0
+  end = time.time() + seconds
+  if kind == "udp-down":
+    s.send(str(seconds).encode())
+  while time.time() < end:
+    try:
+      moved += s.send(data) if kind.endswith("up") else len(s.recv(65536))
+    except (socket.timeout, ConnectionRefusedError):
+      pass
+  s.close()
+  json.dump({"bytes": moved, "seconds": seconds}, sys.stdout)
+
+
+def rtt_probe(dst, seconds, interval):
+  """Measures the RTT of small UDP packets to the echo server."""
+  family = socket.AF_INET6 if ":" in dst else socket.AF_INET
+  s = socket.socket(family, socket.SOCK_DGRAM)
+  s.connect((dst, ECHO_PORT))
+  rtts = []
+  sent = 0
+  # Warm up neighbour caches and clatd before measuring.
+  s.send(struct.pack("!IQ", 0xffffffff, 0))
+  select.select([s], [], [], 1.0)
+  try:
+    s.recv(64, socket.MSG_DONTWAIT)
+  except OSError:
+    pass
+  end = time.time() + seconds
+  while time.time() < end:
+    s.send(struct.pack("!IQ", sent, time.monotonic_ns()))
+    sent += 1
+    deadline = time.monotonic() + max(interval, 1.0)
+    while True:
+      timeout = deadline - time.monotonic()
+      if timeout <= 0 or not select.select([s], [], [], timeout)[0]:
+        break
+      try:
+        seq, stamp = struct.unpack("!IQ", s.recv(64)[:12])
+      except (ConnectionRefusedError, struct.error):
+        continue
+      if seq == sent - 1:
+        rtts.append((time.monotonic_ns() - stamp) // 1000)
+        break
+    time.sleep(interval)
+  json.dump({"sent": sent, "lost": sent - len(rtts), "rtts_us": rtts}, sys.stdout)
+
+
+def udp_load(seconds, size, rate, port, src=None):
+  """Sends UDP to the echo server for a while, as fast as possible or at a given rate in pps."""
+  s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+  if src:
+    s.bind((src, 0))
+  s.connect((IPV4_REMOTE, port))
+  s.setblocking(False)
+  payload = b"x" * size
+  sent = received = 0
+  start = time.time()
+  end = start + seconds
+  now = start
+  while now < end:
+    if not rate or sent < (now - start) * rate:
+      try:
+        s.send(payload)
+        sent += 1
+      except BlockingIOError:
+        select.select([], [s], [], 0.01)
+      except ConnectionRefusedError:
+        # An ICMP error came back. Expected when sending to a closed port.
+        sent += 1
+    while True:
+      try:
+        s.recv(65536)
+        received += 1
+      except (BlockingIOError, ConnectionRefusedError):
+        break
+    now = time.time()
+  # Collect the echoes that are still in flight.
+  while select.select([s], [], [], 0.2)[0]:
+    try:
+      s.recv(65536)
+      received += 1
+    except (BlockingIOError, ConnectionRefusedError):
+      pass
+  json.dump({"sent": sent, "received": received, "seconds": seconds}, sys.stdout)
+
+
+def main():
+  # Internal subcommands have fixed arguments and are not part of the command line interface.
+  if len(sys.argv) > 1 and sys.argv[1] == "_exec_clatd":
+    return exec_clatd(sys.argv[2], sys.argv[3], int(sys.argv[4]), sys.argv[5:])
+  if len(sys.argv) > 1 and sys.argv[1] == "_no_tx_csum":
+    return no_tx_csum(sys.argv[2])
+  if len(sys.argv) > 1 and sys.argv[1] == "_udp_echo":
+    return udp_echo()
+  if len(sys.argv) > 1 and sys.argv[1] == "_udp_load":
+    return udp_load(float(sys.argv[2]), int(sys.argv[3]), float(sys.argv[4]), int(sys.argv[5]),
+                    *sys.argv[6:7])
+  if len(sys.argv) > 1 and sys.argv[1] == "_bulk_server":
+    return bulk_server()
+  if len(sys.argv) > 1 and sys.argv[1] == "_bulk":
+    return bulk(sys.argv[2], float(sys.argv[3]))
+  if len(sys.argv) > 1 and sys.argv[1] == "_rtt_probe":
+    return rtt_probe(sys.argv[2], float(sys.argv[3]), float(sys.argv[4]))
+
+  parser = argparse.ArgumentParser(description=__doc__,
+                                   formatter_class=argparse.RawDescriptionHelpFormatter)
+  parser.add_argument("--clatd", required=True, help="path to the clatd binary")
+  parser.add_argument("--json", help="also write the results to this file")
+  sub = parser.add_subparsers(dest="benchmark", required=True)
+
+  p = sub.add_parser("footprint", help=footprint.__doc__)
+  p.add_argument("--seconds", type=float, default=10, help="duration of the load phase")
+  p.add_argument("--size", type=int, default=1200, help="UDP payload size")
+  p.add_argument("--settle", type=float, default=1, help="idle time before the first sample")
+  p.set_defaults(func=footprint)
+
+  p = sub.add_parser("scale", help=scale.__doc__)
+  p.add_argument("--instances", type=lambda s: [int(n) for n in s.split(",")], default=[1, 2, 4, 8],
+                 help="comma-separated numbers of instances to run, e.g. 1,2,4,8")
+  p.add_argument("--seconds", type=float, default=10, help="duration of each load phase")
+  p.add_argument("--size", type=int, default=1200, help="UDP payload size")
+  p.add_argument("--rate", type=float, default=0,
+                 help="offered load per instance in pps, default as fast as possible")
+  p.add_argument("--settle", type=float, default=1, help="idle time before each load phase")
+  p.add_argument("--vnet-hdr", action="store_true",
+                 help="create the tuns with virtio-net headers, so clatd writes UDP GSO packets")
+  p.add_argument("--energy", action="store_true",
+                 help="also report energy per packet and per GB above idle, from RAPL")
+  p.set_defaults(func=scale)
+
+  p = sub.add_parser("latency", help=latency.__doc__)
+  p.add_argument("--bulk", type=lambda s: s.split(","), default=["tcp-up", "tcp-down", "udp-up"],
+                 help="comma-separated saturating flows: tcp-up, tcp-down, udp-up, udp-down")
+  p.add_argument("--seconds", type=float, default=10, help="duration of each loaded phase")
+  p.add_argument("--interval", type=float, default=0.01, help="time between RTT probes")
+  p.add_argument("--settle", type=float, default=1, help="idle time before the first probe")
+  p.set_defaults(func=latency)
+
+  p = sub.add_parser("soak", help=soak.__doc__)
+  p.add_argument("--hours", type=float, default=0, help="duration of the run")
+  p.add_argument("--minutes", type=float, default=0, help="added to --hours")
+  p.add_argument("--interval", type=float, default=60, help="time between samples")
+  p.add_argument("--rate", type=float, default=2000, help="steady echo load in pps")
+  p.add_argument("--size", type=int, default=1200, help="UDP payload size")
+  p.add_argument("--churn", type=float, default=5, help="time between uplink address changes")
+  p.add_argument("--warmup", type=float, default=0.1,
+                 help="fraction of the samples to skip before judging drift")
+  p.add_argument("--rss-tolerance", type=int, default=256,
+                 help="memory growth in KiB that is not reported as drift")
+  p.add_argument("--pps-tolerance", type=float, default=0.05,
+                 help="throughput loss, as a fraction of --rate, that is not reported as drift")
+  p.set_defaults(func=soak)
+
+  p = sub.add_parser("gateway", help=gateway.__doc__)
+  p.add_argument("--workers", type=lambda s: [int(n) for n in s.split(",")], default=[1, 2, 4],
+                 help="comma-separated numbers of clatd processes to run, e.g. 1,2,4")
+  p.add_argument("--hosts", type=int, default=8, help="IPv4 hosts on the LAN, one flow each")
+  p.add_argument("--seconds", type=float, default=10, help="duration of each load phase")
+  p.add_argument("--size", type=int, default=1200, help="UDP payload size")
+  p.add_argument("--rate", type=float, default=0,
+                 help="offered load per host in pps, default as fast as possible")
+  p.add_argument("--settle", type=float, default=1, help="idle time before each load phase")
+  p.add_argument("--vnet-hdr", action="store_true",
+                 help="create the tun with virtio-net headers, so clatd writes UDP GSO packets")
+  p.set_defaults(func=gateway)
+
+  args = parser.parse_args()
+  args.clatd = os.path.abspath(args.clatd)
+  results = args.func(args)
+  if args.json:
+    with open(args.json, "w") as f:
+      json.dump(results, f, indent=2)
+
+
+if __name__ == "__main__":
+  main()
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * clat_config.h - translation configuration, shared by libclat and the daemon
+ */
+#ifndef __CLAT_CONFIG_H__
+#define __CLAT_CONFIG_H__
+
+#include <netinet/in.h>
+#include <stdint.h>
+
+struct acl;
+struct rate_limit;
+struct shadow;
+struct tcp_monitor;
+
+#define UDP_ZERO_CSUM_MAX_RULES 8
+
+// Where zero UDP checksums are passed through instead of being computed. RFC 6935 and RFC 6936
+// allow zero checksums in IPv6 for tunnel protocols, e.g., VXLAN or GUE, whose endpoints accept
+// them. Computing the checksum takes a pass over the whole payload. All fields are in network byte
+// order.
+struct udp_zero_csum_policy {
+  int pass_all;
+  int num_ports;
+  uint16_t ports[UDP_ZERO_CSUM_MAX_RULES];  // Matches either port.
+  int num_prefixes;
+  struct {
+    uint32_t addr, mask;
+  } prefixes[UDP_ZERO_CSUM_MAX_RULES];  // Matches the remote IPv4 address.
+};
+
+// Translation counters. Not atomic: each process counts the packets it translates.
+struct clat_counters {
+  uint64_t udp_csum_adjusted;       // nonzero checksums, updated incrementally
+  uint64_t udp_zero_csum_computed;  // zero checksums replaced with a computed one
+  uint64_t udp_zero_csum_passed;    // zero checksums passed through by udp_zero_csum_policy
+  uint64_t unknown_protocol;        // dropped because their IP protocol is not translated
+};
+
+struct clat_config {
+  struct in6_addr ipv6_local_subnet;
+  struct in_addr ipv4_local_subnet;
+  struct in6_addr plat_subnet;
+  const char *native_ipv6_interface;
+
+  // Host bits of the local prefix, in network byte order. Zero when acting as a CLAT for a single
+  // address. In SIIT gateway mode, every address in ipv4_local_subnet/n is mapped one-to-one onto
+  // the last 32 - n bits of ipv6_local_subnet/(96 + n), as in an RFC 7757 explicit address mapping.
+  uint32_t local_hostmask;
+
+  struct udp_zero_csum_policy udp_zero_csum;
+
+  // Traffic to drop instead of translating, or NULL. See acl.h.
+  struct acl *acl;
+
+  // Budgets for downlink packets that are expensive to translate, or NULL. See rate_limit.h.
+  struct rate_limit *rate_limit;
+
+  // Where to count translated packets, or NULL.
+  struct clat_counters *counters;
+
+  // Where to measure TCP round-trip times and retransmissions, or NULL. See tcp_monitor.h.
+  struct tcp_monitor *tcp_monitor;
+
+  // Where to verify the flattened fast path against the iovec path, or NULL. Only used by
+  // translate_packet_for_send, which is part of the daemon rather than libclat. See shadow.h.
+  struct shadow *shadow;
+};
+
+#endif /* __CLAT_CONFIG_H__ */
@@ -35,6 +35,8 @@
 #include <linux/if_ether.h>
 #include <linux/if_packet.h>
 #include <linux/if_tun.h>
+#include <linux/net_tstamp.h>
+#include <linux/virtio_net.h>
 #include <net/if.h>
 #include <sys/capability.h>
 #include <sys/uio.h>
@@ -42,16 +44,30 @@
 #include <netid_client.h>                       // For MARK_UNSET.
 #include <private/android_filesystem_config.h>  // For AID_CLAT.
 
+#include "acl.h"
 #include "clatd.h"
 #include "config.h"
 #include "dump.h"
+#include "fq_codel.h"
 #include "getaddr.h"
 #include "logging.h"
+#include "pacer.h"
+#include "rate_limit.h"
 #include "ring.h"
+#include "send.h"
 #include "setif.h"
+#include "shadow.h"
+#include "shm_ring.h"
+#include "tcp_monitor.h"
 #include "translate.h"
+#include "udp_gro.h"
 
 struct clat_config Global_Clatd_Config;
+static struct clat_counters Global_Clatd_Counters;
+static struct tcp_monitor Global_Tcp_Monitor;
+static struct fq_codel *Global_Uplink_Queue;
+static struct pacer *Global_Uplink_Pacer;
+static struct udp_gro *Global_Udp_Gro;
 
 /* 40 bytes IPv6 header - 20 bytes IPv4 header + 8 bytes fragment header */
 #define MTU_DELTA 28
@@ -63,12 +79,333 @@ volatile sig_atomic_t running = 1;
  */
 void stop_loop() { running = 0; }
 
+volatile sig_atomic_t stats_requested = 0;
+
+/* function: request_stats
+ * signal handler: log statistics at the next iteration of the event loop
+ */
+void request_stats() { stats_requested = 1; }
+
+/* function: log_stats
+ * logs packet statistics, for soak tests and for debugging on a device
+ *   tunnel - tun device data
+ */
+void log_stats(struct tun_data *tunnel) {
+  ring_update_stats(&tunnel->ring, tunnel->read_fd6);
+  logmsg(ANDROID_LOG_INFO, "Ring statistics: %llu packets, %llu drops",
+         (unsigned long long)tunnel->ring.packets, (unsigned long long)tunnel->ring.drops);
+  logmsg(ANDROID_LOG_INFO,
+         "UDP checksums: %llu adjusted, %llu zero checksums computed, %llu passed through",
+         (unsigned long long)Global_Clatd_Counters.udp_csum_adjusted,
+         (unsigned long long)Global_Clatd_Counters.udp_zero_csum_computed,
+         (unsigned long long)Global_Clatd_Counters.udp_zero_csum_passed);
+  logmsg(ANDROID_LOG_INFO, "Unknown protocols: %llu packets dropped",
+         (unsigned long long)Global_Clatd_Counters.unknown_protocol);
+
+  if (tunnel->shm.listen_fd >= 0) {
+    const struct shm_counters *shm = &tunnel->shm.counters;
+    logmsg(ANDROID_LOG_INFO,
+           "Shared memory: %llu packets translated, %llu dropped, %llu too large for a slot",
+           (unsigned long long)shm->translated, (unsigned long long)shm->dropped,
+           (unsigned long long)shm->nospace);
+  }
+  const struct tcp_monitor *monitor = Global_Clatd_Config.tcp_monitor;
+  if (monitor) {
+    logmsg(ANDROID_LOG_INFO,
+           "TCP on %s: %d flows, %llu RTT samples, RTT p50 %.1f ms p90 %.1f ms p99 %.1f ms, "
+           "%llu/%llu segments retransmitted out, %llu/%llu in",
+           Global_Clatd_Config.native_ipv6_interface,
+           tcp_monitor_active_flows(monitor, clat_clock_us(CLOCK_MONOTONIC)),
+           (unsigned long long)monitor->rtt_samples,
+           tcp_monitor_rtt_percentile(monitor, 50) / 1000.0,
+           tcp_monitor_rtt_percentile(monitor, 90) / 1000.0,
+           tcp_monitor_rtt_percentile(monitor, 99) / 1000.0,
+           (unsigned long long)monitor->retransmits_out, (unsigned long long)monitor->segments_out,
+           (unsigned long long)monitor->retransmits_in, (unsigned long long)monitor->segments_in);
+  }
+  const struct acl *acl = Global_Clatd_Config.acl;
+  for (int i = 0; acl && i < acl->num_rules; i++) {
+    logmsg(ANDROID_LOG_INFO, "Blocking rule %d: %llu packets dropped", i + 1,
+           (unsigned long long)acl->hits[i]);
+  }
+  const struct rate_limit *limit = Global_Clatd_Config.rate_limit;
+  for (int i = 0; limit && i < RATE_LIMIT_CLASSES; i++) {
+    const struct rate_limit_class *c = &limit->classes[i];
+    if (c->rate || c->source_rate) {
+      logmsg(ANDROID_LOG_INFO,
+             "Rate limit %s: %llu packets passed, %llu dropped over the source limit, %llu over "
+             "the class limit",
+             rate_limit_class_names[i], (unsigned long long)c->passed,
+             (unsigned long long)c->dropped_source, (unsigned long long)c->dropped_class);
+    }
+  }
+  const struct shadow *shadow = Global_Clatd_Config.shadow;
+  if (shadow) {
+    logmsg(ANDROID_LOG_INFO, "Shadow verification: %llu of 1/%u packets verified, %llu mismatches",
+           (unsigned long long)shadow->verified, shadow->rate,
+           (unsigned long long)shadow->mismatches);
+  }
+  const struct fq_codel *queue = Global_Uplink_Queue;
+  if (queue) {
+    logmsg(ANDROID_LOG_INFO,
+           "Uplink queue: %llu packets queued, %llu dropped, %llu ECN marked, %llu dropped when "
+           "full, %u queued now",
+           (unsigned long long)queue->enqueued, (unsigned long long)queue->dropped,
+           (unsigned long long)queue->marked, (unsigned long long)queue->overlimit, queue->qlen);
+  }
+  const struct pacer *pacer = Global_Uplink_Pacer;
+  if (pacer) {
+    logmsg(ANDROID_LOG_INFO, "Uplink pacing: %llu of %llu packets held back, pacing at %llu kbit/s",
+           (unsigned long long)pacer->delayed, (unsigned long long)pacer->packets,
+           (unsigned long long)pacer_rate(pacer) * 8 / 1000);
+  }
+  const struct udp_gro *gro = Global_Udp_Gro;
+  if (gro && gro->gso) {
+    logmsg(ANDROID_LOG_INFO, "UDP GRO: %llu datagrams written as %llu UDP GSO packets",
+           (unsigned long long)gro->gso_segments, (unsigned long long)gro->gso_packets);
+  }
+  if (tunnel->placement.enabled && CPU_COUNT(&tunnel->placement.near_cpus)) {
+    logmsg(ANDROID_LOG_INFO, "Cross-CPU delivery: %llu of %llu packets since %lds ago",
+           (unsigned long long)tunnel->placement.cross_cpu,
+           (unsigned long long)tunnel->placement.packets,
+           (long)(time(NULL) - tunnel->placement.last_eval));
+  }
+  loop_stats_log(&tunnel->loop);
+}
+
+/* function: enable_tcp_monitor
+ * starts measuring TCP round-trip times and retransmissions, which log_stats reports
+ */
+void enable_tcp_monitor() {
+  tcp_monitor_init(&Global_Tcp_Monitor);
+  Global_Clatd_Config.tcp_monitor = &Global_Tcp_Monitor;
+}
+
+/* function: enable_shadow
+ * verifies a sample of translations of the flattened fast path against the iovec path, see shadow.h
+ *   rate         - verify one packet in rate
+ *   capture_path - pcap file to write mismatching packets to, or NULL
+ *   returns: 1 on success, 0 on failure
+ */
+int enable_shadow(unsigned rate, const char *capture_path) {
+  FILE *capture = NULL;
+
+  if (capture_path && !(capture = fopen(capture_path, "we"))) {
+    logmsg(ANDROID_LOG_FATAL, "could not open %s: %s", capture_path, strerror(errno));
+    return 0;
+  }
+  Global_Clatd_Config.shadow = shadow_create(rate, capture);
+  if (!Global_Clatd_Config.shadow) {
+    logmsg(ANDROID_LOG_FATAL, "could not allocate shadow verification buffers");
+    return 0;
+  }
+  return 1;
+}
+
+/* function: enable_uplink_aqm
+ * queues translated uplink packets in fq_codel instead of the raw socket, which is shrunk so that
+ * a backlog builds up where clatd can manage it. Each worker process gets its own copy of the
+ * queue when it forks.
+ *   write_fd - raw socket that uplink packets are sent on
+ */
+void enable_uplink_aqm(int write_fd) {
+  int sndbuf = FQ_CODEL_SNDBUF;
+
+  Global_Uplink_Queue = fq_codel_create();
+  if (!Global_Uplink_Queue) {
+    logmsg(ANDROID_LOG_FATAL, "could not allocate the uplink queue");
+    exit(1);
+  }
+  if (setsockopt(write_fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) < 0) {
+    logmsg(ANDROID_LOG_WARN, "could not set SO_SNDBUF on raw socket: %s", strerror(errno));
+  }
+}
+
+/* function: enable_uplink_pacing
+ * sends translated uplink packets with departure times that spread out bursts, see pacer.h. Does
+ * nothing if the kernel does not support SO_TXTIME.
+ *   write_fd - raw socket that uplink packets are sent on
+ *   max_kbps - most kbit/s to pace at, or 0 for no cap
+ */
+void enable_uplink_pacing(int write_fd, unsigned max_kbps) {
+  struct sock_txtime txtime = { .clockid = CLOCK_MONOTONIC };
+
+  if (setsockopt(write_fd, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) < 0) {
+    logmsg(ANDROID_LOG_WARN, "could not set SO_TXTIME on raw socket, not pacing: %s",
+           strerror(errno));
+    return;
+  }
+  Global_Uplink_Pacer = pacer_create((uint64_t)max_kbps * 1000 / 8);
+  if (!Global_Uplink_Pacer) {
+    logmsg(ANDROID_LOG_FATAL, "could not allocate the uplink pacer");
+    exit(1);
+  }
+  logmsg(ANDROID_LOG_INFO, "Pacing uplink packets, which needs the fq or etf qdisc on the uplink");
+}
+
+/* function: enable_udp_gro
+ * if the tun has virtio-net headers, writes downlink packets with them and coalesces UDP
+ * datagrams into UDP GSO packets, see udp_gro.h. Does nothing if it hasn't.
+ *   tun_fd - the tun
+ */
+void enable_udp_gro(int tun_fd) {
+  struct ifreq ifr;
+  int hdr_len = sizeof(struct virtio_net_hdr);
+
+  memset(&ifr, 0, sizeof(ifr));
+  if (ioctl(tun_fd, TUNGETIFF, &ifr) < 0 || !(ifr.ifr_flags & IFF_VNET_HDR)) {
+    return;
+  }
+  if (ioctl(tun_fd, TUNSETVNETHDRSZ, &hdr_len) < 0) {
+    logmsg(ANDROID_LOG_FATAL, "TUNSETVNETHDRSZ failed: %s", strerror(errno));
+    exit(1);
+  }
+
+  // TUN_F_USO4 and TUN_F_USO6, which the kernel only takes together, came with support for UDP
+  // GSO packets written to a tun, in Linux 6.2. Offloads stay off, so that read_packet only ever
+  // sees whole packets with complete checksums.
+  int gso = ioctl(tun_fd, TUNSETOFFLOAD, TUN_F_CSUM | TUN_F_USO4 | TUN_F_USO6) == 0;
+  if (ioctl(tun_fd, TUNSETOFFLOAD, 0) < 0) {
+    logmsg(ANDROID_LOG_FATAL, "TUNSETOFFLOAD failed: %s", strerror(errno));
+    exit(1);
+  }
+
+  Global_Udp_Gro = udp_gro_create(gso);
+  if (!Global_Udp_Gro) {
+    logmsg(ANDROID_LOG_FATAL, "could not allocate the UDP GRO state");
+    exit(1);
+  }
+  logmsg(ANDROID_LOG_INFO, "tun has virtio-net headers, UDP GSO %s",
+         gso ? "enabled" : "not supported by the kernel");
+}
+
+/* function: uplink_departure
+ * returns the departure time of an uplink packet about to be sent, or 0 if uplink pacing is off
+ *   len - size of the packet
+ */
+static uint64_t uplink_departure(size_t len) {
+  if (!Global_Uplink_Pacer) {
+    return 0;
+  }
+  return pacer_departure(Global_Uplink_Pacer, clat_clock_ns(CLOCK_MONOTONIC), len);
+}
+
+/* function: send_uplink
+ * sends a translated packet on the raw socket, as send_rawv6 does, with a departure time
+ *   write_fd - raw socket to send on
+ *   iov      - the packet. Empty elements in front of the IPv6 header are skipped.
+ *   iov_len  - number of elements of iov
+ *   txtime   - departure time for SCM_TXTIME, or 0 to send the packet right away
+ *   flags    - sendmsg flags
+ * returns: the result of sendmsg
+ */
+static ssize_t send_uplink(int write_fd, struct iovec *iov, int iov_len, uint64_t txtime,
+                           int flags) {
+  struct sockaddr_in6 sin6 = { .sin6_family = AF_INET6 };
+  union {
+    char buf[CMSG_SPACE(sizeof(txtime))];
+    struct cmsghdr align;
+  } control;
+  struct msghdr msg = {
+    .msg_name    = &sin6,
+    .msg_namelen = sizeof(sin6),
+    .msg_iov     = iov,
+    .msg_iovlen  = iov_len,
+  };
+
+  const struct iovec *iphdr = iov;
+  while (!iphdr->iov_len) {
+    iphdr++;
+  }
+  sin6.sin6_addr = ((const struct ip6_hdr *)iphdr->iov_base)->ip6_dst;
+
+  if (txtime) {
+    msg.msg_control      = control.buf;
+    msg.msg_controllen   = sizeof(control.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level     = SOL_SOCKET;
+    cmsg->cmsg_type      = SCM_TXTIME;
+    cmsg->cmsg_len       = CMSG_LEN(sizeof(txtime));
+    memcpy(CMSG_DATA(cmsg), &txtime, sizeof(txtime));
+  }
+  return sendmsg(write_fd, &msg, flags);
+}
+
+/* function: send_paced
+ * translates an IPv4 packet and sends it with a departure time from the uplink pacer
+ *   write_fd   - raw socket to send on
+ *   packet     - IPv4 packet
+ *   packetsize - size of packet
+ *   headroom   - number of writable bytes in front of packet, see translate_packet_headroom
+ */
+static void send_paced(int write_fd, uint8_t *packet, size_t packetsize, size_t headroom) {
+  struct clat_packet_headers headers;
+  clat_packet out;
+  size_t len = 0;
+
+  int iov_len = translate_packet_for_send(&Global_Clatd_Config, 1, packet, packetsize,
+                                          packet - headroom, TP_CSUM_NONE, &headers, out);
+  if (!iov_len) {
+    return;
+  }
+  for (int i = 0; i < iov_len; i++) {
+    len += out[i].iov_len;
+  }
+  send_uplink(write_fd, out, iov_len, uplink_departure(len), 0);
+}
+
+/* function: uplink_transmit
+ * sends queued uplink packets until the queue is empty or the raw socket is full. A packet that
+ * did not fit stays at the head of the queue until the socket polls writable.
+ *   write_fd - raw socket to send on
+ */
+void uplink_transmit(int write_fd) {
+  // Departure time of the packet at the head of the queue, which keeps it when it is retried.
+  static uint64_t txtime;
+  struct fq_codel_packet *packet;
+
+  while ((packet = fq_codel_dequeue(Global_Uplink_Queue, clat_clock_us(CLOCK_MONOTONIC))) != NULL) {
+    struct iovec iov = { packet->data, packet->len };
+    if (!txtime) {
+      txtime = uplink_departure(packet->len);
+    }
+    if (send_uplink(write_fd, &iov, 1, txtime, MSG_DONTWAIT) < 0 &&
+        (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    fq_codel_sent(Global_Uplink_Queue);
+    txtime = 0;
+  }
+}
+
+/* function: enqueue_uplink
+ * translates an IPv4 packet and queues it for uplink_transmit. Packets too large to queue are sent
+ * right away.
+ *   write_fd   - raw socket to send on
+ *   packet     - IPv4 packet
+ *   packetsize - size of packet
+ */
+static void enqueue_uplink(int write_fd, const uint8_t *packet, size_t packetsize) {
+  struct clat_packet_headers headers;
+  clat_packet out;
+
+  int iov_len = translate_packet_for_send(&Global_Clatd_Config, 1, packet, packetsize, NULL, 0,
+                                          &headers, out);
+  if (!iov_len) {
+    return;
+  }
+  if (!fq_codel_enqueue(Global_Uplink_Queue, out, iov_len, clat_clock_us(CLOCK_MONOTONIC))) {
+    send_rawv6(write_fd, out, iov_len);
+  }
+}
+
 /* function: configure_packet_socket
  * Binds the packet socket and attaches the receive filter to it.
  *   sock - the socket to configure
  */
 int configure_packet_socket(int sock) {
   uint32_t *ipv6 = Global_Clatd_Config.ipv6_local_subnet.s6_addr32;
+  uint32_t mask  = ~Global_Clatd_Config.local_hostmask;
 
   // clang-format off
   struct sock_filter filter_code[] = {
@@ -77,14 +414,17 @@ int configure_packet_socket(int sock) {
     // are always in host byte order). If it matches, continue with next instruction (JMP 0). If it
     // doesn't match, jump ahead to statement that returns 0 (ignore packet). Repeat for the other
     // three words of the IPv6 address, and if they all match, return PACKETLEN (accept packet).
+    // The host bits of the last word are masked off, so in SIIT gateway mode the filter accepts
+    // the whole local prefix.
     BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS,  24),
-    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,    htonl(ipv6[0]), 0, 7),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,    htonl(ipv6[0]), 0, 8),
     BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS,  28),
-    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,    htonl(ipv6[1]), 0, 5),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,    htonl(ipv6[1]), 0, 6),
     BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS,  32),
-    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,    htonl(ipv6[2]), 0, 3),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,    htonl(ipv6[2]), 0, 4),
     BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS,  36),
-    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,    htonl(ipv6[3]), 0, 1),
+    BPF_STMT(BPF_ALU | BPF_AND | BPF_K,    htonl(mask)),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,    htonl(ipv6[3] & mask), 0, 1),
     BPF_STMT(BPF_RET | BPF_K,              PACKETLEN),
     BPF_STMT(BPF_RET | BPF_K,              0),
   };
@@ -110,23 +450,238 @@ int configure_packet_socket(int sock) {
   return 1;
 }
 
+/* function: parse_ipv4_prefix
+ * parses an IPv4 address with an optional prefix length, e.g., "192.0.0.4" or "198.51.100.1/24"
+ *   str       - the string to parse
+ *   addr      - the address to write to
+ *   prefixlen - the prefix length to write to, 32 if there is none
+ *   returns: 1 on success, 0 on failure
+ */
+int parse_ipv4_prefix(const char *str, struct in_addr *addr, int *prefixlen) {
+  char addrstr[INET_ADDRSTRLEN];
+  const char *slash = strchr(str, '/');
+  size_t len        = slash ? (size_t)(slash - str) : strlen(str);
+
+  if (len >= sizeof(addrstr)) {
+    return 0;
+  }
+  memcpy(addrstr, str, len);
+  addrstr[len] = '\0';
+
+  *prefixlen = 32;
+  if (slash && (!parse_int(slash + 1, prefixlen) || *prefixlen < 1 || *prefixlen > 32)) {
+    return 0;
+  }
+  return inet_pton(AF_INET, addrstr, addr) == 1;
+}
+
+/* function: parse_udp_zero_csum_policy
+ * parses where zero UDP checksums may be passed through: "all", or a comma-separated list of UDP
+ * ports and IPv4 prefixes, e.g., "4789,6081,198.51.100.0/24"
+ *   str    - the string to parse
+ *   policy - the policy to write to
+ *   returns: 1 on success, 0 on failure
+ */
+int parse_udp_zero_csum_policy(const char *str, struct udp_zero_csum_policy *policy) {
+  char buf[256], *saveptr, *item;
+
+  memset(policy, 0, sizeof(*policy));
+  if (!strcmp(str, "all")) {
+    policy->pass_all = 1;
+    return 1;
+  }
+  if (strlen(str) >= sizeof(buf)) {
+    return 0;
+  }
+  strcpy(buf, str);
+
+  for (item = strtok_r(buf, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+    unsigned port;
+    struct in_addr addr;
+    int prefixlen;
+    if (parse_unsigned(item, &port)) {
+      if (port < 1 || port > 65535 || policy->num_ports == UDP_ZERO_CSUM_MAX_RULES) {
+        return 0;
+      }
+      policy->ports[policy->num_ports++] = htons(port);
+    } else if (parse_ipv4_prefix(item, &addr, &prefixlen)) {
+      if (policy->num_prefixes == UDP_ZERO_CSUM_MAX_RULES) {
+        return 0;
+      }
+      uint32_t mask = htonl(0xffffffffU << (32 - prefixlen));
+      policy->prefixes[policy->num_prefixes].addr   = addr.s_addr & mask;
+      policy->prefixes[policy->num_prefixes++].mask = mask;
+    } else {
+      return 0;
+    }
+  }
+  return policy->num_ports + policy->num_prefixes > 0;
+}
+
+/* function: enable_acl
+ * drops the traffic that a list of blocking rules matches before translating it
+ *   str - the rules, see parse_acl
+ *   returns: 1 on success, 0 if the rules are invalid
+ */
+int enable_acl(const char *str) {
+  struct acl *acl = calloc(1, sizeof(*acl));
+
+  if (!acl || !parse_acl(str, acl)) {
+    free(acl);
+    return 0;
+  }
+  Global_Clatd_Config.acl = acl;
+  return 1;
+}
+
+/* function: enable_rate_limit
+ * drops downlink packets that are expensive to translate once they go over their budget
+ *   str - the limits, see parse_rate_limit
+ *   returns: 1 on success, 0 if the limits are invalid
+ */
+int enable_rate_limit(const char *str) {
+  struct rate_limit *limit = calloc(1, sizeof(*limit));
+
+  if (!limit) {
+    return 0;
+  }
+  limit->hash_key = arc4random();
+  if (!parse_rate_limit(str, limit)) {
+    free(limit);
+    return 0;
+  }
+  Global_Clatd_Config.rate_limit = limit;
+  return 1;
+}
+
+// What SIGUSR2 turns on: the tracing set with -d, or every event of every category.
+static uint32_t debug_categories  = CLAT_DEBUG_ALL;
+static uint32_t debug_sample_rate = 1;
+
+/* function: parse_debug
+ * parses debug tracing settings: a comma-separated list of categories, each of "drops", "icmp",
+ * "fragments" and "addresses" (see logging.h) or "all", optionally followed by "/N" to trace one
+ * event in N, e.g., "drops,fragments/100"
+ *   str         - the string to parse
+ *   categories  - the CLAT_DEBUG_* categories, written on success
+ *   sample_rate - one event in how many is traced, written on success
+ *   returns: 1 on success, 0 on failure
+ */
+int parse_debug(const char *str, uint32_t *categories, uint32_t *sample_rate) {
+  char buf[128], *saveptr, *item, *rate;
+  uint32_t parsed = 0;
+  unsigned rate_num = 1;
+
+  if (strlen(str) >= sizeof(buf)) {
+    return 0;
+  }
+  strcpy(buf, str);
+
+  rate = strchr(buf, '/');
+  if (rate) {
+    *rate++ = '\0';
+    if (!parse_unsigned(rate, &rate_num) || rate_num < 1) {
+      return 0;
+    }
+  }
+
+  for (item = strtok_r(buf, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+    int i;
+    if (!strcmp(item, "all")) {
+      parsed |= CLAT_DEBUG_ALL;
+      continue;
+    }
+    for (i = 0; i < CLAT_DEBUG_CATEGORIES; i++) {
+      if (!strcmp(item, clat_debug_category_names[i])) {
+        break;
+      }
+    }
+    if (i == CLAT_DEBUG_CATEGORIES) {
+      return 0;
+    }
+    parsed |= 1 << i;
+  }
+  if (!parsed) {
+    return 0;
+  }
+
+  *categories  = parsed;
+  *sample_rate = rate_num;
+  return 1;
+}
+
+/* function: log_debug
+ * logs which debug tracing is on
+ */
+static void log_debug() {
+  char names[64] = "";
+  size_t len     = 0;
+
+  if (!clat_debug_categories) {
+    logmsg(ANDROID_LOG_INFO, "Debug tracing off");
+    return;
+  }
+  for (int i = 0; i < CLAT_DEBUG_CATEGORIES; i++) {
+    if (clat_debug_categories & (1 << i)) {
+      len += snprintf(names + len, sizeof(names) - len, "%s%s", len ? "," : "",
+                      clat_debug_category_names[i]);
+    }
+  }
+  logmsg(ANDROID_LOG_INFO, "Debug tracing %s, one event in %u", names, debug_sample_rate);
+}
+
+/* function: enable_debug
+ * turns on debug tracing, and makes it what SIGUSR2 turns on later
+ *   str - the settings, see parse_debug
+ *   returns: 1 on success, 0 if the settings are invalid
+ */
+int enable_debug(const char *str) {
+  if (!parse_debug(str, &debug_categories, &debug_sample_rate)) {
+    return 0;
+  }
+  clat_debug_set(debug_categories, debug_sample_rate);
+  log_debug();
+  return 1;
+}
+
+volatile sig_atomic_t debug_toggle_requested = 0;
+
+/* function: request_debug_toggle
+ * signal handler: turn debug tracing on or off at the next iteration of the event loop
+ */
+void request_debug_toggle() { debug_toggle_requested = 1; }
+
+/* function: toggle_debug
+ * turns debug tracing off if it is on, and back on with the settings from -d otherwise
+ */
+static void toggle_debug() {
+  clat_debug_set(clat_debug_categories ? 0 : debug_categories, debug_sample_rate);
+  log_debug();
+}
+
 /* function: configure_tun_ip
  * configures the ipv4 and ipv6 addresses on the tunnel interface
- *   tunnel - tun device data
- *   mtu    - mtu of tun device
+ *   tunnel  - tun device data
+ *   v4_addr - the IPv4 address, or in SIIT gateway mode, the address and prefix length
+ *   mtu     - mtu of tun device
  */
 void configure_tun_ip(const struct tun_data *tunnel, const char *v4_addr, int mtu) {
-  if (!v4_addr || !inet_pton(AF_INET, v4_addr, &Global_Clatd_Config.ipv4_local_subnet.s_addr)) {
+  int prefixlen;
+  if (!v4_addr ||
+      !parse_ipv4_prefix(v4_addr, &Global_Clatd_Config.ipv4_local_subnet, &prefixlen)) {
     logmsg(ANDROID_LOG_FATAL, "Invalid IPv4 address %s", v4_addr);
     exit(1);
   }
+  Global_Clatd_Config.local_hostmask = prefixlen < 32 ? htonl(0xffffffffU >> prefixlen) : 0;
 
   char addrstr[INET_ADDRSTRLEN];
   inet_ntop(AF_INET, &Global_Clatd_Config.ipv4_local_subnet, addrstr, sizeof(addrstr));
-  logmsg(ANDROID_LOG_INFO, "Using IPv4 address %s on %s", addrstr, tunnel->device4);
+  logmsg(ANDROID_LOG_INFO, "Using IPv4 address %s/%d on %s", addrstr, prefixlen, tunnel->device4);
 
   // Configure the interface before bringing it up. As soon as we bring the interface up, the
   // framework will be notified and will assume the interface's configuration has been finalized.
+  // In SIIT gateway mode too, the tun only gets our own address: the hosts of the local prefix
+  // are on the LAN interface, and that is where their translated downlink packets must be routed.
   int status = add_address(tunnel->device4, AF_INET, &Global_Clatd_Config.ipv4_local_subnet, 32,
                            &Global_Clatd_Config.ipv4_local_subnet);
   if (status < 0) {
@@ -139,6 +694,18 @@ void configure_tun_ip(const struct tun_data *tunnel, const char *v4_addr, int mt
     logmsg(ANDROID_LOG_FATAL, "configure_tun_ip/if_up(4) failed: %s", strerror(-status));
     exit(1);
   }
+
+  // As a CLAT, netd routes traffic into the tun. As a SIIT gateway, route everything the NAT64
+  // reaches, i.e., all IPv4 destinations without a more specific route. The high metric keeps any
+  // other default route preferred.
+  if (Global_Clatd_Config.local_hostmask) {
+    struct in_addr any = { INADDR_ANY };
+    status = add_route(tunnel->device4, AF_INET, &any, 0, SIIT_ROUTE_METRIC);
+    if (status < 0 && status != -EEXIST) {
+      logmsg(ANDROID_LOG_FATAL, "configure_tun_ip/add_route(4) failed: %s", strerror(-status));
+      exit(1);
+    }
+  }
 }
 
 /* function: set_capability
@@ -213,6 +780,115 @@ void open_sockets(struct tun_data *tunnel, uint32_t mark) {
   }
 }
 
+/* function: open_tun_queue
+ * attaches another queue to the tun, if it was created with IFF_MULTI_QUEUE. The kernel steers
+ * each flow to one queue, so a worker with its own queue is only woken up for its own packets.
+ * Needs CAP_NET_ADMIN.
+ *   tun_fd - the tun fd clatd was started with
+ *   returns: the fd of the new queue, or tun_fd if the tun has a single queue or attaching one
+ *   failed
+ */
+static int open_tun_queue(int tun_fd) {
+  struct ifreq ifr;
+
+  memset(&ifr, 0, sizeof(ifr));
+  if (ioctl(tun_fd, TUNGETIFF, &ifr) < 0 || !(ifr.ifr_flags & IFF_MULTI_QUEUE)) {
+    return tun_fd;
+  }
+
+  int fd = open("/dev/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0 && errno == ENOENT) {
+    fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  }
+  // TUNGETIFF returned the name and flags of the tun, so this attaches to it rather than creating
+  // a new one.
+  if (fd < 0 || ioctl(fd, TUNSETIFF, &ifr) < 0) {
+    logmsg(ANDROID_LOG_WARN, "attaching a queue to %s failed, workers share its fd: %s",
+           ifr.ifr_name, strerror(errno));
+    if (fd >= 0) close(fd);
+    return tun_fd;
+  }
+  return fd;
+}
+
+/* function: open_worker_sockets
+ * opens the packet sockets and tun queues of additional worker processes. Needs CAP_NET_RAW and
+ * CAP_NET_ADMIN.
+ *   tunnel  - tun device data of the main process
+ *   workers - tun device data of each additional worker, filled in
+ *   count   - number of additional workers
+ */
+void open_worker_sockets(const struct tun_data *tunnel, struct tun_data *workers, int count) {
+  int i, queues = 0;
+  for (i = 0; i < count; i++) {
+    workers[i] = *tunnel;
+    shm_channel_init(&workers[i].shm);  // Shared memory clients are served by the main process.
+    workers[i].read_fd6 = ring_create(&workers[i]);
+    if (workers[i].read_fd6 < 0) {
+      exit(1);
+    }
+    workers[i].fd4 = open_tun_queue(tunnel->fd4);
+    queues += workers[i].fd4 != tunnel->fd4;
+  }
+  if (count && !queues) {
+    logmsg(ANDROID_LOG_INFO, "%s has a single queue, every uplink packet wakes up all workers",
+           tunnel->device4);
+  }
+}
+
+/* function: join_fanout
+ * adds a configured packet socket to a fanout group that hashes packets by flow
+ *   sock  - the packet socket
+ *   group - fanout group id
+ */
+static void join_fanout(int sock, uint16_t group) {
+  int fanout = group | (PACKET_FANOUT_HASH << 16);
+  if (setsockopt(sock, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout))) {
+    logmsg(ANDROID_LOG_FATAL, "PACKET_FANOUT failed: %s", strerror(errno));
+    exit(1);
+  }
+}
+
+/* function: start_workers
+ * spreads incoming IPv6 packets over the packet sockets of all processes by flow, and forks one
+ * process per worker to run its own event loop. The workers share the raw socket. They have their
+ * own tun queues if the tun has multiple queues, and share the tun fd otherwise.
+ *   tunnel  - tun device data of the main process, already configured
+ *   workers - tun device data from open_worker_sockets
+ *   count   - number of additional workers
+ */
+void start_workers(const struct tun_data *tunnel, struct tun_data *workers, int count) {
+  uint16_t group = getpid() & 0xffff;
+  int i;
+
+  if (count == 0) {
+    return;
+  }
+
+  // Packet sockets can only join a fanout group once they are bound.
+  join_fanout(tunnel->read_fd6, group);
+  for (i = 0; i < count; i++) {
+    if (!configure_packet_socket(workers[i].read_fd6)) {
+      exit(1);
+    }
+    join_fanout(workers[i].read_fd6, group);
+  }
+
+  for (i = 0; i < count; i++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      logmsg(ANDROID_LOG_FATAL, "fork failed: %s", strerror(errno));
+      exit(1);
+    } else if (pid == 0) {
+      // Don't outlive the main process, which is the one that gets stopped.
+      prctl(PR_SET_PDEATHSIG, SIGTERM);
+      event_loop(&workers[i]);
+      exit(0);
+    }
+  }
+  logmsg(ANDROID_LOG_INFO, "Started %d worker processes", count);
+}
+
 int ipv6_address_changed(const char *interface) {
   union anyip *interface_ip;
 
@@ -253,8 +929,22 @@ int configure_clat_ipv6_address(const struct tun_data *tunnel, const char *inter
   inet_ntop(AF_INET6, &Global_Clatd_Config.ipv6_local_subnet, addrstr, sizeof(addrstr));
   logmsg(ANDROID_LOG_INFO, "Using IPv6 address %s on %s", addrstr, interface);
 
-  // Start translating packets to the new prefix.
-  add_anycast_address(tunnel->write_fd6, &Global_Clatd_Config.ipv6_local_subnet, interface);
+  // Start translating packets to the new prefix. In SIIT gateway mode, answer neighbor discovery
+  // for every mapped address, unless there are too many of them.
+  uint32_t hostmask    = Global_Clatd_Config.local_hostmask;
+  uint64_t addresses   = (uint64_t)ntohl(hostmask) + 1;
+  struct in6_addr addr = Global_Clatd_Config.ipv6_local_subnet;
+  if (addresses > MAX_ANYCAST_ADDRESSES) {
+    logmsg(ANDROID_LOG_WARN, "%s/%d has more than %d addresses, it must be routed to this host",
+           addrstr, 128 - __builtin_popcount(hostmask), MAX_ANYCAST_ADDRESSES);
+    addresses = 1;
+    hostmask  = 0;
+  }
+  uint32_t i;
+  for (i = 0; i < addresses; i++) {
+    addr.s6_addr32[3] = (addr.s6_addr32[3] & ~hostmask) | htonl(i & ntohl(hostmask));
+    add_anycast_address(tunnel->write_fd6, &addr, interface);
+  }
 
   // Update our packet socket filter to reflect the new 464xlat IP address.
   if (!configure_packet_socket(tunnel->read_fd6)) {
@@ -320,6 +1010,7 @@ int detect_mtu(const struct in6_addr *plat_subnet, uint32_t plat_suffix, uint32_
 void configure_interface(const char *uplink_interface, const char *plat_prefix, const char *v4_addr,
                          const char *v6_addr, struct tun_data *tunnel, uint32_t mark) {
   Global_Clatd_Config.native_ipv6_interface = uplink_interface;
+  Global_Clatd_Config.counters              = &Global_Clatd_Counters;
   if (!plat_prefix || inet_pton(AF_INET6, plat_prefix, &Global_Clatd_Config.plat_subnet) <= 0) {
     logmsg(ANDROID_LOG_FATAL, "invalid IPv6 address specified for plat prefix: %s", plat_prefix);
     exit(1);
@@ -341,15 +1032,42 @@ void configure_interface(const char *uplink_interface, const char *plat_prefix,
   }
 }
 
+/* function: log_memory_budget
+ * logs what each of clatd's large buffers costs, so the footprint on a device can be read from the
+ * logs. The benchmarks in benchmarks/ measure the same components in a running process.
+ *   tunnel      - tun device data
+ *   num_workers - number of processes translating packets, each with its own ring, stack and
+ *                 copy of the other buffers. Only the main process serves shared memory clients.
+ */
+void log_memory_budget(const struct tun_data *tunnel, unsigned num_workers) {
+  size_t ring    = (size_t)TP_BLOCK_SIZE * tunnel->ring.numblocks;
+  size_t stack   = CLAT_HEADROOM + PACKETLEN + sizeof(struct clat_packet_headers);
+  size_t queue   = Global_Uplink_Queue ? sizeof(*Global_Uplink_Queue) : 0;
+  size_t shadow  = Global_Clatd_Config.shadow ? sizeof(*Global_Clatd_Config.shadow) : 0;
+  size_t monitor = Global_Clatd_Config.tcp_monitor ? sizeof(Global_Tcp_Monitor) : 0;
+  size_t gro     = Global_Udp_Gro ? sizeof(*Global_Udp_Gro) : 0;
+  size_t shm     = tunnel->shm.listen_fd >= 0 ? sizeof(struct shm_region) : 0;
+
+  logmsg(ANDROID_LOG_INFO,
+         "Memory budget: packet ring %zu KiB pinned, read buffer and headers %zu KiB stack, "
+         "uplink queue %zu KiB, shadow buffers %zu KiB, TCP monitor %zu KiB, UDP GRO %zu bytes, "
+         "%zu KiB in total, x%u processes; shm region %zu KiB per client",
+         ring / 1024, stack / 1024, queue / 1024, shadow / 1024, monitor / 1024, gro,
+         (ring + stack + queue + shadow + monitor + gro) / 1024, num_workers, shm / 1024);
+}
+
 /* function: read_packet
  * reads a packet from the tunnel fd and translates it
  *   read_fd  - file descriptor to read original packet from
  *   write_fd - file descriptor to write translated packet to
  *   to_ipv6  - whether the packet is to be translated to ipv6 or ipv4
+ * returns: 1 if a packet was read, even if it could not be translated, 0 otherwise
  */
-void read_packet(int read_fd, int write_fd, int to_ipv6) {
+CLAT_HOT int read_packet(int read_fd, int write_fd, int to_ipv6) {
   ssize_t readlen;
-  uint8_t buf[PACKETLEN], *packet;
+  // Read behind some headroom, so the IPv6 headers can be built in front of the transport header
+  // and the translated packet sent as a single buffer.
+  uint8_t headroom_buf[CLAT_HEADROOM + PACKETLEN], *buf = headroom_buf + CLAT_HEADROOM, *packet;
 
   readlen = read(read_fd, buf, PACKETLEN);
 
@@ -357,23 +1075,23 @@ void read_packet(int read_fd, int write_fd, int to_ipv6) {
     if (errno != EAGAIN) {
       logmsg(ANDROID_LOG_WARN, "read_packet/read error: %s", strerror(errno));
     }
-    return;
+    return 0;
   } else if (readlen == 0) {
     logmsg(ANDROID_LOG_WARN, "read_packet/tun interface removed");
     running = 0;
-    return;
+    return 0;
   }
 
   struct tun_pi *tun_header = (struct tun_pi *)buf;
   if (readlen < (ssize_t)sizeof(*tun_header)) {
     logmsg(ANDROID_LOG_WARN, "read_packet/short read: got %ld bytes", readlen);
-    return;
+    return 1;
   }
 
   uint16_t proto = ntohs(tun_header->proto);
   if (proto != ETH_P_IP) {
     logmsg(ANDROID_LOG_WARN, "%s: unknown packet type = 0x%x", __func__, proto);
-    return;
+    return 1;
   }
 
   if (tun_header->flags != 0) {
@@ -382,7 +1100,27 @@ void read_packet(int read_fd, int write_fd, int to_ipv6) {
 
   packet = (uint8_t *)(tun_header + 1);
   readlen -= sizeof(*tun_header);
-  translate_packet(write_fd, to_ipv6, packet, readlen, TP_CSUM_NONE);
+  if (Global_Udp_Gro) {
+    // With offloads off, the virtio-net header carries nothing.
+    if (readlen < (ssize_t)sizeof(struct virtio_net_hdr)) {
+      logmsg(ANDROID_LOG_WARN, "read_packet/short read: got %ld bytes", readlen);
+      return 1;
+    }
+    packet += sizeof(struct virtio_net_hdr);
+    readlen -= sizeof(struct virtio_net_hdr);
+  }
+  if (to_ipv6 && Global_Uplink_Queue) {
+    enqueue_uplink(write_fd, packet, readlen);
+    uplink_transmit(write_fd);
+    return 1;
+  }
+  if (to_ipv6 && Global_Uplink_Pacer) {
+    send_paced(write_fd, packet, readlen, packet - headroom_buf);
+    return 1;
+  }
+  translate_packet_headroom(&Global_Clatd_Config, write_fd, to_ipv6, packet, readlen,
+                            packet - headroom_buf, TP_CSUM_NONE);
+  return 1;
 }
 
 /* function: event_loop
@@ -394,19 +1132,40 @@ void event_loop(struct tun_data *tunnel) {
   struct pollfd wait_fd[] = {
     { tunnel->read_fd6, POLLIN, 0 },
     { tunnel->fd4, POLLIN, 0 },
+    { tunnel->shm.listen_fd, POLLIN, 0 },
+    { -1, POLLIN, 0 },   // shm client socket, only used to notice disconnects.
+    { -1, POLLIN, 0 },   // shm kick eventfd.
+    { -1, POLLOUT, 0 },  // raw socket, only polled while the uplink queue is backed up.
   };
 
   // start the poll timer
   last_interface_poll = time(NULL);
 
+  if (tunnel->placement.enabled) {
+    placement_evaluate(&tunnel->placement, tunnel->read_fd6, last_interface_poll);
+  }
+  loop_stats_start(&tunnel->loop);
+
   while (running) {
-    if (poll(wait_fd, ARRAY_SIZE(wait_fd), NO_TRAFFIC_INTERFACE_POLL_FREQUENCY * 1000) == -1) {
+    // poll() ignores negative fds, so these entries are inert while no client is connected.
+    wait_fd[3].fd = tunnel->shm.conn_fd;
+    wait_fd[4].fd = tunnel->shm.kick_fd;
+    wait_fd[5].fd = Global_Uplink_Queue && Global_Uplink_Queue->qlen ? tunnel->write_fd6 : -1;
+
+    uint64_t poll_start = clat_clock_us(CLOCK_MONOTONIC);
+    int ready = poll(wait_fd, ARRAY_SIZE(wait_fd), NO_TRAFFIC_INTERFACE_POLL_FREQUENCY * 1000);
+    tunnel->loop.poll_time += clat_clock_us(CLOCK_MONOTONIC) - poll_start;
+
+    if (ready == -1) {
       if (errno != EINTR) {
         logmsg(ANDROID_LOG_WARN, "event_loop/poll returned an error: %s", strerror(errno));
       }
-    } else {
+    } else if (ready > 0) {
+      tunnel->loop.wakeups++;
       if (wait_fd[0].revents & POLLIN) {
-        ring_read(&tunnel->ring, tunnel->fd4, 0 /* to_ipv6 */);
+        int packets = ring_read(&tunnel->ring, tunnel->fd4, 0 /* to_ipv6 */, Global_Udp_Gro);
+        placement_account(&tunnel->placement, packets);
+        loop_stats_downlink(&tunnel->loop, packets);
       }
       // If any other bit is set, assume it's due to an error (i.e. POLLERR).
       if (wait_fd[0].revents & ~POLLIN) {
@@ -421,10 +1180,34 @@ void event_loop(struct tun_data *tunnel) {
       // causing this code to spin in a loop. Calling read() will clear the
       // socket error flag instead.
       if (wait_fd[1].revents) {
-        read_packet(tunnel->fd4, tunnel->write_fd6, 1 /* to_ipv6 */);
+        tunnel->loop.uplink_wakeups++;
+        tunnel->loop.uplink_packets += read_packet(tunnel->fd4, tunnel->write_fd6, 1 /* to_ipv6 */);
+      }
+
+      if (wait_fd[2].revents & POLLIN) {
+        shm_accept(&tunnel->shm);
+      }
+      if (wait_fd[3].revents) {
+        // The client never sends anything after connecting, so any event is a hangup.
+        logmsg(ANDROID_LOG_INFO, "shm client disconnected");
+        shm_disconnect(&tunnel->shm);
+      } else if (wait_fd[4].revents & POLLIN) {
+        shm_read(&Global_Clatd_Config, &tunnel->shm);
+      }
+      if (wait_fd[5].revents) {
+        uplink_transmit(tunnel->write_fd6);
       }
     }
 
+    if (stats_requested) {
+      stats_requested = 0;
+      log_stats(tunnel);
+    }
+    if (debug_toggle_requested) {
+      debug_toggle_requested = 0;
+      toggle_debug();
+    }
+
     time_t now = time(NULL);
     if (now >= (last_interface_poll + INTERFACE_POLL_FREQUENCY)) {
       last_interface_poll = now;
@@ -432,5 +1215,10 @@ void event_loop(struct tun_data *tunnel) {
         break;
       }
     }
+
+    if (tunnel->placement.enabled &&
+        now >= tunnel->placement.last_eval + AFFINITY_EVAL_FREQUENCY) {
+      placement_evaluate(&tunnel->placement, tunnel->read_fd6, now);
+    }
   }
 }
@@ -18,6 +18,7 @@
 #ifndef __CLATD_H__
 #define __CLATD_H__
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <sys/uio.h>
 
@@ -28,6 +29,16 @@ struct tun_data;
 #define PACKETLEN (MAXMRU + sizeof(struct tun_pi))
 #define CLATD_VERSION "1.4"
 
+// maximum number of processes translating packets in SIIT gateway mode
+#define MAX_WORKERS 16
+
+// largest SIIT prefix whose addresses clatd answers neighbor discovery for, one anycast address
+// each. Larger prefixes must be routed to the host.
+#define MAX_ANYCAST_ADDRESSES 256
+
+// metric of the IPv4 default route through the tun in SIIT gateway mode
+#define SIIT_ROUTE_METRIC 1024
+
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
 // how frequently (in seconds) to poll for an address change while traffic is passing
@@ -36,17 +47,40 @@ struct tun_data;
 // how frequently (in seconds) to poll for an address change while there is no traffic
 #define NO_TRAFFIC_INTERFACE_POLL_FREQUENCY 90
 
+struct in_addr;
+struct in6_addr;
+struct udp_zero_csum_policy;
+
 void stop_loop();
+void request_stats();
+void request_debug_toggle();
+int parse_udp_zero_csum_policy(const char *str, struct udp_zero_csum_policy *policy);
+int parse_ipv4_prefix(const char *str, struct in_addr *addr, int *prefixlen);
+int enable_acl(const char *str);
+int enable_rate_limit(const char *str);
+int parse_debug(const char *str, uint32_t *categories, uint32_t *sample_rate);
+int enable_debug(const char *str);
 void configure_tun_ip(const struct tun_data *tunnel, const char *v4_addr, int mtu);
 void set_capability(uint64_t target_cap);
 void drop_root_but_keep_caps();
 void open_sockets(struct tun_data *tunnel, uint32_t mark);
+void open_worker_sockets(const struct tun_data *tunnel, struct tun_data *workers, int count);
+void start_workers(const struct tun_data *tunnel, struct tun_data *workers, int count);
 int ipv6_address_changed(const char *interface);
 int configure_clat_ipv6_address(const struct tun_data *tunnel, const char *interface,
                                 const char *src_addr);
 int detect_mtu(const struct in6_addr *plat_subnet, uint32_t plat_suffix, uint32_t mark);
 void configure_interface(const char *uplink_interface, const char *plat_prefix, const char *v4_addr,
                          const char *v6, struct tun_data *tunnel, uint32_t mark);
+void log_memory_budget(const struct tun_data *tunnel, unsigned num_workers);
+int read_packet(int read_fd, int write_fd, int to_ipv6);
+void enable_tcp_monitor();
+int enable_shadow(unsigned rate, const char *capture_path);
+void enable_uplink_aqm(int write_fd);
+void enable_uplink_pacing(int write_fd, unsigned max_kbps);
+void enable_udp_gro(int tun_fd);
+void uplink_transmit(int write_fd);
+void log_stats(struct tun_data *tunnel);
 void event_loop(struct tun_data *tunnel);
 
 /* function: parse_int
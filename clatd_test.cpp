@@ -19,27 +19,53 @@
 #include <iostream>
 
 #include <arpa/inet.h>
+#include <grp.h>
+#include <ifaddrs.h>
 #include <netinet/in6.h>
+#include <poll.h>
 #include <stdio.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
 #include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 
 #include <gtest/gtest.h>
+#include <private/android_filesystem_config.h>
 
 #include "netutils/ifc.h"
+#include "packet_generator.h"
 #include "tun_interface.h"
 
 extern "C" {
+#include "acl.h"
+#include "affinity.h"
 #include "clatd.h"
 #include "config.h"
+#include "fq_codel.h"
 #include "getaddr.h"
+#include "libclat.h"
+#include "logging.h"
 #include "netutils/checksum.h"
+#include "pacer.h"
+#include "rate_limit.h"
+#include "send.h"
+#include "shadow.h"
+#include "shm_ring.h"
+#include "tcp_monitor.h"
 #include "translate.h"
+#include "udp_gro.h"
 }
 
 // For convenience.
 #define ARRAYSIZE(x) sizeof((x)) / sizeof((x)[0])
 
 using android::net::TunInterface;
+using clat_test::GeneratedPacket;
+using clat_test::PacketGenerator;
+using clat_test::PacketKind;
+using clat_test::SizeMix;
+using clat_test::TrafficMix;
 
 // Default translation parameters.
 static const char kIPv4LocalAddr[]  = "192.0.0.4";
@@ -429,7 +455,11 @@ void fix_udp_checksum(uint8_t *packet) {
 // Testing stub for send_rawv6. The real version uses sendmsg() with a
 // destination IPv6 address, and attempting to call that on our test socketpair
 // fd results in EINVAL.
-extern "C" void send_rawv6(int fd, clat_packet out, int iov_len) { writev(fd, out, iov_len); }
+static int last_rawv6_iov_len;
+extern "C" void send_rawv6(int fd, clat_packet out, int iov_len) {
+  last_rawv6_iov_len = iov_len;
+  writev(fd, out, iov_len);
+}
 
 void do_translate_packet(const uint8_t *original, size_t original_len, uint8_t *out, size_t *outlen,
                          const char *msg) {
@@ -461,7 +491,8 @@ void do_translate_packet(const uint8_t *original, size_t original_len, uint8_t *
       break;
   }
 
-  translate_packet(write_fd, (version == 4), original, original_len, TP_CSUM_NONE);
+  translate_packet(&Global_Clatd_Config, write_fd, (version == 4), original, original_len,
+                   TP_CSUM_NONE);
 
   snprintf(foo, sizeof(foo), "%s: Invalid translated packet", msg);
   if (version == 6) {
@@ -493,7 +524,7 @@ void check_translated_packet(const uint8_t *original, size_t original_len,
                              const uint8_t *expected, size_t expected_len, const char *msg) {
   uint8_t *translated = new uint8_t[MAXMRU];
   ASSERT_NE(translated, nullptr) << msg << ": Unable to allocate memory\n";
-  size_t translated_len = sizeof(translated);
+  size_t translated_len = MAXMRU;
   do_translate_packet(original, original_len, translated, &translated_len, msg);
   EXPECT_EQ(expected_len, translated_len) << msg << ": Translated packet length incorrect\n";
   check_data_matches(expected, translated, translated_len, msg);
@@ -514,13 +545,13 @@ void check_fragment_translation(const uint8_t *original[], const size_t original
   // Sanity check that reassembling the original and translated fragments produces valid packets.
   uint8_t *reassembled = new uint8_t[MAXMRU];
   ASSERT_NE(reassembled, nullptr) << msg << ": Unable to allocate memory\n";
-  size_t reassembled_len = sizeof(reassembled);
+  size_t reassembled_len = MAXMRU;
   reassemble_packet(original, original_lengths, numfragments, reassembled, &reassembled_len, msg);
   check_packet(reassembled, reassembled_len, msg);
 
   uint8_t *translated = new uint8_t[MAXMRU];
   ASSERT_NE(translated, nullptr) << msg << ": Unable to allocate memory\n";
-  size_t translated_len = sizeof(translated);
+  size_t translated_len = MAXMRU;
   do_translate_packet(reassembled, reassembled_len, translated, &translated_len, msg);
   check_packet(translated, translated_len, msg);
 
@@ -591,6 +622,7 @@ class ClatdTest : public ::testing::Test {
     inet_pton(AF_INET, kIPv4LocalAddr, &Global_Clatd_Config.ipv4_local_subnet);
     inet_pton(AF_INET6, kIPv6PlatSubnet, &Global_Clatd_Config.plat_subnet);
     memset(&Global_Clatd_Config.ipv6_local_subnet, 0, sizeof(in6_addr));
+    Global_Clatd_Config.local_hostmask        = 0;
     Global_Clatd_Config.native_ipv6_interface = const_cast<char *>(sTun.name().c_str());
   }
 
@@ -599,6 +631,24 @@ class ClatdTest : public ::testing::Test {
 
   // Closing the socket removes the interface and IP addresses.
   static void TearDownTestCase() { sTun.destroy(); }
+
+  // Returns whether an IPv4 packet, or an IPv6 packet from the network, is translated.
+  static bool translates(const struct clat_config *config, int to_ipv6,
+                         const clat_test::Packet &p) {
+    struct clat_packet_headers headers;
+    clat_packet out;
+    return translate_packet_iovec(config, to_ipv6, p.data(), p.size(), &headers, out) > 0;
+  }
+
+  // Packets from the local IPv4 address to dst, and from src to the local IPv6 address.
+  static clat_test::Packet local_ipv4(uint8_t proto, const clat_test::Packet &l4,
+                                      const char *dst) {
+    return clat_test::ipv4(proto, l4, kIPv4LocalAddr, dst);
+  }
+  static clat_test::Packet local_ipv6(uint8_t proto, const clat_test::Packet &l4,
+                                      const char *src) {
+    return clat_test::ipv6(proto, l4, src, kIPv6LocalAddr);
+  }
 };
 
 TunInterface ClatdTest::sTun;
@@ -654,6 +704,45 @@ TEST_F(ClatdTest, ConfigureTunIpManual) {
   v4Iface.destroy();
 }
 
+TEST_F(ClatdTest, ConfigureTunIpGateway) {
+  TunInterface v4Iface;
+  ASSERT_EQ(0, v4Iface.init());
+  struct tun_data tunnel = makeTunData();
+  strlcpy(tunnel.device4, v4Iface.name().c_str(), sizeof(tunnel.device4));
+
+  configure_tun_ip(&tunnel, "198.51.100.1/24" /* v4_addr */, 1472);
+  EXPECT_EQ(inet_addr("198.51.100.1"), Global_Clatd_Config.ipv4_local_subnet.s_addr);
+  EXPECT_EQ(htonl(0xff), Global_Clatd_Config.local_hostmask);
+
+  // Only our own address is on the tun. The rest of the prefix is on the LAN interface, where the
+  // translated downlink packets must go.
+  struct ifaddrs *ifaddrs;
+  int found = 0;
+  ASSERT_EQ(0, getifaddrs(&ifaddrs));
+  for (struct ifaddrs *ifa = ifaddrs; ifa; ifa = ifa->ifa_next) {
+    if (ifa->ifa_addr && ifa->ifa_addr->sa_family == AF_INET && v4Iface.name() == ifa->ifa_name) {
+      EXPECT_EQ(INADDR_BROADCAST, ((struct sockaddr_in *)ifa->ifa_netmask)->sin_addr.s_addr);
+      found++;
+    }
+  }
+  freeifaddrs(ifaddrs);
+  EXPECT_EQ(1, found);
+
+  v4Iface.destroy();
+
+  struct in_addr addr;
+  int prefixlen;
+  EXPECT_TRUE(parse_ipv4_prefix("192.0.0.4", &addr, &prefixlen));
+  EXPECT_EQ(32, prefixlen);
+  EXPECT_TRUE(parse_ipv4_prefix("10.0.0.0/8", &addr, &prefixlen));
+  EXPECT_EQ(inet_addr("10.0.0.0"), addr.s_addr);
+  EXPECT_EQ(8, prefixlen);
+  EXPECT_FALSE(parse_ipv4_prefix("10.0.0.0/0", &addr, &prefixlen));
+  EXPECT_FALSE(parse_ipv4_prefix("10.0.0.0/33", &addr, &prefixlen));
+  EXPECT_FALSE(parse_ipv4_prefix("10.0.0.0/", &addr, &prefixlen));
+  EXPECT_FALSE(parse_ipv4_prefix("10.0.0/8", &addr, &prefixlen));
+}
+
 TEST_F(ClatdTest, DataSanitycheck) {
   // Sanity checks the data.
   uint8_t v4_header[] = { IPV4_UDP_HEADER };
@@ -688,7 +777,7 @@ TEST_F(ClatdTest, DataSanitycheck) {
   // Sanity checks reassemble_packet.
   uint8_t *reassembled = new uint8_t[MAXMRU];
   ASSERT_NE(reassembled, nullptr) << ": Unable to allocate memory\n";
-  size_t total_length = sizeof(reassembled);
+  size_t total_length = MAXMRU;
   reassemble_packet(kIPv4Fragments, kIPv4FragLengths, ARRAYSIZE(kIPv4Fragments), reassembled,
                     &total_length, "Reassembly sanity check");
   check_packet(reassembled, total_length, "IPv4 Reassembled packet is valid");
@@ -697,7 +786,7 @@ TEST_F(ClatdTest, DataSanitycheck) {
     << "Sanity check: reassembled packet is a fragment!\n";
   check_data_matches(kReassembledIPv4, reassembled, total_length, "IPv4 reassembly sanity check");
 
-  total_length = sizeof(reassembled);
+  total_length = MAXMRU;
   reassemble_packet(kIPv6Fragments, kIPv6FragLengths, ARRAYSIZE(kIPv6Fragments), reassembled,
                     &total_length, "IPv6 reassembly sanity check");
   ASSERT_TRUE(!is_ipv6_fragment((struct ip6_hdr *)reassembled, total_length))
@@ -818,6 +907,1075 @@ TEST_F(ClatdTest, Fragmentation) {
                              ARRAYSIZE(kIPv6Fragments), "IPv6->IPv4 fragment translation");
 }
 
+TEST_F(ClatdTest, TranslateBatch) {
+  struct clat_config config;
+  ASSERT_TRUE(clat_config_init(&config, kIPv4LocalAddr, kIPv6LocalAddr, kIPv6PlatSubnet));
+
+  uint8_t udp_ipv4[] = { IPV4_UDP_HEADER UDP_HEADER PAYLOAD };
+  uint8_t udp_ipv6[] = { IPV6_UDP_HEADER UDP_HEADER PAYLOAD };
+  fix_udp_checksum(udp_ipv4);
+  fix_udp_checksum(udp_ipv6);
+  uint8_t ipv4_ping[] = { IPV4_ICMP_HEADER IPV4_PING PAYLOAD };
+  uint8_t ipv6_ping[] = { IPV6_ICMPV6_HEADER IPV6_PING PAYLOAD };
+  uint8_t truncated[] = { 0x45, 0x00, 0x00 };
+
+  struct iovec in[] = {
+    { udp_ipv4, sizeof(udp_ipv4) },
+    { truncated, sizeof(truncated) },
+    { ipv4_ping, sizeof(ipv4_ping) },
+    { udp_ipv4, sizeof(udp_ipv4) },
+  };
+  uint8_t buf[ARRAYSIZE(in)][MAXMTU];
+  struct iovec out[] = {
+    { buf[0], sizeof(buf[0]) },
+    { buf[1], sizeof(buf[1]) },
+    { buf[2], sizeof(buf[2]) },
+    { buf[3], sizeof(udp_ipv6) - 1 },
+  };
+  clat_verdict verdicts[ARRAYSIZE(in)];
+
+  // Translation does not depend on the global configuration.
+  memset(&Global_Clatd_Config, 0, sizeof(Global_Clatd_Config));
+
+  EXPECT_EQ(2U, clat_translate_batch(&config, 1, in, out, verdicts, ARRAYSIZE(in)));
+  EXPECT_EQ(CLAT_VERDICT_TRANSLATED, verdicts[0]);
+  EXPECT_EQ(CLAT_VERDICT_DROP, verdicts[1]);
+  EXPECT_EQ(CLAT_VERDICT_TRANSLATED, verdicts[2]);
+  EXPECT_EQ(CLAT_VERDICT_NOSPACE, verdicts[3]);
+
+  ASSERT_EQ(sizeof(udp_ipv6), out[0].iov_len);
+  check_data_matches(udp_ipv6, out[0].iov_base, out[0].iov_len, "Batch UDP/IPv4 -> UDP/IPv6");
+  ASSERT_EQ(sizeof(ipv6_ping), out[2].iov_len);
+  check_data_matches(ipv6_ping, out[2].iov_base, out[2].iov_len, "Batch ICMP -> ICMPv6");
+
+  // And back again. IPv4 packets are written without a tun header.
+  in[0] = out[0];
+  out[0] = { buf[3], sizeof(buf[3]) };
+  EXPECT_EQ(1U, clat_translate_batch(&config, 0, in, out, verdicts, 1));
+  EXPECT_EQ(CLAT_VERDICT_TRANSLATED, verdicts[0]);
+  ASSERT_EQ(sizeof(udp_ipv4), out[0].iov_len);
+  check_data_matches(udp_ipv4, out[0].iov_base, out[0].iov_len, "Batch UDP/IPv6 -> UDP/IPv4");
+}
+
+TEST_F(ClatdTest, TranslateGeneratedTraffic) {
+  struct clat_config config;
+  ASSERT_TRUE(clat_config_init(&config, kIPv4LocalAddr, kIPv6LocalAddr, kIPv6PlatSubnet));
+  static uint8_t out[IP_MAXPACKET];
+
+  for (SizeMix sizes : { SizeMix::kImix, SizeMix::kBulk, SizeMix::kSmall }) {
+    TrafficMix mix;
+    mix.sizes = sizes;
+    // Equal weights, so that the rare kinds are covered as well as the common ones.
+    std::fill(std::begin(mix.weights), std::end(mix.weights), 1);
+    std::vector<GeneratedPacket> packets = PacketGenerator(mix, 42).Generate(300);
+    std::vector<GeneratedPacket> again   = PacketGenerator(mix, 42).Generate(300);
+
+    for (size_t i = 0; i < packets.size(); i++) {
+      const GeneratedPacket &p = packets[i];
+      std::string msg = std::string(clat_test::packet_kind_name(p.kind)) +
+                        (p.to_ipv6 ? " IPv4->IPv6 #" : " IPv6->IPv4 #") + std::to_string(i);
+      ASSERT_EQ(again[i].packet, p.packet) << msg << ": generator is not deterministic";
+
+      struct iovec iov = { out, sizeof(out) };
+      clat_verdict verdict =
+        clat_translate(&config, p.to_ipv6, p.packet.data(), p.packet.size(), &iov);
+      if (p.kind == PacketKind::kOptions && !p.to_ipv6) {
+        // IPv6 extension headers other than Fragment are not supported.
+        EXPECT_EQ(CLAT_VERDICT_DROP, verdict) << msg;
+        continue;
+      }
+      ASSERT_EQ(CLAT_VERDICT_TRANSLATED, verdict) << msg;
+      // The generated checksums are correct, so an incorrect one is a translation bug.
+      check_packet(out, iov.iov_len, msg.c_str());
+    }
+  }
+}
+
+TEST_F(ClatdTest, TranslateWithHeadroom) {
+  struct clat_config config;
+  ASSERT_TRUE(clat_config_init(&config, kIPv4LocalAddr, kIPv6LocalAddr, kIPv6PlatSubnet));
+  static uint8_t expected[IP_MAXPACKET], buf[CLAT_HEADROOM + IP_MAXPACKET], out[IP_MAXPACKET];
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, fds));
+
+  TrafficMix mix;
+  std::fill(std::begin(mix.weights), std::end(mix.weights), 1);
+  for (const GeneratedPacket &p : PacketGenerator(mix, 7).Generate(300)) {
+    std::string msg = std::string(clat_test::packet_kind_name(p.kind)) +
+                      (p.to_ipv6 ? " IPv4->IPv6" : " IPv6->IPv4");
+    struct iovec iov = { expected, sizeof(expected) };
+    if (clat_translate(&config, p.to_ipv6, p.packet.data(), p.packet.size(), &iov) !=
+        CLAT_VERDICT_TRANSLATED) {
+      continue;
+    }
+
+    uint8_t *packet = buf + CLAT_HEADROOM;
+    memcpy(packet, p.packet.data(), p.packet.size());
+    last_rawv6_iov_len = 0;
+    translate_packet_headroom(&config, fds[0], p.to_ipv6, packet, p.packet.size(), CLAT_HEADROOM,
+                              TP_CSUM_NONE);
+
+    // Downlink packets get a tun header in front.
+    size_t tunlen = p.to_ipv6 ? 0 : sizeof(struct tun_pi);
+    ssize_t len   = read(fds[1], out, sizeof(out));
+    ASSERT_EQ(iov.iov_len + tunlen, (size_t)len) << msg;
+    EXPECT_EQ(0, memcmp(expected, out + tunlen, iov.iov_len)) << msg;
+
+    // ICMP errors grow by more than the headroom and take the iovec path.
+    if (p.to_ipv6) {
+      EXPECT_EQ(p.kind == PacketKind::kIcmpError ? CLAT_POS_PAYLOAD + 1 : 1, last_rawv6_iov_len)
+        << msg;
+    }
+  }
+
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST_F(ClatdTest, ShadowVerification) {
+  struct clat_config config;
+  ASSERT_TRUE(clat_config_init(&config, kIPv4LocalAddr, kIPv6LocalAddr, kIPv6PlatSubnet));
+  FILE *capture = tmpfile();
+  ASSERT_NE(nullptr, capture);
+  struct shadow *shadow = shadow_create(2, capture);
+  ASSERT_NE(nullptr, shadow);
+  config.shadow = shadow;
+  static uint8_t buf[CLAT_HEADROOM + IP_MAXPACKET], out[IP_MAXPACKET];
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, fds));
+
+  // The headroom path agrees with the reference path on every kind of packet.
+  TrafficMix mix;
+  std::fill(std::begin(mix.weights), std::end(mix.weights), 1);
+  for (const GeneratedPacket &p : PacketGenerator(mix, 11).Generate(300)) {
+    uint8_t *packet = buf + CLAT_HEADROOM;
+    memcpy(packet, p.packet.data(), p.packet.size());
+    translate_packet_headroom(&config, fds[0], p.to_ipv6, packet, p.packet.size(), CLAT_HEADROOM,
+                              TP_CSUM_NONE);
+    while (read(fds[1], out, sizeof(out)) > 0) {
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  EXPECT_LT(100U, shadow->verified);
+  EXPECT_EQ(0U, shadow->mismatches);
+
+  // A corrupted translation is counted and captured with its input and the reference.
+  clat_test::Packet ip4 =
+      clat_test::ipv4(IPPROTO_UDP, clat_test::udp(100), kIPv4LocalAddr, "8.8.8.8");
+  struct clat_packet_headers headers;
+  clat_packet translated;
+  ASSERT_TRUE(shadow_save_input(shadow, ip4.data(), ip4.size()));
+  int iov_len = translate_packet_iovec(&config, 1, ip4.data(), ip4.size(), &headers, translated);
+  ASSERT_LT(0, iov_len);
+  EXPECT_EQ(1, shadow_verify(shadow, &config, 1, translated, iov_len));
+  ((struct udphdr *)headers.transporthdr)->check ^= 1;
+  EXPECT_EQ(0, shadow_verify(shadow, &config, 1, translated, iov_len));
+  EXPECT_EQ(1U, shadow->mismatches);
+
+  const size_t ip6 = ip4.size() + sizeof(struct ip6_hdr) - sizeof(struct iphdr);
+  EXPECT_EQ(24 + 16 * 3 + ip4.size() + 2 * ip6, (size_t)ftell(capture));
+  fclose(capture);
+  free(shadow);
+}
+
+TEST_F(ClatdTest, ShadowVerificationRateLimit) {
+  struct clat_config config;
+  ASSERT_TRUE(clat_config_init(&config, kIPv4LocalAddr, kIPv6LocalAddr, kIPv6PlatSubnet));
+  static struct rate_limit limit;
+  limit.hash_key = 1;
+  ASSERT_TRUE(parse_rate_limit("frag:1", &limit));
+  config.rate_limit = &limit;
+  struct shadow *shadow = shadow_create(1, nullptr);
+  ASSERT_NE(nullptr, shadow);
+  config.shadow = shadow;
+  static uint8_t buf[CLAT_HEADROOM + IP_MAXPACKET], out[IP_MAXPACKET];
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, fds));
+
+  // The bucket holds one fragment. The reference translation doesn't spend it a second time.
+  clat_test::Packet datagram = clat_test::ipv6(IPPROTO_TCP, clat_test::tcp(100, 443, 40000),
+                                               "64:ff9b::808:808", kIPv6LocalAddr);
+  clat_test::Packet fragment = clat_test::ipv6_fragment(datagram, 0, 48);
+  uint8_t *packet            = buf + CLAT_HEADROOM;
+  memcpy(packet, fragment.data(), fragment.size());
+  translate_packet_headroom(&config, fds[0], 0, packet, fragment.size(), CLAT_HEADROOM,
+                            TP_CSUM_NONE);
+  EXPECT_LT(0, read(fds[1], out, sizeof(out)));
+  EXPECT_EQ(1U, shadow->verified);
+  EXPECT_EQ(0U, shadow->mismatches);
+  EXPECT_EQ(1U, limit.classes[RATE_LIMIT_FRAGMENT].passed);
+  EXPECT_EQ(0U, limit.classes[RATE_LIMIT_FRAGMENT].dropped_class);
+
+  // Verifying again leaves the buckets as they were.
+  struct rate_limit_class before = limit.classes[RATE_LIMIT_FRAGMENT];
+  struct clat_packet_headers headers;
+  clat_packet translated;
+  ASSERT_TRUE(shadow_save_input(shadow, fragment.data(), fragment.size()));
+  config.rate_limit = nullptr;
+  int iov_len = translate_packet_iovec(&config, 0, fragment.data(), fragment.size(), &headers,
+                                       translated);
+  config.rate_limit = &limit;
+  ASSERT_LT(0, iov_len);
+  fill_tun_header(&headers.tun, ETH_P_IP, TP_CSUM_NONE);
+  translated[CLAT_POS_TUNHDR].iov_len = sizeof(headers.tun);
+  EXPECT_EQ(1, shadow_verify(shadow, &config, 0, translated, iov_len));
+  EXPECT_EQ(0, memcmp(&before, &limit.classes[RATE_LIMIT_FRAGMENT], sizeof(before)));
+  EXPECT_EQ(0U, shadow->mismatches);
+
+  close(fds[0]);
+  close(fds[1]);
+  free(shadow);
+}
+
+// struct virtio_net_hdr. C++ can't include linux/virtio_net.h, which has a member named class.
+struct VirtioNetHdr {
+  uint8_t flags, gso_type;
+  uint16_t hdr_len, gso_size, csum_start, csum_offset;
+};
+static const uint8_t kVirtioNetHdrNeedsCsum = 1, kVirtioNetHdrGsoUdpL4 = 5;
+
+TEST_F(ClatdTest, UdpGro) {
+  struct clat_config config;
+  ASSERT_TRUE(clat_config_init(&config, kIPv4LocalAddr, kIPv6LocalAddr, kIPv6PlatSubnet));
+  struct udp_gro *gro = udp_gro_create(1);
+  ASSERT_NE(nullptr, gro);
+  static uint8_t out[IP_MAXPACKET], expected[IP_MAXPACKET];
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, fds));
+  auto quic = [](size_t len, uint16_t sport) {
+    return clat_test::with_checksum(
+      clat_test::ipv6(IPPROTO_UDP, clat_test::udp(len, sport, 51339), "64:ff9b::808:808",
+                      kIPv6LocalAddr),
+      sizeof(struct ip6_hdr), IPPROTO_UDP);
+  };
+  const size_t hdrlen = sizeof(struct tun_pi) + sizeof(VirtioNetHdr);
+  const size_t l4     = sizeof(struct iphdr) + sizeof(struct udphdr);
+
+  // A train of one flow ends with a short datagram, and another flow follows. The first datagram
+  // whose checksum the kernel hasn't verified is written on its own.
+  std::vector<clat_test::Packet> packets = { quic(1200, 443), quic(1200, 443), quic(1200, 443),
+                                             quic(500, 443),  quic(1200, 8443), quic(1200, 8443),
+                                             quic(1200, 8443) };
+  for (size_t i = 0; i < packets.size(); i++) {
+    udp_gro_packet(gro, &config, fds[0], packets[i].data(), packets[i].size(),
+                   i == 6 ? TP_CSUM_NONE : TP_CSUM_UNNECESSARY);
+  }
+  udp_gro_flush(gro, fds[0]);
+  EXPECT_EQ(2U, gro->gso_packets);
+  EXPECT_EQ(6U, gro->gso_segments);
+
+  ssize_t len = read(fds[1], out, sizeof(out));
+  ASSERT_EQ(hdrlen + l4 + 3 * 1200 + 500, (size_t)len);
+  const VirtioNetHdr *vnet = (const VirtioNetHdr *)(out + sizeof(struct tun_pi));
+  const struct iphdr *ip   = (const struct iphdr *)(out + hdrlen);
+  struct udphdr *udp       = (struct udphdr *)(ip + 1);
+  EXPECT_EQ(kVirtioNetHdrNeedsCsum, vnet->flags);
+  EXPECT_EQ(kVirtioNetHdrGsoUdpL4, vnet->gso_type);
+  EXPECT_EQ(1200, vnet->gso_size);
+  EXPECT_EQ(l4, vnet->hdr_len);
+  EXPECT_EQ(len - hdrlen, ntohs(ip->tot_len));
+  EXPECT_EQ(0, ip_checksum(ip, sizeof(*ip)));
+  EXPECT_EQ(len - hdrlen - sizeof(*ip), ntohs(udp->len));
+  EXPECT_EQ(443, ntohs(udp->source));
+  // Completing the partial checksum over the UDP header and payload, as the kernel does, gives a
+  // valid checksum.
+  size_t udp_len = len - hdrlen - sizeof(*ip);
+  udp->check     = ip_checksum(udp, udp_len);
+  EXPECT_EQ(0, ip_checksum_finish(
+                 ip_checksum_add(ipv4_pseudo_header_checksum(ip, udp_len), udp, udp_len)));
+
+  len = read(fds[1], out, sizeof(out));
+  ASSERT_EQ(hdrlen + l4 + 2 * 1200, (size_t)len);
+  EXPECT_EQ(8443, ntohs(udp->source));
+
+  // Written as it was translated.
+  struct iovec iov = { expected, sizeof(expected) };
+  ASSERT_EQ(CLAT_VERDICT_TRANSLATED, clat_translate(&config, 0, packets[6].data(),
+                                                    packets[6].size(), &iov));
+  len = read(fds[1], out, sizeof(out));
+  ASSERT_EQ(hdrlen + iov.iov_len, (size_t)len);
+  EXPECT_EQ(0, vnet->gso_type);
+  EXPECT_EQ(0, vnet->flags);
+  EXPECT_EQ(0, memcmp(expected, out + hdrlen, iov.iov_len));
+
+  EXPECT_GT(0, read(fds[1], out, sizeof(out)));
+  close(fds[0]);
+  close(fds[1]);
+  free(gro);
+}
+
+TEST_F(ClatdTest, CpuLists) {
+  cpu_set_t cpus;
+  char buf[64];
+
+  CPU_ZERO(&cpus);
+  EXPECT_TRUE(parse_cpu_list("0-3,8\n", &cpus));
+  EXPECT_EQ(5, CPU_COUNT(&cpus));
+  format_cpu_list(&cpus, buf, sizeof(buf));
+  EXPECT_STREQ("0-3,8", buf);
+
+  CPU_ZERO(&cpus);
+  EXPECT_TRUE(parse_cpu_mask("00000001,0000000a\n", &cpus));
+  format_cpu_list(&cpus, buf, sizeof(buf));
+  EXPECT_STREQ("1,3,32", buf);
+
+  CPU_ZERO(&cpus);
+  EXPECT_TRUE(parse_cpu_mask("0\n", &cpus));
+  EXPECT_EQ(0, CPU_COUNT(&cpus));
+  format_cpu_list(&cpus, buf, sizeof(buf));
+  EXPECT_STREQ("", buf);
+
+  EXPECT_FALSE(parse_cpu_list("3-1", &cpus));
+  EXPECT_FALSE(parse_cpu_list("1,x", &cpus));
+  EXPECT_FALSE(parse_cpu_mask("", &cpus));
+  EXPECT_FALSE(parse_cpu_mask("0000000g", &cpus));
+}
+
+// A TCP segment with payload_len bytes of payload and, if tsval is nonzero, a timestamps option.
+static std::vector<uint8_t> tcp_segment(uint16_t sport, uint16_t dport, uint32_t seq, uint32_t ack,
+                                        size_t payload_len, uint32_t tsval = 0,
+                                        uint32_t tsecr = 0) {
+  size_t optlen = tsval ? 12 : 0;
+  std::vector<uint8_t> segment(sizeof(struct tcphdr) + optlen + payload_len);
+  struct tcphdr tcp = {};
+  tcp.source        = htons(sport);
+  tcp.dest          = htons(dport);
+  tcp.seq           = htonl(seq);
+  tcp.ack_seq       = htonl(ack);
+  tcp.doff          = (sizeof(tcp) + optlen) / 4;
+  tcp.ack           = 1;
+  memcpy(segment.data(), &tcp, sizeof(tcp));
+  if (tsval) {
+    uint8_t *opt = segment.data() + sizeof(tcp);
+    uint32_t ts[] = { htonl(tsval), htonl(tsecr) };
+    opt[0] = opt[1] = TCPOPT_NOP;
+    opt[2]          = TCPOPT_TIMESTAMP;
+    opt[3]          = TCPOLEN_TIMESTAMP;
+    memcpy(opt + 4, ts, sizeof(ts));
+  }
+  return segment;
+}
+
+TEST_F(ClatdTest, TcpMonitor) {
+  static struct tcp_monitor monitor;
+  tcp_monitor_init(&monitor);
+  const uint32_t local = inet_addr(kIPv4LocalAddr), remote = inet_addr("198.51.100.1");
+  uint64_t t = monitor.start;
+  auto out = [&](const std::vector<uint8_t> &s) {
+    tcp_monitor_segment_at(&monitor, t, 1, local, remote, (const struct tcphdr *)s.data(),
+                           s.size());
+  };
+  auto in = [&](const std::vector<uint8_t> &s) {
+    tcp_monitor_segment_at(&monitor, t, 0, local, remote, (const struct tcphdr *)s.data(),
+                           s.size());
+  };
+
+  // Without timestamps, a data segment is timed until it is acknowledged.
+  out(tcp_segment(40000, 443, 1000, 1, 100));
+  t += 20000;
+  in(tcp_segment(443, 40000, 1, 1100, 0));
+  EXPECT_EQ(1U, monitor.rtt_samples);
+  EXPECT_LE(20000U, tcp_monitor_rtt_percentile(&monitor, 50));
+  EXPECT_GE(25000U, tcp_monitor_rtt_percentile(&monitor, 50));
+
+  // A retransmission is counted, and makes the acknowledgement ambiguous.
+  out(tcp_segment(40000, 443, 1100, 1, 100));
+  out(tcp_segment(40000, 443, 1100, 1, 100));
+  t += 300000;
+  in(tcp_segment(443, 40000, 1, 1200, 0));
+  EXPECT_EQ(1U, monitor.rtt_samples);
+  EXPECT_EQ(3U, monitor.segments_out);
+  EXPECT_EQ(1U, monitor.retransmits_out);
+
+  // A keepalive is not a retransmission.
+  out(tcp_segment(40000, 443, 1199, 1, 1));
+  EXPECT_EQ(1U, monitor.retransmits_out);
+
+  // With timestamps, the sample ends when the remote end echoes the TSval, even on a pure ACK.
+  out(tcp_segment(40001, 443, 1, 5000, 0, 700, 0));
+  t += 50000;
+  in(tcp_segment(443, 40001, 5000, 1, 1000, 9, 700));
+  in(tcp_segment(443, 40001, 5000, 1, 1000, 10, 700));
+  EXPECT_EQ(2U, monitor.rtt_samples);
+  EXPECT_EQ(2U, monitor.segments_in);
+  EXPECT_EQ(1U, monitor.retransmits_in);
+  EXPECT_LE(50000U, tcp_monitor_rtt_percentile(&monitor, 99));
+  EXPECT_EQ(2, tcp_monitor_active_flows(&monitor, t));
+
+  // A RST forgets the flow.
+  std::vector<uint8_t> rst = tcp_segment(443, 40001, 6000, 1, 0);
+  ((struct tcphdr *)rst.data())->rst = 1;
+  in(rst);
+  EXPECT_EQ(1, tcp_monitor_active_flows(&monitor, t));
+
+  // The flow table is bounded, and idle flows age out.
+  for (int i = 0; i < 4 * TCP_MONITOR_FLOWS; i++) {
+    tcp_monitor_segment_at(&monitor, t, 1, local, htonl(0xc6336400 + i),
+                           (const struct tcphdr *)tcp_segment(40000, 443, 1, 1, 10).data(),
+                           sizeof(struct tcphdr) + 10);
+  }
+  EXPECT_GE(TCP_MONITOR_FLOWS, tcp_monitor_active_flows(&monitor, t));
+  EXPECT_LT(0U, monitor.flows_evicted);
+  EXPECT_EQ(0, tcp_monitor_active_flows(&monitor, t + TCP_MONITOR_IDLE * 1000000ULL));
+
+  // Translation feeds the monitor, but not with the TCP headers quoted by ICMP errors.
+  struct clat_config config;
+  ASSERT_TRUE(clat_config_init(&config, kIPv4LocalAddr, kIPv6LocalAddr, kIPv6PlatSubnet));
+  tcp_monitor_init(&monitor);
+  config.tcp_monitor = &monitor;
+  static uint8_t buf[IP_MAXPACKET];
+  clat_test::Packet segment =
+    clat_test::with_checksum(clat_test::ipv4(IPPROTO_TCP, clat_test::tcp(100), kIPv4LocalAddr,
+                                             "198.51.100.1"),
+                             sizeof(struct iphdr), IPPROTO_TCP);
+  struct iovec iov = { buf, sizeof(buf) };
+  ASSERT_EQ(CLAT_VERDICT_TRANSLATED,
+            clat_translate(&config, 1, segment.data(), segment.size(), &iov));
+  EXPECT_EQ(1U, monitor.segments_out);
+  clat_test::Packet quoted =
+    clat_test::with_checksum(clat_test::ipv4(IPPROTO_TCP, clat_test::tcp(100), "198.51.100.1",
+                                             kIPv4LocalAddr),
+                             sizeof(struct iphdr), IPPROTO_TCP);
+  clat_test::Packet error = clat_test::with_checksum(
+    clat_test::ipv4(IPPROTO_ICMP, clat_test::icmp_error(quoted), kIPv4LocalAddr, "198.51.100.1"),
+    sizeof(struct iphdr), IPPROTO_ICMP);
+  iov = { buf, sizeof(buf) };
+  ASSERT_EQ(CLAT_VERDICT_TRANSLATED, clat_translate(&config, 1, error.data(), error.size(), &iov));
+  EXPECT_EQ(1U, monitor.segments_out);
+  EXPECT_EQ(1, tcp_monitor_active_flows(&monitor, monitor.start));
+}
+
+TEST_F(ClatdTest, LoopStats) {
+  struct loop_stats stats;
+  loop_stats_start(&stats);
+  EXPECT_LT(0U, stats.start);
+  loop_stats_downlink(&stats, 3);
+  loop_stats_downlink(&stats, 64);
+  loop_stats_downlink(&stats, 0);
+  EXPECT_EQ(3U, stats.downlink_wakeups);
+  EXPECT_EQ(67U, stats.downlink_packets);
+  EXPECT_EQ(64U, stats.downlink_max);
+
+  // read_packet says whether there was a packet, so uplink wakeups can be told from spurious ones.
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, fds));
+  EXPECT_EQ(0, read_packet(fds[0], -1, 1));
+  clat_test::Packet p(sizeof(struct tun_pi));
+  ((struct tun_pi *)p.data())->proto = htons(ETH_P_IP);
+  clat_test::Packet ip4 =
+      clat_test::ipv4(IPPROTO_UDP, clat_test::udp(100), kIPv4LocalAddr, "8.8.8.8");
+  p.insert(p.end(), ip4.begin(), ip4.end());
+  ASSERT_EQ((ssize_t)p.size(), write(fds[1], p.data(), p.size()));
+  EXPECT_EQ(1, read_packet(fds[0], -1, 1));
+  EXPECT_EQ(0, read_packet(fds[0], -1, 1));
+  close(fds[0]);
+  close(fds[1]);
+
+  loop_stats_log(&stats);
+  EXPECT_EQ(0U, stats.downlink_packets);
+}
+
+TEST_F(ClatdTest, FqCodel) {
+  struct fq_codel *q = fq_codel_create();
+  ASSERT_NE(nullptr, q);
+  uint64_t t = 1000000;
+  auto packet = [](uint16_t sport, uint8_t ecn, size_t len = 1000) {
+    clat_test::Packet p = clat_test::ipv6(IPPROTO_UDP, clat_test::udp(len, sport, 443),
+                                          kIPv6LocalAddr, "64:ff9b::808:808");
+    p[1] |= ecn << 4;
+    return p;
+  };
+  auto enqueue = [&](const clat_test::Packet &p) {
+    struct iovec iov = { (void *)p.data(), p.size() };
+    return fq_codel_enqueue(q, &iov, 1, t);
+  };
+  // Returns the source port and ECN field of the next packet, or -1.
+  auto dequeue = [&](uint8_t *ecn = nullptr) {
+    struct fq_codel_packet *p = fq_codel_dequeue(q, t);
+    if (!p) return -1;
+    if (ecn) *ecn = (p->data[1] >> 4) & 3;
+    int sport = ntohs(((const struct udphdr *)(p->data + sizeof(struct ip6_hdr)))->source);
+    fq_codel_sent(q);
+    return sport;
+  };
+
+  // A new flow is served as soon as the backlogged flow has used its quantum.
+  for (int i = 0; i < 10; i++) EXPECT_EQ(1, enqueue(packet(1000, 0)));
+  EXPECT_EQ(1, enqueue(packet(2000, 0)));
+  EXPECT_EQ(1000, dequeue());
+  EXPECT_EQ(1000, dequeue());
+  EXPECT_EQ(2000, dequeue());
+
+  // A packet stays at the head of the queue until it is sent.
+  struct fq_codel_packet *head = fq_codel_dequeue(q, t);
+  EXPECT_EQ(head, fq_codel_dequeue(q, t));
+  EXPECT_EQ(8U, q->qlen);
+  fq_codel_sent(q);
+  EXPECT_EQ(7U, q->qlen);
+  while (dequeue() != -1) {
+  }
+  EXPECT_EQ(0U, q->qlen);
+
+  // Packets too large to queue are left to the caller.
+  EXPECT_EQ(0, enqueue(packet(1000, 0, FQ_CODEL_PACKET_SIZE)));
+
+  // When the queue is full, the largest flow loses its oldest packet.
+  for (int i = 0; i < FQ_CODEL_LIMIT; i++) enqueue(packet(1000, 0, 100));
+  for (int i = 0; i < 10; i++) enqueue(packet(2000, 0, 100));
+  EXPECT_EQ(10U, q->overlimit);
+  EXPECT_EQ((unsigned)FQ_CODEL_LIMIT, q->qlen);
+  int small_flow = 0;
+  for (int sport; (sport = dequeue()) != -1;) small_flow += sport == 2000;
+  EXPECT_EQ(10, small_flow);
+  EXPECT_EQ(0U, q->dropped);
+
+  // A standing queue of 50ms is above target, so CoDel starts dropping after an interval...
+  for (int i = 0; i < 50; i++) enqueue(packet(1000, 0));
+  for (int i = 0; i < 1000; i++) {
+    t += 1000;
+    enqueue(packet(1000, 0));
+    dequeue();
+  }
+  EXPECT_LT(0U, q->dropped);
+  EXPECT_EQ(0U, q->marked);
+  EXPECT_GT(50U, q->qlen);
+  while (dequeue() != -1) {
+  }
+
+  // ...or marks ECN-capable packets instead.
+  uint64_t dropped = q->dropped;
+  for (int i = 0; i < 50; i++) enqueue(packet(3000, 2));
+  int ce = 0;
+  for (int i = 0; i < 1000; i++) {
+    t += 1000;
+    enqueue(packet(3000, 2));
+    uint8_t ecn;
+    if (dequeue(&ecn) != -1 && ecn == 3) ce++;
+  }
+  EXPECT_LT(0U, q->marked);
+  EXPECT_EQ((int)q->marked, ce);
+  EXPECT_EQ(dropped, q->dropped);
+  free(q);
+
+  // Translation keeps the ECN field, but not the DSCP, of IPv4 packets.
+  clat_test::Packet ip4 =
+      clat_test::ipv4(IPPROTO_UDP, clat_test::udp(100), kIPv4LocalAddr, "8.8.8.8");
+  ip4[1] = 0xb8 | 1;
+  struct clat_packet_headers headers;
+  clat_packet out;
+  ASSERT_LT(0, translate_packet_iovec(&Global_Clatd_Config, 1, ip4.data(), ip4.size(), &headers,
+                                      out));
+  EXPECT_EQ(htonl(6 << 28 | 1 << 20), ((struct ip6_hdr *)out[CLAT_POS_IPHDR].iov_base)->ip6_flow &
+                                          htonl(0xfff00000));
+}
+
+TEST_F(ClatdTest, Pacer) {
+  struct pacer *pacer = pacer_create(0);
+  ASSERT_NE(nullptr, pacer);
+
+  // Until the first window is measured, nothing is held back. 1000 bytes per ms is 1 MB/s.
+  uint64_t now = 1000000000;
+  for (int i = 0; i <= 100; i++, now += 1000000) {
+    EXPECT_EQ(now, pacer_departure(pacer, now, 1000));
+  }
+  EXPECT_EQ(0U, pacer->delayed);
+  EXPECT_EQ(2 * 1010000U, pacer_rate(pacer));
+
+  // A steady sender is not held back, but a burst is spread out at twice the measured rate.
+  EXPECT_EQ(now, pacer_departure(pacer, now, 1000));
+  now += 1000000;
+  const uint64_t gap = 1000 * 1000000000ULL / pacer_rate(pacer);
+  for (int i = 0; i < 10; i++) {
+    EXPECT_EQ(now + i * gap, pacer_departure(pacer, now, 1000));
+  }
+  EXPECT_EQ(9U, pacer->delayed);
+  EXPECT_EQ(112U, pacer->packets);
+  free(pacer);
+
+  // With a cap, packets are paced from the start, but never held back beyond PACER_MAX_DELAY.
+  pacer = pacer_create(125000);
+  ASSERT_NE(nullptr, pacer);
+  EXPECT_EQ(125000U, pacer_rate(pacer));
+  for (int i = 0; i < 10; i++) {
+    uint64_t expected = now + std::min<uint64_t>(i * 10000000ULL, PACER_MAX_DELAY);
+    EXPECT_EQ(expected, pacer_departure(pacer, now, 1250));
+  }
+  free(pacer);
+}
+
+TEST_F(ClatdTest, DebugTracing) {
+  uint32_t categories, sample_rate;
+  EXPECT_FALSE(parse_debug("", &categories, &sample_rate));
+  EXPECT_FALSE(parse_debug("drops,tcp", &categories, &sample_rate));
+  EXPECT_FALSE(parse_debug("drops/0", &categories, &sample_rate));
+  EXPECT_FALSE(parse_debug("/10", &categories, &sample_rate));
+  ASSERT_TRUE(parse_debug("drops,fragments/100", &categories, &sample_rate));
+  EXPECT_EQ((uint32_t)(CLAT_DEBUG_DROPS | CLAT_DEBUG_FRAGMENTS), categories);
+  EXPECT_EQ(100U, sample_rate);
+  ASSERT_TRUE(parse_debug("all", &categories, &sample_rate));
+  EXPECT_EQ((uint32_t)CLAT_DEBUG_ALL, categories);
+  EXPECT_EQ(1U, sample_rate);
+
+  // Events of categories that are off are not traced, and do not count towards the sampling.
+  clat_debug_set(CLAT_DEBUG_ICMP, 3);
+  int traced = 0;
+  for (int i = 0; i < 9; i++) {
+    EXPECT_FALSE(clat_debug(CLAT_DEBUG_DROPS));
+    traced += clat_debug(CLAT_DEBUG_ICMP);
+  }
+  EXPECT_EQ(3, traced);
+
+  // Tracing does not change what is translated, or what is counted.
+  struct clat_config config;
+  struct clat_counters counters = {};
+  ASSERT_TRUE(clat_config_init(&config, kIPv4LocalAddr, kIPv6LocalAddr, kIPv6PlatSubnet));
+  config.counters = &counters;
+  clat_test::Packet datagram = local_ipv6(IPPROTO_UDP, clat_test::udp(100), "64:ff9b::808:808");
+  clat_test::Packet fragment = clat_test::ipv6_fragment(datagram, 0, 64);
+  clat_test::Packet multicast =
+    clat_test::ipv6(IPPROTO_UDP, clat_test::udp(100), "64:ff9b::808:808", "ff02::1");
+  clat_test::Packet unknown = local_ipv4(IPPROTO_SCTP, clat_test::udp(100), "8.8.8.8");
+
+  for (uint32_t on : { 0U, (uint32_t)CLAT_DEBUG_ALL }) {
+    clat_debug_set(on, 1);
+    EXPECT_TRUE(translates(&config, 0, fragment));
+    EXPECT_FALSE(translates(&config, 0, multicast));
+    EXPECT_FALSE(translates(&config, 1, unknown));
+  }
+  EXPECT_EQ(2U, counters.unknown_protocol);
+  clat_debug_set(0, 1);
+}
+
+TEST_F(ClatdTest, UdpZeroChecksumPolicy) {
+  struct udp_zero_csum_policy policy;
+  EXPECT_TRUE(parse_udp_zero_csum_policy("all", &policy));
+  EXPECT_TRUE(policy.pass_all);
+  EXPECT_TRUE(parse_udp_zero_csum_policy("4789,198.51.100.7/24,6081", &policy));
+  EXPECT_FALSE(policy.pass_all);
+  ASSERT_EQ(2, policy.num_ports);
+  EXPECT_EQ(htons(4789), policy.ports[0]);
+  EXPECT_EQ(htons(6081), policy.ports[1]);
+  ASSERT_EQ(1, policy.num_prefixes);
+  EXPECT_EQ(inet_addr("198.51.100.0"), policy.prefixes[0].addr);
+  EXPECT_EQ(inet_addr("255.255.255.0"), policy.prefixes[0].mask);
+  EXPECT_FALSE(parse_udp_zero_csum_policy("", &policy));
+  EXPECT_FALSE(parse_udp_zero_csum_policy("0", &policy));
+  EXPECT_FALSE(parse_udp_zero_csum_policy("65536", &policy));
+  EXPECT_FALSE(parse_udp_zero_csum_policy("4789,vxlan", &policy));
+  EXPECT_FALSE(parse_udp_zero_csum_policy("1,2,3,4,5,6,7,8,9", &policy));
+
+  struct clat_config config;
+  struct clat_counters counters = {};
+  ASSERT_TRUE(clat_config_init(&config, kIPv4LocalAddr, kIPv6LocalAddr, kIPv6PlatSubnet));
+  ASSERT_TRUE(parse_udp_zero_csum_policy("4789,198.51.100.0/24", &config.udp_zero_csum));
+  config.counters = &counters;
+
+  const size_t v4hdr = sizeof(struct iphdr), v6hdr = sizeof(struct ip6_hdr);
+  auto udp4 = [](uint16_t dport, const char *dst) {
+    return clat_test::ipv4(IPPROTO_UDP, clat_test::udp(1000, 51339, dport), kIPv4LocalAddr, dst);
+  };
+  auto translated_checksum = [&](int to_ipv6, const clat_test::Packet &p) {
+    uint8_t out[MAXMTU];
+    struct iovec iov = { out, sizeof(out) };
+    EXPECT_EQ(CLAT_VERDICT_TRANSLATED, clat_translate(&config, to_ipv6, p.data(), p.size(), &iov));
+    return ((struct udphdr *)(out + (to_ipv6 ? v6hdr : v4hdr)))->check;
+  };
+
+  // Zero checksums are passed through for the configured port and prefix, and computed otherwise.
+  EXPECT_EQ(0, translated_checksum(1, udp4(4789, "8.8.8.8")));
+  EXPECT_EQ(0, translated_checksum(1, udp4(443, "198.51.100.200")));
+  EXPECT_NE(0, translated_checksum(1, udp4(443, "8.8.8.8")));
+  EXPECT_NE(0, translated_checksum(1, clat_test::with_checksum(udp4(4789, "8.8.8.8"), v4hdr,
+                                                               IPPROTO_UDP)));
+  // From the network, the port is the source port.
+  clat_test::Packet udp6 = clat_test::ipv6(IPPROTO_UDP, clat_test::udp(1000, 4789, 51339),
+                                           "64:ff9b::808:808", kIPv6LocalAddr);
+  EXPECT_EQ(0, translated_checksum(0, udp6));
+
+  EXPECT_EQ(3U, counters.udp_zero_csum_passed);
+  EXPECT_EQ(1U, counters.udp_zero_csum_computed);
+  EXPECT_EQ(1U, counters.udp_csum_adjusted);
+}
+
+TEST_F(ClatdTest, AclParse) {
+  static struct acl acl;
+  EXPECT_FALSE(parse_acl("", &acl));
+  EXPECT_FALSE(parse_acl("out:tcp", &acl));
+  EXPECT_FALSE(parse_acl("sideways:tcp:198.51.100.0/24", &acl));
+  EXPECT_FALSE(parse_acl("out:tcp:198.51.100.0/24:25:26", &acl));
+  EXPECT_FALSE(parse_acl("out:icmp:198.51.100.0/24:25", &acl));
+  EXPECT_FALSE(parse_acl("out:udp:198.51.100.0/24:139-137", &acl));
+  EXPECT_FALSE(parse_acl("out:udp:198.51.100.0/24:65536", &acl));
+  EXPECT_FALSE(parse_acl("out:udp:198.51.100.0/33", &acl));
+  EXPECT_FALSE(parse_acl("out:udp:198.51.100.0/", &acl));
+  EXPECT_FALSE(parse_acl("out:256:198.51.100.0/24", &acl));
+
+  ASSERT_TRUE(
+      parse_acl("out:tcp:198.51.100.77/24:25,both:udp:0.0.0.0/0:137-139,in:any:203.0.113.7", &acl));
+  ASSERT_EQ(3, acl.num_rules);
+  EXPECT_EQ(ACL_OUT, acl.rules[0].directions);
+  EXPECT_EQ(IPPROTO_TCP, acl.rules[0].protocol);
+  EXPECT_EQ(inet_addr("198.51.100.0"), acl.rules[0].addr);
+  EXPECT_EQ(inet_addr("255.255.255.0"), acl.rules[0].mask);
+  EXPECT_EQ(25, acl.rules[0].port_min);
+  EXPECT_EQ(25, acl.rules[0].port_max);
+  EXPECT_EQ(ACL_IN | ACL_OUT, acl.rules[1].directions);
+  EXPECT_EQ(IPPROTO_UDP, acl.rules[1].protocol);
+  EXPECT_EQ(0U, acl.rules[1].mask);
+  EXPECT_EQ(137, acl.rules[1].port_min);
+  EXPECT_EQ(139, acl.rules[1].port_max);
+  EXPECT_EQ(ACL_IN, acl.rules[2].directions);
+  EXPECT_EQ(0, acl.rules[2].protocol);
+  EXPECT_EQ(inet_addr("203.0.113.7"), acl.rules[2].addr);
+  EXPECT_EQ(0xffffffffU, acl.rules[2].mask);
+  EXPECT_EQ(0, acl.rules[2].port_min);
+  EXPECT_EQ(65535, acl.rules[2].port_max);
+}
+
+TEST_F(ClatdTest, AccessControlList) {
+  static struct acl acl;
+  ASSERT_TRUE(parse_acl("out:tcp:198.51.100.0/24:25,both:udp:0.0.0.0/0:137-139,"
+                        "in:any:203.0.113.7,out:47:192.0.2.0/28",
+                        &acl));
+  ASSERT_EQ(4, acl.num_rules);
+
+  struct clat_config config;
+  ASSERT_TRUE(clat_config_init(&config, kIPv4LocalAddr, kIPv6LocalAddr, kIPv6PlatSubnet));
+  config.acl = &acl;
+
+  // Rule 1 matches the destination port of outgoing TCP only.
+  EXPECT_FALSE(translates(&config, 1, local_ipv4(IPPROTO_TCP, clat_test::tcp(10, 40000, 25),
+                                                 "198.51.100.255")));
+  EXPECT_TRUE(translates(&config, 1, local_ipv4(IPPROTO_TCP, clat_test::tcp(10, 40000, 26),
+                                                "198.51.100.1")));
+  EXPECT_TRUE(translates(&config, 1, local_ipv4(IPPROTO_TCP, clat_test::tcp(10, 40000, 25),
+                                                "198.51.101.1")));
+  EXPECT_TRUE(translates(&config, 1, local_ipv4(IPPROTO_UDP, clat_test::udp(10, 40000, 25),
+                                                "198.51.100.1")));
+  EXPECT_TRUE(translates(&config, 0, local_ipv6(IPPROTO_TCP, clat_test::tcp(10, 25, 40000),
+                                                "64:ff9b::c633:6401")));
+  EXPECT_EQ(1U, acl.hits[0]);
+
+  // Rule 2 matches the remote port in both directions, from anywhere.
+  EXPECT_FALSE(translates(&config, 1, local_ipv4(IPPROTO_UDP, clat_test::udp(10, 40000, 137),
+                                                 "8.8.8.8")));
+  EXPECT_FALSE(translates(&config, 0, local_ipv6(IPPROTO_UDP, clat_test::udp(10, 139, 40000),
+                                                 "64:ff9b::808:808")));
+  EXPECT_TRUE(translates(&config, 0, local_ipv6(IPPROTO_UDP, clat_test::udp(10, 40000, 139),
+                                                "64:ff9b::808:808")));
+  EXPECT_EQ(2U, acl.hits[1]);
+
+  // Rule 3 blocks everything from one host, including fragments without ports.
+  clat_test::Packet frag = clat_test::ipv6_fragment(
+      local_ipv6(IPPROTO_UDP, clat_test::udp(100, 53, 40000), "64:ff9b::cb00:7107"), 56, 48);
+  EXPECT_FALSE(translates(&config, 0, frag));
+  EXPECT_FALSE(translates(&config, 0, local_ipv6(IPPROTO_ICMPV6, clat_test::icmp6_echo_reply(10),
+                                                 "64:ff9b::cb00:7107")));
+  EXPECT_TRUE(translates(&config, 1, local_ipv4(IPPROTO_ICMP, clat_test::icmp_echo_request(10),
+                                                "203.0.113.7")));
+  EXPECT_EQ(2U, acl.hits[2]);
+
+  // Rule 4 matches a protocol by number, up to the end of its prefix.
+  EXPECT_FALSE(translates(&config, 1, local_ipv4(IPPROTO_GRE, clat_test::Packet(8), "192.0.2.15")));
+  EXPECT_TRUE(translates(&config, 1, local_ipv4(IPPROTO_GRE, clat_test::Packet(8), "192.0.2.16")));
+  EXPECT_EQ(1U, acl.hits[3]);
+
+  // Without port ranges, the lookup tables cover the whole address space.
+  ASSERT_TRUE(parse_acl("out:any:0.0.0.0/0,in:any:255.255.255.255", &acl));
+  EXPECT_EQ(1, acl_blocks(&acl, 1, inet_addr("255.255.255.255"), IPPROTO_UDP, nullptr, 0));
+  EXPECT_EQ(1, acl_blocks(&acl, 0, inet_addr("255.255.255.255"), IPPROTO_TCP, nullptr, 0));
+  EXPECT_EQ(0, acl_blocks(&acl, 0, inet_addr("255.255.255.254"), IPPROTO_TCP, nullptr, 0));
+}
+
+TEST_F(ClatdTest, RateLimitParse) {
+  static struct rate_limit limit;
+  limit.hash_key = 1;
+  EXPECT_FALSE(parse_rate_limit("", &limit));
+  EXPECT_FALSE(parse_rate_limit("icmp", &limit));
+  EXPECT_FALSE(parse_rate_limit("ping:100", &limit));
+  EXPECT_FALSE(parse_rate_limit("icmp:100:10:1", &limit));
+  EXPECT_FALSE(parse_rate_limit("frag:lots", &limit));
+  ASSERT_TRUE(parse_rate_limit("icmp:1000:20,frag:10", &limit));
+  EXPECT_EQ(1000U, limit.classes[RATE_LIMIT_ICMP_ERROR].rate);
+  EXPECT_EQ(20U, limit.classes[RATE_LIMIT_ICMP_ERROR].source_rate);
+  EXPECT_EQ(0U, limit.classes[RATE_LIMIT_UDP_ZERO_CSUM].rate);
+  EXPECT_EQ(10U, limit.classes[RATE_LIMIT_FRAGMENT].rate);
+  EXPECT_EQ(0U, limit.classes[RATE_LIMIT_FRAGMENT].source_rate);
+
+  // Parsing starts from no limits, and keeps the hash key.
+  ASSERT_TRUE(parse_rate_limit("udp0:5", &limit));
+  EXPECT_EQ(0U, limit.classes[RATE_LIMIT_ICMP_ERROR].rate);
+  EXPECT_EQ(5U, limit.classes[RATE_LIMIT_UDP_ZERO_CSUM].rate);
+  EXPECT_EQ(1U, limit.hash_key);
+}
+
+TEST_F(ClatdTest, RateLimit) {
+  static struct rate_limit limit;
+  limit.hash_key = 1;
+  ASSERT_TRUE(parse_rate_limit("icmp:1000:20,frag:10", &limit));
+
+  struct in6_addr a1, a2, b;
+  inet_pton(AF_INET6, "2001:db8:1::1", &a1);
+  inet_pton(AF_INET6, "2001:db8:1::2", &a2);
+  inet_pton(AF_INET6, "2001:db8:2::1", &b);
+
+  // Buckets hold 100 ms worth of packets, and at least one. Sources in the same /64 share theirs.
+  uint64_t now = 5000000;
+  EXPECT_TRUE(rate_limit_allow_at(&limit, now, RATE_LIMIT_ICMP_ERROR, &a1));
+  EXPECT_TRUE(rate_limit_allow_at(&limit, now, RATE_LIMIT_ICMP_ERROR, &a2));
+  EXPECT_FALSE(rate_limit_allow_at(&limit, now, RATE_LIMIT_ICMP_ERROR, &a1));
+  EXPECT_TRUE(rate_limit_allow_at(&limit, now, RATE_LIMIT_ICMP_ERROR, &b));
+  EXPECT_FALSE(rate_limit_allow_at(&limit, now + 49000, RATE_LIMIT_ICMP_ERROR, &a2));
+  EXPECT_TRUE(rate_limit_allow_at(&limit, now + 50000, RATE_LIMIT_ICMP_ERROR, &a2));
+  EXPECT_EQ(4U, limit.classes[RATE_LIMIT_ICMP_ERROR].passed);
+  EXPECT_EQ(2U, limit.classes[RATE_LIMIT_ICMP_ERROR].dropped_source);
+
+  // Without a source limit, only the class's bucket counts.
+  EXPECT_TRUE(rate_limit_allow_at(&limit, now, RATE_LIMIT_FRAGMENT, &a1));
+  EXPECT_FALSE(rate_limit_allow_at(&limit, now, RATE_LIMIT_FRAGMENT, &b));
+  EXPECT_TRUE(rate_limit_allow_at(&limit, now + 100000, RATE_LIMIT_FRAGMENT, &b));
+  EXPECT_EQ(1U, limit.classes[RATE_LIMIT_FRAGMENT].dropped_class);
+
+  // Translated packets are classified before any work is done on them. One packet per second per
+  // class is one packet in this test.
+  struct clat_config config;
+  ASSERT_TRUE(clat_config_init(&config, kIPv4LocalAddr, kIPv6LocalAddr, kIPv6PlatSubnet));
+  ASSERT_TRUE(parse_udp_zero_csum_policy("4789", &config.udp_zero_csum));
+  ASSERT_TRUE(parse_rate_limit("icmp:0:1,udp0:1,frag:1", &limit));
+  config.rate_limit = &limit;
+
+  clat_test::Packet error = clat_test::icmp6_error(
+      clat_test::ipv6(IPPROTO_UDP, clat_test::udp(10, 40000, 53), kIPv6LocalAddr,
+                      "64:ff9b::808:808"));
+
+  // ICMP errors are limited per source, including third-party ones. Echo replies are not limited.
+  EXPECT_TRUE(translates(&config, 0, local_ipv6(IPPROTO_ICMPV6, error, "2001:db8:ffff::1")));
+  EXPECT_FALSE(translates(&config, 0, local_ipv6(IPPROTO_ICMPV6, error, "2001:db8:ffff::1")));
+  EXPECT_TRUE(translates(&config, 0, local_ipv6(IPPROTO_ICMPV6, error, "64:ff9b::808:808")));
+  clat_test::Packet echo =
+      local_ipv6(IPPROTO_ICMPV6, clat_test::icmp6_echo_reply(10), "64:ff9b::808:808");
+  EXPECT_TRUE(translates(&config, 0, echo));
+  EXPECT_TRUE(translates(&config, 0, echo));
+
+  // Only zero checksums that must be computed are limited.
+  clat_test::Packet dns =
+      local_ipv6(IPPROTO_UDP, clat_test::udp(10, 53, 40000), "64:ff9b::808:808");
+  clat_test::Packet vxlan =
+      local_ipv6(IPPROTO_UDP, clat_test::udp(10, 4789, 40000), "64:ff9b::808:808");
+  EXPECT_TRUE(translates(&config, 0, dns));
+  EXPECT_FALSE(translates(&config, 0, dns));
+  EXPECT_TRUE(translates(&config, 0, vxlan));
+  EXPECT_TRUE(translates(&config, 0,
+                         clat_test::with_checksum(dns, sizeof(struct ip6_hdr), IPPROTO_UDP)));
+
+  // Fragments are limited whatever they carry.
+  clat_test::Packet datagram =
+      local_ipv6(IPPROTO_TCP, clat_test::tcp(100, 443, 40000), "64:ff9b::808:808");
+  EXPECT_TRUE(translates(&config, 0, clat_test::ipv6_fragment(datagram, 0, 48)));
+  EXPECT_FALSE(translates(&config, 0, clat_test::ipv6_fragment(datagram, 48, 72)));
+  EXPECT_TRUE(translates(&config, 0, datagram));
+
+  EXPECT_EQ(1U, limit.classes[RATE_LIMIT_ICMP_ERROR].dropped_source);
+  EXPECT_EQ(1U, limit.classes[RATE_LIMIT_UDP_ZERO_CSUM].dropped_class);
+  EXPECT_EQ(1U, limit.classes[RATE_LIMIT_FRAGMENT].dropped_class);
+}
+
+TEST_F(ClatdTest, SiitGatewayTranslate) {
+  // Map 192.0.0.0/24 onto 2001:db8:0:b11::400/120.
+  struct clat_config config;
+  ASSERT_TRUE(clat_config_init(&config, "192.0.0.1", "2001:db8:0:b11::400", kIPv6PlatSubnet));
+  config.local_hostmask = htonl(0xff);
+
+  // The test packets are from 192.0.0.4, which maps to 2001:db8:0:b11::404.
+  uint8_t udp_ipv4[] = { IPV4_UDP_HEADER UDP_HEADER PAYLOAD };
+  uint8_t udp_ipv6[] = { IPV6_UDP_HEADER UDP_HEADER PAYLOAD };
+  struct ip6_hdr *ip6 = (struct ip6_hdr *)udp_ipv6;
+  inet_pton(AF_INET6, "2001:db8:0:b11::404", &ip6->ip6_src);
+  fix_udp_checksum(udp_ipv4);
+  fix_udp_checksum(udp_ipv6);
+
+  uint8_t buf[MAXMTU];
+  struct iovec out = { buf, sizeof(buf) };
+  ASSERT_EQ(CLAT_VERDICT_TRANSLATED, clat_translate(&config, 1, udp_ipv4, sizeof(udp_ipv4), &out));
+  ASSERT_EQ(sizeof(udp_ipv6), out.iov_len);
+  check_data_matches(udp_ipv6, buf, out.iov_len, "SIIT UDP/IPv4 -> UDP/IPv6");
+
+  out = { buf, sizeof(buf) };
+  ASSERT_EQ(CLAT_VERDICT_TRANSLATED, clat_translate(&config, 0, udp_ipv6, sizeof(udp_ipv6), &out));
+  ASSERT_EQ(sizeof(udp_ipv4), out.iov_len);
+  check_data_matches(udp_ipv4, buf, out.iov_len, "SIIT UDP/IPv6 -> UDP/IPv4");
+
+  // Hosts outside the prefix are not ours.
+  inet_pton(AF_INET6, "2001:db8:0:b11::504", &ip6->ip6_src);
+  fix_udp_checksum(udp_ipv6);
+  out = { buf, sizeof(buf) };
+  EXPECT_EQ(CLAT_VERDICT_DROP, clat_translate(&config, 0, udp_ipv6, sizeof(udp_ipv6), &out));
+}
+
+void shm_produce(struct shm_region *region, const uint8_t *packet, size_t len) {
+  struct shm_slot *slot = shm_ring_reserve(&region->to_clat, region->to_clat_slots);
+  ASSERT_NE(nullptr, slot);
+  memcpy(slot->data, packet, len);
+  slot->len = len;
+  shm_ring_commit(&region->to_clat);
+}
+
+void shm_expect(struct shm_region *region, const uint8_t *expected, size_t len, const char *msg) {
+  struct shm_slot *slot = shm_ring_peek(&region->from_clat, region->from_clat_slots);
+  ASSERT_NE(nullptr, slot) << msg;
+  ASSERT_EQ(len, slot->len) << msg;
+  check_data_matches(expected, slot->data, len, msg);
+  shm_ring_release(&region->from_clat);
+}
+
+TEST_F(ClatdTest, ShmRingTranslate) {
+  inet_pton(AF_INET6, kIPv6LocalAddr, &Global_Clatd_Config.ipv6_local_subnet);
+
+  uint8_t udp_ipv4[] = { IPV4_UDP_HEADER UDP_HEADER PAYLOAD };
+  uint8_t udp_ipv6[] = { IPV6_UDP_HEADER UDP_HEADER PAYLOAD };
+  fix_udp_checksum(udp_ipv4);
+  fix_udp_checksum(udp_ipv6);
+  uint8_t ipv6_ping[] = { IPV6_ICMPV6_HEADER IPV6_PING PAYLOAD };
+  uint8_t ipv4_ping[] = { IPV4_ICMP_HEADER IPV4_PING PAYLOAD };
+
+  struct shm_region *region    = new shm_region();
+  struct shm_counters counters = {};
+
+  // Both directions can be mixed in the same ring. Untranslatable packets are consumed and counted.
+  shm_produce(region, udp_ipv4, sizeof(udp_ipv4));
+  shm_produce(region, udp_ipv4, 3);
+  shm_produce(region, ipv6_ping, sizeof(ipv6_ping));
+  EXPECT_EQ(2, shm_translate(&Global_Clatd_Config, region, &counters, SHM_READ_BATCH));
+  EXPECT_EQ(nullptr, shm_ring_peek(&region->to_clat, region->to_clat_slots));
+  shm_expect(region, udp_ipv6, sizeof(udp_ipv6), "shm UDP/IPv4 -> UDP/IPv6");
+  shm_expect(region, ipv4_ping, sizeof(ipv4_ping), "shm ICMPv6 -> ICMP");
+  EXPECT_EQ(nullptr, shm_ring_peek(&region->from_clat, region->from_clat_slots));
+  EXPECT_EQ(2U, counters.translated);
+  EXPECT_EQ(1U, counters.dropped);
+
+  // Packets that grow too large for a slot when translated are consumed and counted too.
+  clat_test::Packet large =
+    clat_test::ipv4(IPPROTO_UDP, clat_test::udp(2000), kIPv4LocalAddr, "8.8.8.8");
+  ASSERT_GE(sizeof(region->to_clat_slots[0].data), large.size());
+  shm_produce(region, large.data(), large.size());
+  EXPECT_EQ(0, shm_translate(&Global_Clatd_Config, region, &counters, SHM_READ_BATCH));
+  EXPECT_EQ(nullptr, shm_ring_peek(&region->to_clat, region->to_clat_slots));
+  EXPECT_EQ(1U, counters.nospace);
+
+  // If the client doesn't consume its output, packets stay in to_clat until there is room.
+  for (int i = 0; i < SHM_RING_SLOTS - 1; i++) {
+    ASSERT_NE(nullptr, shm_ring_reserve(&region->from_clat, region->from_clat_slots));
+    shm_ring_commit(&region->from_clat);
+  }
+  shm_produce(region, udp_ipv4, sizeof(udp_ipv4));
+  shm_produce(region, udp_ipv4, sizeof(udp_ipv4));
+  EXPECT_EQ(1, shm_translate(&Global_Clatd_Config, region, &counters, SHM_READ_BATCH));
+  EXPECT_EQ(0, shm_translate(&Global_Clatd_Config, region, &counters, SHM_READ_BATCH));
+  EXPECT_NE(nullptr, shm_ring_peek(&region->to_clat, region->to_clat_slots));
+
+  delete region;
+}
+
+TEST_F(ClatdTest, ShmReadBatch) {
+  inet_pton(AF_INET6, kIPv6LocalAddr, &Global_Clatd_Config.ipv6_local_subnet);
+  uint8_t udp_ipv4[] = { IPV4_UDP_HEADER UDP_HEADER PAYLOAD };
+  fix_udp_checksum(udp_ipv4);
+
+  struct shm_channel shm;
+  shm_channel_init(&shm);
+  shm.region    = new shm_region();
+  shm.kick_fd   = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  shm.notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  ASSERT_LE(0, shm.kick_fd);
+  ASSERT_LE(0, shm.notify_fd);
+  uint64_t count;
+
+  // A kick translates at most SHM_READ_BATCH packets, and kicks clatd again if more are waiting.
+  for (int i = 0; i < SHM_READ_BATCH + 1; i++) {
+    shm_produce(shm.region, udp_ipv4, sizeof(udp_ipv4));
+  }
+  shm_read(&Global_Clatd_Config, &shm);
+  EXPECT_EQ((uint64_t)SHM_READ_BATCH, shm.counters.translated);
+  ASSERT_EQ((ssize_t)sizeof(count), read(shm.notify_fd, &count, sizeof(count)));
+  ASSERT_EQ((ssize_t)sizeof(count), read(shm.kick_fd, &count, sizeof(count)));
+
+  // The rest is translated on the next kick, which leaves nothing to kick again for.
+  shm_read(&Global_Clatd_Config, &shm);
+  EXPECT_EQ((uint64_t)SHM_READ_BATCH + 1, shm.counters.translated);
+  EXPECT_EQ(-1, read(shm.kick_fd, &count, sizeof(count)));
+
+  delete shm.region;
+  shm.region = nullptr;
+  shm_disconnect(&shm);
+}
+
+static int shm_connect(const char *path) {
+  int s = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  struct sockaddr_un sun = { .sun_family = AF_UNIX };
+  strncpy(sun.sun_path, path, sizeof(sun.sun_path) - 1);
+  if (s >= 0 && connect(s, (struct sockaddr *)&sun, sizeof(sun))) {
+    close(s);
+    return -1;
+  }
+  return s;
+}
+
+TEST_F(ClatdTest, ShmListenPermissions) {
+  if (getuid() != 0) GTEST_SKIP() << "needs root to chown the socket";
+  char path[] = "/tmp/clatd_shm_test_XXXXXX";
+  ASSERT_NE(nullptr, mkdtemp(path));
+  std::string sock = std::string(path) + "/shm";
+
+  struct shm_channel shm;
+  shm_channel_init(&shm);
+  ASSERT_TRUE(shm_listen(&shm, sock.c_str()));
+
+  // The socket is created owned by clatd, and only clatd's user and group can connect to it.
+  struct stat st;
+  ASSERT_EQ(0, stat(sock.c_str(), &st));
+  EXPECT_EQ(0660U, st.st_mode & 0777);
+  EXPECT_EQ((uid_t)AID_CLAT, st.st_uid);
+  EXPECT_EQ((gid_t)AID_CLAT, st.st_gid);
+
+  // Root is served.
+  int client = shm_connect(sock.c_str());
+  ASSERT_LE(0, client);
+  shm_accept(&shm);
+  EXPECT_LE(0, shm.conn_fd);
+  shm_disconnect(&shm);
+  close(client);
+
+  // Anybody else that gets a connection through, here by opening up the directory and socket, is
+  // turned away by its credentials.
+  ASSERT_EQ(0, chmod(path, 0777));
+  ASSERT_EQ(0, chmod(sock.c_str(), 0666));
+  pid_t pid = fork();
+  ASSERT_LE(0, pid);
+  if (pid == 0) {
+    if (setgroups(0, nullptr) || setresgid(AID_NOBODY, AID_NOBODY, AID_NOBODY) ||
+        setresuid(AID_NOBODY, AID_NOBODY, AID_NOBODY)) {
+      _exit(1);
+    }
+    int s = shm_connect(sock.c_str());
+    char byte;
+    // Wait for clatd to hang up.
+    _exit(s >= 0 && read(s, &byte, sizeof(byte)) == 0 ? 0 : 2);
+  }
+  struct pollfd pfd = { .fd = shm.listen_fd, .events = POLLIN };
+  ASSERT_EQ(1, poll(&pfd, 1, 5000));
+  shm_accept(&shm);
+  EXPECT_EQ(-1, shm.conn_fd);
+  int status;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+
+  shm_close(&shm);
+  EXPECT_EQ(-1, access(sock.c_str(), F_OK));
+  rmdir(path);
+}
+
 // picks a random interface ID that is checksum neutral with the IPv4 address and the NAT64 prefix
 void gen_random_iid(struct in6_addr *myaddr, struct in_addr *ipv4_local_subnet,
                     struct in6_addr *plat_subnet) {
@@ -845,7 +2003,7 @@ void check_translate_checksum_neutral(const uint8_t *original, size_t original_l
                                       size_t expected_len, const char *msg) {
   uint8_t *translated = new uint8_t[MAXMRU];
   ASSERT_NE(translated, nullptr) << msg << ": Unable to allocate memory\n";
-  size_t translated_len = sizeof(translated);
+  size_t translated_len = MAXMRU;
   do_translate_packet(original, original_len, translated, &translated_len, msg);
   EXPECT_EQ(expected_len, translated_len) << msg << ": Translated packet length incorrect\n";
   // do_translate_packet already checks packets for validity and verifies the checksum.
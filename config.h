@@ -21,19 +21,19 @@
 #include <linux/if.h>
 #include <netinet/in.h>
 
+#include "affinity.h"
+#include "clat_config.h"
+#include "loop_stats.h"
 #include "ring.h"
+#include "shm_ring.h"
 
 struct tun_data {
   char device4[IFNAMSIZ];
   int read_fd6, write_fd6, fd4;
   struct packet_ring ring;
-};
-
-struct clat_config {
-  struct in6_addr ipv6_local_subnet;
-  struct in_addr ipv4_local_subnet;
-  struct in6_addr plat_subnet;
-  const char *native_ipv6_interface;
+  struct shm_channel shm;
+  struct cpu_placement placement;
+  struct loop_stats loop;
 };
 
 extern struct clat_config Global_Clatd_Config;
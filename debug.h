@@ -18,7 +18,8 @@
 #ifndef __DEBUG_H__
 #define __DEBUG_H__
 
-// set to 1 to enable debug logging and packet dumping.
+// set to 1 to compile in the dump_* functions, which print headers to stdout. Debug logging is
+// turned on at runtime instead, see clat_debug in logging.h.
 #define CLAT_DEBUG 0
 
 #endif /* __DEBUG_H__ */
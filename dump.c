@@ -222,28 +222,33 @@ void dump_tcp6(const struct tcphdr *tcp, const struct ip6_hdr *ip6, const uint8_
     ipv6_pseudo_header_checksum(ip6, sizeof(*tcp) + options_size + payload_size, IPPROTO_TCP);
   dump_tcp_generic(tcp, options, options_size, temp_checksum, payload, payload_size);
 }
+#endif  // CLAT_DEBUG
+
+// Most bytes of a packet that logcat_hexdump logs, to keep the log line short.
+#define HEXDUMP_MAX 256
 
-/* generic hex dump */
+/* generic hex dump, used by debug tracing */
 void logcat_hexdump(const char *info, const uint8_t *data, size_t len) {
-  char output[PACKETLEN * 3 + 2];
+  char output[HEXDUMP_MAX * 3 + 1];
   size_t i;
 
   output[0] = '\0';
-  for (i = 0; i < len && i < PACKETLEN; i++) {
+  for (i = 0; i < len && i < HEXDUMP_MAX; i++) {
     snprintf(output + i * 3, 4, " %02x", data[i]);
   }
-  output[len * 3 + 3] = '\0';
 
-  logmsg(ANDROID_LOG_WARN, "info %s len %d data%s", info, len, output);
+  logmsg(ANDROID_LOG_WARN, "info %s len %zu data%s%s", info, len, output,
+         len > HEXDUMP_MAX ? " ..." : "");
 }
 
 void dump_iovec(const struct iovec *iov, int iov_len) {
   int i;
   char *str;
   for (i = 0; i < iov_len; i++) {
-    asprintf(&str, "iov[%d]: ", i);
+    if (asprintf(&str, "iov[%d]: ", i) < 0) {
+      return;
+    }
     logcat_hexdump(str, iov[i].iov_base, iov[i].iov_len);
     free(str);
   }
 }
-#endif  // CLAT_DEBUG
@@ -26,6 +26,8 @@
 #include <netinet/tcp.h>
 #include <netinet/udp.h>
 
+#include "common.h"
+
 void dump_ip(struct iphdr *header);
 void dump_icmp(struct icmphdr *icmp);
 void dump_udp(const struct udphdr *udp, const struct iphdr *ip, const uint8_t *payload,
@@ -40,7 +42,8 @@ void dump_udp6(const struct udphdr *udp, const struct ip6_hdr *ip6, const uint8_
 void dump_tcp6(const struct tcphdr *tcp, const struct ip6_hdr *ip6, const uint8_t *payload,
                size_t payload_size, const char *options, size_t options_size);
 
-void logcat_hexdump(const char *info, const uint8_t *data, size_t len);
-void dump_iovec(const struct iovec *iov, int iov_len);
+// Called from the error paths of the translation functions.
+void logcat_hexdump(const char *info, const uint8_t *data, size_t len) CLAT_COLD;
+void dump_iovec(const struct iovec *iov, int iov_len) CLAT_COLD;
 
 #endif /* __DUMP_H__ */
@@ -0,0 +1,391 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * fq_codel.c - flow queueing and CoDel for translated uplink packets
+ */
+#include <netinet/in.h>
+#include <netinet/ip6.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fq_codel.h"
+
+#define LIST_NONE 0
+#define LIST_NEW 1
+#define LIST_OLD 2
+
+// ECN field of the IPv6 traffic class, in the second byte of the header.
+#define IP6_ECN_SHIFT 4
+#define IP6_ECN_MASK (3 << IP6_ECN_SHIFT)
+
+/* function: fq_codel_create
+ * allocates an empty queue
+ * returns: the queue, or NULL if out of memory
+ */
+struct fq_codel *fq_codel_create() {
+  struct fq_codel *q = calloc(1, sizeof(*q));
+  int i;
+
+  if (!q) {
+    return NULL;
+  }
+  for (i = 0; i < FQ_CODEL_LIMIT; i++) {
+    q->packets[i].next = i + 1 < FQ_CODEL_LIMIT ? i + 1 : -1;
+  }
+  for (i = 0; i < FQ_CODEL_FLOWS; i++) {
+    q->flows[i].head = q->flows[i].tail = q->flows[i].next = -1;
+  }
+  q->new_flows.head = q->new_flows.tail = -1;
+  q->old_flows.head = q->old_flows.tail = -1;
+  q->free                               = 0;
+  q->pending                            = -1;
+  return q;
+}
+
+/* function: flow_index
+ * returns the flow queue of a translated packet, from its addresses, protocol and ports
+ *   data - IPv6 packet
+ *   len  - size of the packet
+ */
+static int flow_index(const uint8_t *data, size_t len) {
+  const struct ip6_hdr *ip6 = (const struct ip6_hdr *)data;
+  uint32_t h, ports = 0;
+
+  if (len < sizeof(*ip6)) {
+    return 0;
+  }
+  if ((ip6->ip6_nxt == IPPROTO_TCP || ip6->ip6_nxt == IPPROTO_UDP) && len >= sizeof(*ip6) + 4) {
+    memcpy(&ports, data + sizeof(*ip6), sizeof(ports));
+  }
+  h = ip6->ip6_src.s6_addr32[3] ^ (ip6->ip6_dst.s6_addr32[3] * 0x9e3779b1) ^
+      (ip6->ip6_dst.s6_addr32[2] * 0x85ebca6b) ^ (ports * 0xc2b2ae35) ^ ip6->ip6_nxt;
+  h ^= h >> 16;
+  h *= 0x45d9f3b;
+  h ^= h >> 16;
+  return h & (FQ_CODEL_FLOWS - 1);
+}
+
+/* function: list_append
+ * adds a flow to the end of the new or old flows list
+ *   q    - the queue
+ *   list - the list
+ *   id   - list identifier, LIST_NEW or LIST_OLD
+ *   flow - index of the flow
+ */
+static void list_append(struct fq_codel *q, struct fq_codel_list *list, uint8_t id, int flow) {
+  q->flows[flow].next = -1;
+  q->flows[flow].list = id;
+  if (list->tail >= 0) {
+    q->flows[list->tail].next = flow;
+  } else {
+    list->head = flow;
+  }
+  list->tail = flow;
+}
+
+/* function: list_pop
+ * removes the first flow from the new or old flows list
+ *   q    - the queue
+ *   list - the list, which must not be empty
+ */
+static void list_pop(struct fq_codel *q, struct fq_codel_list *list) {
+  struct fq_codel_flow *flow = &q->flows[list->head];
+  list->head                 = flow->next;
+  if (list->head < 0) {
+    list->tail = -1;
+  }
+  flow->next = -1;
+  flow->list = LIST_NONE;
+}
+
+/* function: flow_pop
+ * removes the first packet of a flow
+ *   q    - the queue
+ *   flow - the flow
+ * returns: the packet, or -1 if the flow is empty
+ */
+static int flow_pop(struct fq_codel *q, struct fq_codel_flow *flow) {
+  int i = flow->head;
+  if (i < 0) {
+    return -1;
+  }
+  flow->head = q->packets[i].next;
+  if (flow->head < 0) {
+    flow->tail = -1;
+  }
+  flow->backlog -= q->packets[i].len;
+  return i;
+}
+
+/* function: packet_free
+ * returns a packet that was removed from its flow to the free list
+ *   q - the queue
+ *   i - the packet
+ */
+static void packet_free(struct fq_codel *q, int i) {
+  q->packets[i].next = q->free;
+  q->free            = i;
+  q->qlen--;
+}
+
+/* function: drop_from_fattest
+ * makes room for a packet by dropping the oldest packet of the flow with the largest backlog
+ *   q - the queue
+ */
+static void drop_from_fattest(struct fq_codel *q) {
+  struct fq_codel_flow *fattest = &q->flows[0];
+  int i;
+
+  for (i = 1; i < FQ_CODEL_FLOWS; i++) {
+    if (q->flows[i].backlog > fattest->backlog) {
+      fattest = &q->flows[i];
+    }
+  }
+  if ((i = flow_pop(q, fattest)) >= 0) {
+    packet_free(q, i);
+    q->overlimit++;
+  }
+}
+
+/* function: fq_codel_enqueue
+ * copies a translated packet into the queue
+ *   q       - the queue
+ *   iov     - the packet
+ *   iov_len - number of elements in iov
+ *   now     - current time in microseconds, CLOCK_MONOTONIC
+ * returns: 1 if the packet was queued, 0 if it is too large and should be sent directly
+ */
+int fq_codel_enqueue(struct fq_codel *q, const struct iovec *iov, int iov_len, uint64_t now) {
+  size_t len = 0;
+  int i;
+
+  for (i = 0; i < iov_len; i++) {
+    len += iov[i].iov_len;
+  }
+  if (len > FQ_CODEL_PACKET_SIZE) {
+    return 0;
+  }
+
+  if (q->free < 0) {
+    drop_from_fattest(q);
+  }
+  int p                          = q->free;
+  struct fq_codel_packet *packet = &q->packets[p];
+  q->free                        = packet->next;
+
+  uint8_t *pos = packet->data;
+  for (i = 0; i < iov_len; i++) {
+    memcpy(pos, iov[i].iov_base, iov[i].iov_len);
+    pos += iov[i].iov_len;
+  }
+  packet->len      = len;
+  packet->enqueued = now;
+  packet->next     = -1;
+
+  int f                      = flow_index(packet->data, len);
+  struct fq_codel_flow *flow = &q->flows[f];
+  if (flow->tail >= 0) {
+    q->packets[flow->tail].next = p;
+  } else {
+    flow->head = p;
+  }
+  flow->tail = p;
+  flow->backlog += len;
+  q->qlen++;
+  q->enqueued++;
+
+  if (flow->list == LIST_NONE) {
+    list_append(q, &q->new_flows, LIST_NEW, f);
+    flow->deficit = FQ_CODEL_QUANTUM;
+  }
+  return 1;
+}
+
+/* function: isqrt
+ * returns the integer square root of x
+ */
+static uint64_t isqrt(uint64_t x) {
+  uint64_t r = x, y = (x + 1) / 2;
+  while (y < r) {
+    r = y;
+    y = (r + x / r) / 2;
+  }
+  return r;
+}
+
+/* function: control_law
+ * returns the time of the next drop: drops get closer together as the square root of the number
+ * of drops, which makes TCP's throughput decrease linearly
+ *   t     - time of the previous drop
+ *   count - number of drops since entering the dropping state
+ */
+static uint64_t control_law(uint64_t t, uint32_t count) {
+  return t + (uint64_t)CODEL_INTERVAL * 1024 / isqrt((uint64_t)count << 20);
+}
+
+/* function: codel_pop
+ * removes the first packet of a flow and checks whether its queueing delay has been above target
+ * for an interval
+ *   q          - the queue
+ *   flow       - the flow
+ *   now        - current time in microseconds
+ *   ok_to_drop - set to whether CoDel may drop the packet
+ * returns: the packet, or -1 if the flow is empty
+ */
+static int codel_pop(struct fq_codel *q, struct fq_codel_flow *flow, uint64_t now,
+                     int *ok_to_drop) {
+  struct codel_vars *vars = &flow->cvars;
+  int i                   = flow_pop(q, flow);
+
+  *ok_to_drop = 0;
+  if (i < 0) {
+    vars->first_above_time = 0;
+    return -1;
+  }
+
+  // A queue of less than a packet can't be reduced further, whatever its delay.
+  if (now - q->packets[i].enqueued < CODEL_TARGET || flow->backlog <= FQ_CODEL_QUANTUM) {
+    vars->first_above_time = 0;
+  } else if (vars->first_above_time == 0) {
+    vars->first_above_time = now + CODEL_INTERVAL;
+  } else if (now >= vars->first_above_time) {
+    *ok_to_drop = 1;
+  }
+  return i;
+}
+
+/* function: codel_signal
+ * signals congestion with a packet: sets CE if the sender supports ECN, or drops it
+ *   q - the queue
+ *   i - the packet, which has been removed from its flow
+ * returns: 1 if the packet was marked and should be sent, 0 if it was dropped
+ */
+static int codel_signal(struct fq_codel *q, int i) {
+  uint8_t *tclass = &q->packets[i].data[1];
+  if (*tclass & IP6_ECN_MASK) {
+    *tclass |= IP6_ECN_MASK;
+    q->marked++;
+    return 1;
+  }
+  packet_free(q, i);
+  q->dropped++;
+  return 0;
+}
+
+/* function: codel_dequeue
+ * removes the next packet of a flow, dropping packets as CoDel sees fit (RFC 8289, section 5)
+ *   q    - the queue
+ *   flow - the flow
+ *   now  - current time in microseconds
+ * returns: the packet to send, or -1 if the flow is empty
+ */
+static int codel_dequeue(struct fq_codel *q, struct fq_codel_flow *flow, uint64_t now) {
+  struct codel_vars *vars = &flow->cvars;
+  int ok_to_drop;
+  int i = codel_pop(q, flow, now, &ok_to_drop);
+
+  if (i < 0) {
+    vars->dropping = 0;
+    return -1;
+  }
+
+  if (vars->dropping) {
+    if (!ok_to_drop) {
+      vars->dropping = 0;
+    }
+    while (vars->dropping && now >= vars->drop_next) {
+      vars->count++;
+      if (codel_signal(q, i)) {
+        vars->drop_next = control_law(vars->drop_next, vars->count);
+        break;
+      }
+      i = codel_pop(q, flow, now, &ok_to_drop);
+      if (i < 0 || !ok_to_drop) {
+        vars->dropping = 0;
+      } else {
+        vars->drop_next = control_law(vars->drop_next, vars->count);
+      }
+    }
+  } else if (ok_to_drop) {
+    if (!codel_signal(q, i)) {
+      i = codel_pop(q, flow, now, &ok_to_drop);
+    }
+    vars->dropping = 1;
+    // If we were dropping recently, start at a drop rate close to the one that worked then.
+    uint32_t delta = vars->count - vars->lastcount;
+    vars->count    = 1;
+    if (delta > 1 && now - vars->drop_next < 16 * CODEL_INTERVAL) {
+      vars->count = delta;
+    }
+    vars->lastcount = vars->count;
+    vars->drop_next = control_law(now, vars->count);
+  }
+  return i;
+}
+
+/* function: fq_codel_dequeue
+ * returns the next packet to send, choosing flows by deficit round robin (RFC 8290, section 4.2).
+ * The packet stays queued, and is returned again, until fq_codel_sent is called.
+ *   q   - the queue
+ *   now - current time in microseconds, CLOCK_MONOTONIC
+ * returns: the packet, or NULL if the queue is empty
+ */
+struct fq_codel_packet *fq_codel_dequeue(struct fq_codel *q, uint64_t now) {
+  if (q->pending >= 0) {
+    return &q->packets[q->pending];
+  }
+
+  for (;;) {
+    struct fq_codel_list *list = q->new_flows.head >= 0 ? &q->new_flows : &q->old_flows;
+    if (list->head < 0) {
+      return NULL;
+    }
+    int f                      = list->head;
+    struct fq_codel_flow *flow = &q->flows[f];
+
+    if (flow->deficit <= 0) {
+      flow->deficit += FQ_CODEL_QUANTUM;
+      list_pop(q, list);
+      list_append(q, &q->old_flows, LIST_OLD, f);
+      continue;
+    }
+
+    int i = codel_dequeue(q, flow, now);
+    if (i < 0) {
+      // An emptied new flow goes through the old list once, so that a flow can't get ahead of the
+      // others by keeping its queue just short enough to empty every round.
+      list_pop(q, list);
+      if (list == &q->new_flows && q->old_flows.head >= 0) {
+        list_append(q, &q->old_flows, LIST_OLD, f);
+      }
+      continue;
+    }
+
+    flow->deficit -= q->packets[i].len;
+    q->pending = i;
+    return &q->packets[i];
+  }
+}
+
+/* function: fq_codel_sent
+ * releases the packet returned by fq_codel_dequeue, after it was sent
+ *   q - the queue
+ */
+void fq_codel_sent(struct fq_codel *q) {
+  if (q->pending >= 0) {
+    packet_free(q, q->pending);
+    q->pending = -1;
+  }
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * fq_codel.h - flow queueing and CoDel for translated uplink packets
+ *
+ * When the uplink is slower than the IPv4 senders, translated packets queue in the raw socket and
+ * the uplink's qdisc, where clatd can't see them. With -q, clatd shrinks the raw socket's send
+ * buffer so that the backlog forms here instead, in per-flow queues served round robin (RFC 8290)
+ * and kept short by CoDel (RFC 8289), which drops or ECN-marks packets once the queueing delay
+ * has stayed above CODEL_TARGET for CODEL_INTERVAL. Packets are only dequeued when the raw socket
+ * can take them.
+ */
+#ifndef __FQ_CODEL_H__
+#define __FQ_CODEL_H__
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+// Number of flow queues. Flows are hashed into them.
+#define FQ_CODEL_FLOWS 64
+
+// Maximum number of queued packets, across all flows.
+#define FQ_CODEL_LIMIT 256
+
+// Largest packet that can be queued. Larger ones bypass the queue.
+#define FQ_CODEL_PACKET_SIZE 2048
+
+// Bytes each flow may send per round.
+#define FQ_CODEL_QUANTUM 1500
+
+// CoDel parameters, in microseconds: the acceptable standing queueing delay, and how long it may
+// be exceeded before CoDel starts dropping.
+#define CODEL_TARGET 5000
+#define CODEL_INTERVAL 100000
+
+// Send buffer of the raw socket with -q. Small, so that the queue builds up in fq_codel rather
+// than in the qdisc, but large enough to keep a fast uplink busy between wakeups.
+#define FQ_CODEL_SNDBUF 32768
+
+struct fq_codel_packet {
+  uint64_t enqueued;  // microseconds, CLOCK_MONOTONIC
+  int16_t next;       // next packet of the same flow, or free packet, or -1
+  uint16_t len;
+  uint8_t data[FQ_CODEL_PACKET_SIZE];
+};
+
+struct codel_vars {
+  uint64_t first_above_time;
+  uint64_t drop_next;
+  uint32_t count, lastcount;
+  int dropping;
+};
+
+struct fq_codel_flow {
+  int16_t head, tail;  // packets, or -1
+  int16_t next;        // next flow in the new or old flows list, or -1
+  uint8_t list;        // which list the flow is on, if any
+  int32_t deficit;
+  uint32_t backlog;  // bytes
+  struct codel_vars cvars;
+};
+
+struct fq_codel_list {
+  int16_t head, tail;
+};
+
+struct fq_codel {
+  struct fq_codel_packet packets[FQ_CODEL_LIMIT];
+  struct fq_codel_flow flows[FQ_CODEL_FLOWS];
+  struct fq_codel_list new_flows, old_flows;
+  int16_t free;     // free packets
+  int16_t pending;  // packet returned by fq_codel_dequeue and not yet sent, or -1
+  unsigned qlen;    // queued packets, including pending
+
+  uint64_t enqueued, dropped, marked, overlimit;
+};
+
+struct fq_codel *fq_codel_create();
+int fq_codel_enqueue(struct fq_codel *q, const struct iovec *iov, int iov_len, uint64_t now);
+struct fq_codel_packet *fq_codel_dequeue(struct fq_codel *q, uint64_t now);
+void fq_codel_sent(struct fq_codel *q);
+
+#endif /* __FQ_CODEL_H__ */
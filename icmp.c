@@ -75,7 +75,8 @@ uint8_t icmp_to_icmp6_type(uint8_t type, uint8_t code) {
   }
 
   // We don't understand this ICMP type. Return parameter problem so the caller will bail out.
-  logmsg_dbg(ANDROID_LOG_DEBUG, "icmp_to_icmp6_type: unhandled ICMP type %d", type);
+  logmsg_dbg(CLAT_DEBUG_ICMP, ANDROID_LOG_DEBUG, "icmp_to_icmp6_type: unhandled ICMP type %d",
+             type);
   return ICMP6_PARAM_PROB;
 }
 
@@ -111,7 +112,8 @@ uint8_t icmp_to_icmp6_code(uint8_t type, uint8_t code) {
           // Otherwise, we don't understand this ICMP type/code combination. Fall through.
       }
   }
-  logmsg_dbg(ANDROID_LOG_DEBUG, "icmp_to_icmp6_code: unhandled ICMP type/code %d/%d", type, code);
+  logmsg_dbg(CLAT_DEBUG_ICMP, ANDROID_LOG_DEBUG,
+             "icmp_to_icmp6_code: unhandled ICMP type/code %d/%d", type, code);
   return 0;
 }
 
@@ -135,7 +137,8 @@ uint8_t icmp6_to_icmp_type(uint8_t type, uint8_t code) {
   }
 
   // We don't understand this ICMP type. Return parameter problem so the caller will bail out.
-  logmsg_dbg(ANDROID_LOG_DEBUG, "icmp6_to_icmp_type: unhandled ICMP type/code %d/%d", type, code);
+  logmsg_dbg(CLAT_DEBUG_ICMP, ANDROID_LOG_DEBUG,
+             "icmp6_to_icmp_type: unhandled ICMP type/code %d/%d", type, code);
   return ICMP_PARAMETERPROB;
 }
 
@@ -172,6 +175,7 @@ uint8_t icmp6_to_icmp_code(uint8_t type, uint8_t code) {
       }
   }
 
-  logmsg_dbg(ANDROID_LOG_DEBUG, "icmp6_to_icmp_code: unhandled ICMP type/code %d/%d", type, code);
+  logmsg_dbg(CLAT_DEBUG_ICMP, ANDROID_LOG_DEBUG,
+             "icmp6_to_icmp_code: unhandled ICMP type/code %d/%d", type, code);
   return 0;
 }
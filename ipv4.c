@@ -19,43 +19,48 @@
 
 #include "netutils/checksum.h"
 
-#include "debug.h"
+#include "acl.h"
+#include "clat_config.h"
 #include "dump.h"
 #include "logging.h"
+#include "tcp_monitor.h"
 #include "translate.h"
 
 /* function: icmp_packet
  * translates an icmp packet
+ * config   - translation configuration
  * out      - output packet
  * icmp     - pointer to icmp header in packet
  * checksum - pseudo-header checksum
  * len      - size of ip payload
  * returns: the highest position in the output clat_packet that's filled in
  */
-int icmp_packet(clat_packet out, clat_packet_index pos, const struct icmphdr *icmp,
-                uint32_t checksum, size_t len) {
+int icmp_packet(const struct clat_config *config, clat_packet out, clat_packet_index pos,
+                const struct icmphdr *icmp, uint32_t checksum, size_t len) {
   const uint8_t *payload;
   size_t payload_size;
 
   if (len < sizeof(struct icmphdr)) {
-    logmsg_dbg(ANDROID_LOG_ERROR, "icmp_packet/(too small)");
+    logmsg_dbg(CLAT_DEBUG_DROPS, ANDROID_LOG_ERROR, "icmp_packet/(too small)");
     return 0;
   }
 
   payload      = (const uint8_t *)(icmp + 1);
   payload_size = len - sizeof(struct icmphdr);
 
-  return icmp_to_icmp6(out, pos, icmp, checksum, payload, payload_size);
+  return icmp_to_icmp6(config, out, pos, icmp, checksum, payload, payload_size);
 }
 
 /* function: ipv4_packet
  * translates an ipv4 packet
+ * config - translation configuration
  * out    - output packet
  * packet - packet data
  * len    - size of packet
  * returns: the highest position in the output clat_packet that's filled in
  */
-int ipv4_packet(clat_packet out, clat_packet_index pos, const uint8_t *packet, size_t len) {
+CLAT_HOT int ipv4_packet(const struct clat_config *config, clat_packet out, clat_packet_index pos,
+                         const uint8_t *packet, size_t len) {
   const struct iphdr *header = (struct iphdr *)packet;
   struct ip6_hdr *ip6_targ   = (struct ip6_hdr *)out[pos].iov_base;
   struct ip6_frag *frag_hdr;
@@ -66,23 +71,26 @@ int ipv4_packet(clat_packet out, clat_packet_index pos, const uint8_t *packet, s
   uint32_t old_sum, new_sum;
   int iov_len;
 
-  if (len < sizeof(struct iphdr)) {
-    logmsg_dbg(ANDROID_LOG_ERROR, "ip_packet/too short for an ip header");
+  if (unlikely(len < sizeof(struct iphdr))) {
+    logmsg_dbg(CLAT_DEBUG_DROPS, ANDROID_LOG_ERROR, "ip_packet/too short for an ip header");
     return 0;
   }
 
-  if (header->ihl < 5) {
-    logmsg_dbg(ANDROID_LOG_ERROR, "ip_packet/ip header length set to less than 5: %x", header->ihl);
+  if (unlikely(header->ihl < 5)) {
+    logmsg_dbg(CLAT_DEBUG_DROPS, ANDROID_LOG_ERROR,
+               "ip_packet/ip header length set to less than 5: %x", header->ihl);
     return 0;
   }
 
-  if ((size_t)header->ihl * 4 > len) {  // ip header length larger than entire packet
-    logmsg_dbg(ANDROID_LOG_ERROR, "ip_packet/ip header length set too large: %x", header->ihl);
+  if (unlikely((size_t)header->ihl * 4 > len)) {  // ip header length larger than entire packet
+    logmsg_dbg(CLAT_DEBUG_DROPS, ANDROID_LOG_ERROR, "ip_packet/ip header length set too large: %x",
+               header->ihl);
     return 0;
   }
 
-  if (header->version != 4) {
-    logmsg_dbg(ANDROID_LOG_ERROR, "ip_packet/ip header version not 4: %x", header->version);
+  if (unlikely(header->version != 4)) {
+    logmsg_dbg(CLAT_DEBUG_DROPS, ANDROID_LOG_ERROR, "ip_packet/ip header version not 4: %x",
+               header->version);
     return 0;
   }
 
@@ -94,6 +102,14 @@ int ipv4_packet(clat_packet out, clat_packet_index pos, const uint8_t *packet, s
   next_header = packet + header->ihl * 4;
   len_left    = len - header->ihl * 4;
 
+  // Drop blocked traffic before doing any work on it. Packets quoted by ICMP errors are not
+  // checked: the error itself was already let through.
+  if (config->acl && pos == CLAT_POS_IPHDR &&
+      acl_blocks(config->acl, 1 /* outgoing */, header->daddr, header->protocol,
+                 (header->frag_off & htons(IP_OFFMASK)) ? NULL : next_header, len_left)) {
+    return 0;
+  }
+
   nxthdr = header->protocol;
   if (nxthdr == IPPROTO_ICMP) {
     // ICMP and ICMPv6 have different protocol numbers.
@@ -104,7 +120,7 @@ int ipv4_packet(clat_packet out, clat_packet_index pos, const uint8_t *packet, s
    * UDP include parts of the IP header in the checksum. Set the length to zero because we don't
    * know it yet.
    */
-  fill_ip6_header(ip6_targ, 0, nxthdr, header);
+  fill_ip6_header(config, ip6_targ, 0, nxthdr, header);
   out[pos].iov_len = sizeof(struct ip6_hdr);
 
   /* Calculate the pseudo-header checksum.
@@ -119,25 +135,43 @@ int ipv4_packet(clat_packet out, clat_packet_index pos, const uint8_t *packet, s
   frag_hdr             = (struct ip6_frag *)out[pos + 1].iov_base;
   frag_hdr_len         = maybe_fill_frag_header(frag_hdr, ip6_targ, header);
   out[pos + 1].iov_len = frag_hdr_len;
+  if (unlikely(frag_hdr_len)) {
+    logmsg_dbg(CLAT_DEBUG_FRAGMENTS, ANDROID_LOG_DEBUG,
+               "ip_packet/fragment id %04x offset %d%s protocol %d len %zu", ntohs(header->id),
+               (ntohs(header->frag_off) & IP_OFFMASK) * 8,
+               (header->frag_off & htons(IP_MF)) ? " more" : "", header->protocol, len_left);
+  }
 
-  if (frag_hdr_len && frag_hdr->ip6f_offlg & IP6F_OFF_MASK) {
+  if (unlikely(frag_hdr_len && frag_hdr->ip6f_offlg & IP6F_OFF_MASK)) {
     // Non-first fragment. Copy the rest of the packet as is.
     iov_len = generic_packet(out, pos + 2, next_header, len_left);
   } else if (nxthdr == IPPROTO_ICMPV6) {
-    iov_len = icmp_packet(out, pos + 2, (const struct icmphdr *)next_header, new_sum, len_left);
+    iov_len = icmp_packet(config, out, pos + 2, (const struct icmphdr *)next_header, new_sum,
+                          len_left);
   } else if (nxthdr == IPPROTO_TCP) {
     iov_len =
       tcp_packet(out, pos + 2, (const struct tcphdr *)next_header, old_sum, new_sum, len_left);
+    // The TCP header quoted by an ICMP error is not a segment of its own.
+    if (iov_len && config->tcp_monitor && pos == CLAT_POS_IPHDR) {
+      tcp_monitor_segment(config->tcp_monitor, 1 /* outgoing */, header->saddr, header->daddr,
+                          (const struct tcphdr *)next_header, len_left);
+    }
   } else if (nxthdr == IPPROTO_UDP) {
-    iov_len =
-      udp_packet(out, pos + 2, (const struct udphdr *)next_header, old_sum, new_sum, len_left);
+    iov_len = udp_packet(config, out, pos + 2, (const struct udphdr *)next_header, header->daddr,
+                         old_sum, new_sum, len_left);
   } else if (nxthdr == IPPROTO_GRE || nxthdr == IPPROTO_ESP) {
     iov_len = generic_packet(out, pos + 2, next_header, len_left);
   } else {
-#if CLAT_DEBUG
-    logmsg_dbg(ANDROID_LOG_ERROR, "ip_packet/unknown protocol: %x", header->protocol);
-    logcat_hexdump("ipv4/protocol", packet, len);
-#endif
+    // Always warned about, but only at powers of two, so that a host can't flood the log. Drops
+    // tracing logs every one of them.
+    uint64_t unknown = config->counters ? ++config->counters->unknown_protocol : 0;
+    if (clat_debug(CLAT_DEBUG_DROPS)) {
+      logmsg(ANDROID_LOG_ERROR, "ip_packet/unknown protocol: %x", header->protocol);
+      logcat_hexdump("ipv4/protocol", packet, len);
+    } else if (unknown && !(unknown & (unknown - 1))) {
+      logmsg(ANDROID_LOG_WARN, "ip_packet/unknown protocol: %x, %llu packets so far",
+             header->protocol, (unsigned long long)unknown);
+    }
     return 0;
   }
 
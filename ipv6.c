@@ -21,62 +21,93 @@
 
 #include "netutils/checksum.h"
 
-#include "config.h"
-#include "debug.h"
+#include "acl.h"
+#include "clat_config.h"
 #include "dump.h"
 #include "logging.h"
+#include "rate_limit.h"
+#include "tcp_monitor.h"
 #include "translate.h"
 
 /* function: icmp6_packet
  * takes an icmp6 packet and sets it up for translation
+ * config   - translation configuration
  * out      - output packet
  * icmp6    - pointer to icmp6 header in packet
  * checksum - pseudo-header checksum (unused)
  * len      - size of ip payload
  * returns: the highest position in the output clat_packet that's filled in
  */
-int icmp6_packet(clat_packet out, clat_packet_index pos, const struct icmp6_hdr *icmp6,
-                 size_t len) {
+int icmp6_packet(const struct clat_config *config, clat_packet out, clat_packet_index pos,
+                 const struct icmp6_hdr *icmp6, size_t len) {
   const uint8_t *payload;
   size_t payload_size;
 
   if (len < sizeof(struct icmp6_hdr)) {
-    logmsg_dbg(ANDROID_LOG_ERROR, "icmp6_packet/(too small)");
+    logmsg_dbg(CLAT_DEBUG_DROPS, ANDROID_LOG_ERROR, "icmp6_packet/(too small)");
     return 0;
   }
 
   payload      = (const uint8_t *)(icmp6 + 1);
   payload_size = len - sizeof(struct icmp6_hdr);
 
-  return icmp6_to_icmp(out, pos, icmp6, payload, payload_size);
+  return icmp6_to_icmp(config, out, pos, icmp6, payload, payload_size);
 }
 
 /* function: log_bad_address
- * logs a bad address to android's log buffer if debugging is turned on
- * fmt     - printf-style format, use %s to place the address
- * badaddr - the bad address in question
+ * logs a packet dropped because of its addresses to android's log buffer
+ * fmt - printf-style format, use %s twice to place the source and destination addresses
+ * src - the source address
+ * dst - the destination address
  */
-#if CLAT_DEBUG
-void log_bad_address(const char *fmt, const struct in6_addr *src, const struct in6_addr *dst) {
+static CLAT_COLD void log_bad_address(const char *fmt, const struct in6_addr *src,
+                                      const struct in6_addr *dst) {
   char srcstr[INET6_ADDRSTRLEN];
   char dststr[INET6_ADDRSTRLEN];
 
   inet_ntop(AF_INET6, src, srcstr, sizeof(srcstr));
   inet_ntop(AF_INET6, dst, dststr, sizeof(dststr));
-  logmsg_dbg(ANDROID_LOG_ERROR, fmt, srcstr, dststr);
+  logmsg(ANDROID_LOG_ERROR, fmt, srcstr, dststr);
+}
+
+/* function: expensive_class
+ * finds which rate-limited class, if any, a packet from the network belongs to
+ * config      - translation configuration
+ * frag_hdr    - fragment header, or NULL
+ * protocol    - IPv4 protocol of the packet
+ * next_header - transport header
+ * len         - size of the transport header and payload
+ * remote4     - IPv4 address of the remote end, in network byte order
+ * returns: a RATE_LIMIT_* class, or -1 if the packet is not limited
+ */
+static int expensive_class(const struct clat_config *config, const struct ip6_frag *frag_hdr,
+                           uint8_t protocol, const uint8_t *next_header, size_t len,
+                           uint32_t remote4) {
+  if (frag_hdr) {
+    return RATE_LIMIT_FRAGMENT;
+  }
+  if (protocol == IPPROTO_ICMP && len >= 1 && !(next_header[0] & ICMP6_INFOMSG_MASK)) {
+    return RATE_LIMIT_ICMP_ERROR;
+  }
+  if (protocol == IPPROTO_UDP && len >= sizeof(struct udphdr)) {
+    const struct udphdr *udp = (const struct udphdr *)next_header;
+    if (!udp->check && !udp_zero_csum_allowed(&config->udp_zero_csum, udp, remote4)) {
+      return RATE_LIMIT_UDP_ZERO_CSUM;
+    }
+  }
+  return -1;
 }
-#else
-#define log_bad_address(fmt, src, dst)
-#endif
 
 /* function: ipv6_packet
  * takes an ipv6 packet and hands it off to the layer 4 protocol function
+ * config - translation configuration
  * out    - output packet
  * packet - packet data
  * len    - size of packet
  * returns: the highest position in the output clat_packet that's filled in
  */
-int ipv6_packet(clat_packet out, clat_packet_index pos, const uint8_t *packet, size_t len) {
+CLAT_HOT int ipv6_packet(const struct clat_config *config, clat_packet out, clat_packet_index pos,
+                         const uint8_t *packet, size_t len) {
   const struct ip6_hdr *ip6 = (struct ip6_hdr *)packet;
   struct iphdr *ip_targ     = (struct iphdr *)out[pos].iov_base;
   struct ip6_frag *frag_hdr = NULL;
@@ -86,13 +117,16 @@ int ipv6_packet(clat_packet out, clat_packet_index pos, const uint8_t *packet, s
   uint32_t old_sum, new_sum;
   int iov_len;
 
-  if (len < sizeof(struct ip6_hdr)) {
-    logmsg_dbg(ANDROID_LOG_ERROR, "ipv6_packet/too short for an ip6 header: %d", len);
+  if (unlikely(len < sizeof(struct ip6_hdr))) {
+    logmsg_dbg(CLAT_DEBUG_DROPS, ANDROID_LOG_ERROR, "ipv6_packet/too short for an ip6 header: %zu",
+               len);
     return 0;
   }
 
-  if (IN6_IS_ADDR_MULTICAST(&ip6->ip6_dst)) {
-    log_bad_address("ipv6_packet/multicast %s->%s", &ip6->ip6_src, &ip6->ip6_dst);
+  if (unlikely(IN6_IS_ADDR_MULTICAST(&ip6->ip6_dst))) {
+    if (clat_debug(CLAT_DEBUG_ADDRESSES)) {
+      log_bad_address("ipv6_packet/multicast %s->%s", &ip6->ip6_src, &ip6->ip6_dst);
+    }
     return 0;  // silently ignore
   }
 
@@ -102,12 +136,13 @@ int ipv6_packet(clat_packet out, clat_packet_index pos, const uint8_t *packet, s
   // to translate them. We accept third-party ICMPv6 errors, even though their source addresses
   // cannot be translated, so that things like unreachables and traceroute will work. fill_ip_header
   // takes care of faking a source address for them.
-  if (!(is_in_plat_subnet(&ip6->ip6_src) &&
-        IN6_ARE_ADDR_EQUAL(&ip6->ip6_dst, &Global_Clatd_Config.ipv6_local_subnet)) &&
-      !(is_in_plat_subnet(&ip6->ip6_dst) &&
-        IN6_ARE_ADDR_EQUAL(&ip6->ip6_src, &Global_Clatd_Config.ipv6_local_subnet)) &&
-      ip6->ip6_nxt != IPPROTO_ICMPV6) {
-    log_bad_address("ipv6_packet/wrong source address: %s->%s", &ip6->ip6_src, &ip6->ip6_dst);
+  if (unlikely(
+        !(is_in_plat_subnet(config, &ip6->ip6_src) && is_in_local_subnet(config, &ip6->ip6_dst)) &&
+        !(is_in_plat_subnet(config, &ip6->ip6_dst) && is_in_local_subnet(config, &ip6->ip6_src)) &&
+        ip6->ip6_nxt != IPPROTO_ICMPV6)) {
+    if (clat_debug(CLAT_DEBUG_ADDRESSES)) {
+      log_bad_address("ipv6_packet/wrong source address: %s->%s", &ip6->ip6_src, &ip6->ip6_dst);
+    }
     return 0;
   }
 
@@ -120,15 +155,16 @@ int ipv6_packet(clat_packet out, clat_packet_index pos, const uint8_t *packet, s
    * UDP include parts of the IP header in the checksum. Set the length to zero because we don't
    * know it yet.
    */
-  fill_ip_header(ip_targ, 0, protocol, ip6);
+  fill_ip_header(config, ip_targ, 0, protocol, ip6);
   out[pos].iov_len = sizeof(struct iphdr);
 
   // If there's a Fragment header, parse it and decide what the next header is.
   // Do this before calculating the pseudo-header checksum because it updates the next header value.
-  if (protocol == IPPROTO_FRAGMENT) {
+  if (unlikely(protocol == IPPROTO_FRAGMENT)) {
     frag_hdr = (struct ip6_frag *)next_header;
-    if (len_left < sizeof(*frag_hdr)) {
-      logmsg_dbg(ANDROID_LOG_ERROR, "ipv6_packet/too short for fragment header: %d", len);
+    if (unlikely(len_left < sizeof(*frag_hdr))) {
+      logmsg_dbg(CLAT_DEBUG_FRAGMENTS, ANDROID_LOG_ERROR,
+                 "ipv6_packet/too short for fragment header: %zu", len);
       return 0;
     }
 
@@ -136,6 +172,10 @@ int ipv6_packet(clat_packet out, clat_packet_index pos, const uint8_t *packet, s
     len_left -= sizeof(*frag_hdr);
 
     protocol = parse_frag_header(frag_hdr, ip_targ);
+    logmsg_dbg(CLAT_DEBUG_FRAGMENTS, ANDROID_LOG_DEBUG,
+               "ipv6_packet/fragment id %08x offset %d%s protocol %d len %zu",
+               ntohl(frag_hdr->ip6f_ident), ntohs(frag_hdr->ip6f_offlg & IP6F_OFF_MASK),
+               (frag_hdr->ip6f_offlg & IP6F_MORE_FRAG) ? " more" : "", protocol, len_left);
   }
 
   // ICMP and ICMPv6 have different protocol numbers.
@@ -144,6 +184,24 @@ int ipv6_packet(clat_packet out, clat_packet_index pos, const uint8_t *packet, s
     ip_targ->protocol = IPPROTO_ICMP;
   }
 
+  // Drop blocked traffic before doing any work on it. fill_ip_header has found the remote IPv4
+  // address, which for third-party ICMP errors is a placeholder.
+  if (config->acl && pos == CLAT_POS_IPHDR &&
+      acl_blocks(config->acl, 0 /* incoming */, ip_targ->saddr, protocol,
+                 (frag_hdr && (frag_hdr->ip6f_offlg & IP6F_OFF_MASK)) ? NULL : next_header,
+                 len_left)) {
+    return 0;
+  }
+
+  // Likewise drop packets that are expensive to translate once their budget is used up.
+  if (config->rate_limit && pos == CLAT_POS_IPHDR) {
+    int class_id =
+      expensive_class(config, frag_hdr, protocol, next_header, len_left, ip_targ->saddr);
+    if (class_id >= 0 && !rate_limit_allow(config->rate_limit, class_id, &ip6->ip6_src)) {
+      return 0;
+    }
+  }
+
   /* Calculate the pseudo-header checksum.
    * Technically, the length that is used in the pseudo-header checksum is the transport layer
    * length, which is not the same as len_left in the case of fragmented packets. But since
@@ -153,23 +211,34 @@ int ipv6_packet(clat_packet out, clat_packet_index pos, const uint8_t *packet, s
   new_sum = ipv4_pseudo_header_checksum(ip_targ, len_left);
 
   // Does not support IPv6 extension headers except Fragment.
-  if (frag_hdr && (frag_hdr->ip6f_offlg & IP6F_OFF_MASK)) {
+  if (unlikely(frag_hdr && (frag_hdr->ip6f_offlg & IP6F_OFF_MASK))) {
     iov_len = generic_packet(out, pos + 2, next_header, len_left);
   } else if (protocol == IPPROTO_ICMP) {
-    iov_len = icmp6_packet(out, pos + 2, (const struct icmp6_hdr *)next_header, len_left);
+    iov_len = icmp6_packet(config, out, pos + 2, (const struct icmp6_hdr *)next_header, len_left);
   } else if (protocol == IPPROTO_TCP) {
     iov_len =
       tcp_packet(out, pos + 2, (const struct tcphdr *)next_header, old_sum, new_sum, len_left);
+    // The TCP header quoted by an ICMP error is not a segment of its own.
+    if (iov_len && config->tcp_monitor && pos == CLAT_POS_IPHDR) {
+      tcp_monitor_segment(config->tcp_monitor, 0 /* incoming */, ip_targ->daddr, ip_targ->saddr,
+                          (const struct tcphdr *)next_header, len_left);
+    }
   } else if (protocol == IPPROTO_UDP) {
-    iov_len =
-      udp_packet(out, pos + 2, (const struct udphdr *)next_header, old_sum, new_sum, len_left);
+    iov_len = udp_packet(config, out, pos + 2, (const struct udphdr *)next_header, ip_targ->saddr,
+                         old_sum, new_sum, len_left);
   } else if (protocol == IPPROTO_GRE || protocol == IPPROTO_ESP) {
     iov_len = generic_packet(out, pos + 2, next_header, len_left);
   } else {
-#if CLAT_DEBUG
-    logmsg(ANDROID_LOG_ERROR, "ipv6_packet/unknown next header type: %x", ip6->ip6_nxt);
-    logcat_hexdump("ipv6/nxthdr", packet, len);
-#endif
+    // Always warned about, but only at powers of two, so that a peer can't flood the log. Drops
+    // tracing logs every one of them.
+    uint64_t unknown = config->counters ? ++config->counters->unknown_protocol : 0;
+    if (clat_debug(CLAT_DEBUG_DROPS)) {
+      logmsg(ANDROID_LOG_ERROR, "ipv6_packet/unknown next header type: %x", ip6->ip6_nxt);
+      logcat_hexdump("ipv6/nxthdr", packet, len);
+    } else if (unknown && !(unknown & (unknown - 1))) {
+      logmsg(ANDROID_LOG_WARN, "ipv6_packet/unknown next header type: %x, %llu packets so far",
+             ip6->ip6_nxt, (unsigned long long)unknown);
+    }
     return 0;
   }
 
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * libclat.c - packet translation API for code that does not own a tun device
+ */
+#include <arpa/inet.h>
+#include <string.h>
+
+#include "libclat.h"
+#include "translate.h"
+
+/* function: clat_config_init
+ * fills in a translation configuration
+ * config      - the configuration to fill in
+ * v4_addr     - the local IPv4 address, e.g., "192.0.0.4"
+ * v6_addr     - the local IPv6 address that the IPv4 address is translated to
+ * plat_prefix - the /96 NAT64 prefix, e.g., "64:ff9b::"
+ * returns: 1 on success, 0 if any of the addresses are invalid
+ */
+int clat_config_init(struct clat_config *config, const char *v4_addr, const char *v6_addr,
+                     const char *plat_prefix) {
+  memset(config, 0, sizeof(*config));
+  return v4_addr && inet_pton(AF_INET, v4_addr, &config->ipv4_local_subnet) == 1 && v6_addr &&
+         inet_pton(AF_INET6, v6_addr, &config->ipv6_local_subnet) == 1 && plat_prefix &&
+         inet_pton(AF_INET6, plat_prefix, &config->plat_subnet) == 1;
+}
+
+/* function: clat_translate
+ * translates a packet into a caller-provided buffer
+ * config  - translation configuration
+ * to_ipv6 - true if translating to ipv6, false if translating to ipv4
+ * packet  - packet
+ * len     - size of packet
+ * out     - output buffer. iov_len is the size of the buffer on input, and the size of the
+ *           translated packet on output if the packet was translated. IPv4 packets are written
+ *           without a tun header.
+ * returns: the verdict for the packet
+ */
+clat_verdict clat_translate(const struct clat_config *config, int to_ipv6, const uint8_t *packet,
+                            size_t len, struct iovec *out) {
+  struct clat_packet_headers headers;
+  clat_packet translated;
+  size_t total = 0;
+  int i;
+
+  int iov_len = translate_packet_iovec(config, to_ipv6, packet, len, &headers, translated);
+  if (iov_len <= 0) {
+    return CLAT_VERDICT_DROP;
+  }
+
+  for (i = CLAT_POS_IPHDR; i < iov_len; i++) {
+    total += translated[i].iov_len;
+  }
+  if (total > out->iov_len) {
+    return CLAT_VERDICT_NOSPACE;
+  }
+
+  uint8_t *pos = out->iov_base;
+  for (i = CLAT_POS_IPHDR; i < iov_len; i++) {
+    memcpy(pos, translated[i].iov_base, translated[i].iov_len);
+    pos += translated[i].iov_len;
+  }
+  out->iov_len = total;
+
+  return CLAT_VERDICT_TRANSLATED;
+}
+
+/* function: clat_translate_batch
+ * translates a batch of packets into caller-provided buffers
+ * config   - translation configuration
+ * to_ipv6  - true if translating to ipv6, false if translating to ipv4
+ * in       - the packets to translate
+ * out      - one output buffer per packet, see clat_translate
+ * verdicts - receives one verdict per packet
+ * count    - number of packets
+ * returns: the number of packets that were translated
+ */
+size_t clat_translate_batch(const struct clat_config *config, int to_ipv6,
+                            const struct iovec *in, struct iovec *out, clat_verdict *verdicts,
+                            size_t count) {
+  size_t translated = 0;
+  size_t i;
+
+  for (i = 0; i < count; i++) {
+    verdicts[i] = clat_translate(config, to_ipv6, in[i].iov_base, in[i].iov_len, &out[i]);
+    if (verdicts[i] == CLAT_VERDICT_TRANSLATED) {
+      translated++;
+    }
+  }
+
+  return translated;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * libclat.h - packet translation API for code that does not own a tun device
+ *
+ * Translating a packet does not allocate memory, read or write file descriptors, or use global
+ * state: callers provide the translation configuration and all input and output buffers. What the
+ * configuration points to can add to that. Rate limits and the TCP monitor read the monotonic clock
+ * and update their own state, and debug tracing, which is off unless clat_debug_set (see
+ * logging.h) turns it on, writes to the log. With counters, packets of an unknown IP protocol are
+ * also warned about in the log, at powers of two.
+ */
+#ifndef __LIBCLAT_H__
+#define __LIBCLAT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "clat_config.h"
+
+// What happened to a packet passed to clat_translate.
+typedef enum {
+  CLAT_VERDICT_TRANSLATED,  // The translated packet was written to the output buffer.
+  CLAT_VERDICT_DROP,        // The packet cannot be translated and should be dropped.
+  CLAT_VERDICT_NOSPACE,     // The output buffer is too small for the translated packet.
+} clat_verdict;
+
+// Fills in a translation configuration from the string forms of its addresses.
+int clat_config_init(struct clat_config *config, const char *v4_addr, const char *v6_addr,
+                     const char *plat_prefix);
+
+// Translates one IPv4 packet to IPv6, or one IPv6 packet to IPv4.
+clat_verdict clat_translate(const struct clat_config *config, int to_ipv6, const uint8_t *packet,
+                            size_t len, struct iovec *out);
+
+// Translates a batch of packets. Returns the number of packets that were translated.
+size_t clat_translate_batch(const struct clat_config *config, int to_ipv6,
+                            const struct iovec *in, struct iovec *out, clat_verdict *verdicts,
+                            size_t count);
+
+#endif /* __LIBCLAT_H__ */
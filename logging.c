@@ -19,7 +19,6 @@
 #include <android/log.h>
 #include <stdarg.h>
 
-#include "debug.h"
 #include "logging.h"
 
 /* function: logmsg
@@ -36,20 +35,34 @@ void logmsg(int prio, const char *fmt, ...) {
   va_end(ap);
 }
 
-/* function: logmsg_dbg
- * prints a log message to android's log buffer if CLAT_DEBUG is set
- * prio - the log message priority
- * fmt  - printf format specifier
- * ...  - printf format arguments
+const char *const clat_debug_category_names[CLAT_DEBUG_CATEGORIES] = {
+  "drops",
+  "icmp",
+  "fragments",
+  "addresses",
+};
+
+uint32_t clat_debug_categories = 0;
+
+// Trace one in this many events of the categories that are on.
+static uint32_t clat_debug_sample_rate = 1;
+static uint32_t clat_debug_events      = 0;
+
+/* function: clat_debug_set
+ * turns debug tracing on or off. Each process has its own settings.
+ *   categories  - CLAT_DEBUG_* categories to trace, or 0 for none
+ *   sample_rate - trace one in this many events, or every event if 0 or 1
  */
-#if CLAT_DEBUG
-void logmsg_dbg(int prio, const char *fmt, ...) {
-  va_list ap;
+void clat_debug_set(uint32_t categories, uint32_t sample_rate) {
+  clat_debug_sample_rate = sample_rate ? sample_rate : 1;
+  clat_debug_events      = 0;
+  clat_debug_categories  = categories;
+}
 
-  va_start(ap, fmt);
-  __android_log_vprint(prio, "clatd", fmt, ap);
-  va_end(ap);
+/* function: clat_debug_sampled
+ * counts an event of a category that is being traced
+ *   returns: 1 if the event is one of the sampled ones, 0 if it should not be traced
+ */
+int clat_debug_sampled() {
+  return clat_debug_events++ % clat_debug_sample_rate == 0;
 }
-#else
-void logmsg_dbg(__attribute__((unused)) int prio, __attribute__((unused)) const char *fmt, ...) {}
-#endif
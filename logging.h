@@ -20,8 +20,45 @@
 #define __LOGGING_H__
 // for the priorities
 #include <android/log.h>
+#include <stdint.h>
 
-void logmsg(int prio, const char *fmt, ...);
-void logmsg_dbg(int prio, const char *fmt, ...);
+#include "common.h"
+
+// Logging is never on the fast path, so calls to it mark the branch they are on as unlikely.
+void logmsg(int prio, const char *fmt, ...) CLAT_COLD;
+
+// Debug tracing categories. Tracing is compiled into every build and costs one load and one
+// predicted branch per trace point while its category is off. It is turned on with -d or SIGUSR2.
+#define CLAT_DEBUG_DROPS 0x1      // malformed and unsupported packets
+#define CLAT_DEBUG_ICMP 0x2       // ICMP types and codes that have no translation
+#define CLAT_DEBUG_FRAGMENTS 0x4  // fragments and fragment headers
+#define CLAT_DEBUG_ADDRESSES 0x8  // packets dropped because of their addresses
+#define CLAT_DEBUG_CATEGORIES 4
+#define CLAT_DEBUG_ALL ((1 << CLAT_DEBUG_CATEGORIES) - 1)
+
+extern const char *const clat_debug_category_names[CLAT_DEBUG_CATEGORIES];
+
+// Categories being traced. Only written by clat_debug_set.
+extern uint32_t clat_debug_categories;
+
+void clat_debug_set(uint32_t categories, uint32_t sample_rate);
+int clat_debug_sampled() CLAT_COLD;
+
+/* function: clat_debug
+ * returns: true if an event of a category should be traced: the category is on and the event is
+ * picked by sampling
+ *   category - a CLAT_DEBUG_* category
+ */
+static inline int clat_debug(uint32_t category) {
+  return unlikely(clat_debug_categories & category) && clat_debug_sampled();
+}
+
+// Logs a message if its category is being traced.
+#define logmsg_dbg(category, prio, ...)                                                            \
+  do {                                                                                             \
+    if (clat_debug(category)) {                                                                    \
+      logmsg(prio, __VA_ARGS__);                                                                   \
+    }                                                                                              \
+  } while (0)
 
 #endif
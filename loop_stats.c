@@ -0,0 +1,81 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * loop_stats.c - how busy the event loop is
+ */
+#include <string.h>
+#include <sys/resource.h>
+
+#include "common.h"
+#include "logging.h"
+#include "loop_stats.h"
+
+/* function: timeval_us
+ * converts a timeval to microseconds
+ */
+static uint64_t timeval_us(const struct timeval *tv) {
+  return (uint64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+/* function: loop_stats_start
+ * starts a new interval
+ *   stats - event loop statistics
+ */
+void loop_stats_start(struct loop_stats *stats) {
+  struct rusage usage;
+
+  memset(stats, 0, sizeof(*stats));
+  stats->start = clat_clock_us(CLOCK_MONOTONIC);
+  // The process is single-threaded, so its usage is the event loop's.
+  if (!getrusage(RUSAGE_SELF, &usage)) {
+    stats->user_start   = timeval_us(&usage.ru_utime);
+    stats->system_start = timeval_us(&usage.ru_stime);
+  }
+}
+
+/* function: ratio
+ * returns a / b, or 0 if b is 0
+ */
+static double ratio(uint64_t a, uint64_t b) {
+  return b ? (double)a / b : 0;
+}
+
+/* function: loop_stats_log
+ * logs the statistics of the current interval and starts a new one
+ *   stats - event loop statistics
+ */
+void loop_stats_log(struct loop_stats *stats) {
+  uint64_t elapsed = clat_clock_us(CLOCK_MONOTONIC) - stats->start;
+  uint64_t user = 0, system = 0;
+  struct rusage usage;
+
+  if (!getrusage(RUSAGE_SELF, &usage)) {
+    user   = timeval_us(&usage.ru_utime) - stats->user_start;
+    system = timeval_us(&usage.ru_stime) - stats->system_start;
+  }
+  // poll() can't take longer than the interval, but the clock reads around it are not atomic
+  // with the interval's start and end.
+  uint64_t busy = elapsed > stats->poll_time ? elapsed - stats->poll_time : 0;
+
+  logmsg(ANDROID_LOG_INFO,
+         "Event loop: %.1f%% busy over %.1fs, CPU %.1f%% user %.1f%% system, %.0f wakeups/s, "
+         "%.1f downlink packets/wakeup (max %llu), %.1f uplink packets/wakeup",
+         100 * ratio(busy, elapsed), elapsed / 1e6, 100 * ratio(user, elapsed),
+         100 * ratio(system, elapsed), 1e6 * ratio(stats->wakeups, elapsed),
+         ratio(stats->downlink_packets, stats->downlink_wakeups),
+         (unsigned long long)stats->downlink_max,
+         ratio(stats->uplink_packets, stats->uplink_wakeups));
+  loop_stats_start(stats);
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * loop_stats.h - how busy the event loop is
+ *
+ * Packets per second don't say how close a clatd process is to saturation. The event loop reads
+ * the clock around poll(), which tells how much of each interval was spent waiting and how much
+ * handling wakeups, and counts wakeups and the packets each one handled. The CPU time that the
+ * kernel accounts to the process splits the busy time into translation (user) and syscalls
+ * (system). Nothing is measured per packet. Each process reports its own figures for the interval
+ * since it last reported.
+ */
+#ifndef __LOOP_STATS_H__
+#define __LOOP_STATS_H__
+
+#include <stdint.h>
+
+struct loop_stats {
+  uint64_t start;                    // microseconds, CLOCK_MONOTONIC
+  uint64_t user_start, system_start;  // CPU time used at start, microseconds
+  uint64_t poll_time;                 // microseconds spent in poll()
+  uint64_t wakeups;
+
+  // Wakeups that read each direction, and the packets they read.
+  uint64_t downlink_wakeups, downlink_packets, downlink_max;
+  uint64_t uplink_wakeups, uplink_packets;
+};
+
+void loop_stats_start(struct loop_stats *stats);
+void loop_stats_log(struct loop_stats *stats);
+
+/* function: loop_stats_downlink
+ * counts a wakeup that read downlink packets
+ *   stats   - event loop statistics
+ *   packets - number of packets read
+ */
+static inline void loop_stats_downlink(struct loop_stats *stats, int packets) {
+  stats->downlink_wakeups++;
+  if (packets > 0) {
+    stats->downlink_packets += packets;
+    if ((uint64_t)packets > stats->downlink_max) {
+      stats->downlink_max = packets;
+    }
+  }
+}
+
+#endif /* __LOOP_STATS_H__ */
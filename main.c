@@ -32,6 +32,7 @@
 #include "config.h"
 #include "logging.h"
 #include "setif.h"
+#include "shm_ring.h"
 
 #define DEVICEPREFIX "v4-"
 
@@ -46,6 +47,30 @@ void print_help() {
   printf("-6 [IPv6 address]\n");
   printf("-m [socket mark]\n");
   printf("-t [tun file descriptor number]\n");
+  printf("-s [unix socket path for shared memory clients]\n");
+  printf("-w [number of worker processes]\n");
+  printf("-u [UDP ports and IPv4 prefixes to pass zero UDP checksums through for, or \"all\"]\n");
+  printf("-b [IPv4 traffic to drop, e.g., \"out:tcp:198.51.100.0/24:25,in:udp:0.0.0.0/0\"]\n");
+  printf("-l [downlink packets per second of ICMP errors, zero UDP checksums and fragments, per\n");
+  printf("    class and per source, e.g., \"icmp:1000:100,udp0:10000,frag:20000:2000\"]\n");
+  printf("-x [verify one translation in N of the fast path against the iovec path, logged on\n");
+  printf("    SIGUSR1]\n");
+  printf("-X [pcap file to write translations that fail verification to]\n");
+  printf("-a (run on the CPUs that receive the uplink's traffic)\n");
+  printf("-r (measure TCP round-trip times and retransmissions, logged on SIGUSR1)\n");
+  printf("-P [pace uplink bursts with SO_TXTIME at twice their measured rate, at most N kbit/s,\n");
+  printf("    or 0 for no cap. Needs the fq or etf qdisc on the uplink.]\n");
+  printf("-q (queue uplink packets per flow with fq_codel, keeping the uplink's queue short)\n");
+  printf("-d [debug tracing to log: drops, icmp, fragments, addresses or all, optionally one\n");
+  printf("    event in N, e.g., \"drops,fragments/100\". SIGUSR2 turns it off and on again in\n");
+  printf("    the process it is sent to, with every category if -d is not given.]\n");
+  printf("\n");
+  printf("To run as a SIIT gateway, pass our IPv4 address and the length of its prefix to -4\n");
+  printf("(e.g., 198.51.100.1/24) and the IPv6 prefix it maps to (e.g., 2001:db8:64::c633:6400,\n");
+  printf("a /120) to -6. The IPv4 prefix belongs on the LAN interface: the tun only gets our\n");
+  printf("address, and a default route. IPv6 prefixes of more than %d addresses must be routed\n",
+         MAX_ANYCAST_ADDRESSES);
+  printf("to this host.\n");
 }
 
 /* function: main
@@ -55,11 +80,18 @@ int main(int argc, char **argv) {
   struct tun_data tunnel;
   int opt;
   char *uplink_interface = NULL, *plat_prefix = NULL, *mark_str = NULL;
-  char *v4_addr = NULL, *v6_addr = NULL, *tunfd_str = NULL;
-  uint32_t mark   = MARK_UNSET;
+  char *v4_addr = NULL, *v6_addr = NULL, *tunfd_str = NULL, *shm_path = NULL;
+  char *workers_str = NULL, *udp_zero_csum_str = NULL, *acl_str = NULL;
+  char *rate_limit_str = NULL, *shadow_rate_str = NULL, *shadow_capture = NULL;
+  char *pacing_str = NULL, *debug_str = NULL;
+  struct tun_data workers[MAX_WORKERS - 1];
+  unsigned num_workers = 1;
+  int pin_cpus         = 0;
+  int uplink_aqm       = 0;
+  uint32_t mark        = MARK_UNSET;
   unsigned len;
 
-  while ((opt = getopt(argc, argv, "i:p:4:6:m:t:h")) != -1) {
+  while ((opt = getopt(argc, argv, "i:p:4:6:m:t:s:w:u:b:l:x:X:P:d:arqh")) != -1) {
     switch (opt) {
       case 'i':
         uplink_interface = optarg;
@@ -79,6 +111,42 @@ int main(int argc, char **argv) {
       case 't':
         tunfd_str = optarg;
         break;
+      case 's':
+        shm_path = optarg;
+        break;
+      case 'w':
+        workers_str = optarg;
+        break;
+      case 'u':
+        udp_zero_csum_str = optarg;
+        break;
+      case 'b':
+        acl_str = optarg;
+        break;
+      case 'l':
+        rate_limit_str = optarg;
+        break;
+      case 'x':
+        shadow_rate_str = optarg;
+        break;
+      case 'X':
+        shadow_capture = optarg;
+        break;
+      case 'P':
+        pacing_str = optarg;
+        break;
+      case 'd':
+        debug_str = optarg;
+        break;
+      case 'a':
+        pin_cpus = 1;
+        break;
+      case 'r':
+        enable_tcp_monitor();
+        break;
+      case 'q':
+        uplink_aqm = 1;
+        break;
       case 'h':
         print_help();
         exit(0);
@@ -98,6 +166,50 @@ int main(int argc, char **argv) {
     exit(1);
   }
 
+  if (workers_str != NULL &&
+      (!parse_unsigned(workers_str, &num_workers) || num_workers < 1 || num_workers > MAX_WORKERS)) {
+    logmsg(ANDROID_LOG_FATAL, "invalid number of workers %s", workers_str);
+    exit(1);
+  }
+
+  if (udp_zero_csum_str != NULL &&
+      !parse_udp_zero_csum_policy(udp_zero_csum_str, &Global_Clatd_Config.udp_zero_csum)) {
+    logmsg(ANDROID_LOG_FATAL, "invalid UDP zero checksum policy %s", udp_zero_csum_str);
+    exit(1);
+  }
+
+  if (acl_str != NULL && !enable_acl(acl_str)) {
+    logmsg(ANDROID_LOG_FATAL, "invalid blocking rules %s", acl_str);
+    exit(1);
+  }
+
+  if (rate_limit_str != NULL && !enable_rate_limit(rate_limit_str)) {
+    logmsg(ANDROID_LOG_FATAL, "invalid rate limits %s", rate_limit_str);
+    exit(1);
+  }
+
+  if (shadow_rate_str != NULL) {
+    unsigned rate;
+    if (!parse_unsigned(shadow_rate_str, &rate) || rate < 1) {
+      logmsg(ANDROID_LOG_FATAL, "invalid verification rate %s", shadow_rate_str);
+      exit(1);
+    }
+    if (!enable_shadow(rate, shadow_capture)) {
+      exit(1);
+    }
+  }
+
+  if (debug_str != NULL && !enable_debug(debug_str)) {
+    logmsg(ANDROID_LOG_FATAL, "invalid debug tracing %s", debug_str);
+    exit(1);
+  }
+
+  unsigned pacing_max_kbps = 0;
+  if (pacing_str != NULL && !parse_unsigned(pacing_str, &pacing_max_kbps)) {
+    logmsg(ANDROID_LOG_FATAL, "invalid pacing rate %s", pacing_str);
+    exit(1);
+  }
+
   if (tunfd_str != NULL && !parse_int(tunfd_str, &tunnel.fd4)) {
     logmsg(ANDROID_LOG_FATAL, "invalid tunfd %s", tunfd_str);
     exit(1);
@@ -118,11 +230,25 @@ int main(int argc, char **argv) {
          plat_prefix ? plat_prefix : "(none)", v4_addr ? v4_addr : "(none)",
          v6_addr ? v6_addr : "(none)");
 
+  shm_channel_init(&tunnel.shm);
+  placement_init(&tunnel.placement, uplink_interface, pin_cpus);
+  if (shm_path != NULL && !shm_listen(&tunnel.shm, shm_path)) {
+    exit(1);
+  }
+
   // run under a regular user but keep needed capabilities
   drop_root_but_keep_caps();
 
   // open our raw sockets before dropping privs
   open_sockets(&tunnel, mark);
+  if (uplink_aqm) {
+    enable_uplink_aqm(tunnel.write_fd6);
+  }
+  if (pacing_str != NULL) {
+    enable_uplink_pacing(tunnel.write_fd6, pacing_max_kbps);
+  }
+  enable_udp_gro(tunnel.fd4);
+  open_worker_sockets(&tunnel, workers, num_workers - 1);
 
   // keeps only admin capability
   set_capability(1 << CAP_NET_ADMIN);
@@ -137,11 +263,22 @@ int main(int argc, char **argv) {
     logmsg(ANDROID_LOG_FATAL, "sigterm handler failed: %s", strerror(errno));
     exit(1);
   }
+  if (signal(SIGUSR1, request_stats) == SIG_ERR) {
+    logmsg(ANDROID_LOG_FATAL, "sigusr1 handler failed: %s", strerror(errno));
+    exit(1);
+  }
+  if (signal(SIGUSR2, request_debug_toggle) == SIG_ERR) {
+    logmsg(ANDROID_LOG_FATAL, "sigusr2 handler failed: %s", strerror(errno));
+    exit(1);
+  }
 
+  log_memory_budget(&tunnel, num_workers);
+  start_workers(&tunnel, workers, num_workers - 1);
   event_loop(&tunnel);
 
   logmsg(ANDROID_LOG_INFO, "Shutting down clat on %s", uplink_interface);
   del_anycast_address(tunnel.write_fd6, &Global_Clatd_Config.ipv6_local_subnet);
+  shm_close(&tunnel.shm);
 
   return 0;
 }
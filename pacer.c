@@ -0,0 +1,104 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * pacer.c - spacing out translated uplink bursts with SO_TXTIME
+ */
+#include <stdlib.h>
+
+#include "pacer.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+
+/* function: pacer_create
+ * allocates a pacer that has not measured anything yet
+ *   max_rate - most bytes per second to pace at, or 0 for no cap
+ * returns: the pacer, or NULL if out of memory
+ */
+struct pacer *pacer_create(uint64_t max_rate) {
+  struct pacer *pacer = calloc(1, sizeof(*pacer));
+  if (pacer) {
+    pacer->max_rate = max_rate;
+  }
+  return pacer;
+}
+
+/* function: pacer_rate
+ * returns the rate packets are currently spaced at, in bytes per second, or 0 if they are not
+ *   pacer - the pacer
+ */
+uint64_t pacer_rate(const struct pacer *pacer) {
+  if (!pacer->rate) {
+    return pacer->max_rate;
+  }
+  uint64_t rate = pacer->rate * PACER_GAIN;
+  if (rate < PACER_MIN_RATE) {
+    rate = PACER_MIN_RATE;
+  }
+  if (pacer->max_rate && rate > pacer->max_rate) {
+    rate = pacer->max_rate;
+  }
+  return rate;
+}
+
+/* function: measure
+ * counts a packet towards the uplink rate. When a window is over, a higher rate is taken at once
+ * and a lower one smoothed in, so that a burst right after a quiet window is not held back much.
+ *   pacer - the pacer
+ *   now   - current CLOCK_MONOTONIC time, in nanoseconds, the clock fq expects departure times in
+ *   len   - size of the packet
+ */
+static void measure(struct pacer *pacer, uint64_t now, size_t len) {
+  if (!pacer->window_start) {
+    pacer->window_start = now;
+  }
+  pacer->window_bytes += len;
+
+  uint64_t elapsed = now - pacer->window_start;
+  if (elapsed < PACER_WINDOW) {
+    return;
+  }
+  uint64_t sample     = pacer->window_bytes * NSEC_PER_SEC / elapsed;
+  pacer->rate         = sample > pacer->rate ? sample : (pacer->rate * 3 + sample) / 4;
+  pacer->window_start = now;
+  pacer->window_bytes = 0;
+}
+
+/* function: pacer_departure
+ * measures a packet and returns when it should leave: now if the pacer is caught up, or once the
+ * packets before it have gone out at the pacing rate
+ *   pacer - the pacer
+ *   now   - current CLOCK_MONOTONIC time, in nanoseconds, the clock fq expects departure times in
+ *   len   - size of the packet
+ * returns: the departure time for SCM_TXTIME, in nanoseconds, CLOCK_MONOTONIC
+ */
+uint64_t pacer_departure(struct pacer *pacer, uint64_t now, size_t len) {
+  measure(pacer, now, len);
+  pacer->packets++;
+
+  uint64_t rate = pacer_rate(pacer);
+  if (!rate) {
+    return now;
+  }
+
+  uint64_t departure = pacer->next_departure > now ? pacer->next_departure : now;
+  if (departure > now + PACER_MAX_DELAY) {
+    departure = now + PACER_MAX_DELAY;
+  }
+  if (departure > now) {
+    pacer->delayed++;
+  }
+  pacer->next_departure = departure + len * NSEC_PER_SEC / rate;
+  return departure;
+}
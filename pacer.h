@@ -0,0 +1,64 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * pacer.h - spacing out translated uplink bursts with SO_TXTIME
+ *
+ * The IPv4 stack often hands clatd a burst of packets at once, e.g., when a TCP window opens, and
+ * sending them back to back can overrun the shallow buffers of a cellular modem. With -P, every
+ * uplink packet is sent with an SCM_TXTIME departure time, and the uplink's qdisc holds it until
+ * then if it is fq or etf. Other qdiscs ignore departure times.
+ *
+ * Departures are spaced at PACER_GAIN times the uplink rate measured over the last PACER_WINDOW,
+ * optionally capped at a configured rate such as the modem's. A steady sender is never held back,
+ * but a burst is spread out over the time it would take at that rate. Until there is a
+ * measurement, packets are only paced if there is a cap. The rate is measured across all flows:
+ * every packet leaves through the same raw socket, which fq treats as one flow anyway.
+ */
+#ifndef __PACER_H__
+#define __PACER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// How long the uplink rate is measured over, in nanoseconds.
+#define PACER_WINDOW 100000000ULL
+
+// Pacing rate, as a multiple of the measured rate. Enough for TCP slow start to keep growing.
+#define PACER_GAIN 2
+
+// Slowest pacing rate, in bytes per second, so that a low measurement after an idle period does not
+// hold back the next burst for long.
+#define PACER_MIN_RATE 125000
+
+// Latest departure time, in nanoseconds from now. fq drops packets too far in the future.
+#define PACER_MAX_DELAY 50000000ULL
+
+struct pacer {
+  uint64_t max_rate;  // bytes per second, or 0 for no cap
+  uint64_t rate;      // measured bytes per second, or 0 before the first measurement
+
+  uint64_t window_start;  // nanoseconds, CLOCK_MONOTONIC
+  uint64_t window_bytes;
+  uint64_t next_departure;  // earliest departure time of the next packet
+
+  uint64_t packets;  // packets stamped
+  uint64_t delayed;  // of which were held back
+};
+
+struct pacer *pacer_create(uint64_t max_rate);
+uint64_t pacer_rate(const struct pacer *pacer);
+uint64_t pacer_departure(struct pacer *pacer, uint64_t now, size_t len);
+
+#endif /* __PACER_H__ */
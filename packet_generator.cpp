@@ -0,0 +1,348 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * packet_generator.cpp - synthetic traffic for tests and benchmarks
+ */
+
+#include "packet_generator.h"
+
+#include <arpa/inet.h>
+#include <netinet/icmp6.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <string.h>
+
+#include <algorithm>
+
+extern "C" {
+#include "netutils/checksum.h"
+}
+
+namespace clat_test {
+
+void set_l4_checksum(Packet &p, size_t offset, uint8_t proto) {
+  uint32_t sum = 0;
+  size_t len   = p.size() - offset;
+  if (p[0] >> 4 == 4) {
+    if (proto != IPPROTO_ICMP) {
+      sum = ipv4_pseudo_header_checksum((const struct iphdr *)p.data(), len);
+    }
+  } else {
+    sum = ipv6_pseudo_header_checksum((const struct ip6_hdr *)p.data(), len, proto);
+  }
+  size_t field = proto == IPPROTO_TCP ? 16 : proto == IPPROTO_UDP ? 6 : 2;
+  p[offset + field] = p[offset + field + 1] = 0;
+  uint16_t check = ip_checksum_finish(ip_checksum_add(sum, p.data() + offset, len));
+  memcpy(&p[offset + field], &check, sizeof(check));
+}
+
+Packet with_checksum(Packet p, size_t offset, uint8_t proto) {
+  set_l4_checksum(p, offset, proto);
+  return p;
+}
+
+Packet ipv4(uint8_t proto, const Packet &l4, const char *src, const char *dst, size_t optlen,
+            uint16_t frag_off) {
+  size_t hdrlen = sizeof(struct iphdr) + optlen;
+  Packet p(hdrlen + l4.size());
+  struct iphdr *ip = (struct iphdr *)p.data();
+  ip->version      = 4;
+  ip->ihl          = hdrlen / 4;
+  ip->tot_len      = htons(p.size());
+  ip->id           = htons(0x1234);
+  ip->frag_off     = htons(frag_off);
+  ip->ttl          = 64;
+  ip->protocol     = proto;
+  inet_pton(AF_INET, src, &ip->saddr);
+  inet_pton(AF_INET, dst, &ip->daddr);
+  memset(&p[sizeof(struct iphdr)], IPOPT_NOP, optlen);
+  ip->check = ip_checksum(ip, hdrlen);
+  memcpy(&p[hdrlen], l4.data(), l4.size());
+  return p;
+}
+
+Packet ipv6(uint8_t nxt, const Packet &l4, const char *src, const char *dst, uint8_t ext_type) {
+  size_t extlen = ext_type ? 8 : 0;
+  Packet p(sizeof(struct ip6_hdr) + extlen + l4.size());
+  struct ip6_hdr *ip6 = (struct ip6_hdr *)p.data();
+  ip6->ip6_flow       = htonl(6 << 28);
+  ip6->ip6_plen       = htons(p.size() - sizeof(*ip6));
+  ip6->ip6_nxt        = ext_type ? ext_type : nxt;
+  ip6->ip6_hlim       = 64;
+  inet_pton(AF_INET6, src, &ip6->ip6_src);
+  inet_pton(AF_INET6, dst, &ip6->ip6_dst);
+  if (ext_type) {
+    // Next header, length in 8-byte units not counting the first, and a 4-byte PadN option.
+    const uint8_t ext[] = { nxt, 0, 1, 4, 0, 0, 0, 0 };
+    memcpy(&p[sizeof(*ip6)], ext, sizeof(ext));
+  }
+  memcpy(&p[sizeof(*ip6) + extlen], l4.data(), l4.size());
+  return p;
+}
+
+Packet udp(size_t payload_len, uint16_t sport, uint16_t dport) {
+  Packet l4(sizeof(struct udphdr) + payload_len, 'x');
+  struct udphdr *u = (struct udphdr *)l4.data();
+  u->source        = htons(sport);
+  u->dest          = htons(dport);
+  u->len           = htons(l4.size());
+  u->check         = 0;
+  return l4;
+}
+
+Packet tcp(size_t payload_len, uint16_t sport, uint16_t dport) {
+  struct tcphdr t;
+  memset(&t, 0, sizeof(t));
+  t.source = htons(sport);
+  t.dest   = htons(dport);
+  t.seq    = htonl(1);
+  t.doff   = sizeof(t) / 4;
+  t.ack    = 1;
+  t.window = htons(65535);
+  Packet l4(sizeof(t) + payload_len, 'x');
+  memcpy(l4.data(), &t, sizeof(t));
+  return l4;
+}
+
+Packet icmp_echo_request(size_t payload_len, uint16_t id) {
+  Packet l4(sizeof(struct icmphdr) + payload_len, 'x');
+  struct icmphdr *icmp   = (struct icmphdr *)l4.data();
+  icmp->type             = ICMP_ECHO;
+  icmp->code             = 0;
+  icmp->checksum         = 0;
+  icmp->un.echo.id       = htons(id);
+  icmp->un.echo.sequence = htons(1);
+  return l4;
+}
+
+Packet icmp6_echo_reply(size_t payload_len, uint16_t id) {
+  Packet l4(sizeof(struct icmp6_hdr) + payload_len, 'x');
+  struct icmp6_hdr *icmp6 = (struct icmp6_hdr *)l4.data();
+  icmp6->icmp6_type       = ICMP6_ECHO_REPLY;
+  icmp6->icmp6_code       = 0;
+  icmp6->icmp6_cksum      = 0;
+  icmp6->icmp6_id         = htons(id);
+  icmp6->icmp6_seq        = htons(1);
+  return l4;
+}
+
+Packet icmp_error(const Packet &inner) {
+  Packet l4(sizeof(struct icmphdr) + inner.size());
+  struct icmphdr *icmp = (struct icmphdr *)l4.data();
+  icmp->type           = ICMP_DEST_UNREACH;
+  icmp->code           = ICMP_PORT_UNREACH;
+  memcpy(&l4[sizeof(*icmp)], inner.data(), inner.size());
+  return l4;
+}
+
+Packet icmp6_error(const Packet &inner) {
+  Packet l4(sizeof(struct icmp6_hdr) + inner.size());
+  struct icmp6_hdr *icmp6 = (struct icmp6_hdr *)l4.data();
+  icmp6->icmp6_type       = ICMP6_DST_UNREACH;
+  icmp6->icmp6_code       = ICMP6_DST_UNREACH_NOPORT;
+  memcpy(&l4[sizeof(*icmp6)], inner.data(), inner.size());
+  return l4;
+}
+
+Packet ipv4_fragment(const Packet &datagram, size_t offset, size_t len) {
+  const struct iphdr *orig = (const struct iphdr *)datagram.data();
+  size_t hdrlen            = orig->ihl * 4;
+  bool more                = hdrlen + offset + len < datagram.size();
+
+  Packet p(hdrlen + len);
+  memcpy(p.data(), datagram.data(), hdrlen);
+  memcpy(&p[hdrlen], &datagram[hdrlen + offset], len);
+  struct iphdr *ip = (struct iphdr *)p.data();
+  ip->tot_len      = htons(p.size());
+  ip->frag_off     = htons((offset / 8) | (more ? IP_MF : 0));
+  ip->check        = 0;
+  ip->check        = ip_checksum(ip, hdrlen);
+  return p;
+}
+
+Packet ipv6_fragment(const Packet &datagram, size_t offset, size_t len, uint32_t ident) {
+  const struct ip6_hdr *orig = (const struct ip6_hdr *)datagram.data();
+  const size_t hdrlen        = sizeof(*orig);
+  bool more                  = hdrlen + offset + len < datagram.size();
+
+  Packet p(hdrlen + sizeof(struct ip6_frag) + len);
+  memcpy(p.data(), datagram.data(), hdrlen);
+  struct ip6_hdr *ip6   = (struct ip6_hdr *)p.data();
+  struct ip6_frag *frag = (struct ip6_frag *)(ip6 + 1);
+  ip6->ip6_plen         = htons(p.size() - hdrlen);
+  ip6->ip6_nxt          = IPPROTO_FRAGMENT;
+  frag->ip6f_nxt        = orig->ip6_nxt;
+  frag->ip6f_reserved   = 0;
+  frag->ip6f_offlg      = htons(offset) | (more ? IP6F_MORE_FRAG : 0);
+  frag->ip6f_ident      = htonl(ident);
+  memcpy(frag + 1, &datagram[hdrlen + offset], len);
+  return p;
+}
+
+const char *packet_kind_name(PacketKind kind) {
+  switch (kind) {
+    case PacketKind::kTcp:
+      return "tcp";
+    case PacketKind::kUdp:
+      return "udp";
+    case PacketKind::kIcmpEcho:
+      return "icmp_echo";
+    case PacketKind::kIcmpError:
+      return "icmp_error";
+    case PacketKind::kFragment:
+      return "fragment";
+    case PacketKind::kOptions:
+      return "options";
+    default:
+      return "unknown";
+  }
+}
+
+PacketGenerator::PacketGenerator(const TrafficMix &mix, uint32_t seed,
+                                 const GeneratorAddresses &addresses)
+    : mix_(mix),
+      addresses_(addresses),
+      rng_(seed),
+      kinds_(std::begin(mix.weights), std::end(mix.weights)) {}
+
+// Returns an IP packet size from the configured distribution, at least min.
+size_t PacketGenerator::NextSize(size_t min) {
+  size_t size;
+  switch (mix_.sizes) {
+    case SizeMix::kImix: {
+      static const size_t kSizes[] = { 40, 40, 40, 40, 40, 40, 40, 576, 576, 576, 576, 1500 };
+      size = kSizes[std::uniform_int_distribution<size_t>(0, std::size(kSizes) - 1)(rng_)];
+      break;
+    }
+    case SizeMix::kBulk:
+      size = std::uniform_int_distribution<int>(0, 2)(rng_) ? 1500 : 40;
+      break;
+    case SizeMix::kSmall:
+    default:
+      size = std::uniform_int_distribution<size_t>(min, std::max<size_t>(min, 128))(rng_);
+      break;
+  }
+  return std::max(size, min);
+}
+
+// A transport header and payload of the given kind with a zero checksum.
+Packet PacketGenerator::Transport(bool from_ipv6, PacketKind kind, size_t payload_len) {
+  uint16_t port = std::uniform_int_distribution<uint16_t>(32768, 60999)(rng_);
+  switch (kind) {
+    case PacketKind::kUdp:
+    case PacketKind::kFragment:
+      // Traffic from the network comes from the remote's well-known port.
+      return from_ipv6 ? udp(payload_len, 443, port) : udp(payload_len, port, 443);
+    case PacketKind::kIcmpEcho:
+      return from_ipv6 ? icmp6_echo_reply(payload_len, port) : icmp_echo_request(payload_len, port);
+    default:
+      return from_ipv6 ? tcp(payload_len, 443, port) : tcp(payload_len, port, 443);
+  }
+}
+
+Packet PacketGenerator::Build(bool from_ipv6, PacketKind kind, const char *remote4,
+                              const char *remote6) {
+  const char *src    = from_ipv6 ? remote6 : addresses_.ipv4_local;
+  const char *dst    = from_ipv6 ? addresses_.ipv6_local : remote4;
+  const size_t iphdr = from_ipv6 ? sizeof(struct ip6_hdr) : sizeof(struct iphdr);
+  const uint8_t icmp = from_ipv6 ? (uint8_t)IPPROTO_ICMPV6 : (uint8_t)IPPROTO_ICMP;
+  // UDP and ICMP headers are the same size.
+  const size_t l4hdr = kind == PacketKind::kTcp || kind == PacketKind::kOptions
+                         ? sizeof(struct tcphdr)
+                         : sizeof(struct udphdr);
+
+  auto build = [&](uint8_t proto, const Packet &l4, size_t optlen = 0, uint8_t ext = 0) {
+    Packet p = from_ipv6 ? ipv6(proto, l4, src, dst, ext) : ipv4(proto, l4, src, dst, optlen);
+    return with_checksum(p, p.size() - l4.size(), proto);
+  };
+  auto payload_len = [&]() { return NextSize(iphdr + l4hdr) - iphdr - l4hdr; };
+
+  switch (kind) {
+    case PacketKind::kUdp:
+      return build(IPPROTO_UDP, Transport(from_ipv6, kind, payload_len()));
+
+    case PacketKind::kIcmpEcho:
+      return build(icmp, Transport(from_ipv6, kind, payload_len()));
+
+    case PacketKind::kIcmpError: {
+      // An error about a UDP packet going the other way, truncated to the minimum MTU as a
+      // router would.
+      size_t size     = std::min<size_t>(from_ipv6 ? 1280 : 576, NextSize(2 * (iphdr + l4hdr)));
+      Packet inner_l4 = Transport(!from_ipv6, PacketKind::kUdp, size - 2 * (iphdr + l4hdr));
+      Packet inner    = from_ipv6 ? ipv6(IPPROTO_UDP, inner_l4, addresses_.ipv6_local, remote6)
+                                  : ipv4(IPPROTO_UDP, inner_l4, remote4, addresses_.ipv4_local);
+      inner           = with_checksum(inner, iphdr, IPPROTO_UDP);
+      return build(icmp, from_ipv6 ? icmp6_error(inner) : icmp_error(inner));
+    }
+
+    case PacketKind::kFragment: {
+      // A datagram twice the size, so that it takes at least two fragments, then either its first
+      // fragment or the rest.
+      size_t payload  = 2 * (NextSize(iphdr + l4hdr + 8) - iphdr);
+      Packet datagram = build(IPPROTO_UDP, Transport(from_ipv6, kind, payload - l4hdr));
+      size_t offset = 0, len = payload / 2 & ~7;
+      if (std::uniform_int_distribution<int>(0, 1)(rng_)) {
+        offset = len;
+        len    = payload - offset;
+      }
+      return from_ipv6 ? ipv6_fragment(datagram, offset, len)
+                       : ipv4_fragment(datagram, offset, len);
+    }
+
+    case PacketKind::kOptions: {
+      size_t optlen = from_ipv6 ? 8 : 4 * std::uniform_int_distribution<size_t>(1, 10)(rng_);
+      size_t size   = NextSize(iphdr + optlen + l4hdr);
+      Packet l4     = Transport(from_ipv6, PacketKind::kTcp, size - iphdr - optlen - l4hdr);
+      return build(IPPROTO_TCP, l4, optlen, from_ipv6 ? IPPROTO_DSTOPTS : 0);
+    }
+
+    case PacketKind::kTcp:
+    default:
+      return build(IPPROTO_TCP, Transport(from_ipv6, kind, payload_len()));
+  }
+}
+
+GeneratedPacket PacketGenerator::Next() {
+  // A remote in the benchmarking range, 198.18.0.0/15, and its address behind the NAT64.
+  struct in_addr remote4;
+  struct in6_addr remote6;
+  remote4.s_addr = htonl(0xc6120000 | std::uniform_int_distribution<uint32_t>(1, 0x1fffe)(rng_));
+  inet_pton(AF_INET6, addresses_.plat_prefix, &remote6);
+  memcpy(&remote6.s6_addr[12], &remote4, sizeof(remote4));
+  char remote4_str[INET_ADDRSTRLEN], remote6_str[INET6_ADDRSTRLEN];
+  inet_ntop(AF_INET, &remote4, remote4_str, sizeof(remote4_str));
+  inet_ntop(AF_INET6, &remote6, remote6_str, sizeof(remote6_str));
+
+  GeneratedPacket generated;
+  generated.kind    = (PacketKind)kinds_(rng_);
+  bool from_ipv6    = std::bernoulli_distribution(mix_.ipv6_fraction)(rng_);
+  generated.to_ipv6 = !from_ipv6;
+  generated.packet  = Build(from_ipv6, generated.kind, remote4_str, remote6_str);
+  return generated;
+}
+
+std::vector<GeneratedPacket> PacketGenerator::Generate(size_t count) {
+  std::vector<GeneratedPacket> packets;
+  packets.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    packets.push_back(Next());
+  }
+  return packets;
+}
+
+}  // namespace clat_test
@@ -0,0 +1,121 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * packet_generator.h - synthetic traffic for tests and benchmarks
+ *
+ * Packet builders, and a seedable generator of valid IPv4 packets from the local IPv4 address and
+ * IPv6 packets to the local IPv6 address, i.e., of the packets clatd translates. Every packet has
+ * correct IP and transport checksums, so a translated packet with a bad checksum is a bug in the
+ * translation.
+ */
+#ifndef __PACKET_GENERATOR_H__
+#define __PACKET_GENERATOR_H__
+
+#include <stdint.h>
+
+#include <random>
+#include <vector>
+
+namespace clat_test {
+
+typedef std::vector<uint8_t> Packet;
+
+// Sets the transport checksum of an IPv4 or IPv6 packet whose transport header starts at offset.
+void set_l4_checksum(Packet &p, size_t offset, uint8_t proto);
+Packet with_checksum(Packet p, size_t offset, uint8_t proto);
+
+// IP headers around a transport payload. optlen bytes of IPv4 NOP options are added after the
+// IPv4 header. ext_type, if nonzero, adds an 8-byte IPv6 extension header of that type.
+Packet ipv4(uint8_t proto, const Packet &l4, const char *src, const char *dst, size_t optlen = 0,
+            uint16_t frag_off = 0);
+Packet ipv6(uint8_t nxt, const Packet &l4, const char *src, const char *dst, uint8_t ext_type = 0);
+
+// Transport headers followed by payload_len bytes of payload, with a zero checksum.
+Packet udp(size_t payload_len, uint16_t sport = 51339, uint16_t dport = 443);
+Packet tcp(size_t payload_len, uint16_t sport = 51339, uint16_t dport = 443);
+Packet icmp_echo_request(size_t payload_len, uint16_t id = 1);
+Packet icmp6_echo_reply(size_t payload_len, uint16_t id = 1);
+
+// ICMP errors quoting inner, with a zero checksum.
+Packet icmp_error(const Packet &inner);
+Packet icmp6_error(const Packet &inner);
+
+// Cuts len bytes at offset, which must be a multiple of 8, out of the payload of an unfragmented
+// packet and returns them as a fragment.
+Packet ipv4_fragment(const Packet &datagram, size_t offset, size_t len);
+Packet ipv6_fragment(const Packet &datagram, size_t offset, size_t len, uint32_t ident = 0x1234);
+
+enum class PacketKind {
+  kTcp,
+  kUdp,
+  kIcmpEcho,
+  kIcmpError,  // ICMP errors quoting a packet of the opposite direction
+  kFragment,   // a first or later fragment of a UDP datagram
+  kOptions,    // IPv4 options, or an IPv6 destination options header. clatd drops the latter.
+  kNumKinds,
+};
+
+const char *packet_kind_name(PacketKind kind);
+
+// Distribution of IP packet sizes.
+enum class SizeMix {
+  kImix,   // 40, 576 and 1500 bytes in the ratio 7:4:1
+  kBulk,   // full-sized data packets and 40-byte acks in the ratio 2:1
+  kSmall,  // uniform between the smallest packet of each kind and 128 bytes
+};
+
+struct TrafficMix {
+  SizeMix sizes = SizeMix::kImix;
+  // Fraction of the packets that are IPv6 from the network rather than IPv4 from the local host.
+  double ipv6_fraction = 0.5;
+  // Relative weights of each kind of packet.
+  double weights[(int)PacketKind::kNumKinds] = { 60, 30, 2, 2, 3, 3 };
+};
+
+struct GeneratedPacket {
+  PacketKind kind;
+  int to_ipv6;  // the direction clatd translates the packet in
+  Packet packet;
+};
+
+// Addresses of the translator the generated packets go through.
+struct GeneratorAddresses {
+  const char *ipv4_local  = "192.0.0.4";
+  const char *ipv6_local  = "2001:db8:0:b11::464";
+  const char *plat_prefix = "64:ff9b::";
+};
+
+class PacketGenerator {
+ public:
+  PacketGenerator(const TrafficMix &mix, uint32_t seed,
+                  const GeneratorAddresses &addresses = GeneratorAddresses());
+
+  GeneratedPacket Next();
+  std::vector<GeneratedPacket> Generate(size_t count);
+
+ private:
+  size_t NextSize(size_t min);
+  Packet Transport(bool from_ipv6, PacketKind kind, size_t payload_len);
+  Packet Build(bool from_ipv6, PacketKind kind, const char *remote4, const char *remote6);
+
+  TrafficMix mix_;
+  GeneratorAddresses addresses_;
+  std::mt19937 rng_;
+  std::discrete_distribution<int> kinds_;
+};
+
+}  // namespace clat_test
+
+#endif /* __PACKET_GENERATOR_H__ */
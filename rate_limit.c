@@ -0,0 +1,200 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * rate_limit.c - token buckets for downlink packets that are expensive to translate
+ */
+#include <string.h>
+
+#include "clatd.h"
+#include "common.h"
+#include "rate_limit.h"
+
+// One packet, in the units of token_bucket.tokens.
+#define PACKET_TOKENS 1000000ULL
+
+const char *const rate_limit_class_names[RATE_LIMIT_CLASSES] = {
+  [RATE_LIMIT_ICMP_ERROR]    = "icmp",
+  [RATE_LIMIT_UDP_ZERO_CSUM] = "udp0",
+  [RATE_LIMIT_FRAGMENT]      = "frag",
+};
+
+/* function: rate_limit_init
+ * initializes rate limits that let everything through
+ *   limit    - the rate limits
+ *   hash_key - key for hashing sources to their buckets
+ */
+void rate_limit_init(struct rate_limit *limit, uint32_t hash_key) {
+  memset(limit, 0, sizeof(*limit));
+  limit->hash_key = hash_key;
+}
+
+/* function: burst_tokens
+ * returns how many tokens a bucket refilled at a rate holds at most
+ *   rate - packets per second
+ */
+static uint64_t burst_tokens(uint32_t rate) {
+  uint64_t burst = (uint64_t)rate * RATE_LIMIT_BURST_MS * (PACKET_TOKENS / 1000);
+  return burst > PACKET_TOKENS ? burst : PACKET_TOKENS;
+}
+
+/* function: rate_limit_set
+ * sets the limits of a class and fills its buckets
+ *   limit       - the rate limits
+ *   class_id    - RATE_LIMIT_ICMP_ERROR, RATE_LIMIT_UDP_ZERO_CSUM or RATE_LIMIT_FRAGMENT
+ *   rate        - packets per second, or 0 for no limit
+ *   source_rate - packets per second from each source, or 0 for no limit
+ */
+void rate_limit_set(struct rate_limit *limit, int class_id, uint32_t rate, uint32_t source_rate) {
+  struct rate_limit_class *c = &limit->classes[class_id];
+  c->rate                    = rate;
+  c->source_rate             = source_rate;
+  c->bucket                  = (struct token_bucket){ burst_tokens(rate), 0 };
+  for (int i = 0; i < RATE_LIMIT_SOURCE_BUCKETS; i++) {
+    c->sources[i] = (struct token_bucket){ burst_tokens(source_rate), 0 };
+  }
+}
+
+/* function: take_token
+ * refills a bucket for the time since it was last refilled and takes a packet's worth of tokens
+ *   bucket - the bucket
+ *   rate   - packets per second
+ *   now    - current time, in microseconds
+ *   returns: 1 if the bucket had enough tokens, 0 if the packet is over the limit
+ */
+static int take_token(struct token_bucket *bucket, uint32_t rate, uint64_t now) {
+  uint64_t burst   = burst_tokens(rate);
+  uint64_t elapsed = now > bucket->last ? now - bucket->last : 0;
+
+  // A second refills any bucket, and capping elapsed keeps the product below from overflowing.
+  if (elapsed >= 1000000) {
+    bucket->tokens = burst;
+  } else {
+    bucket->tokens += elapsed * rate;
+    if (bucket->tokens > burst) {
+      bucket->tokens = burst;
+    }
+  }
+  if (now > bucket->last) {
+    bucket->last = now;
+  }
+
+  if (bucket->tokens < PACKET_TOKENS) {
+    return 0;
+  }
+  bucket->tokens -= PACKET_TOKENS;
+  return 1;
+}
+
+/* function: source_bucket
+ * returns the index of the bucket a source address is limited by. Hosts usually control a whole
+ * /64, so only the first 64 bits count.
+ *   key - hash key
+ *   src - source address
+ */
+static uint32_t source_bucket(uint32_t key, const struct in6_addr *src) {
+  uint32_t hash = key;
+  for (int i = 0; i < 2; i++) {
+    hash = (hash ^ src->s6_addr32[i]) * 0x9e3779b1;
+    hash ^= hash >> 16;
+  }
+  return hash % RATE_LIMIT_SOURCE_BUCKETS;
+}
+
+/* function: rate_limit_allow_at
+ * decides whether a packet of a limited class is translated or dropped, and counts it. The source's
+ * bucket is checked first, so that packets a source sends over its limit do not use up the class's
+ * tokens.
+ *   limit    - the rate limits
+ *   now      - current time, in microseconds
+ *   class_id - the class of the packet
+ *   src      - source address of the packet
+ *   returns: 1 if the packet is within the limits, 0 if it should be dropped
+ */
+int rate_limit_allow_at(struct rate_limit *limit, uint64_t now, int class_id,
+                        const struct in6_addr *src) {
+  struct rate_limit_class *c = &limit->classes[class_id];
+
+  if (c->source_rate &&
+      !take_token(&c->sources[source_bucket(limit->hash_key, src)], c->source_rate, now)) {
+    c->dropped_source++;
+    return 0;
+  }
+  if (c->rate && !take_token(&c->bucket, c->rate, now)) {
+    c->dropped_class++;
+    return 0;
+  }
+  c->passed++;
+  return 1;
+}
+
+/* function: rate_limit_allow
+ * rate_limit_allow_at, at the current time. Classes without limits do not read the clock.
+ *   limit    - the rate limits
+ *   class_id - the class of the packet
+ *   src      - source address of the packet
+ *   returns: 1 if the packet is within the limits, 0 if it should be dropped
+ */
+int rate_limit_allow(struct rate_limit *limit, int class_id, const struct in6_addr *src) {
+  struct rate_limit_class *c = &limit->classes[class_id];
+  if (!c->rate && !c->source_rate) {
+    c->passed++;
+    return 1;
+  }
+  // The coarse clock's resolution of a few milliseconds is fine for refilling buckets, and it is
+  // cheaper to read than the precise clock.
+  return rate_limit_allow_at(limit, clat_clock_us(CLOCK_MONOTONIC_COARSE), class_id, src);
+}
+
+/* function: parse_rate_limit
+ * parses a comma-separated list of limits: "class:rate[:source_rate]", where class is "icmp",
+ * "udp0" or "frag" (see rate_limit.h), and the rates are in packets per second for the whole
+ * class and for each source /64, e.g., "icmp:1000:100,frag:20000". A rate of 0 is no limit.
+ *   str   - the string to parse
+ *   limit - the rate limits to write to
+ *   returns: 1 on success, 0 on failure
+ */
+int parse_rate_limit(const char *str, struct rate_limit *limit) {
+  char buf[256], *saveptr, *item;
+  int num_limits = 0;
+
+  rate_limit_init(limit, limit->hash_key);
+  if (strlen(str) >= sizeof(buf)) {
+    return 0;
+  }
+  strcpy(buf, str);
+
+  for (item = strtok_r(buf, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+    char *field_saveptr;
+    char *name        = strtok_r(item, ":", &field_saveptr);
+    char *rate        = strtok_r(NULL, ":", &field_saveptr);
+    char *source_rate = strtok_r(NULL, ":", &field_saveptr);
+    unsigned rate_num, source_rate_num = 0;
+    int class_id;
+
+    for (class_id = 0; class_id < RATE_LIMIT_CLASSES; class_id++) {
+      if (name && !strcmp(name, rate_limit_class_names[class_id])) {
+        break;
+      }
+    }
+    if (class_id == RATE_LIMIT_CLASSES || !rate || !parse_unsigned(rate, &rate_num) ||
+        (source_rate && !parse_unsigned(source_rate, &source_rate_num)) ||
+        strtok_r(NULL, ":", &field_saveptr)) {
+      return 0;
+    }
+    rate_limit_set(limit, class_id, rate_num, source_rate_num);
+    num_limits++;
+  }
+  return num_limits > 0;
+}
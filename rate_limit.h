@@ -0,0 +1,75 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * rate_limit.h - token buckets for downlink packets that are expensive to translate
+ *
+ * Some packets from the network cost much more to translate than others. ICMPv6 errors are
+ * accepted from any source, carry a packet that is translated too, and get a checksum computed over
+ * the whole translated packet. Zero UDP checksums are computed over the whole payload. Fragments
+ * cannot be matched on ports and are cheap for a sender to multiply. Each of these classes gets a
+ * token bucket for all of its packets and a table of buckets per source /64, so that one source
+ * cannot use up the budget of the class on its own. Packets over either limit are dropped before
+ * any work is done on them.
+ *
+ * The clock is only read for packets of a limited class. Each worker process has its own buckets.
+ */
+#ifndef __RATE_LIMIT_H__
+#define __RATE_LIMIT_H__
+
+#include <netinet/in.h>
+#include <stdint.h>
+
+#define RATE_LIMIT_ICMP_ERROR 0     // ICMPv6 errors
+#define RATE_LIMIT_UDP_ZERO_CSUM 1  // UDP datagrams whose zero checksum must be computed
+#define RATE_LIMIT_FRAGMENT 2       // fragments, first or not
+#define RATE_LIMIT_CLASSES 3
+
+// Per-source buckets of each class. Sources whose /64s hash alike share a bucket.
+#define RATE_LIMIT_SOURCE_BUCKETS 256
+
+// Buckets hold this many milliseconds' worth of packets, and at least one.
+#define RATE_LIMIT_BURST_MS 100
+
+struct token_bucket {
+  uint64_t tokens;  // millionths of a packet
+  uint64_t last;    // microseconds, when tokens was last refilled
+};
+
+struct rate_limit_class {
+  uint32_t rate;         // packets per second, or 0 for no limit
+  uint32_t source_rate;  // packets per second from each source, or 0 for no limit
+  struct token_bucket bucket;
+  struct token_bucket sources[RATE_LIMIT_SOURCE_BUCKETS];
+
+  uint64_t passed;
+  uint64_t dropped_source;  // dropped because their source was over its limit
+  uint64_t dropped_class;   // dropped because the class was over its limit
+};
+
+struct rate_limit {
+  uint32_t hash_key;  // random, so that senders cannot pick sources that share a bucket
+  struct rate_limit_class classes[RATE_LIMIT_CLASSES];
+};
+
+extern const char *const rate_limit_class_names[RATE_LIMIT_CLASSES];
+
+int parse_rate_limit(const char *str, struct rate_limit *limit);
+void rate_limit_init(struct rate_limit *limit, uint32_t hash_key);
+void rate_limit_set(struct rate_limit *limit, int class_id, uint32_t rate, uint32_t source_rate);
+int rate_limit_allow(struct rate_limit *limit, int class_id, const struct in6_addr *src);
+int rate_limit_allow_at(struct rate_limit *limit, uint64_t now, int class_id,
+                        const struct in6_addr *src);
+
+#endif /* __RATE_LIMIT_H__ */
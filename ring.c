@@ -27,7 +27,9 @@
 #include "config.h"
 #include "logging.h"
 #include "ring.h"
+#include "send.h"
 #include "translate.h"
+#include "udp_gro.h"
 
 #define TP_STATUS_CSUM_UNNECESSARY (1 << 7)
 
@@ -78,6 +80,8 @@ int ring_create(struct tun_data *tunnel) {
 
   ring->block    = 0;
   ring->slot     = 0;
+  ring->packets  = 0;
+  ring->drops    = 0;
   ring->numslots = TP_BLOCK_SIZE / TP_FRAME_SIZE;
   ring->next     = (struct tpacket2_hdr *)ring->base;
 
@@ -114,15 +118,23 @@ static struct tpacket2_hdr *ring_advance(struct packet_ring *ring) {
 }
 
 /* function: ring_read
- * reads a packet from the ring buffer and translates it
+ * reads up to RING_READ_BATCH packets from the ring buffer and translates them
  * read_fd  - file descriptor to read original packet from
  * write_fd - file descriptor to write translated packet to
  * to_ipv6  - whether the packet is to be translated to ipv6 or ipv4
+ * gro      - if not NULL, the tun has virtio-net headers and packets are written through
+ *            udp_gro_packet. Their frames are handed back to the kernel at the end of the batch,
+ *            once the datagrams held back have been written.
+ * returns: the number of packets read
  */
-void ring_read(struct packet_ring *ring, int write_fd, int to_ipv6) {
-  struct tpacket2_hdr *tp = ring->next;
-  uint16_t val = TP_CSUM_NONE;
-  if (tp->tp_status & TP_STATUS_USER) {
+CLAT_HOT int ring_read(struct packet_ring *ring, int write_fd, int to_ipv6, struct udp_gro *gro) {
+  struct tpacket2_hdr *tp = ring->next, *held[RING_READ_BATCH];
+  int count               = 0;
+  // The kernel writes the frame before handing it over in tp_status, and reads tp_status before
+  // reusing the frame.
+  while (count < RING_READ_BATCH &&
+         (__atomic_load_n(&tp->tp_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+    uint16_t val = TP_CSUM_NONE;
     //We expect only GRO coalesced packets to have TP_STATUS_CSUMNOTREADY
     //(ip_summed = CHECKSUM_PARTIAL) in this path. Note that these packets have already gone
     //through checksum validation in GRO engine. CHECKSUM_PARTIAL is defined to be 3 while
@@ -133,8 +145,38 @@ void ring_read(struct packet_ring *ring, int write_fd, int to_ipv6) {
       val = TP_CSUM_UNNECESSARY;
     }
     uint8_t *packet = ((uint8_t *) tp) + tp->tp_net;
-    translate_packet(write_fd, to_ipv6, packet, tp->tp_len, val);
-    tp->tp_status = TP_STATUS_KERNEL;
-    tp            = ring_advance(ring);
+    if (gro) {
+      udp_gro_packet(gro, &Global_Clatd_Config, write_fd, packet, tp->tp_len, val);
+      held[count] = tp;
+    } else {
+      translate_packet(&Global_Clatd_Config, write_fd, to_ipv6, packet, tp->tp_len, val);
+      __atomic_store_n(&tp->tp_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    }
+    tp = ring_advance(ring);
+    count++;
+  }
+  if (gro) {
+    udp_gro_flush(gro, write_fd);
+    for (int i = 0; i < count; i++) {
+      __atomic_store_n(&held[i]->tp_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    }
+  }
+  return count;
+}
+
+/* function: ring_update_stats
+ * adds the packets received and dropped since the last call to the ring's totals
+ * ring - packet ring buffer
+ * sock - the ring's packet socket
+ */
+void ring_update_stats(struct packet_ring *ring, int sock) {
+  struct tpacket_stats stats;
+  socklen_t len = sizeof(stats);
+  if (getsockopt(sock, SOL_PACKET, PACKET_STATISTICS, &stats, &len)) {
+    logmsg(ANDROID_LOG_WARN, "PACKET_STATISTICS failed: %s", strerror(errno));
+    return;
   }
+  // tp_packets includes the dropped packets.
+  ring->packets += stats.tp_packets;
+  ring->drops += stats.tp_drops;
 }
@@ -0,0 +1,151 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * send.c - translate packets and write them to the tun device or the raw socket
+ */
+#include <linux/if_ether.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "config.h"
+#include "send.h"
+#include "shadow.h"
+#include "translate.h"
+
+// Weak symbol so we can override it in the unit test.
+void send_rawv6(int fd, clat_packet out, int iov_len) __attribute__((weak));
+
+CLAT_HOT void send_rawv6(int fd, clat_packet out, int iov_len) {
+  // A send on a raw socket requires a destination address to be specified even if the socket's
+  // protocol is IPPROTO_RAW. This is the address that will be used in routing lookups; the
+  // destination address in the packet header only affects what appears on the wire, not where the
+  // packet is sent to.
+  static struct sockaddr_in6 sin6 = { AF_INET6, 0, 0, { { { 0, 0, 0, 0 } } }, 0 };
+  static struct msghdr msg        = {
+    .msg_name    = &sin6,
+    .msg_namelen = sizeof(sin6),
+  };
+
+  // There is no tun header on this path, so a non-empty first element is a flattened packet.
+  const struct iovec *iphdr = out[CLAT_POS_TUNHDR].iov_len ? &out[CLAT_POS_TUNHDR]
+                                                           : &out[CLAT_POS_IPHDR];
+  msg.msg_iov = out, msg.msg_iovlen = iov_len,
+  sin6.sin6_addr = ((struct ip6_hdr *)iphdr->iov_base)->ip6_dst;
+  sendmsg(fd, &msg, 0);
+}
+
+/* function: translate_packet_for_send
+ * translates a packet and fills in its tun header, as translate_and_send does, but leaves sending
+ * it to the caller
+ * config     - translation configuration
+ * to_ipv6    - true if translating to ipv6, false if translating to ipv4
+ * packet     - packet
+ * packetsize - size of packet
+ * start      - if not NULL, start of a writable buffer holding the packet, used to send the
+ *              translated packet as a single buffer
+ * skip_csum  - true if kernel has to skip checksum validation, false if it has to validate checksum.
+ * headers    - storage for the translated headers
+ * out        - output packet
+ * returns: the number of elements of out in use, or 0 if there is nothing to send
+ */
+CLAT_HOT int translate_packet_for_send(const struct clat_config *config, int to_ipv6,
+                                       const uint8_t *packet, size_t packetsize, uint8_t *start,
+                                       uint16_t skip_csum, struct clat_packet_headers *headers,
+                                       clat_packet out) {
+  // Only translations that produce a packet are verified: the iovec path ignores the
+  // blocking rules, so it can't tell a dropped packet from a bug.
+  int verify = config->shadow && shadow_sample(config->shadow, packet, packetsize);
+
+  int iov_len = translate_packet_iovec(config, to_ipv6, packet, packetsize, headers, out);
+  if (unlikely(iov_len <= 0)) {
+    return 0;
+  }
+
+  if (!to_ipv6) {
+    fill_tun_header(&headers->tun, ETH_P_IP, skip_csum);
+    out[CLAT_POS_TUNHDR].iov_len = sizeof(headers->tun);
+  }
+
+  if (start && clat_packet_flatten(out, iov_len, start)) {
+    iov_len = 1;
+  }
+
+  if (unlikely(verify)) {
+    shadow_verify(config->shadow, config, to_ipv6, out, iov_len);
+  }
+  return iov_len;
+}
+
+/* function: translate_and_send
+ * translates a packet and writes it to fd
+ * config     - translation configuration
+ * fd         - fd to write translated packet to
+ * to_ipv6    - true if translating to ipv6, false if translating to ipv4
+ * packet     - packet
+ * packetsize - size of packet
+ * start      - if not NULL, start of a writable buffer holding the packet, used to send the
+ *              translated packet as a single buffer
+ * skip_csum  - true if kernel has to skip checksum validation, false if it has to validate checksum.
+ */
+static CLAT_HOT void translate_and_send(const struct clat_config *config, int fd, int to_ipv6,
+                                        const uint8_t *packet, size_t packetsize, uint8_t *start,
+                                        uint16_t skip_csum) {
+  struct clat_packet_headers headers;
+  clat_packet out;
+
+  int iov_len = translate_packet_for_send(config, to_ipv6, packet, packetsize, start, skip_csum,
+                                          &headers, out);
+  if (!iov_len) {
+    return;
+  }
+
+  if (to_ipv6) {
+    send_rawv6(fd, out, iov_len);
+  } else {
+    writev(fd, out, iov_len);
+  }
+}
+
+/* function: translate_packet
+ * takes a packet, translates it, and writes it to fd
+ * config     - translation configuration
+ * fd         - fd to write translated packet to
+ * to_ipv6    - true if translating to ipv6, false if translating to ipv4
+ * packet     - packet
+ * packetsize - size of packet
+ * skip_csum  - true if kernel has to skip checksum validation, false if it has to validate checksum.
+ */
+CLAT_HOT void translate_packet(const struct clat_config *config, int fd, int to_ipv6,
+                               const uint8_t *packet, size_t packetsize, uint16_t skip_csum) {
+  translate_and_send(config, fd, to_ipv6, packet, packetsize, NULL, skip_csum);
+}
+
+/* function: translate_packet_headroom
+ * like translate_packet, but overwrites the packet and the headroom in front of it to write the
+ * translated packet as a single buffer. With CLAT_HEADROOM bytes of headroom this works for
+ * everything except ICMP errors, which fall back to the iovec of translate_packet.
+ * config     - translation configuration
+ * fd         - fd to write translated packet to
+ * to_ipv6    - true if translating to ipv6, false if translating to ipv4
+ * packet     - packet
+ * packetsize - size of packet
+ * headroom   - number of writable bytes in front of packet
+ * skip_csum  - true if kernel has to skip checksum validation, false if it has to validate checksum.
+ */
+CLAT_HOT void translate_packet_headroom(const struct clat_config *config, int fd, int to_ipv6,
+                                        uint8_t *packet, size_t packetsize, size_t headroom,
+                                        uint16_t skip_csum) {
+  translate_and_send(config, fd, to_ipv6, packet, packetsize, packet - headroom, skip_csum);
+}
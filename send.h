@@ -0,0 +1,45 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * send.h - translate packets and write them to the tun device or the raw socket
+ *
+ * These are the daemon's side of translation: they fill in tun headers, run shadow verification
+ * and make system calls, so they are not part of libclat.
+ */
+#ifndef __SEND_H__
+#define __SEND_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+
+struct clat_config;
+struct clat_packet_headers;
+
+// Translate packets and fill in their tun headers, for the caller to send.
+int translate_packet_for_send(const struct clat_config *config, int to_ipv6, const uint8_t *packet,
+                              size_t packetsize, uint8_t *start, uint16_t skip_csum,
+                              struct clat_packet_headers *headers, clat_packet out);
+
+// Translate and send packets.
+void translate_packet(const struct clat_config *config, int fd, int to_ipv6, const uint8_t *packet,
+                      size_t packetsize, uint16_t skip_csum);
+void translate_packet_headroom(const struct clat_config *config, int fd, int to_ipv6,
+                               uint8_t *packet, size_t packetsize, size_t headroom,
+                               uint16_t skip_csum);
+void send_rawv6(int fd, clat_packet out, int iov_len);
+
+#endif /* __SEND_H__ */
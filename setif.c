@@ -135,6 +135,61 @@ cleanup:
   return retval;
 }
 
+/* function: add_route
+ * adds a route through an interface, returns 0 on success and <0 on failure
+ * ifname    - name of interface to route through
+ * family    - address family (AF_INET, AF_INET6)
+ * dst       - pointer to a struct in_addr or in6_addr, the destination prefix
+ * prefixlen - bitlength of the destination prefix, 0 for a default route
+ * metric    - route priority, lower is preferred
+ */
+int add_route(const char *ifname, int family, const void *dst, int prefixlen, uint32_t metric) {
+  int retval;
+  size_t addr_size;
+  uint32_t ifindex;
+  struct rtmsg rt;
+  struct nl_msg *msg = NULL;
+
+  addr_size = inet_family_size(family);
+  if (addr_size == 0) {
+    retval = -EAFNOSUPPORT;
+    goto cleanup;
+  }
+
+  if (!(ifindex = if_nametoindex(ifname))) {
+    retval = -ENODEV;
+    goto cleanup;
+  }
+
+  memset(&rt, 0, sizeof(rt));
+  rt.rtm_family   = family;
+  rt.rtm_dst_len  = prefixlen;
+  rt.rtm_table    = RT_TABLE_MAIN;
+  rt.rtm_protocol = RTPROT_STATIC;
+  rt.rtm_scope    = RT_SCOPE_LINK;
+  rt.rtm_type     = RTN_UNICAST;
+
+  msg = nlmsg_alloc_rtmsg(RTM_NEWROUTE, NLM_F_ACK | NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL, &rt);
+  if (!msg) {
+    retval = -ENOMEM;
+    goto cleanup;
+  }
+
+  if ((prefixlen && nla_put(msg, RTA_DST, addr_size, dst) < 0) ||
+      nla_put(msg, RTA_OIF, sizeof(ifindex), &ifindex) < 0 ||
+      nla_put(msg, RTA_PRIORITY, sizeof(metric), &metric) < 0) {
+    retval = -ENOMEM;
+    goto cleanup;
+  }
+
+  retval = netlink_sendrecv(msg);
+
+cleanup:
+  if (msg) nlmsg_free(msg);
+
+  return retval;
+}
+
 static int do_anycast_setsockopt(int sock, int what, struct in6_addr *addr, int ifindex) {
   struct ipv6_mreq mreq = { *addr, ifindex };
   char *optname;
@@ -18,9 +18,12 @@
 #ifndef __SETIF_H__
 #define __SETIF_H__
 
+#include <stdint.h>
+
 int add_address(const char *ifname, int family, const void *address, int cidr,
                 const void *broadcast);
 int if_up(const char *ifname, int mtu);
+int add_route(const char *ifname, int family, const void *dst, int prefixlen, uint32_t metric);
 
 int add_anycast_address(int sock, const struct in6_addr *addr, const char *interface);
 int del_anycast_address(int sock, const struct in6_addr *addr);
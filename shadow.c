@@ -0,0 +1,181 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * shadow.c - checking translations against the reference path on live traffic
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "config.h"
+#include "logging.h"
+#include "shadow.h"
+#include "translate.h"
+
+// pcap file format, with raw IPv4 and IPv6 packets and no link-layer header.
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_LINKTYPE_RAW 101
+
+struct pcap_file_header {
+  uint32_t magic;
+  uint16_t version_major, version_minor;
+  int32_t thiszone;
+  uint32_t sigfigs, snaplen, linktype;
+};
+
+struct pcap_record_header {
+  uint32_t ts_sec, ts_usec, incl_len, orig_len;
+};
+
+/* function: shadow_create
+ * allocates shadow verification state
+ *   rate    - verify one packet in rate
+ *   capture - file to write mismatching packets to, or NULL
+ * returns: the state, or NULL if out of memory
+ */
+struct shadow *shadow_create(unsigned rate, FILE *capture) {
+  struct shadow *shadow = calloc(1, sizeof(*shadow));
+  if (!shadow) {
+    return NULL;
+  }
+  shadow->rate = shadow->countdown = rate;
+  shadow->capture                  = capture;
+
+  if (capture) {
+    struct pcap_file_header header = { PCAP_MAGIC, 2, 4, 0, 0, SHADOW_BUFSIZE, PCAP_LINKTYPE_RAW };
+    fwrite(&header, sizeof(header), 1, capture);
+    fflush(capture);
+  }
+  return shadow;
+}
+
+/* function: shadow_save_input
+ * keeps a copy of a packet whose translation will be verified
+ *   shadow - shadow verification state
+ *   packet - packet about to be translated
+ *   len    - size of packet
+ * returns: 1 if the packet was copied, 0 if it is too large to verify
+ */
+int shadow_save_input(struct shadow *shadow, const uint8_t *packet, size_t len) {
+  if (len > sizeof(shadow->input)) {
+    return 0;
+  }
+  memcpy(shadow->input, packet, len);
+  shadow->input_len = len;
+  return 1;
+}
+
+/* function: gather
+ * copies a clat_packet into a buffer
+ *   iov     - the packet
+ *   iov_len - number of elements in iov
+ *   skip    - number of bytes to leave out at the start
+ *   buf     - buffer of SHADOW_BUFSIZE bytes
+ * returns: number of bytes copied
+ */
+static size_t gather(const struct iovec *iov, int iov_len, size_t skip, uint8_t *buf) {
+  size_t len = 0;
+  for (int i = 0; i < iov_len; i++) {
+    const uint8_t *base = iov[i].iov_base;
+    size_t n            = iov[i].iov_len;
+    if (skip >= n) {
+      skip -= n;
+      continue;
+    }
+    base += skip;
+    n -= skip;
+    skip = 0;
+    if (n > SHADOW_BUFSIZE - len) {
+      n = SHADOW_BUFSIZE - len;
+    }
+    memcpy(buf + len, base, n);
+    len += n;
+  }
+  return len;
+}
+
+/* function: capture_packet
+ * appends a packet to the capture file
+ *   shadow - shadow verification state
+ *   packet - the packet
+ *   len    - size of packet
+ *   now    - timestamp
+ */
+static void capture_packet(struct shadow *shadow, const uint8_t *packet, size_t len,
+                           const struct timeval *now) {
+  struct pcap_record_header header = { now->tv_sec, now->tv_usec, len, len };
+  fwrite(&header, sizeof(header), 1, shadow->capture);
+  fwrite(packet, len, 1, shadow->capture);
+}
+
+/* function: shadow_verify
+ * translates the packet saved by shadow_sample with translate_packet_iovec, and compares the
+ * result with the translation that is about to be sent
+ *   shadow  - shadow verification state
+ *   config  - translation configuration
+ *   to_ipv6 - true if translating to ipv6, false if translating to ipv4
+ *   out     - the translation to be sent. On the downlink, it starts with a tun header.
+ *   iov_len - number of elements in out
+ * returns: 1 if the translations are identical, 0 otherwise
+ */
+int shadow_verify(struct shadow *shadow, const struct clat_config *config, int to_ipv6,
+                  const struct iovec *out, int iov_len) {
+  struct clat_config reference_config = *config;
+  struct clat_packet_headers headers;
+  clat_packet reference;
+  size_t primary_len, reference_len = 0;
+
+  reference_config.counters    = NULL;
+  reference_config.rate_limit  = NULL;
+  reference_config.tcp_monitor = NULL;
+  reference_config.acl         = NULL;
+  reference_config.shadow      = NULL;
+
+  primary_len = gather(out, iov_len, to_ipv6 ? 0 : sizeof(struct tun_pi), shadow->primary);
+  int reference_iov_len = translate_packet_iovec(&reference_config, to_ipv6, shadow->input,
+                                                 shadow->input_len, &headers, reference);
+  if (reference_iov_len > 0) {
+    reference_len = gather(reference, reference_iov_len, 0, shadow->reference);
+  }
+
+  shadow->verified++;
+  if (primary_len == reference_len && !memcmp(shadow->primary, shadow->reference, primary_len)) {
+    return 1;
+  }
+  shadow->mismatches++;
+
+  if (shadow->captured < SHADOW_MAX_CAPTURES) {
+    size_t diff = 0;
+    while (diff < primary_len && diff < reference_len &&
+           shadow->primary[diff] == shadow->reference[diff]) {
+      diff++;
+    }
+    logmsg(ANDROID_LOG_WARN,
+           "Shadow verification: %s translation of a %zu-byte packet differs from the reference "
+           "at byte %zu (%zu bytes, reference %zu bytes)",
+           to_ipv6 ? "IPv4 to IPv6" : "IPv6 to IPv4", shadow->input_len, diff, primary_len,
+           reference_len);
+    if (shadow->capture) {
+      struct timeval now;
+      gettimeofday(&now, NULL);
+      capture_packet(shadow, shadow->input, shadow->input_len, &now);
+      capture_packet(shadow, shadow->primary, primary_len, &now);
+      capture_packet(shadow, shadow->reference, reference_len, &now);
+      fflush(shadow->capture);
+    }
+    shadow->captured++;
+  }
+  return 0;
+}
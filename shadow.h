@@ -0,0 +1,84 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * shadow.h - verifying the flattened fast path against the iovec path on live traffic
+ *
+ * translate_packet_headroom builds the translated headers in the headroom of the read buffer,
+ * overwriting the input, and sends the packet as a single buffer. For one packet in every rate,
+ * translate_packet_for_send also translates a copy of the input with translate_packet_iovec and a
+ * configuration with no side effects (no counters, rate limits, TCP monitor or blocking rules),
+ * gathers the result into a scratch buffer, and compares it with what it is about to send. Both
+ * translations run translate_packet_iovec, so this catches bugs in flattening, in the tun header
+ * and in state shared between packets, not in the translation rules themselves. Packets that are
+ * not flattened, e.g., ICMP errors and the uplink queue's, are compared iovec to iovec.
+ *
+ * Only the primary translation is sent. Mismatches are counted, and the first SHADOW_MAX_CAPTURES
+ * are written to a pcap file as three packets: the input, the primary translation and the
+ * reference translation from the iovec path.
+ */
+#ifndef __SHADOW_H__
+#define __SHADOW_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/uio.h>
+
+#include "clatd.h"
+
+// Large enough for any translation of a MAXMRU-byte packet, including an ICMP error, whose
+// quoted packet grows too.
+#define SHADOW_BUFSIZE (MAXMRU + 256)
+
+// Maximum number of mismatches written to the capture file.
+#define SHADOW_MAX_CAPTURES 100
+
+struct clat_config;
+
+struct shadow {
+  unsigned rate;       // verify one packet in rate
+  unsigned countdown;  // packets until the next sample
+  FILE *capture;       // pcap file, or NULL
+  unsigned captured;   // mismatches logged, and written to capture
+
+  uint64_t verified, mismatches;
+
+  size_t input_len;
+  uint8_t input[SHADOW_BUFSIZE];
+  uint8_t primary[SHADOW_BUFSIZE];
+  uint8_t reference[SHADOW_BUFSIZE];
+};
+
+struct shadow *shadow_create(unsigned rate, FILE *capture);
+int shadow_save_input(struct shadow *shadow, const uint8_t *packet, size_t len);
+int shadow_verify(struct shadow *shadow, const struct clat_config *config, int to_ipv6,
+                  const struct iovec *out, int iov_len);
+
+/* function: shadow_sample
+ * decides whether to verify the translation of a packet, and if so, keeps a copy of it, since
+ * translate_packet_headroom overwrites the input
+ *   shadow - shadow verification state
+ *   packet - packet about to be translated
+ *   len    - size of packet
+ * returns: 1 if the translation should be verified
+ */
+static inline int shadow_sample(struct shadow *shadow, const uint8_t *packet, size_t len) {
+  if (--shadow->countdown > 0) {
+    return 0;
+  }
+  shadow->countdown = shadow->rate;
+  return shadow_save_input(shadow, packet, len);
+}
+
+#endif /* __SHADOW_H__ */
@@ -0,0 +1,352 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * shm_ring.c - shared memory packet rings for userspace dataplanes
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <private/android_filesystem_config.h>  // For AID_CLAT.
+
+#include "libclat.h"
+#include "logging.h"
+#include "shm_ring.h"
+
+/* function: shm_ring_reserve
+ * returns the next slot the producer can write into, or NULL if the ring is full
+ * ring  - ring to produce into
+ * slots - the ring's slots
+ */
+struct shm_slot *shm_ring_reserve(struct shm_ring *ring, struct shm_slot *slots) {
+  uint32_t head = ring->head;
+  uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  if (head - tail >= SHM_RING_SLOTS) {
+    return NULL;
+  }
+  return &slots[head & (SHM_RING_SLOTS - 1)];
+}
+
+/* function: shm_ring_commit
+ * hands the slot returned by shm_ring_reserve to the consumer
+ * ring - ring to produce into
+ */
+void shm_ring_commit(struct shm_ring *ring) {
+  __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/* function: shm_ring_peek
+ * returns the next slot the consumer can read from, or NULL if the ring is empty
+ * ring  - ring to consume from
+ * slots - the ring's slots
+ */
+struct shm_slot *shm_ring_peek(struct shm_ring *ring, struct shm_slot *slots) {
+  uint32_t tail = ring->tail;
+  uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  if (head == tail) {
+    return NULL;
+  }
+  return &slots[tail & (SHM_RING_SLOTS - 1)];
+}
+
+/* function: shm_ring_release
+ * hands the slot returned by shm_ring_peek back to the producer
+ * ring - ring to consume from
+ */
+void shm_ring_release(struct shm_ring *ring) {
+  __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+/* function: shm_translate
+ * translates packets from the to_clat ring into the from_clat ring until one of them runs out, or
+ * budget packets have been consumed
+ * config   - translation configuration
+ * region   - shared memory region
+ * counters - where to count what happened to each packet
+ * budget   - maximum number of packets to consume from to_clat
+ * returns: the number of translated packets written to from_clat
+ */
+int shm_translate(const struct clat_config *config, struct shm_region *region,
+                  struct shm_counters *counters, int budget) {
+  uint8_t packet[sizeof(region->to_clat_slots[0].data)];
+  struct shm_slot *in, *out;
+  int produced = 0;
+
+  while (budget-- > 0 && (in = shm_ring_peek(&region->to_clat, region->to_clat_slots)) != NULL &&
+         (out = shm_ring_reserve(&region->from_clat, region->from_clat_slots)) != NULL) {
+    // The client can write to the slot at any time. Take a private copy of the packet so the
+    // translation code's length checks can't be raced.
+    size_t len = in->len;
+    if (len > sizeof(packet)) {
+      len = 0;
+    }
+    memcpy(packet, in->data, len);
+    shm_ring_release(&region->to_clat);
+
+    int to_ipv6          = len > 0 && (packet[0] >> 4) == 4;
+    struct iovec iov     = { out->data, sizeof(out->data) };
+    clat_verdict verdict = len > 0 ? clat_translate(config, to_ipv6, packet, len, &iov)
+                                   : CLAT_VERDICT_DROP;
+    if (verdict == CLAT_VERDICT_TRANSLATED) {
+      out->len = iov.iov_len;
+      shm_ring_commit(&region->from_clat);
+      counters->translated++;
+      produced++;
+    } else if (verdict == CLAT_VERDICT_NOSPACE) {
+      logmsg_dbg(CLAT_DEBUG_DROPS, ANDROID_LOG_ERROR,
+                 "shm_translate/%zu-byte packet does not fit in a slot when translated", len);
+      counters->nospace++;
+    } else {
+      counters->dropped++;
+    }
+  }
+
+  return produced;
+}
+
+/* function: shm_channel_init
+ * initializes a disabled shared memory interface
+ * shm - shared memory interface
+ */
+void shm_channel_init(struct shm_channel *shm) {
+  memset(shm, 0, sizeof(*shm));
+  shm->listen_fd = shm->conn_fd = shm->kick_fd = shm->notify_fd = -1;
+}
+
+/* function: shm_listen
+ * starts listening for shared memory clients
+ * shm  - shared memory interface
+ * path - filesystem path of the unix socket
+ * returns: 1 on success, 0 on failure
+ */
+int shm_listen(struct shm_channel *shm, const char *path) {
+  struct sockaddr_un sun = { .sun_family = AF_UNIX };
+  if (strlen(path) >= sizeof(sun.sun_path)) {
+    logmsg(ANDROID_LOG_FATAL, "shm socket path too long: %s", path);
+    return 0;
+  }
+  strncpy(sun.sun_path, path, sizeof(sun.sun_path) - 1);
+
+  int s = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (s < 0) {
+    logmsg(ANDROID_LOG_FATAL, "shm socket failed: %s", strerror(errno));
+    return 0;
+  }
+
+  // Create the socket with its final mode, so that nobody else can connect before it is
+  // restricted, and hand it to AID_CLAT, which clatd runs as by the time shm_close removes it.
+  unlink(path);
+  mode_t mask = umask(0117);
+  int ret     = bind(s, (struct sockaddr *)&sun, sizeof(sun));
+  umask(mask);
+  if (ret || chown(path, AID_CLAT, AID_CLAT) || listen(s, 1)) {
+    logmsg(ANDROID_LOG_FATAL, "shm socket %s: %s", path, strerror(errno));
+    close(s);
+    unlink(path);
+    return 0;
+  }
+
+  strncpy(shm->path, path, sizeof(shm->path) - 1);
+  shm->listen_fd = s;
+  logmsg(ANDROID_LOG_INFO, "Listening for shared memory clients on %s", path);
+  return 1;
+}
+
+/* function: shm_send_setup
+ * sends the region layout and file descriptors to a newly connected client
+ * conn_fd   - connected client socket
+ * memfd     - memfd containing the region
+ * kick_fd   - eventfd written by the client
+ * notify_fd - eventfd written by clatd
+ * returns: 1 on success, 0 on failure
+ */
+static int shm_send_setup(int conn_fd, int memfd, int kick_fd, int notify_fd) {
+  struct shm_setup setup = {
+    .magic     = SHM_RING_MAGIC,
+    .version   = SHM_RING_VERSION,
+    .size      = sizeof(struct shm_region),
+    .slots     = SHM_RING_SLOTS,
+    .slot_size = SHM_RING_SLOT_SIZE,
+  };
+  int fds[] = { memfd, kick_fd, notify_fd };
+  union {
+    char buf[CMSG_SPACE(sizeof(fds))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov  = { &setup, sizeof(setup) };
+  struct msghdr msg = {
+    .msg_iov        = &iov,
+    .msg_iovlen     = 1,
+    .msg_control    = control.buf,
+    .msg_controllen = sizeof(control.buf),
+  };
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level     = SOL_SOCKET;
+  cmsg->cmsg_type      = SCM_RIGHTS;
+  cmsg->cmsg_len       = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  return sendmsg(conn_fd, &msg, MSG_NOSIGNAL) == sizeof(setup);
+}
+
+/* function: shm_peer_allowed
+ * checks that a client may use the shared memory interface, see shm_ring.h
+ * conn_fd - connected client socket
+ * returns: 1 if the client is allowed, 0 otherwise
+ */
+static int shm_peer_allowed(int conn_fd) {
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if (getsockopt(conn_fd, SOL_SOCKET, SO_PEERCRED, &cred, &len)) {
+    logmsg(ANDROID_LOG_WARN, "shm client credentials unavailable: %s", strerror(errno));
+    return 0;
+  }
+  if (cred.uid != 0 && cred.uid != AID_CLAT && cred.gid != AID_CLAT) {
+    logmsg(ANDROID_LOG_WARN, "shm client pid %d uid %d gid %d not allowed", cred.pid, cred.uid,
+           cred.gid);
+    return 0;
+  }
+  return 1;
+}
+
+/* function: shm_accept
+ * accepts a client and sets up a fresh pair of rings for it. Only one client is served at a time.
+ * shm - shared memory interface
+ */
+void shm_accept(struct shm_channel *shm) {
+  int conn_fd = accept4(shm->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (conn_fd < 0) {
+    return;
+  }
+  if (!shm_peer_allowed(conn_fd)) {
+    close(conn_fd);
+    return;
+  }
+  if (shm->conn_fd >= 0) {
+    logmsg(ANDROID_LOG_WARN, "shm client already connected, rejecting new client");
+    close(conn_fd);
+    return;
+  }
+
+  int memfd = memfd_create("clatd-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (memfd < 0) {
+    logmsg(ANDROID_LOG_ERROR, "memfd_create failed: %s", strerror(errno));
+    close(conn_fd);
+    return;
+  }
+
+  // Seal the size so the client can't truncate the region and make us take a SIGBUS.
+  if (ftruncate(memfd, sizeof(struct shm_region)) ||
+      fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)) {
+    logmsg(ANDROID_LOG_ERROR, "sizing shm region failed: %s", strerror(errno));
+    close(memfd);
+    close(conn_fd);
+    return;
+  }
+
+  struct shm_region *region =
+    mmap(NULL, sizeof(struct shm_region), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+  if (region == MAP_FAILED) {
+    logmsg(ANDROID_LOG_ERROR, "mmap shm region failed: %s", strerror(errno));
+    close(memfd);
+    close(conn_fd);
+    return;
+  }
+
+  shm->conn_fd   = conn_fd;
+  shm->region    = region;
+  shm->kick_fd   = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  shm->notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (shm->kick_fd < 0 || shm->notify_fd < 0 ||
+      !shm_send_setup(conn_fd, memfd, shm->kick_fd, shm->notify_fd)) {
+    logmsg(ANDROID_LOG_ERROR, "shm client setup failed: %s", strerror(errno));
+    shm_disconnect(shm);
+  } else {
+    logmsg(ANDROID_LOG_INFO, "shm client connected, %d slots per ring", SHM_RING_SLOTS);
+  }
+
+  // The client holds its own reference to the memfd, and the mapping holds ours.
+  close(memfd);
+}
+
+/* function: shm_disconnect
+ * tears down the rings of the connected client, if any
+ * shm - shared memory interface
+ */
+void shm_disconnect(struct shm_channel *shm) {
+  if (shm->region) {
+    munmap(shm->region, sizeof(struct shm_region));
+    shm->region = NULL;
+  }
+  if (shm->kick_fd >= 0) close(shm->kick_fd);
+  if (shm->notify_fd >= 0) close(shm->notify_fd);
+  if (shm->conn_fd >= 0) close(shm->conn_fd);
+  shm->conn_fd = shm->kick_fd = shm->notify_fd = -1;
+}
+
+/* function: shm_close
+ * disconnects the client and stops listening
+ * shm - shared memory interface
+ */
+void shm_close(struct shm_channel *shm) {
+  shm_disconnect(shm);
+  if (shm->listen_fd >= 0) {
+    close(shm->listen_fd);
+    if (unlink(shm->path) && errno != ENOENT) {
+      logmsg(ANDROID_LOG_WARN, "removing shm socket %s failed: %s", shm->path, strerror(errno));
+    }
+    shm->listen_fd = -1;
+  }
+}
+
+/* function: shm_read
+ * services the rings after the client kicked us
+ * config - translation configuration
+ * shm    - shared memory interface
+ */
+void shm_read(const struct clat_config *config, struct shm_channel *shm) {
+  uint64_t count;
+
+  // Clear the kick before draining, so a kick that arrives while we work wakes us up again.
+  if (read(shm->kick_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    logmsg(ANDROID_LOG_WARN, "shm_read/read error: %s", strerror(errno));
+  }
+
+  count = 1;
+  if (shm_translate(config, shm->region, &shm->counters, SHM_READ_BATCH) > 0) {
+    // EAGAIN means the counter is saturated, so the client has a wakeup pending anyway.
+    if (write(shm->notify_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+      logmsg(ANDROID_LOG_WARN, "shm_read/write error: %s", strerror(errno));
+    }
+  }
+
+  // If the batch ran out with packets still to translate and room for them, kick ourselves, so
+  // that the event loop services the other fds before coming back for the rest. If from_clat is
+  // full, the client kicks us once it has made room.
+  struct shm_region *region = shm->region;
+  if (shm_ring_peek(&region->to_clat, region->to_clat_slots) &&
+      shm_ring_reserve(&region->from_clat, region->from_clat_slots)) {
+    if (write(shm->kick_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+      logmsg(ANDROID_LOG_WARN, "shm_read/write error: %s", strerror(errno));
+    }
+  }
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * shm_ring.h - shared memory packet rings for userspace dataplanes
+ *
+ * A client connects to the unix socket passed to clatd with -s. clatd replies with a struct
+ * shm_setup and three file descriptors: a memfd containing a struct shm_region, an eventfd the
+ * client writes to after producing into to_clat or consuming from from_clat, and an eventfd clatd
+ * writes to after producing into from_clat. The client writes IPv4 or IPv6 packets into to_clat,
+ * and clatd writes the translated packets into from_clat. Both rings are single producer, single
+ * consumer. Closing the socket tears the rings down.
+ *
+ * The socket is owned by AID_CLAT with mode 0660, and clatd only serves clients running as root,
+ * as AID_CLAT or with AID_CLAT as their group. clatd removes the socket when it exits, so its
+ * directory must be writable by AID_CLAT, or be sticky.
+ */
+#ifndef __SHM_RING_H__
+#define __SHM_RING_H__
+
+#include <stdint.h>
+#include <sys/un.h>
+
+struct clat_config;
+
+#define SHM_RING_MAGIC 0x434c4154  // "CLAT"
+#define SHM_RING_VERSION 1
+
+// Number of slots in each ring. Must be a power of two.
+#define SHM_RING_SLOTS 256
+
+// Size of each slot, including its length field. Large enough for an MTU-sized packet plus the
+// 28 bytes that translating it to IPv6 can add.
+#define SHM_RING_SLOT_SIZE 2048
+
+// Maximum number of packets translated per kick. The client controls both rings, so it could
+// otherwise keep clatd translating forever and starve the tun and the packet ring.
+#define SHM_READ_BATCH 64
+
+// Indices are free-running and only ever written by one side. A slot is owned by the producer if
+// head - tail < SHM_RING_SLOTS and by the consumer otherwise. Keep them on separate cache lines so
+// the two sides don't bounce a line back and forth on every packet.
+struct shm_ring {
+  uint32_t head;  // Next slot to produce into. Only written by the producer.
+  uint8_t pad1[60];
+  uint32_t tail;  // Next slot to consume from. Only written by the consumer.
+  uint8_t pad2[60];
+};
+
+struct shm_slot {
+  uint32_t len;
+  uint32_t reserved;
+  uint8_t data[SHM_RING_SLOT_SIZE - 8];
+};
+
+// Layout of the shared memory region.
+struct shm_region {
+  struct shm_ring to_clat;
+  struct shm_ring from_clat;
+  struct shm_slot to_clat_slots[SHM_RING_SLOTS];
+  struct shm_slot from_clat_slots[SHM_RING_SLOTS];
+};
+
+// Sent by clatd along with the memfd and the two eventfds, in that order.
+struct shm_setup {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;  // sizeof(struct shm_region)
+  uint32_t slots;
+  uint32_t slot_size;
+};
+
+// What happened to the packets a client sent. The client only sees the packets that were
+// translated, so the others are counted here and logged on SIGUSR1.
+struct shm_counters {
+  uint64_t translated;
+  uint64_t dropped;  // could not be translated, or had an invalid length
+  uint64_t nospace;  // translated packet did not fit in a slot
+};
+
+// clatd's side of the interface.
+struct shm_channel {
+  char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+  int listen_fd;  // Listening unix socket, or -1 if the interface is disabled.
+  int conn_fd;    // Connected client, or -1.
+  int kick_fd;    // Eventfd written by the client.
+  int notify_fd;  // Eventfd written by clatd.
+  struct shm_region *region;
+  struct shm_counters counters;  // across all clients
+};
+
+// Ring operations, usable by either side.
+struct shm_slot *shm_ring_reserve(struct shm_ring *ring, struct shm_slot *slots);
+void shm_ring_commit(struct shm_ring *ring);
+struct shm_slot *shm_ring_peek(struct shm_ring *ring, struct shm_slot *slots);
+void shm_ring_release(struct shm_ring *ring);
+
+// Translates packets from to_clat into from_clat.
+int shm_translate(const struct clat_config *config, struct shm_region *region,
+                  struct shm_counters *counters, int budget);
+
+void shm_channel_init(struct shm_channel *shm);
+int shm_listen(struct shm_channel *shm, const char *path);
+void shm_accept(struct shm_channel *shm);
+void shm_disconnect(struct shm_channel *shm);
+void shm_close(struct shm_channel *shm);
+void shm_read(const struct clat_config *config, struct shm_channel *shm);
+
+#endif /* __SHM_RING_H__ */
@@ -0,0 +1,338 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * tcp_monitor.c - passive TCP round-trip time and retransmission telemetry
+ */
+#include <arpa/inet.h>
+#include <string.h>
+
+#include "common.h"
+#include "tcp_monitor.h"
+
+#define FLOW_SND_VALID 0x01   // snd_max is valid
+#define FLOW_RCV_VALID 0x02   // rcv_max is valid
+#define FLOW_TIMESTAMPS 0x04  // the flow uses the timestamps option; timed is the last timed TSval
+#define FLOW_TIMING_TS 0x08   // waiting for the remote end to echo timed
+#define FLOW_TIMING_SEQ 0x10  // waiting for the remote end to acknowledge timed
+
+// Sequence number and timestamp comparisons, modulo 2^32.
+#define SEQ_LT(a, b) ((int32_t)((a) - (b)) < 0)
+
+/* function: sample_time
+ * returns the time to start or end a round-trip time sample at, reading the clock the first time
+ * it is needed for a segment
+ *   now - time the segment was seen, or 0 if the clock has not been read yet
+ */
+static uint64_t sample_time(uint64_t *now) {
+  if (!*now) {
+    *now = clat_clock_us(CLOCK_MONOTONIC);
+  }
+  return *now;
+}
+
+/* function: tcp_monitor_init
+ * initializes an empty monitor
+ *   monitor - the monitor
+ */
+void tcp_monitor_init(struct tcp_monitor *monitor) {
+  memset(monitor, 0, sizeof(*monitor));
+  // The coarse clock, which lags the precise one, so that flow ages never go negative.
+  monitor->start = clat_clock_us(CLOCK_MONOTONIC_COARSE);
+}
+
+/* function: tcp_timestamps
+ * finds the timestamps option in a TCP header
+ *   tcp   - TCP header, whose length has already been checked against the packet
+ *   tsval - set to the TSval field, in host byte order
+ *   tsecr - set to the TSecr field, in host byte order
+ * returns: 1 if the option is present, 0 otherwise
+ */
+static int tcp_timestamps(const struct tcphdr *tcp, uint32_t *tsval, uint32_t *tsecr) {
+  const uint8_t *opt = (const uint8_t *)(tcp + 1);
+  const uint8_t *end = (const uint8_t *)tcp + tcp->doff * 4;
+
+  while (opt < end && *opt != TCPOPT_EOL) {
+    if (*opt == TCPOPT_NOP) {
+      opt++;
+      continue;
+    }
+    if (end - opt < 2 || opt[1] < 2 || opt[1] > end - opt) {
+      break;
+    }
+    if (opt[0] == TCPOPT_TIMESTAMP && opt[1] == TCPOLEN_TIMESTAMP) {
+      memcpy(tsval, opt + 2, sizeof(*tsval));
+      memcpy(tsecr, opt + 6, sizeof(*tsecr));
+      *tsval = ntohl(*tsval);
+      *tsecr = ntohl(*tsecr);
+      return 1;
+    }
+    opt += opt[1];
+  }
+  return 0;
+}
+
+/* function: rtt_bucket
+ * returns the histogram bucket of a round-trip time
+ *   rtt - round-trip time in microseconds
+ */
+static int rtt_bucket(uint64_t rtt) {
+  if (rtt < 4) {
+    return rtt;
+  }
+  int msb    = 63 - __builtin_clzll(rtt);
+  int bucket = 4 + (msb - 2) * 4 + ((rtt >> (msb - 2)) & 3);
+  return bucket < TCP_MONITOR_RTT_BUCKETS ? bucket : TCP_MONITOR_RTT_BUCKETS - 1;
+}
+
+/* function: rtt_bucket_start
+ * returns the smallest round-trip time, in microseconds, that falls into a histogram bucket
+ *   bucket - the bucket
+ */
+static uint64_t rtt_bucket_start(int bucket) {
+  if (bucket < 4) {
+    return bucket;
+  }
+  int msb = (bucket - 4) / 4 + 2;
+  return (uint64_t)(4 + (bucket - 4) % 4) << (msb - 2);
+}
+
+/* function: record_rtt
+ * adds a round-trip time sample to the histogram
+ *   monitor - the monitor
+ *   rtt     - round-trip time in microseconds
+ */
+static void record_rtt(struct tcp_monitor *monitor, uint64_t rtt) {
+  monitor->rtt_hist[rtt_bucket(rtt)]++;
+  monitor->rtt_samples++;
+}
+
+/* function: flow_hash
+ * returns the hash of a flow's addresses and ports
+ */
+static uint32_t flow_hash(uint32_t local4, uint32_t remote4, uint16_t local_port,
+                          uint16_t remote_port) {
+  uint32_t ports = ((uint32_t)local_port << 16) | remote_port;
+  uint32_t h     = local4 ^ (remote4 * 0x9e3779b1) ^ (ports * 0x85ebca6b);
+  h ^= h >> 15;
+  h *= 0x2c1b3c6d;
+  h ^= h >> 12;
+  return h;
+}
+
+/* function: find_flow
+ * finds the flow a segment belongs to, replacing an idle or the least recently seen flow if it is
+ * new
+ *   monitor - the monitor
+ *   now_s   - the flow table's notion of now, see tcp_flow.last_seen
+ *   create  - whether to add the flow if it is new
+ * returns: the flow, or NULL if it is new and create is false
+ */
+static struct tcp_flow *find_flow(struct tcp_monitor *monitor, uint32_t now_s, uint32_t local4,
+                                  uint32_t remote4, uint16_t local_port, uint16_t remote_port,
+                                  int create) {
+  uint32_t h              = flow_hash(local4, remote4, local_port, remote_port);
+  struct tcp_flow *victim = NULL;
+  int i;
+
+  // Scan the whole probe window: slots freed by a RST leave holes that must not end a lookup.
+  for (i = 0; i < TCP_MONITOR_PROBES; i++) {
+    struct tcp_flow *flow = &monitor->flows[(h + i) & (TCP_MONITOR_FLOWS - 1)];
+    if (flow->last_seen && flow->local4 == local4 && flow->remote4 == remote4 &&
+        flow->local_port == local_port && flow->remote_port == remote_port) {
+      return flow;
+    }
+    if (!victim || flow->last_seen < victim->last_seen) {
+      victim = flow;
+    }
+  }
+
+  if (!create) {
+    return NULL;
+  }
+  if (victim->last_seen && now_s - victim->last_seen < TCP_MONITOR_IDLE) {
+    monitor->flows_evicted++;
+  }
+  memset(victim, 0, sizeof(*victim));
+  victim->local4      = local4;
+  victim->remote4     = remote4;
+  victim->local_port  = local_port;
+  victim->remote_port = remote_port;
+  monitor->flows_created++;
+  return victim;
+}
+
+/* function: monitor_segment
+ * updates the monitor with a TCP segment
+ *   monitor  - the monitor
+ *   now      - time the segment was seen, in CLOCK_MONOTONIC microseconds, or 0 to read the clock
+ *              only if a sample starts or ends. Reading it for every segment would double the
+ *              monitor's cost.
+ *   now_s    - the flow table's notion of now, see tcp_flow.last_seen
+ *   outgoing - true if the segment is going to the network, false if it is coming from it
+ *   local4   - IPv4 address of the local end, in network byte order
+ *   remote4  - IPv4 address of the remote end, in network byte order
+ *   tcp      - TCP header, whose length has already been checked against the packet
+ *   len      - size of the TCP header and payload
+ */
+static void monitor_segment(struct tcp_monitor *monitor, uint64_t now, uint32_t now_s,
+                            int outgoing, uint32_t local4, uint32_t remote4,
+                            const struct tcphdr *tcp, size_t len) {
+  uint16_t local_port  = outgoing ? tcp->source : tcp->dest;
+  uint16_t remote_port = outgoing ? tcp->dest : tcp->source;
+
+  struct tcp_flow *flow =
+    find_flow(monitor, now_s, local4, remote4, local_port, remote_port, !tcp->rst);
+  if (!flow) {
+    return;
+  }
+  if (tcp->rst) {
+    flow->last_seen = 0;
+    return;
+  }
+  flow->last_seen = now_s;
+
+  uint32_t tsval = 0, tsecr = 0;
+  int has_ts      = tcp_timestamps(tcp, &tsval, &tsecr);
+  uint32_t seq    = ntohl(tcp->seq);
+  uint32_t seglen = len - tcp->doff * 4 + tcp->syn + tcp->fin;
+  uint32_t end    = seq + seglen;
+
+  if (outgoing) {
+    if (seglen) {
+      // A keepalive resends the last byte, and is not a sign of loss.
+      int keepalive = seglen == 1 && end == flow->snd_max && len == (size_t)tcp->doff * 4 + 1;
+      if ((flow->flags & FLOW_SND_VALID) && SEQ_LT(seq, flow->snd_max)) {
+        if (!keepalive) {
+          monitor->retransmits_out++;
+          monitor->segments_out++;
+        }
+        // Karn's algorithm: the acknowledgement could be for either transmission.
+        flow->flags &= ~FLOW_TIMING_SEQ;
+      } else {
+        monitor->segments_out++;
+        if (!has_ts && !(flow->flags & FLOW_TIMING_SEQ)) {
+          flow->flags |= FLOW_TIMING_SEQ;
+          flow->timed    = end;
+          flow->timed_at = sample_time(&now);
+        }
+      }
+      if (!(flow->flags & FLOW_SND_VALID) || SEQ_LT(flow->snd_max, end)) {
+        flow->snd_max = end;
+      }
+      flow->flags |= FLOW_SND_VALID;
+    }
+
+    // Only time a TSval newer than the last one timed, or an echo of an earlier segment with the
+    // same TSval could end the sample early.
+    if (has_ts && !(flow->flags & FLOW_TIMING_TS) &&
+        (!(flow->flags & FLOW_TIMESTAMPS) || SEQ_LT(flow->timed, tsval))) {
+      flow->flags |= FLOW_TIMESTAMPS | FLOW_TIMING_TS;
+      flow->flags &= ~FLOW_TIMING_SEQ;
+      flow->timed    = tsval;
+      flow->timed_at = sample_time(&now);
+    }
+    return;
+  }
+
+  if (seglen) {
+    if ((flow->flags & FLOW_RCV_VALID) && SEQ_LT(seq, flow->rcv_max)) {
+      monitor->retransmits_in++;
+    } else if (!(flow->flags & FLOW_RCV_VALID) || SEQ_LT(flow->rcv_max, end)) {
+      flow->rcv_max = end;
+    }
+    flow->flags |= FLOW_RCV_VALID;
+    monitor->segments_in++;
+  }
+
+  if ((flow->flags & FLOW_TIMING_TS) && has_ts && !SEQ_LT(tsecr, flow->timed)) {
+    // An echo of a later TSval means the echo of the timed one was lost or never sent.
+    if (tsecr == flow->timed) {
+      record_rtt(monitor, sample_time(&now) - flow->timed_at);
+    }
+    flow->flags &= ~FLOW_TIMING_TS;
+  } else if ((flow->flags & FLOW_TIMING_SEQ) && tcp->ack &&
+             !SEQ_LT(ntohl(tcp->ack_seq), flow->timed)) {
+    record_rtt(monitor, sample_time(&now) - flow->timed_at);
+    flow->flags &= ~FLOW_TIMING_SEQ;
+  }
+}
+
+/* function: tcp_monitor_segment_at
+ * updates the monitor with a TCP segment seen at a given time
+ *   monitor  - the monitor
+ *   now      - time the segment was seen, in CLOCK_MONOTONIC microseconds
+ *   outgoing - true if the segment is going to the network, false if it is coming from it
+ *   local4   - IPv4 address of the local end, in network byte order
+ *   remote4  - IPv4 address of the remote end, in network byte order
+ *   tcp      - TCP header, whose length has already been checked against the packet
+ *   len      - size of the TCP header and payload
+ */
+void tcp_monitor_segment_at(struct tcp_monitor *monitor, uint64_t now, int outgoing,
+                            uint32_t local4, uint32_t remote4, const struct tcphdr *tcp,
+                            size_t len) {
+  uint32_t now_s = (now - monitor->start) / 1000000 + 1;
+  monitor_segment(monitor, now, now_s, outgoing, local4, remote4, tcp, len);
+}
+
+/* function: tcp_monitor_segment
+ * updates the monitor with a TCP segment that is being translated
+ *   monitor  - the monitor
+ *   outgoing - true if the segment is going to the network, false if it is coming from it
+ *   local4   - IPv4 address of the local end, in network byte order
+ *   remote4  - IPv4 address of the remote end, in network byte order
+ *   tcp      - TCP header, whose length has already been checked against the packet
+ *   len      - size of the TCP header and payload
+ */
+void tcp_monitor_segment(struct tcp_monitor *monitor, int outgoing, uint32_t local4,
+                         uint32_t remote4, const struct tcphdr *tcp, size_t len) {
+  uint32_t now_s = (clat_clock_us(CLOCK_MONOTONIC_COARSE) - monitor->start) / 1000000 + 1;
+  monitor_segment(monitor, 0, now_s, outgoing, local4, remote4, tcp, len);
+}
+
+/* function: tcp_monitor_rtt_percentile
+ * returns a percentile of the round-trip times seen, in microseconds, or 0 if there are none.
+ * The result is the upper bound of a histogram bucket, so it is up to 25% too high.
+ *   monitor    - the monitor
+ *   percentile - the percentile, e.g., 50 for the median
+ */
+uint64_t tcp_monitor_rtt_percentile(const struct tcp_monitor *monitor, double percentile) {
+  uint64_t rank = monitor->rtt_samples * percentile / 100, seen = 0;
+  if (!monitor->rtt_samples) {
+    return 0;
+  }
+  for (int i = 0; i < TCP_MONITOR_RTT_BUCKETS; i++) {
+    seen += monitor->rtt_hist[i];
+    if (seen > rank || (seen == monitor->rtt_samples && seen)) {
+      return rtt_bucket_start(i + 1) - 1;
+    }
+  }
+  return rtt_bucket_start(TCP_MONITOR_RTT_BUCKETS) - 1;
+}
+
+/* function: tcp_monitor_active_flows
+ * returns the number of flows seen in the last TCP_MONITOR_IDLE seconds
+ *   monitor - the monitor
+ *   now     - current time, in CLOCK_MONOTONIC microseconds
+ */
+int tcp_monitor_active_flows(const struct tcp_monitor *monitor, uint64_t now) {
+  uint32_t now_s = (now - monitor->start) / 1000000 + 1;
+  int count      = 0;
+  for (int i = 0; i < TCP_MONITOR_FLOWS; i++) {
+    if (monitor->flows[i].last_seen && now_s - monitor->flows[i].last_seen < TCP_MONITOR_IDLE) {
+      count++;
+    }
+  }
+  return count;
+}
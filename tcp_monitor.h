@@ -0,0 +1,82 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * tcp_monitor.h - passive TCP round-trip time and retransmission telemetry
+ *
+ * Every TCP segment of the IPv4 traffic passes through clatd in both directions, so the round
+ * trip from clatd to the remote end and back, i.e., across the network behind the NAT64, can be
+ * measured without sending anything. Each flow times one outgoing segment at a time: with the
+ * timestamps option, until the remote end echoes its TSval; without it, until the remote end
+ * acknowledges it, discarding samples that a retransmission makes ambiguous (Karn's algorithm).
+ * Flows live in a fixed-size table, and the samples go into a histogram, so memory use is bounded
+ * however many flows there are.
+ */
+#ifndef __TCP_MONITOR_H__
+#define __TCP_MONITOR_H__
+
+#include <netinet/tcp.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Size of the flow table. Must be a power of two.
+#define TCP_MONITOR_FLOWS 1024
+
+// Number of slots a flow may occupy, starting from the one its hash selects.
+#define TCP_MONITOR_PROBES 8
+
+// Flows not seen for this long (in seconds) can be replaced.
+#define TCP_MONITOR_IDLE 120
+
+// RTT histogram buckets. Each power of two is split into four buckets, from 1us to about
+// four minutes.
+#define TCP_MONITOR_RTT_BUCKETS (27 * 4)
+
+struct tcp_flow {
+  uint32_t local4, remote4;  // network byte order
+  uint16_t local_port, remote_port;
+  uint32_t last_seen;  // seconds since the monitor started, plus one. 0 if the slot is free.
+
+  uint8_t flags;
+  uint32_t snd_max;  // end of the highest segment sent
+  uint32_t rcv_max;  // end of the highest segment received
+  uint32_t timed;    // TSval or end sequence number of the segment being timed
+  uint64_t timed_at;
+};
+
+struct tcp_monitor {
+  struct tcp_flow flows[TCP_MONITOR_FLOWS];
+  uint64_t start;  // microseconds, CLOCK_MONOTONIC
+
+  uint64_t rtt_hist[TCP_MONITOR_RTT_BUCKETS];
+  uint64_t rtt_samples;
+
+  // Data segments sent to and received from the network, and how many of them were
+  // retransmissions.
+  uint64_t segments_out, retransmits_out;
+  uint64_t segments_in, retransmits_in;
+
+  uint64_t flows_created, flows_evicted;
+};
+
+void tcp_monitor_init(struct tcp_monitor *monitor);
+void tcp_monitor_segment(struct tcp_monitor *monitor, int outgoing, uint32_t local4,
+                         uint32_t remote4, const struct tcphdr *tcp, size_t len);
+void tcp_monitor_segment_at(struct tcp_monitor *monitor, uint64_t now, int outgoing,
+                            uint32_t local4, uint32_t remote4, const struct tcphdr *tcp,
+                            size_t len);
+uint64_t tcp_monitor_rtt_percentile(const struct tcp_monitor *monitor, double percentile);
+int tcp_monitor_active_flows(const struct tcp_monitor *monitor, uint64_t now);
+
+#endif /* __TCP_MONITOR_H__ */
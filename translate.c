@@ -21,8 +21,7 @@
 
 #include "clatd.h"
 #include "common.h"
-#include "config.h"
-#include "debug.h"
+#include "clat_config.h"
 #include "icmp.h"
 #include "logging.h"
 #include "translate.h"
@@ -44,42 +43,21 @@ uint16_t packet_checksum(uint32_t checksum, clat_packet packet, clat_packet_inde
   return ip_checksum_finish(checksum);
 }
 
-/* function: packet_length
- * returns the total length of all the packet components after pos
- * packet - packet to calculate the length of
- * pos    - position to start counting after
- * returns: the total length of the packet components after pos
- */
-uint16_t packet_length(clat_packet packet, clat_packet_index pos) {
-  size_t len = 0;
-  int i;
-  for (i = pos + 1; i < CLAT_POS_MAX; i++) {
-    len += packet[i].iov_len;
-  }
-  return len;
-}
-
-/* function: is_in_plat_subnet
- * returns true iff the given IPv6 address is in the plat subnet.
- * addr - IPv6 address
- */
-int is_in_plat_subnet(const struct in6_addr *addr6) {
-  // Assumes a /96 plat subnet.
-  return (addr6 != NULL) && (memcmp(addr6, &Global_Clatd_Config.plat_subnet, 12) == 0);
-}
-
 /* function: ipv6_addr_to_ipv4_addr
  * return the corresponding ipv4 address for the given ipv6 address
- * addr6 - ipv6 address
+ * config - translation configuration
+ * addr6  - ipv6 address
  * returns: the IPv4 address
  */
-uint32_t ipv6_addr_to_ipv4_addr(const struct in6_addr *addr6) {
-  if (is_in_plat_subnet(addr6)) {
+CLAT_HOT uint32_t ipv6_addr_to_ipv4_addr(const struct clat_config *config,
+                                         const struct in6_addr *addr6) {
+  if (is_in_plat_subnet(config, addr6)) {
     // Assumes a /96 plat subnet.
     return addr6->s6_addr32[3];
-  } else if (IN6_ARE_ADDR_EQUAL(addr6, &Global_Clatd_Config.ipv6_local_subnet)) {
-    // Special-case our own address.
-    return Global_Clatd_Config.ipv4_local_subnet.s_addr;
+  } else if (is_in_local_subnet(config, addr6)) {
+    // Special-case our own address (or prefix).
+    return (config->ipv4_local_subnet.s_addr & ~config->local_hostmask) |
+           (addr6->s6_addr32[3] & config->local_hostmask);
   } else {
     // Third party packet. Let the caller deal with it.
     return INADDR_NONE;
@@ -88,17 +66,21 @@ uint32_t ipv6_addr_to_ipv4_addr(const struct in6_addr *addr6) {
 
 /* function: ipv4_addr_to_ipv6_addr
  * return the corresponding ipv6 address for the given ipv4 address
- * addr4 - ipv4 address
+ * config - translation configuration
+ * addr4  - ipv4 address
  */
-struct in6_addr ipv4_addr_to_ipv6_addr(uint32_t addr4) {
+CLAT_HOT struct in6_addr ipv4_addr_to_ipv6_addr(const struct clat_config *config, uint32_t addr4) {
   struct in6_addr addr6;
   // Both addresses are in network byte order (addr4 comes from a network packet, and the config
   // file entry is read using inet_ntop).
-  if (addr4 == Global_Clatd_Config.ipv4_local_subnet.s_addr) {
-    return Global_Clatd_Config.ipv6_local_subnet;
+  if (!((addr4 ^ config->ipv4_local_subnet.s_addr) & ~config->local_hostmask)) {
+    addr6              = config->ipv6_local_subnet;
+    addr6.s6_addr32[3] = (addr6.s6_addr32[3] & ~config->local_hostmask) |
+                         (addr4 & config->local_hostmask);
+    return addr6;
   } else {
     // Assumes a /96 plat subnet.
-    addr6              = Global_Clatd_Config.plat_subnet;
+    addr6              = config->plat_subnet;
     addr6.s6_addr32[3] = addr4;
     return addr6;
   }
@@ -109,20 +91,22 @@ struct in6_addr ipv4_addr_to_ipv6_addr(uint32_t addr4) {
  * tun_header - tunnel header, already allocated
  * proto      - ethernet protocol id: ETH_P_IP(ipv4) or ETH_P_IPV6(ipv6)
  */
-void fill_tun_header(struct tun_pi *tun_header, uint16_t proto, uint16_t skip_csum) {
+CLAT_HOT void fill_tun_header(struct tun_pi *tun_header, uint16_t proto, uint16_t skip_csum) {
   tun_header->flags = htons(skip_csum);
   tun_header->proto = htons(proto);
 }
 
 /* function: fill_ip_header
  * generate an ipv4 header from an ipv6 header
+ * config      - translation configuration
  * ip_targ     - (ipv4) target packet header, source: original ipv4 addr, dest: local subnet addr
  * payload_len - length of other data inside packet
  * protocol    - protocol number (tcp, udp, etc)
  * old_header  - (ipv6) source packet header, source: nat64 prefix, dest: local subnet prefix
  */
-void fill_ip_header(struct iphdr *ip, uint16_t payload_len, uint8_t protocol,
-                    const struct ip6_hdr *old_header) {
+CLAT_HOT void fill_ip_header(const struct clat_config *config, struct iphdr *ip,
+                             uint16_t payload_len, uint8_t protocol,
+                             const struct ip6_hdr *old_header) {
   int ttl_guess;
   memset(ip, 0, sizeof(struct iphdr));
 
@@ -136,13 +120,13 @@ void fill_ip_header(struct iphdr *ip, uint16_t payload_len, uint8_t protocol,
   ip->protocol = protocol;
   ip->check    = 0;
 
-  ip->saddr = ipv6_addr_to_ipv4_addr(&old_header->ip6_src);
-  ip->daddr = ipv6_addr_to_ipv4_addr(&old_header->ip6_dst);
+  ip->saddr = ipv6_addr_to_ipv4_addr(config, &old_header->ip6_src);
+  ip->daddr = ipv6_addr_to_ipv4_addr(config, &old_header->ip6_dst);
 
   // Third-party ICMPv6 message. This may have been originated by an native IPv6 address.
   // In that case, the source IPv6 address can't be translated and we need to make up an IPv4
   // source address. For now, use 255.0.0.<ttl>, which at least looks useful in traceroute.
-  if ((uint32_t)ip->saddr == INADDR_NONE) {
+  if (unlikely((uint32_t)ip->saddr == INADDR_NONE)) {
     ttl_guess = icmp_guess_ttl(old_header->ip6_hlim);
     ip->saddr = htonl((0xff << 24) + ttl_guess);
   }
@@ -150,13 +134,15 @@ void fill_ip_header(struct iphdr *ip, uint16_t payload_len, uint8_t protocol,
 
 /* function: fill_ip6_header
  * generate an ipv6 header from an ipv4 header
+ * config      - translation configuration
  * ip6         - (ipv6) target packet header, source: local subnet prefix, dest: nat64 prefix
  * payload_len - length of other data inside packet
  * protocol    - protocol number (tcp, udp, etc)
  * old_header  - (ipv4) source packet header, source: local subnet addr, dest: internet's ipv4 addr
  */
-void fill_ip6_header(struct ip6_hdr *ip6, uint16_t payload_len, uint8_t protocol,
-                     const struct iphdr *old_header) {
+CLAT_HOT void fill_ip6_header(const struct clat_config *config, struct ip6_hdr *ip6,
+                              uint16_t payload_len, uint8_t protocol,
+                              const struct iphdr *old_header) {
   memset(ip6, 0, sizeof(struct ip6_hdr));
 
   ip6->ip6_vfc  = 6 << 4;
@@ -164,8 +150,11 @@ void fill_ip6_header(struct ip6_hdr *ip6, uint16_t payload_len, uint8_t protocol
   ip6->ip6_nxt  = protocol;
   ip6->ip6_hlim = old_header->ttl;
 
-  ip6->ip6_src = ipv4_addr_to_ipv6_addr(old_header->saddr);
-  ip6->ip6_dst = ipv4_addr_to_ipv6_addr(old_header->daddr);
+  // Keep the ECN field, so that ECN-capable flows can be marked instead of dropped (RFC 7915).
+  ip6->ip6_flow |= htonl((old_header->tos & IPTOS_ECN_MASK) << 20);
+
+  ip6->ip6_src = ipv4_addr_to_ipv6_addr(config, old_header->saddr);
+  ip6->ip6_dst = ipv4_addr_to_ipv6_addr(config, old_header->daddr);
 }
 
 /* function: maybe_fill_frag_header
@@ -176,11 +165,11 @@ void fill_ip6_header(struct ip6_hdr *ip6, uint16_t payload_len, uint8_t protocol
  * old_header  - (ipv4) source packet header
  * returns: the length of the fragmentation header if present, or zero if not present
  */
-size_t maybe_fill_frag_header(struct ip6_frag *frag_hdr, struct ip6_hdr *ip6_targ,
-                              const struct iphdr *old_header) {
+CLAT_HOT size_t maybe_fill_frag_header(struct ip6_frag *frag_hdr, struct ip6_hdr *ip6_targ,
+                                       const struct iphdr *old_header) {
   uint16_t frag_flags = ntohs(old_header->frag_off);
   uint16_t frag_off   = frag_flags & IP_OFFMASK;
-  if (frag_off == 0 && (frag_flags & IP_MF) == 0) {
+  if (likely(frag_off == 0 && (frag_flags & IP_MF) == 0)) {
     // Not a fragment.
     return 0;
   }
@@ -218,6 +207,7 @@ uint8_t parse_frag_header(const struct ip6_frag *frag_hdr, struct iphdr *ip_targ
 
 /* function: icmp_to_icmp6
  * translate ipv4 icmp to ipv6 icmp
+ * config       - translation configuration
  * out          - output packet
  * icmp         - source packet icmp header
  * checksum     - pseudo-header checksum
@@ -225,8 +215,9 @@ uint8_t parse_frag_header(const struct ip6_frag *frag_hdr, struct iphdr *ip_targ
  * payload_size - size of payload
  * returns: the highest position in the output clat_packet that's filled in
  */
-int icmp_to_icmp6(clat_packet out, clat_packet_index pos, const struct icmphdr *icmp,
-                  uint32_t checksum, const uint8_t *payload, size_t payload_size) {
+int icmp_to_icmp6(const struct clat_config *config, clat_packet out, clat_packet_index pos,
+                  const struct icmphdr *icmp, uint32_t checksum, const uint8_t *payload,
+                  size_t payload_size) {
   struct icmp6_hdr *icmp6_targ = out[pos].iov_base;
   uint8_t icmp6_type;
   int clat_packet_len;
@@ -242,7 +233,7 @@ int icmp_to_icmp6(clat_packet out, clat_packet_index pos, const struct icmphdr *
   if (pos == CLAT_POS_TRANSPORTHDR && is_icmp_error(icmp->type) && icmp6_type != ICMP6_PARAM_PROB) {
     // An ICMP error we understand, one level deep.
     // Translate the nested packet (the one that caused the error).
-    clat_packet_len = ipv4_packet(out, pos + 1, payload, payload_size);
+    clat_packet_len = ipv4_packet(config, out, pos + 1, payload, payload_size);
 
     // The pseudo-header checksum was calculated on the transport length of the original IPv4
     // packet that we were asked to translate. This transport length is 20 bytes smaller than it
@@ -271,14 +262,15 @@ int icmp_to_icmp6(clat_packet out, clat_packet_index pos, const struct icmphdr *
 
 /* function: icmp6_to_icmp
  * translate ipv6 icmp to ipv4 icmp
+ * config       - translation configuration
  * out          - output packet
  * icmp6        - source packet icmp6 header
  * payload      - icmp6 payload
  * payload_size - size of payload
  * returns: the highest position in the output clat_packet that's filled in
  */
-int icmp6_to_icmp(clat_packet out, clat_packet_index pos, const struct icmp6_hdr *icmp6,
-                  const uint8_t *payload, size_t payload_size) {
+int icmp6_to_icmp(const struct clat_config *config, clat_packet out, clat_packet_index pos,
+                  const struct icmp6_hdr *icmp6, const uint8_t *payload, size_t payload_size) {
   struct icmphdr *icmp_targ = out[pos].iov_base;
   uint8_t icmp_type;
   int clat_packet_len;
@@ -295,7 +287,7 @@ int icmp6_to_icmp(clat_packet out, clat_packet_index pos, const struct icmp6_hdr
       icmp_type != ICMP_PARAMETERPROB) {
     // An ICMPv6 error we understand, one level deep.
     // Translate the nested packet (the one that caused the error).
-    clat_packet_len = ipv6_packet(out, pos + 1, payload, payload_size);
+    clat_packet_len = ipv6_packet(config, out, pos + 1, payload, payload_size);
   } else if (icmp_type == ICMP_ECHO || icmp_type == ICMP_ECHOREPLY) {
     // Ping packet.
     icmp_targ->un.echo.id          = icmp6->icmp6_id;
@@ -332,26 +324,29 @@ int generic_packet(clat_packet out, clat_packet_index pos, const uint8_t *payloa
 
 /* function: udp_packet
  * takes a udp packet and sets it up for translation
+ * config   - translation configuration
  * out      - output packet
  * udp      - pointer to udp header in packet
+ * remote4  - IPv4 address of the remote end, in network byte order
  * old_sum  - pseudo-header checksum of old header
  * new_sum  - pseudo-header checksum of new header
  * len      - size of ip payload
  */
-int udp_packet(clat_packet out, clat_packet_index pos, const struct udphdr *udp, uint32_t old_sum,
-               uint32_t new_sum, size_t len) {
+CLAT_HOT int udp_packet(const struct clat_config *config, clat_packet out, clat_packet_index pos,
+                        const struct udphdr *udp, uint32_t remote4, uint32_t old_sum,
+                        uint32_t new_sum, size_t len) {
   const uint8_t *payload;
   size_t payload_size;
 
-  if (len < sizeof(struct udphdr)) {
-    logmsg_dbg(ANDROID_LOG_ERROR, "udp_packet/(too small)");
+  if (unlikely(len < sizeof(struct udphdr))) {
+    logmsg_dbg(CLAT_DEBUG_DROPS, ANDROID_LOG_ERROR, "udp_packet/(too small)");
     return 0;
   }
 
   payload      = (const uint8_t *)(udp + 1);
   payload_size = len - sizeof(struct udphdr);
 
-  return udp_translate(out, pos, udp, old_sum, new_sum, payload, payload_size);
+  return udp_translate(config, out, pos, udp, remote4, old_sum, new_sum, payload, payload_size);
 }
 
 /* function: tcp_packet
@@ -362,23 +357,25 @@ int udp_packet(clat_packet out, clat_packet_index pos, const struct udphdr *udp,
  * len      - size of ip payload
  * returns: the highest position in the output clat_packet that's filled in
  */
-int tcp_packet(clat_packet out, clat_packet_index pos, const struct tcphdr *tcp, uint32_t old_sum,
-               uint32_t new_sum, size_t len) {
+CLAT_HOT int tcp_packet(clat_packet out, clat_packet_index pos, const struct tcphdr *tcp,
+                        uint32_t old_sum, uint32_t new_sum, size_t len) {
   const uint8_t *payload;
   size_t payload_size, header_size;
 
-  if (len < sizeof(struct tcphdr)) {
-    logmsg_dbg(ANDROID_LOG_ERROR, "tcp_packet/(too small)");
+  if (unlikely(len < sizeof(struct tcphdr))) {
+    logmsg_dbg(CLAT_DEBUG_DROPS, ANDROID_LOG_ERROR, "tcp_packet/(too small)");
     return 0;
   }
 
-  if (tcp->doff < 5) {
-    logmsg_dbg(ANDROID_LOG_ERROR, "tcp_packet/tcp header length set to less than 5: %x", tcp->doff);
+  if (unlikely(tcp->doff < 5)) {
+    logmsg_dbg(CLAT_DEBUG_DROPS, ANDROID_LOG_ERROR,
+               "tcp_packet/tcp header length set to less than 5: %x", tcp->doff);
     return 0;
   }
 
-  if ((size_t)tcp->doff * 4 > len) {
-    logmsg_dbg(ANDROID_LOG_ERROR, "tcp_packet/tcp header length set too large: %x", tcp->doff);
+  if (unlikely((size_t)tcp->doff * 4 > len)) {
+    logmsg_dbg(CLAT_DEBUG_DROPS, ANDROID_LOG_ERROR,
+               "tcp_packet/tcp header length set too large: %x", tcp->doff);
     return 0;
   }
 
@@ -389,19 +386,50 @@ int tcp_packet(clat_packet out, clat_packet_index pos, const struct tcphdr *tcp,
   return tcp_translate(out, pos, tcp, header_size, old_sum, new_sum, payload, payload_size);
 }
 
+/* function: udp_zero_csum_allowed
+ * checks whether the udp_zero_csum_policy lets a zero UDP checksum through untouched
+ * policy  - the policy
+ * udp     - udp header
+ * remote4 - IPv4 address of the remote end, in network byte order
+ * returns: 1 if the zero checksum can be passed through, 0 if it must be computed
+ */
+int udp_zero_csum_allowed(const struct udp_zero_csum_policy *policy, const struct udphdr *udp,
+                          uint32_t remote4) {
+  int i;
+
+  if (policy->pass_all) {
+    return 1;
+  }
+  for (i = 0; i < policy->num_ports; i++) {
+    if (udp->dest == policy->ports[i] || udp->source == policy->ports[i]) {
+      return 1;
+    }
+  }
+  for (i = 0; i < policy->num_prefixes; i++) {
+    if ((remote4 & policy->prefixes[i].mask) == policy->prefixes[i].addr) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
 /* function: udp_translate
  * common between ipv4/ipv6 - setup checksum and send udp packet
+ * config       - translation configuration
  * out          - output packet
  * udp          - udp header
+ * remote4      - IPv4 address of the remote end, in network byte order
  * old_sum      - pseudo-header checksum of old header
  * new_sum      - pseudo-header checksum of new header
  * payload      - tcp payload
  * payload_size - size of payload
  * returns: the highest position in the output clat_packet that's filled in
  */
-int udp_translate(clat_packet out, clat_packet_index pos, const struct udphdr *udp,
-                  uint32_t old_sum, uint32_t new_sum, const uint8_t *payload, size_t payload_size) {
-  struct udphdr *udp_targ = out[pos].iov_base;
+CLAT_HOT int udp_translate(const struct clat_config *config, clat_packet out, clat_packet_index pos,
+                           const struct udphdr *udp, uint32_t remote4, uint32_t old_sum,
+                           uint32_t new_sum, const uint8_t *payload, size_t payload_size) {
+  struct udphdr *udp_targ        = out[pos].iov_base;
+  struct clat_counters *counters = config->counters;
 
   memcpy(udp_targ, udp, sizeof(struct udphdr));
 
@@ -411,6 +439,12 @@ int udp_translate(clat_packet out, clat_packet_index pos, const struct udphdr *u
 
   if (udp_targ->check) {
     udp_targ->check = ip_checksum_adjust(udp->check, old_sum, new_sum);
+    if (counters) counters->udp_csum_adjusted++;
+  } else if (udp_zero_csum_allowed(&config->udp_zero_csum, udp, remote4)) {
+    // The configuration says the other end accepts zero checksums (RFC 6936, section 5), so save
+    // the pass over the payload. Skip the 0xffff substitution below, which would make it invalid.
+    if (counters) counters->udp_zero_csum_passed++;
+    return CLAT_POS_PAYLOAD + 1;
   } else {
     // Zero checksums are special. RFC 768 says, "An all zero transmitted checksum value means that
     // the transmitter generated no checksum (for debugging or for higher level protocols that
@@ -418,11 +452,12 @@ int udp_translate(clat_packet out, clat_packet_index pos, const struct udphdr *u
     // for safety we recompute it.
     udp_targ->check = 0;  // Checksum field must be 0 when calculating checksum.
     udp_targ->check = packet_checksum(new_sum, out, pos);
+    if (counters) counters->udp_zero_csum_computed++;
   }
 
   // RFC 768: "If the computed checksum is zero, it is transmitted as all ones (the equivalent
   // in one's complement arithmetic)."
-  if (!udp_targ->check) {
+  if (unlikely(!udp_targ->check)) {
     udp_targ->check = 0xffff;
   }
 
@@ -439,17 +474,17 @@ int udp_translate(clat_packet out, clat_packet_index pos, const struct udphdr *u
  * payload_size - size of payload
  * returns: the highest position in the output clat_packet that's filled in
  */
-int tcp_translate(clat_packet out, clat_packet_index pos, const struct tcphdr *tcp,
-                  size_t header_size, uint32_t old_sum, uint32_t new_sum, const uint8_t *payload,
-                  size_t payload_size) {
+CLAT_HOT int tcp_translate(clat_packet out, clat_packet_index pos, const struct tcphdr *tcp,
+                           size_t header_size, uint32_t old_sum, uint32_t new_sum,
+                           const uint8_t *payload, size_t payload_size) {
   struct tcphdr *tcp_targ = out[pos].iov_base;
   out[pos].iov_len        = header_size;
 
-  if (header_size > MAX_TCP_HDR) {
+  if (unlikely(header_size > MAX_TCP_HDR)) {
     // A TCP header cannot be more than MAX_TCP_HDR bytes long because it's a 4-bit field that
     // counts in 4-byte words. So this can never happen unless there is a bug in the caller.
-    logmsg(ANDROID_LOG_ERROR, "tcp_translate: header too long %d > %d, truncating", header_size,
-           MAX_TCP_HDR);
+    logmsg_dbg(CLAT_DEBUG_DROPS, ANDROID_LOG_ERROR,
+               "tcp_translate: header too long %zu > %d, truncating", header_size, MAX_TCP_HDR);
     header_size = MAX_TCP_HDR;
   }
 
@@ -463,68 +498,67 @@ int tcp_translate(clat_packet out, clat_packet_index pos, const struct tcphdr *t
   return CLAT_POS_PAYLOAD + 1;
 }
 
-// Weak symbol so we can override it in the unit test.
-void send_rawv6(int fd, clat_packet out, int iov_len) __attribute__((weak));
-
-void send_rawv6(int fd, clat_packet out, int iov_len) {
-  // A send on a raw socket requires a destination address to be specified even if the socket's
-  // protocol is IPPROTO_RAW. This is the address that will be used in routing lookups; the
-  // destination address in the packet header only affects what appears on the wire, not where the
-  // packet is sent to.
-  static struct sockaddr_in6 sin6 = { AF_INET6, 0, 0, { { { 0, 0, 0, 0 } } }, 0 };
-  static struct msghdr msg        = {
-    .msg_name    = &sin6,
-    .msg_namelen = sizeof(sin6),
-  };
-
-  msg.msg_iov = out, msg.msg_iovlen = iov_len,
-  sin6.sin6_addr = ((struct ip6_hdr *)out[CLAT_POS_IPHDR].iov_base)->ip6_dst;
-  sendmsg(fd, &msg, 0);
-}
-
-/* function: translate_packet
- * takes a packet, translates it, and writes it to fd
- * fd         - fd to write translated packet to
+/* function: translate_packet_iovec
+ * translates a packet into a clat_packet without sending it anywhere
+ * config     - translation configuration
  * to_ipv6    - true if translating to ipv6, false if translating to ipv4
  * packet     - packet
  * packetsize - size of packet
- * skip_csum  - true if kernel has to skip checksum validation, false if it has to validate checksum.
+ * headers    - storage for the translated headers
+ * out        - output packet. The tun header is left empty.
+ * returns: the highest position in the output clat_packet that's filled in, or 0 on failure
  */
-void translate_packet(int fd, int to_ipv6, const uint8_t *packet, size_t packetsize, uint16_t skip_csum) {
-  int iov_len = 0;
-
-  // Allocate buffers for all packet headers.
-  struct tun_pi tun_targ;
-  char iphdr[sizeof(struct ip6_hdr)];
-  char fraghdr[sizeof(struct ip6_frag)];
-  char transporthdr[MAX_TCP_HDR];
-  char icmp_iphdr[sizeof(struct ip6_hdr)];
-  char icmp_fraghdr[sizeof(struct ip6_frag)];
-  char icmp_transporthdr[MAX_TCP_HDR];
-
-  // iovec of the packets we'll send. This gets passed down to the translation functions.
-  clat_packet out = {
-    { &tun_targ, 0 },          // Tunnel header.
-    { iphdr, 0 },              // IP header.
-    { fraghdr, 0 },            // Fragment header.
-    { transporthdr, 0 },       // Transport layer header.
-    { icmp_iphdr, 0 },         // ICMP error inner IP header.
-    { icmp_fraghdr, 0 },       // ICMP error fragmentation header.
-    { icmp_transporthdr, 0 },  // ICMP error transport layer header.
-    { NULL, 0 },               // Payload. No buffer, it's a pointer to the original payload.
-  };
+CLAT_HOT int translate_packet_iovec(const struct clat_config *config, int to_ipv6,
+                                    const uint8_t *packet, size_t packetsize,
+                                    struct clat_packet_headers *headers, clat_packet out) {
+  // iovec of the packet we'll send. This gets passed down to the translation functions.
+  out[CLAT_POS_TUNHDR]               = (struct iovec){ &headers->tun, 0 };
+  out[CLAT_POS_IPHDR]                = (struct iovec){ headers->iphdr, 0 };
+  out[CLAT_POS_FRAGHDR]              = (struct iovec){ headers->fraghdr, 0 };
+  out[CLAT_POS_TRANSPORTHDR]         = (struct iovec){ headers->transporthdr, 0 };
+  out[CLAT_POS_ICMPERR_IPHDR]        = (struct iovec){ headers->icmp_iphdr, 0 };
+  out[CLAT_POS_ICMPERR_FRAGHDR]      = (struct iovec){ headers->icmp_fraghdr, 0 };
+  out[CLAT_POS_ICMPERR_TRANSPORTHDR] = (struct iovec){ headers->icmp_transporthdr, 0 };
+  out[CLAT_POS_PAYLOAD]              = (struct iovec){ NULL, 0 };  // Points into the original.
 
   if (to_ipv6) {
-    iov_len = ipv4_packet(out, CLAT_POS_IPHDR, packet, packetsize);
-    if (iov_len > 0) {
-      send_rawv6(fd, out, iov_len);
-    }
+    return ipv4_packet(config, out, CLAT_POS_IPHDR, packet, packetsize);
   } else {
-    iov_len = ipv6_packet(out, CLAT_POS_IPHDR, packet, packetsize);
-    if (iov_len > 0) {
-      fill_tun_header(&tun_targ, ETH_P_IP, skip_csum);
-      out[CLAT_POS_TUNHDR].iov_len = sizeof(tun_targ);
-      writev(fd, out, iov_len);
-    }
+    return ipv6_packet(config, out, CLAT_POS_IPHDR, packet, packetsize);
+  }
+}
+
+/* function: clat_packet_flatten
+ * copies the translated headers into the buffer right in front of the payload, so that the packet
+ * can be sent as a single buffer
+ * out     - translated packet whose payload points into a writable buffer
+ * iov_len - number of elements of out in use
+ * start   - start of the writable buffer. Everything between here and the payload is overwritten.
+ * returns: 1 if out[CLAT_POS_TUNHDR] now holds the whole packet, 0 if there was not enough room
+ */
+CLAT_HOT int clat_packet_flatten(clat_packet out, int iov_len, uint8_t *start) {
+  if (iov_len != CLAT_POS_PAYLOAD + 1 || out[CLAT_POS_PAYLOAD].iov_base == NULL) {
+    return 0;
+  }
+
+  size_t hdrlen = 0;
+  for (int i = 0; i < CLAT_POS_PAYLOAD; i++) {
+    hdrlen += out[i].iov_len;
+  }
+
+  uint8_t *payload = out[CLAT_POS_PAYLOAD].iov_base;
+  if ((size_t)(payload - start) < hdrlen) {
+    return 0;
   }
+
+  // The headers are in a clat_packet_headers, so they never overlap the destination.
+  uint8_t *pos = payload - hdrlen;
+  for (int i = 0; i < CLAT_POS_PAYLOAD; i++) {
+    memcpy(pos, out[i].iov_base, out[i].iov_len);
+    pos += out[i].iov_len;
+  }
+
+  out[CLAT_POS_TUNHDR].iov_base = payload - hdrlen;
+  out[CLAT_POS_TUNHDR].iov_len  = hdrlen + out[CLAT_POS_PAYLOAD].iov_len;
+  return 1;
 }
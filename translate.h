@@ -27,34 +27,94 @@
 #include <netinet/ip_icmp.h>
 #include <netinet/tcp.h>
 #include <netinet/udp.h>
+#include <string.h>
 
 #include "clatd.h"
 #include "common.h"
+#include "clat_config.h"
 
 #define MAX_TCP_HDR (15 * 4)  // Data offset field is 4 bits and counts in 32-bit words.
 
+// Headroom that lets translate_packet_headroom build an IPv6 and Fragment header where the
+// smallest IPv4 header used to be.
+#define CLAT_HEADROOM (sizeof(struct ip6_hdr) + sizeof(struct ip6_frag) - sizeof(struct iphdr))
+
+// Storage for the headers of a translated packet. The payload is not copied: the payload entry of
+// the clat_packet points into the original packet.
+struct clat_packet_headers {
+  struct tun_pi tun;
+  char iphdr[sizeof(struct ip6_hdr)];
+  char fraghdr[sizeof(struct ip6_frag)];
+  char transporthdr[MAX_TCP_HDR];
+  char icmp_iphdr[sizeof(struct ip6_hdr)];
+  char icmp_fraghdr[sizeof(struct ip6_frag)];
+  char icmp_transporthdr[MAX_TCP_HDR];
+};
+
 // Calculates the checksum over all the packet components starting from pos.
 uint16_t packet_checksum(uint32_t checksum, clat_packet packet, clat_packet_index pos);
 
-// Returns the total length of the packet components after pos.
-uint16_t packet_length(clat_packet packet, clat_packet_index pos);
+// The helpers below run several times per packet from ipv4.c and ipv6.c, so they are inline.
 
-// Returns true iff the given IPv6 address is in the plat subnet.
-int is_in_plat_subnet(const struct in6_addr *addr6);
+/* function: packet_length
+ * returns the total length of all the packet components after pos
+ * packet - packet to calculate the length of
+ * pos    - position to start counting after
+ * returns: the total length of the packet components after pos
+ */
+static inline uint16_t packet_length(clat_packet packet, clat_packet_index pos) {
+  size_t len = 0;
+  int i;
+  for (i = pos + 1; i < CLAT_POS_MAX; i++) {
+    len += packet[i].iov_len;
+  }
+  return len;
+}
+
+/* function: is_in_plat_subnet
+ * returns true iff the given IPv6 address is in the plat subnet.
+ * config - translation configuration
+ * addr   - IPv6 address
+ */
+static inline int is_in_plat_subnet(const struct clat_config *config,
+                                    const struct in6_addr *addr6) {
+  // Assumes a /96 plat subnet.
+  return (addr6 != NULL) && (memcmp(addr6, &config->plat_subnet, 12) == 0);
+}
+
+/* function: is_in_local_subnet
+ * returns true iff the given IPv6 address is our own address, or in SIIT gateway mode, is in the
+ * local IPv6 prefix.
+ * config - translation configuration
+ * addr   - IPv6 address
+ */
+static inline int is_in_local_subnet(const struct clat_config *config,
+                                     const struct in6_addr *addr6) {
+  return !memcmp(addr6, &config->ipv6_local_subnet, 12) &&
+         !((addr6->s6_addr32[3] ^ config->ipv6_local_subnet.s6_addr32[3]) &
+           ~config->local_hostmask);
+}
 
 // Functions to create tun, IPv4, and IPv6 headers.
 void fill_tun_header(struct tun_pi *tun_header, uint16_t proto, uint16_t skip_csum);
-void fill_ip_header(struct iphdr *ip_targ, uint16_t payload_len, uint8_t protocol,
-                    const struct ip6_hdr *old_header);
-void fill_ip6_header(struct ip6_hdr *ip6, uint16_t payload_len, uint8_t protocol,
-                     const struct iphdr *old_header);
+void fill_ip_header(const struct clat_config *config, struct iphdr *ip_targ, uint16_t payload_len,
+                    uint8_t protocol, const struct ip6_hdr *old_header);
+void fill_ip6_header(const struct clat_config *config, struct ip6_hdr *ip6, uint16_t payload_len,
+                     uint8_t protocol, const struct iphdr *old_header);
+
+// Translate packets without sending them.
+int translate_packet_iovec(const struct clat_config *config, int to_ipv6, const uint8_t *packet,
+                           size_t packetsize, struct clat_packet_headers *headers,
+                           clat_packet out);
 
-// Translate and send packets.
-void translate_packet(int fd, int to_ipv6, const uint8_t *packet, size_t packetsize, uint16_t skip_csum);
+// Copy a translated packet's headers in front of its payload. See send.h for sending packets.
+int clat_packet_flatten(clat_packet out, int iov_len, uint8_t *start);
 
 // Translate IPv4 and IPv6 packets.
-int ipv4_packet(clat_packet out, clat_packet_index pos, const uint8_t *packet, size_t len);
-int ipv6_packet(clat_packet out, clat_packet_index pos, const uint8_t *packet, size_t len);
+int ipv4_packet(const struct clat_config *config, clat_packet out, clat_packet_index pos,
+                const uint8_t *packet, size_t len);
+int ipv6_packet(const struct clat_config *config, clat_packet out, clat_packet_index pos,
+                const uint8_t *packet, size_t len);
 
 // Deal with fragmented packets.
 size_t maybe_fill_frag_header(struct ip6_frag *frag_hdr, struct ip6_hdr *ip6_targ,
@@ -67,10 +127,11 @@ size_t maybe_fill_frag_header(struct ip6_frag *frag_hdr, struct ip6_hdr *ip6_tar
 uint8_t parse_frag_header(const struct ip6_frag *frag_hdr, struct iphdr *ip_targ);
 
 // Translate ICMP packets.
-int icmp_to_icmp6(clat_packet out, clat_packet_index pos, const struct icmphdr *icmp,
-                  uint32_t checksum, const uint8_t *payload, size_t payload_size);
-int icmp6_to_icmp(clat_packet out, clat_packet_index pos, const struct icmp6_hdr *icmp6,
-                  const uint8_t *payload, size_t payload_size);
+int icmp_to_icmp6(const struct clat_config *config, clat_packet out, clat_packet_index pos,
+                  const struct icmphdr *icmp, uint32_t checksum, const uint8_t *payload,
+                  size_t payload_size);
+int icmp6_to_icmp(const struct clat_config *config, clat_packet out, clat_packet_index pos,
+                  const struct icmp6_hdr *icmp6, const uint8_t *payload, size_t payload_size);
 
 // Translate generic IP packets.
 int generic_packet(clat_packet out, clat_packet_index pos, const uint8_t *payload, size_t len);
@@ -78,13 +139,17 @@ int generic_packet(clat_packet out, clat_packet_index pos, const uint8_t *payloa
 // Translate TCP and UDP packets.
 int tcp_packet(clat_packet out, clat_packet_index pos, const struct tcphdr *tcp, uint32_t old_sum,
                uint32_t new_sum, size_t len);
-int udp_packet(clat_packet out, clat_packet_index pos, const struct udphdr *udp, uint32_t old_sum,
-               uint32_t new_sum, size_t len);
+int udp_packet(const struct clat_config *config, clat_packet out, clat_packet_index pos,
+               const struct udphdr *udp, uint32_t remote4, uint32_t old_sum, uint32_t new_sum,
+               size_t len);
 
 int tcp_translate(clat_packet out, clat_packet_index pos, const struct tcphdr *tcp,
                   size_t header_size, uint32_t old_sum, uint32_t new_sum, const uint8_t *payload,
                   size_t payload_size);
-int udp_translate(clat_packet out, clat_packet_index pos, const struct udphdr *udp,
-                  uint32_t old_sum, uint32_t new_sum, const uint8_t *payload, size_t payload_size);
+int udp_translate(const struct clat_config *config, clat_packet out, clat_packet_index pos,
+                  const struct udphdr *udp, uint32_t remote4, uint32_t old_sum, uint32_t new_sum,
+                  const uint8_t *payload, size_t payload_size);
+int udp_zero_csum_allowed(const struct udp_zero_csum_policy *policy, const struct udphdr *udp,
+                          uint32_t remote4);
 
 #endif /* __TRANSLATE_H__ */
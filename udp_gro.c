@@ -0,0 +1,167 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * udp_gro.c - coalescing downlink UDP datagrams into UDP GSO packets
+ */
+#include <arpa/inet.h>
+#include <linux/virtio_net.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "netutils/checksum.h"
+
+#include "ring.h"
+#include "send.h"
+#include "translate.h"
+#include "udp_gro.h"
+
+#ifndef VIRTIO_NET_HDR_GSO_UDP_L4
+#define VIRTIO_NET_HDR_GSO_UDP_L4 5
+#endif
+
+/* function: udp_gro_create
+ * allocates the state for writing downlink packets to a tun with virtio-net headers
+ *   gso - whether the kernel takes UDP GSO packets from the tun
+ * returns: the state, or NULL if out of memory
+ */
+struct udp_gro *udp_gro_create(int gso) {
+  struct udp_gro *gro = calloc(1, sizeof(*gro));
+  if (gro) {
+    gro->gso = gso;
+  }
+  return gro;
+}
+
+/* function: write_packet
+ * writes a translated packet to the tun with a virtio-net header that asks for nothing
+ *   fd        - the tun
+ *   out       - translated packet, with the tun header filled in
+ *   iov_len   - number of elements of out in use
+ *   skip_csum - whether the kernel has already verified the checksums
+ */
+static CLAT_HOT void write_packet(int fd, clat_packet out, int iov_len, uint16_t skip_csum) {
+  struct virtio_net_hdr vnet = { .flags = skip_csum ? VIRTIO_NET_HDR_F_DATA_VALID : 0 };
+  struct iovec iov[CLAT_POS_MAX + 1];
+
+  // The virtio-net header goes between the tun header and the packet.
+  iov[0] = out[CLAT_POS_TUNHDR];
+  iov[1] = (struct iovec){ &vnet, sizeof(vnet) };
+  memcpy(&iov[2], &out[CLAT_POS_TUNHDR + 1], (iov_len - 1) * sizeof(iov[0]));
+  writev(fd, iov, iov_len + 1);
+}
+
+/* function: udp_gro_flush
+ * writes the datagrams held back, as they were if there is only one, and as a UDP GSO packet
+ * otherwise
+ *   gro - coalescing state
+ *   fd  - the tun
+ */
+CLAT_HOT void udp_gro_flush(struct udp_gro *gro, int fd) {
+  // Only datagrams whose checksums the kernel has verified are held back.
+  struct virtio_net_hdr vnet = { .flags = VIRTIO_NET_HDR_F_DATA_VALID };
+  struct iovec iov[4 + UDP_GRO_MAX_SEGMENTS];
+
+  if (!gro->segments) {
+    return;
+  }
+
+  if (gro->segments > 1) {
+    uint16_t udp_len = sizeof(gro->udp) + gro->payload_len;
+    gro->ip.tot_len  = htons(sizeof(gro->ip) + udp_len);
+    gro->ip.check    = 0;
+    gro->ip.check    = ip_checksum(&gro->ip, sizeof(gro->ip));
+    gro->udp.len     = htons(udp_len);
+    // The kernel finishes the checksum of each segment, starting from the pseudo-header sum. The
+    // virtio-net header is in host byte order.
+    gro->udp.check = ~ip_checksum_finish(ipv4_pseudo_header_checksum(&gro->ip, udp_len));
+    vnet           = (struct virtio_net_hdr){
+      .flags       = VIRTIO_NET_HDR_F_NEEDS_CSUM,
+      .gso_type    = VIRTIO_NET_HDR_GSO_UDP_L4,
+      .hdr_len     = sizeof(gro->ip) + sizeof(gro->udp),
+      .gso_size    = gro->segment_len,
+      .csum_start  = sizeof(gro->ip),
+      .csum_offset = offsetof(struct udphdr, check),
+    };
+    gro->gso_packets++;
+    gro->gso_segments += gro->segments;
+  }
+
+  iov[0] = (struct iovec){ &gro->tun, sizeof(gro->tun) };
+  iov[1] = (struct iovec){ &vnet, sizeof(vnet) };
+  iov[2] = (struct iovec){ &gro->ip, sizeof(gro->ip) };
+  iov[3] = (struct iovec){ &gro->udp, sizeof(gro->udp) };
+  memcpy(&iov[4], gro->payloads, gro->segments * sizeof(iov[0]));
+  writev(fd, iov, 4 + gro->segments);
+  gro->segments = 0;
+}
+
+/* function: udp_gro_packet
+ * translates a downlink packet and writes it to the tun with a virtio-net header, or holds it
+ * back to be written with the next datagrams of its flow. The payloads of held datagrams point
+ * into packet, which must stay valid until udp_gro_flush.
+ *   gro        - coalescing state
+ *   config     - translation configuration
+ *   fd         - the tun
+ *   packet     - IPv6 packet
+ *   packetsize - size of packet
+ *   skip_csum  - whether the kernel has already verified the checksums
+ */
+CLAT_HOT void udp_gro_packet(struct udp_gro *gro, const struct clat_config *config, int fd,
+                             const uint8_t *packet, size_t packetsize, uint16_t skip_csum) {
+  struct clat_packet_headers headers;
+  clat_packet out;
+
+  int iov_len = translate_packet_for_send(config, 0, packet, packetsize, NULL, skip_csum, &headers,
+                                          out);
+  if (!iov_len) {
+    return;
+  }
+
+  const struct iphdr *ip   = (const struct iphdr *)headers.iphdr;
+  const struct udphdr *udp = (const struct udphdr *)headers.transporthdr;
+  size_t len               = out[CLAT_POS_PAYLOAD].iov_len;
+
+  if (!gro->gso || skip_csum != TP_CSUM_UNNECESSARY || ip->protocol != IPPROTO_UDP ||
+      (ip->frag_off & htons(IP_MF | IP_OFFMASK)) || len == 0) {
+    udp_gro_flush(gro, fd);
+    write_packet(fd, out, iov_len, skip_csum);
+    return;
+  }
+
+  // Every segment but the last must be the same size, and they must add up to an IPv4 packet.
+  if (gro->segments &&
+      (ip->saddr != gro->ip.saddr || ip->daddr != gro->ip.daddr || ip->tos != gro->ip.tos ||
+       ip->ttl != gro->ip.ttl || ip->frag_off != gro->ip.frag_off ||
+       udp->source != gro->udp.source || udp->dest != gro->udp.dest || len > gro->segment_len ||
+       gro->segments == UDP_GRO_MAX_SEGMENTS ||
+       sizeof(*ip) + sizeof(*udp) + gro->payload_len + len > IP_MAXPACKET)) {
+    udp_gro_flush(gro, fd);
+  }
+
+  if (!gro->segments) {
+    gro->tun         = headers.tun;
+    gro->ip          = *ip;
+    gro->udp         = *udp;
+    gro->segment_len = len;
+    gro->payload_len = 0;
+  }
+  gro->payloads[gro->segments++] = out[CLAT_POS_PAYLOAD];
+  gro->payload_len += len;
+
+  if (len < gro->segment_len) {
+    udp_gro_flush(gro, fd);
+  }
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * udp_gro.h - coalescing downlink UDP datagrams into UDP GSO packets
+ *
+ * QUIC sends bulk data as trains of same-size datagrams, and each one written to the tun goes
+ * through the IPv4 and UDP receive path on its own. If the tun has virtio-net headers
+ * (IFF_VNET_HDR), every downlink packet is written with one, and consecutive datagrams of a flow
+ * within a ring_read batch are written as a single UDP GSO packet instead. The kernel hands it to
+ * sockets with UDP_GRO in one piece and splits it for everything else.
+ *
+ * The datagrams' checksums are replaced by one the kernel computes for each segment, so only
+ * datagrams whose checksums the kernel has already verified are coalesced. Without virtio-net
+ * headers, packets are written as they always were. With them, but on kernels that can't take
+ * UDP GSO packets from a tun (before Linux 6.2), packets get a virtio-net header but are not
+ * coalesced.
+ */
+#ifndef __UDP_GRO_H__
+#define __UDP_GRO_H__
+
+#include <linux/if_tun.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "config.h"
+
+#ifndef TUN_F_USO4
+#define TUN_F_USO4 0x20
+#define TUN_F_USO6 0x40
+#endif
+
+// The most segments the kernel accepts in a UDP GSO packet (UDP_MAX_SEGMENTS).
+#define UDP_GRO_MAX_SEGMENTS 64
+
+struct udp_gro {
+  int gso;  // whether the kernel takes UDP GSO packets from the tun
+
+  // Datagrams held back. The headers are the first one's, and the payloads point into the ring.
+  struct tun_pi tun;
+  struct iphdr ip;
+  struct udphdr udp;
+  struct iovec payloads[UDP_GRO_MAX_SEGMENTS];
+  int segments;
+  size_t segment_len;  // payload length of every segment but the last
+  size_t payload_len;  // payload length of all of them
+
+  uint64_t gso_packets;   // UDP GSO packets written
+  uint64_t gso_segments;  // datagrams written in them
+};
+
+struct udp_gro *udp_gro_create(int gso);
+void udp_gro_packet(struct udp_gro *gro, const struct clat_config *config, int fd,
+                    const uint8_t *packet, size_t packetsize, uint16_t skip_csum);
+void udp_gro_flush(struct udp_gro *gro, int fd);
+
+#endif /* __UDP_GRO_H__ */